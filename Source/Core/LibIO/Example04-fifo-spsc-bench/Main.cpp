@@ -0,0 +1,325 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Benchmark: one producer thread and one consumer thread move the same
+// amount of data through mutex based IOFifo and through lock-free
+// IOFifoSpsc. Throughput in MB/s is printed for both.
+//
+// Usage: LibIO-example04-fifo-spsc-bench [totalMB] [chunkSize]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <Tegenaria/Debug.h>
+#include <Tegenaria/Thread.h>
+#include <Tegenaria/IOFifo.h>
+#include <Tegenaria/IOFifoSpsc.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <sched.h>
+# include <sys/time.h>
+#endif
+
+using namespace Tegenaria;
+
+//
+// Benchmark parameters shared by producer and consumer.
+//
+
+struct BenchCtx
+{
+  IOFifo *fifo_;
+  IOFifoSpsc *spsc_;
+
+  uint64_t total_;
+  int chunk_;
+
+  uint64_t checksum_;
+};
+
+//
+// Get current time in ms.
+//
+
+static double GetTimeMs()
+{
+  #ifdef WIN32
+  {
+    return double(GetTickCount());
+  }
+  #else
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+  }
+  #endif
+}
+
+//
+// Yield CPU while fifo is full or empty.
+//
+
+static void Backoff()
+{
+  #ifdef WIN32
+  {
+    SwitchToThread();
+  }
+  #else
+  {
+    sched_yield();
+  }
+  #endif
+}
+
+// ----------------------------------------------------------------------------
+//
+//                          Mutex based IOFifo
+//
+// ----------------------------------------------------------------------------
+
+static int MutexProducer(BenchCtx *ctx)
+{
+  char *buf = (char *) malloc(ctx -> chunk_);
+
+  uint64_t sent = 0;
+
+  for (int i = 0; i < ctx -> chunk_; i++)
+  {
+    buf[i] = char(i);
+  }
+
+  while (sent < ctx -> total_)
+  {
+    int pushed = 0;
+
+    ctx -> fifo_ -> lock();
+
+    if (ctx -> fifo_ -> bytesLeft() >= (unsigned int) ctx -> chunk_)
+    {
+      ctx -> fifo_ -> push(buf, ctx -> chunk_);
+
+      pushed = 1;
+    }
+
+    ctx -> fifo_ -> unlock();
+
+    if (pushed)
+    {
+      sent += ctx -> chunk_;
+    }
+    else
+    {
+      Backoff();
+    }
+  }
+
+  free(buf);
+
+  return 0;
+}
+
+static int MutexConsumer(BenchCtx *ctx)
+{
+  char *buf = (char *) malloc(ctx -> chunk_);
+
+  uint64_t received = 0;
+
+  while (received < ctx -> total_)
+  {
+    int popped = 0;
+
+    ctx -> fifo_ -> lock();
+
+    if (ctx -> fifo_ -> size() >= (unsigned int) ctx -> chunk_)
+    {
+      ctx -> fifo_ -> pop(buf, ctx -> chunk_);
+
+      popped = 1;
+    }
+
+    ctx -> fifo_ -> unlock();
+
+    if (popped)
+    {
+      received += ctx -> chunk_;
+
+      ctx -> checksum_ += (uint8_t) buf[ctx -> chunk_ - 1];
+    }
+    else
+    {
+      Backoff();
+    }
+  }
+
+  free(buf);
+
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+//
+//                         Lock-free IOFifoSpsc
+//
+// ----------------------------------------------------------------------------
+
+static int SpscProducer(BenchCtx *ctx)
+{
+  char *buf = (char *) malloc(ctx -> chunk_);
+
+  uint64_t sent = 0;
+
+  for (int i = 0; i < ctx -> chunk_; i++)
+  {
+    buf[i] = char(i);
+  }
+
+  while (sent < ctx -> total_)
+  {
+    if (ctx -> spsc_ -> push(buf, ctx -> chunk_) == 0)
+    {
+      sent += ctx -> chunk_;
+    }
+    else
+    {
+      Backoff();
+    }
+  }
+
+  free(buf);
+
+  return 0;
+}
+
+static int SpscConsumer(BenchCtx *ctx)
+{
+  char *buf = (char *) malloc(ctx -> chunk_);
+
+  uint64_t received = 0;
+
+  while (received < ctx -> total_)
+  {
+    if (ctx -> spsc_ -> pop(buf, ctx -> chunk_) == 0)
+    {
+      received += ctx -> chunk_;
+
+      ctx -> checksum_ += (uint8_t) buf[ctx -> chunk_ - 1];
+    }
+    else
+    {
+      Backoff();
+    }
+  }
+
+  free(buf);
+
+  return 0;
+}
+
+//
+// Run one producer and one consumer thread and print throughput.
+//
+
+static void RunBench(const char *name, BenchCtx *ctx,
+                         int (*producer)(BenchCtx *),
+                             int (*consumer)(BenchCtx *))
+{
+  ctx -> checksum_ = 0;
+
+  double t0 = GetTimeMs();
+
+  ThreadHandle_t *consumerThread = ThreadCreate(consumer, ctx);
+  ThreadHandle_t *producerThread = ThreadCreate(producer, ctx);
+
+  ThreadWait(producerThread);
+  ThreadWait(consumerThread);
+
+  double elapsed = GetTimeMs() - t0;
+
+  ThreadClose(producerThread);
+  ThreadClose(consumerThread);
+
+  if (elapsed < 1.0)
+  {
+    elapsed = 1.0;
+  }
+
+  printf("%-12s %8.1f ms %10.1f MB/s (checksum %llu)\n",
+             name, elapsed, (ctx -> total_ / 1048576.0) / (elapsed / 1000.0),
+                 (unsigned long long) ctx -> checksum_);
+}
+
+//
+// Entry point.
+//
+
+int main(int argc, char **argv)
+{
+  DBG_INIT_EX(NULL, "error", -1);
+
+  BenchCtx ctx;
+
+  int totalMB = 512;
+  int chunk   = 64;
+
+  if (argc > 1)
+  {
+    totalMB = atoi(argv[1]);
+  }
+
+  if (argc > 2)
+  {
+    chunk = atoi(argv[2]);
+  }
+
+  if (totalMB <= 0 || chunk <= 0 || chunk > IOFIFO_DEFAULT_BUFFER_SIZE / 2)
+  {
+    fprintf(stderr, "Usage: %s [totalMB] [chunkSize]\n", argv[0]);
+
+    return 1;
+  }
+
+  ctx.total_ = uint64_t(totalMB) * 1048576 / chunk * chunk;
+  ctx.chunk_ = chunk;
+  ctx.fifo_  = new IOFifo;
+  ctx.spsc_  = new IOFifoSpsc;
+
+  printf("Moving %d MB in %d byte chunks through %u byte fifo...\n",
+             totalMB, chunk, ctx.spsc_ -> capacity());
+
+  RunBench("IOFifo", &ctx, MutexProducer, MutexConsumer);
+  RunBench("IOFifoSpsc", &ctx, SpscProducer, SpscConsumer);
+
+  delete ctx.fifo_;
+  delete ctx.spsc_;
+
+  return 0;
+}
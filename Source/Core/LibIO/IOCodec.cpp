@@ -0,0 +1,519 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Pluggable compression codecs for IOMixer channels.
+//
+//          ZLib is loaded runtime and used if available only.
+//          LZ4 is linked statically from Source/Import/LZ4.
+//
+//          IOCipher is interface only, ciphers are implemented outside
+//          LibIO (see LibSecure).
+//
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <dlfcn.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+#include <lz4.h>
+
+#include <Tegenaria/Debug.h>
+#include <Tegenaria/Mutex.h>
+
+#include "IOCodec.h"
+
+namespace Tegenaria
+{
+  //
+  // ZLib typedefs.
+  //
+
+  typedef int (*ZLibCompressProto)(Bytef *dest, uLongf *destLen,
+                                       const Bytef *source, uLong sourceLen);
+
+  typedef int (*ZLibUncompressProto)(Bytef *dest, uLongf *destLen,
+                                         const Bytef *source, uLong sourceLen);
+
+  typedef uLong (*ZLibCompressBoundProto)(uLong sourceLen);
+
+  typedef int (*ZLibDeflateInitProto)(z_streamp strm, int level,
+                                          const char *version, int streamSize);
+
+  typedef int (*ZLibInflateInitProto)(z_streamp strm,
+                                          const char *version, int streamSize);
+
+  typedef int (*ZLibDeflateProto)(z_streamp strm, int flush);
+  typedef int (*ZLibInflateProto)(z_streamp strm, int flush);
+  typedef int (*ZLibEndProto)(z_streamp strm);
+
+  //
+  // ZLib library loaded runtime. Shared by all codecs in process.
+  //
+
+  static struct
+  {
+    #ifdef WIN32
+    HMODULE module_;
+    #else
+    void *module_;
+    #endif
+
+    int loaded_;
+
+    ZLibCompressProto compress_;
+    ZLibUncompressProto uncompress_;
+    ZLibCompressBoundProto compressBound_;
+    ZLibDeflateInitProto deflateInit_;
+    ZLibDeflateProto deflate_;
+    ZLibEndProto deflateEnd_;
+    ZLibInflateInitProto inflateInit_;
+    ZLibInflateProto inflate_;
+    ZLibEndProto inflateEnd_;
+  }
+  ZLib;
+
+  static Mutex ZLibMutex("IOCodec::ZLib");
+
+  //
+  // Load ZLib library once per process.
+  //
+  // RETURNS: 1 if one-shot API is available,
+  //          0 otherwise.
+  //
+
+  static int IOCodecLoadZLib()
+  {
+    ZLibMutex.lock();
+
+    if (ZLib.loaded_ == 0)
+    {
+      #ifdef WIN32
+      {
+        ZLib.module_ = LoadLibrary("z.dll");
+
+        #define IOCODEC_ZLIB_SYMBOL(name) GetProcAddress(ZLib.module_, name)
+      }
+      #else
+      {
+        ZLib.module_ = dlopen("libz.so", RTLD_LAZY);
+
+        if (ZLib.module_ == NULL)
+        {
+          ZLib.module_ = dlopen("libz.so.1", RTLD_LAZY);
+        }
+
+        #define IOCODEC_ZLIB_SYMBOL(name) dlsym(ZLib.module_, name)
+      }
+      #endif
+
+      if (ZLib.module_)
+      {
+        ZLib.compress_      = (ZLibCompressProto) IOCODEC_ZLIB_SYMBOL("compress");
+        ZLib.uncompress_    = (ZLibUncompressProto) IOCODEC_ZLIB_SYMBOL("uncompress");
+        ZLib.compressBound_ = (ZLibCompressBoundProto) IOCODEC_ZLIB_SYMBOL("compressBound");
+        ZLib.deflateInit_   = (ZLibDeflateInitProto) IOCODEC_ZLIB_SYMBOL("deflateInit_");
+        ZLib.deflate_       = (ZLibDeflateProto) IOCODEC_ZLIB_SYMBOL("deflate");
+        ZLib.deflateEnd_    = (ZLibEndProto) IOCODEC_ZLIB_SYMBOL("deflateEnd");
+        ZLib.inflateInit_   = (ZLibInflateInitProto) IOCODEC_ZLIB_SYMBOL("inflateInit_");
+        ZLib.inflate_       = (ZLibInflateProto) IOCODEC_ZLIB_SYMBOL("inflate");
+        ZLib.inflateEnd_    = (ZLibEndProto) IOCODEC_ZLIB_SYMBOL("inflateEnd");
+      }
+
+      #undef IOCODEC_ZLIB_SYMBOL
+
+      if (ZLib.compress_ && ZLib.uncompress_ && ZLib.compressBound_)
+      {
+        ZLib.loaded_ = 1;
+
+        DEBUG1("IOCodec : ZLib loaded.\n");
+      }
+      else
+      {
+        ZLib.loaded_ = -1;
+
+        DEBUG1("WARNING: Cannot to load ZLib library. Compression not available.\n");
+      }
+    }
+
+    ZLibMutex.unlock();
+
+    return ZLib.loaded_ == 1;
+  }
+
+  //
+  // ---------------------------------------------------------------------------
+  //
+  //                            IOCodec base class
+  //
+  // ---------------------------------------------------------------------------
+  //
+
+  IOCodec::IOCodec(int id, int mode)
+  {
+    id_   = id;
+    mode_ = mode;
+  }
+
+  IOCodec::~IOCodec()
+  {
+  }
+
+  int IOCodec::isStream()
+  {
+    return 0;
+  }
+
+  int IOCodec::id()
+  {
+    return id_;
+  }
+
+  IOCipher::~IOCipher()
+  {
+  }
+
+  //
+  // ---------------------------------------------------------------------------
+  //
+  //                One-shot zlib. Every packet is independent.
+  //
+  // ---------------------------------------------------------------------------
+  //
+
+  class IOCodecZLib : public IOCodec
+  {
+    public:
+
+    IOCodecZLib(int mode) : IOCodec(IOCODEC_ZLIB, mode)
+    {
+    }
+
+    int encode(void *dst, int dstSize, const void *src, int srcSize)
+    {
+      uLongf compSize = dstSize;
+
+      if (ZLib.compress_((Bytef *) dst, &compSize, (const Bytef *) src, srcSize) != Z_OK)
+      {
+        return -1;
+      }
+
+      return int(compSize);
+    }
+
+    int decode(void *dst, int dstSize, const void *src, int srcSize)
+    {
+      uLongf uncompSize = dstSize;
+
+      if (ZLib.uncompress_((Bytef *) dst, &uncompSize, (const Bytef *) src, srcSize) != Z_OK)
+      {
+        return -1;
+      }
+
+      return int(uncompSize);
+    }
+
+    int bound(int size)
+    {
+      return int(ZLib.compressBound_(size));
+    }
+  };
+
+  //
+  // ---------------------------------------------------------------------------
+  //
+  //     Streaming zlib. One deflate/inflate context kept for whole channel.
+  //
+  // ---------------------------------------------------------------------------
+  //
+
+  class IOCodecZLibStream : public IOCodec
+  {
+    z_stream strm_;
+
+    int inited_;
+
+    public:
+
+    IOCodecZLibStream(int mode) : IOCodec(IOCODEC_ZLIB_STREAM, mode)
+    {
+      int ret = -1;
+
+      memset(&strm_, 0, sizeof(strm_));
+
+      if (mode == IOCODEC_ENCODER)
+      {
+        ret = ZLib.deflateInit_(&strm_, Z_DEFAULT_COMPRESSION,
+                                    ZLIB_VERSION, sizeof(strm_));
+      }
+      else
+      {
+        ret = ZLib.inflateInit_(&strm_, ZLIB_VERSION, sizeof(strm_));
+      }
+
+      inited_ = (ret == Z_OK);
+    }
+
+    ~IOCodecZLibStream()
+    {
+      if (inited_)
+      {
+        if (mode_ == IOCODEC_ENCODER)
+        {
+          ZLib.deflateEnd_(&strm_);
+        }
+        else
+        {
+          ZLib.inflateEnd_(&strm_);
+        }
+      }
+    }
+
+    int isInited()
+    {
+      return inited_;
+    }
+
+    //
+    // Compress packet and flush it with Z_SYNC_FLUSH, so remote can
+    // decode it at once without waiting for next packets.
+    //
+
+    int encode(void *dst, int dstSize, const void *src, int srcSize)
+    {
+      strm_.next_in   = (Bytef *) src;
+      strm_.avail_in  = srcSize;
+      strm_.next_out  = (Bytef *) dst;
+      strm_.avail_out = dstSize;
+
+      if (ZLib.deflate_(&strm_, Z_SYNC_FLUSH) != Z_OK)
+      {
+        return -1;
+      }
+
+      //
+      // Output buffer too small. Stream can't be recovered, because
+      // part of input was already consumed.
+      //
+
+      if (strm_.avail_in != 0 || strm_.avail_out == 0)
+      {
+        return -1;
+      }
+
+      return dstSize - int(strm_.avail_out);
+    }
+
+    int decode(void *dst, int dstSize, const void *src, int srcSize)
+    {
+      int ret = -1;
+
+      strm_.next_in   = (Bytef *) src;
+      strm_.avail_in  = srcSize;
+      strm_.next_out  = (Bytef *) dst;
+      strm_.avail_out = dstSize;
+
+      ret = ZLib.inflate_(&strm_, Z_SYNC_FLUSH);
+
+      if ((ret != Z_OK && ret != Z_BUF_ERROR) || strm_.avail_in != 0)
+      {
+        return -1;
+      }
+
+      return dstSize - int(strm_.avail_out);
+    }
+
+    //
+    // compressBound() plus space for sync flush marker and block headers.
+    //
+
+    int bound(int size)
+    {
+      return int(ZLib.compressBound_(size)) + 64;
+    }
+
+    int isStream()
+    {
+      return 1;
+    }
+  };
+
+  //
+  // ---------------------------------------------------------------------------
+  //
+  //                  LZ4 block. Every packet is independent.
+  //
+  // ---------------------------------------------------------------------------
+  //
+
+  class IOCodecLZ4 : public IOCodec
+  {
+    public:
+
+    IOCodecLZ4(int mode) : IOCodec(IOCODEC_LZ4, mode)
+    {
+    }
+
+    int encode(void *dst, int dstSize, const void *src, int srcSize)
+    {
+      int ret = LZ4_compress_default((const char *) src, (char *) dst, srcSize, dstSize);
+
+      return ret > 0 ? ret : -1;
+    }
+
+    int decode(void *dst, int dstSize, const void *src, int srcSize)
+    {
+      return LZ4_decompress_safe((const char *) src, (char *) dst, srcSize, dstSize);
+    }
+
+    int bound(int size)
+    {
+      return LZ4_compressBound(size);
+    }
+  };
+
+  //
+  // ---------------------------------------------------------------------------
+  //
+  //                            Exported functions
+  //
+  // ---------------------------------------------------------------------------
+  //
+
+  //
+  // Check is given codec available in this process.
+  //
+  // id - one of IOCODEC_XXX defines (IN).
+  //
+  // RETURNS: 1 if codec can be created by IOCodecCreate(),
+  //          0 otherwise.
+  //
+
+  int IOCodecIsAvailable(int id)
+  {
+    switch(id)
+    {
+      case IOCODEC_ZLIB:
+      {
+        return IOCodecLoadZLib();
+      }
+
+      case IOCODEC_ZLIB_STREAM:
+      {
+        return IOCodecLoadZLib() && ZLib.deflateInit_ && ZLib.deflate_ &&
+                   ZLib.deflateEnd_ && ZLib.inflateInit_ &&
+                       ZLib.inflate_ && ZLib.inflateEnd_;
+      }
+
+      case IOCODEC_LZ4:
+      {
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  //
+  // Create new compression context.
+  //
+  // id   - one of IOCODEC_XXX defines (IN).
+  // mode - IOCODEC_ENCODER or IOCODEC_DECODER (IN).
+  //
+  // RETURNS: New codec object, which should be freed by delete,
+  //          or NULL if error.
+  //
+
+  IOCodec *IOCodecCreate(int id, int mode)
+  {
+    IOCodec *codec = NULL;
+
+    if (IOCodecIsAvailable(id) == 0)
+    {
+      Error("ERROR: Codec '%s' is not available.\n", IOCodecName(id));
+
+      return NULL;
+    }
+
+    switch(id)
+    {
+      case IOCODEC_ZLIB:
+      {
+        codec = new IOCodecZLib(mode);
+
+        break;
+      }
+
+      case IOCODEC_ZLIB_STREAM:
+      {
+        IOCodecZLibStream *stream = new IOCodecZLibStream(mode);
+
+        if (stream -> isInited() == 0)
+        {
+          Error("ERROR: Cannot initialize zlib stream.\n");
+
+          delete stream;
+
+          stream = NULL;
+        }
+
+        codec = stream;
+
+        break;
+      }
+
+      case IOCODEC_LZ4:
+      {
+        codec = new IOCodecLZ4(mode);
+
+        break;
+      }
+    }
+
+    return codec;
+  }
+
+  //
+  // Get human readable codec name.
+  //
+  // id - one of IOCODEC_XXX defines (IN).
+  //
+
+  const char *IOCodecName(int id)
+  {
+    switch(id)
+    {
+      case IOCODEC_ZLIB:        return "zlib";
+      case IOCODEC_ZLIB_STREAM: return "zlib-stream";
+      case IOCODEC_LZ4:         return "lz4";
+    }
+
+    return "unknown";
+  }
+
+} /* namespace Tegenaria */
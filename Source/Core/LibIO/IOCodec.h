@@ -0,0 +1,160 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef Tegenaria_Core_IOCodec_H
+#define Tegenaria_Core_IOCodec_H
+
+#include <stdint.h>
+
+namespace Tegenaria
+{
+  //
+  // Codecs used to compress IOMixer channels.
+  //
+  // IOCODEC_ZLIB        - one-shot zlib compress() on every packet.
+  //                       Understood by every IOMixer version.
+  //
+  // IOCODEC_ZLIB_STREAM - one deflate stream per channel flushed with
+  //                       Z_SYNC_FLUSH after every packet. Dictionary is
+  //                       kept between packets, so small packets compress
+  //                       much better.
+  //
+  // IOCODEC_LZ4         - LZ4 block per packet. Much faster than zlib,
+  //                       but weaker ratio.
+  //
+  // Codec ID is sent in IOMixer packet flags, so it MUST fit into 2 bits.
+  //
+
+  #define IOCODEC_ZLIB        0
+  #define IOCODEC_ZLIB_STREAM 1
+  #define IOCODEC_LZ4         2
+
+  #define IOCODEC_MAX         2
+
+  //
+  // Codec direction passed to IOCodecCreate().
+  //
+
+  #define IOCODEC_ENCODER 0
+  #define IOCODEC_DECODER 1
+
+  //
+  // Base class for one compression context.
+  // One object = one direction of one channel.
+  //
+
+  class IOCodec
+  {
+    protected:
+
+    int id_;
+    int mode_;
+
+    public:
+
+    IOCodec(int id, int mode);
+
+    virtual ~IOCodec();
+
+    //
+    // Compress or decompress one packet.
+    //
+    // RETURNS: Number of bytes written to dst[] or -1 if error.
+    //
+
+    virtual int encode(void *dst, int dstSize, const void *src, int srcSize) = 0;
+    virtual int decode(void *dst, int dstSize, const void *src, int srcSize) = 0;
+
+    //
+    // Worst case encoded size for <size> input bytes.
+    //
+
+    virtual int bound(int size) = 0;
+
+    //
+    // Stream codecs keep state between packets. Every encoded packet
+    // MUST be delivered to remote decoder, even if it's bigger than
+    // input.
+    //
+
+    virtual int isStream();
+
+    int id();
+  };
+
+  //
+  // Authenticated cipher used to encrypt IOMixer channels.
+  // See IOMixer::setSlaveEncryption().
+  //
+  // LibIO doesn't implement any cipher itself. Implementation is
+  // provided by caller, e.g. SecureMixerCipherCreate() in LibSecure.
+  //
+  // One object serves both directions of one channel:
+  //
+  // - encrypt() is called from slave context only,
+  // - decrypt() is called from master reader context only,
+  //
+  // so implementation MUST keep send and receive state separated.
+  //
+
+  class IOCipher
+  {
+    public:
+
+    virtual ~IOCipher();
+
+    //
+    // Encrypt <size> bytes in place and compute tagSize() bytes long
+    // authentication tag.
+    //
+    // RETURNS: 0 if OK.
+    //
+
+    virtual int encrypt(void *buf, int size, void *tag) = 0;
+
+    //
+    // Verify authentication tag and decrypt <size> bytes in place.
+    //
+    // RETURNS: 0 if OK,
+    //          -1 if data was modified, replayed or reordered.
+    //
+
+    virtual int decrypt(void *buf, int size, const void *tag) = 0;
+
+    virtual int tagSize() = 0;
+  };
+
+  //
+  // Exported functions.
+  //
+
+  IOCodec *IOCodecCreate(int id, int mode);
+
+  int IOCodecIsAvailable(int id);
+
+  const char *IOCodecName(int id);
+
+} /* namespace Tegenaria */
+
+#endif /* Tegenaria_Core_IOCodec_H */
@@ -34,13 +34,30 @@
 //      Read position.                     Write position.
 //      Pop data from here.                Push data here.
 //
+//          If grow policy is set (see setGrowPolicy()) data, which does
+//          not fit into ring is stored in chained chunks:
+//
+//          [ ring ] -> [ chunk#1 ] -> [ chunk#2 ] -> ...
+//
+//          Pop always reads ring first, then chunks in order. New data
+//          goes to chunks until all of them are drained, then ring is
+//          used again.
+//
 
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
 
 #include "IOFifo.h"
 #include <Tegenaria/Debug.h>
 
+#ifdef WIN32
+# include <io.h>
+#else
+# include <unistd.h>
+# include <sys/uio.h>
+#endif
+
 namespace Tegenaria
 {
   // ----------------------------------------------------------------------------
@@ -65,6 +82,16 @@ namespace Tegenaria
     writePos_  = 0;
     readPos_   = 0;
 
+    chunkHead_  = NULL;
+    chunkTail_  = NULL;
+    chunkBytes_ = 0;
+    growChunk_  = 0;
+    growLimit_  = 0;
+
+    reserved_      = NULL;
+    reservedLen_   = 0;
+    reservedChunk_ = NULL;
+
     mutex_ = new Mutex("IOFifo");
   }
 
@@ -83,6 +110,15 @@ namespace Tegenaria
       buffer_ = NULL;
     }
 
+    while (chunkHead_)
+    {
+      IOFifoChunk *next = chunkHead_ -> next_;
+
+      free(chunkHead_);
+
+      chunkHead_ = next;
+    }
+
     if (mutex_)
     {
       delete mutex_;
@@ -91,6 +127,99 @@ namespace Tegenaria
     }
   }
 
+  // ----------------------------------------------------------------------------
+  //
+  //                                Grow policy
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Allow fifo to grow above ring capacity. Data, which does not fit
+  // into ring is stored in extra chunks allocated on demand and freed
+  // as soon as drained.
+  //
+  // chunkSize - minimum size of one extra chunk in bytes. Set to 0 to
+  //             disable growing (default) (IN).
+  //
+  // maxSize   - max. number of bytes stored in fifo at once (ring + chunks).
+  //             Set to 0 for no limit (IN/OPT).
+  //
+
+  void IOFifo::setGrowPolicy(unsigned int chunkSize, unsigned int maxSize)
+  {
+    growChunk_ = chunkSize;
+    growLimit_ = maxSize;
+  }
+
+  //
+  // Return number of bytes, which can be still stored in extra chunks
+  // without crossing grow limit.
+  //
+
+  unsigned int IOFifo::growLeft()
+  {
+    unsigned int used = size();
+
+    if (growChunk_ == 0)
+    {
+      return 0;
+    }
+
+    if (growLimit_ == 0)
+    {
+      return 0x7fffffff;
+    }
+
+    return (growLimit_ > used) ? (growLimit_ - used) : 0;
+  }
+
+  //
+  // Allocate new chunk and link it at the end of chunk list.
+  //
+  // len - min. number of bytes needed (IN).
+  //
+  // RETURNS: New chunk or NULL if out of memory.
+  //
+
+  IOFifoChunk *IOFifo::chunkAppend(unsigned int len)
+  {
+    IOFifoChunk *chunk = NULL;
+
+    if (len < growChunk_)
+    {
+      len = growChunk_;
+    }
+
+    chunk = (IOFifoChunk *) malloc(sizeof(IOFifoChunk) + len);
+
+    if (chunk == NULL)
+    {
+      Error("ERROR: Out of memory while growing IOFifo PTR#%p.\n", this);
+
+      return NULL;
+    }
+
+    chunk -> next_     = NULL;
+    chunk -> capacity_ = len;
+    chunk -> readPos_  = 0;
+    chunk -> writePos_ = 0;
+
+    if (chunkTail_)
+    {
+      chunkTail_ -> next_ = chunk;
+    }
+    else
+    {
+      chunkHead_ = chunk;
+    }
+
+    chunkTail_ = chunk;
+
+    DEBUG2("Allocated [%d] bytes chunk for IOFifo PTR#%p.\n", len, this);
+
+    return chunk;
+  }
+
   // ----------------------------------------------------------------------------
   //
   //                       Destructive functions (push/pop)
@@ -103,6 +232,9 @@ namespace Tegenaria
   // Buffer before: xx xx xx xx xx
   // Buffer after : xx xx xx xx xx yy yy yy yy ...
   //
+  // TIP#1: If grow policy is set, data which does not fit into ring
+  //        is stored in extra chunks.
+  //
   // source - source buffer with data to append (IN).
   // len    - number of bytes to append (IN).
   //
@@ -118,39 +250,87 @@ namespace Tegenaria
 
     char *src = (char *) source;
 
+    unsigned int ringLen = 0;
+
+    FAILEX(len < 0, "ERROR: Negative length passed to IOFifo::push().\n");
+
+    FAILEX(reserved_, "ERROR: IOFifo::push() called while reserve() is pending"
+                          " on IOFifo PTR#%p.\n", this);
+
     //
     // Check is it sufficient space left.
+    // Data goes to ring only if there are no chunks queued after it.
     //
 
-    FAILEX(len > bytesLeft_,
+    if (chunkHead_ == NULL)
+    {
+      ringLen = std::min(unsigned(len), bytesLeft_);
+    }
+
+    FAILEX(len - ringLen > growLeft(),
                "ERROR: Going to append [%d] bytes to IOFifo PTR#%p,"
-                   " but only [%d] bytes left.\n", len, this, bytesLeft_);
+                   " but only [%d] bytes left.\n", len, this, bytesLeft());
+
+    DEBUG2("Appending [%d] bytes to IOFifo PTR#%p,"
+               " [%d] bytes left.\n", len, this, bytesLeft());
 
     //
     // Write data to buffer.
     //
 
-    if ((writePos_ + len) < capacity_)
+    if (ringLen > 0)
     {
-      memcpy(buffer_ + writePos_, src, len);
+      if ((writePos_ + ringLen) < capacity_)
+      {
+        memcpy(buffer_ + writePos_, src, ringLen);
+      }
+      else
+      {
+        unsigned int bytesToEnd = capacity_ - writePos_;
+
+        unsigned int overflow = (ringLen - bytesToEnd) % capacity_;
+
+        memcpy(buffer_ + writePos_, src, bytesToEnd);
+
+        memcpy(buffer_, src + bytesToEnd, overflow);
+      }
+
+      writePos_ = (writePos_ + ringLen) % capacity_;
+
+      bytesLeft_ -= ringLen;
+
+      src += ringLen;
+      len -= ringLen;
     }
-    else
+
+    //
+    // Write rest to chunks, allocate new one if needed.
+    //
+
+    while (len > 0)
     {
-      unsigned int bytesToEnd = capacity_ - writePos_;
+      IOFifoChunk *chunk = chunkTail_;
 
-      unsigned int overflow = (len - bytesToEnd) % capacity_;
+      unsigned int toCopy = 0;
 
-      memcpy(buffer_ + writePos_, src, bytesToEnd);
+      if (chunk == NULL || chunk -> writePos_ == chunk -> capacity_)
+      {
+        chunk = chunkAppend(len);
 
-      memcpy(buffer_, src + bytesToEnd, overflow);
-    }
+        FAIL(chunk == NULL);
+      }
+
+      toCopy = std::min(unsigned(len), chunk -> capacity_ - chunk -> writePos_);
+
+      memcpy(chunk -> data_ + chunk -> writePos_, src, toCopy);
 
-    writePos_ = (writePos_ + len) % capacity_;
+      chunk -> writePos_ += toCopy;
 
-    bytesLeft_ -= len;
+      chunkBytes_ += toCopy;
 
-    DEBUG2("Appended [%d] bytes to IOFifo PTR#%p,"
-               " [%d] bytes left.\n", len, this, bytesLeft_);
+      src += toCopy;
+      len -= toCopy;
+    }
 
     //
     // Error handler.
@@ -201,49 +381,124 @@ namespace Tegenaria
 
     char *dst = (char *) dest;
 
+    unsigned int ringLen = 0;
+
+    IOFifoChunk *chunk = NULL;
+
+    if (len < 0)
+    {
+      len = size();
+    }
+
     //
     // Check is it sufficient space left.
     //
 
-    FAILEX(capacity_ - bytesLeft_ < len,
+    FAILEX(size() < unsigned(len),
                "ERROR: Going to pop [%d] bytes from IOFifo PTR#%p,"
                    " but only [%d] bytes available.\n",
-                       len, this, capacity_ - bytesLeft_);
+                       len, this, size());
+
+    if (peekOnly == 0)
+    {
+      DEBUG2("Popping [%d] bytes from IOFifo PTR#%p,"
+                 " [%d] bytes available.\n", len, this, size());
+    }
+
+    ringLen = std::min(unsigned(len), capacity_ - bytesLeft_);
 
     //
     // Read data from buffer if needed.
     //
 
-    if (dst)
+    if (dst && ringLen > 0)
     {
-      if ((readPos_ + len) < capacity_)
+      if ((readPos_ + ringLen) < capacity_)
       {
-        memcpy(dst, buffer_ + readPos_, len);
+        memcpy(dst, buffer_ + readPos_, ringLen);
       }
       else
       {
         unsigned int bytesToEnd = capacity_ - readPos_;
 
-        unsigned int overflow = (len - bytesToEnd) % capacity_;
+        unsigned int overflow = (ringLen - bytesToEnd) % capacity_;
 
         memcpy(dst, buffer_ + readPos_, bytesToEnd);
 
         memcpy(dst + bytesToEnd, buffer_, overflow);
       }
+
+      dst += ringLen;
     }
 
     //
     // Move read position.
+    // Rewind empty ring to begin to get longest possible reserve() window.
     //
 
-    if (peekOnly == 0)
+    if (peekOnly == 0 && ringLen > 0)
     {
-      readPos_ = (readPos_ + len) % capacity_;
+      readPos_ = (readPos_ + ringLen) % capacity_;
 
-      bytesLeft_ += len;
+      bytesLeft_ += ringLen;
 
-      DEBUG2("Popped [%d] bytes from IOFifo PTR#%p,"
-                 " [%d] bytes left.\n", len, this, bytesLeft_);
+      if (bytesLeft_ == capacity_ && (reserved_ == NULL || reservedChunk_))
+      {
+        readPos_  = 0;
+        writePos_ = 0;
+      }
+    }
+
+    len -= ringLen;
+
+    //
+    // Read rest from chunks.
+    // Free drained chunks unless there is pending reserve() on it.
+    //
+
+    chunk = chunkHead_;
+
+    while (len > 0 && chunk)
+    {
+      unsigned int toCopy = std::min(unsigned(len), chunk -> writePos_ - chunk -> readPos_);
+
+      if (dst)
+      {
+        memcpy(dst, chunk -> data_ + chunk -> readPos_, toCopy);
+
+        dst += toCopy;
+      }
+
+      len -= toCopy;
+
+      if (peekOnly)
+      {
+        chunk = chunk -> next_;
+      }
+      else
+      {
+        chunk -> readPos_ += toCopy;
+
+        chunkBytes_ -= toCopy;
+
+        if (chunk -> readPos_ == chunk -> writePos_ && chunk != reservedChunk_)
+        {
+          chunkHead_ = chunk -> next_;
+
+          if (chunkHead_ == NULL)
+          {
+            chunkTail_ = NULL;
+          }
+
+          free(chunk);
+
+          chunk = chunkHead_;
+        }
+        else
+        {
+          chunk = chunk -> next_;
+        }
+      }
     }
 
     //
@@ -279,6 +534,363 @@ namespace Tegenaria
     return pop(NULL, len);
   }
 
+  // ----------------------------------------------------------------------------
+  //
+  //                       Zero-copy write window (reserve/commit)
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Reserve contiguous free space at the end of FIFO. Caller can write
+  // data directly into returned window (e.g. by read() or recv()) and
+  // append it to fifo by commit() call.
+  //
+  // Buffer before: xx xx xx xx ..
+  // Buffer after : xx xx xx xx [reserved window] ..
+  //
+  // TIP#1: Window is NOT visible for pop/peek until commit() is called.
+  //
+  // TIP#2: Window stays valid while data is popped from other thread
+  //        (with lock()/unlock() held around reserve/pop/commit calls).
+  //
+  // TIP#3: Only one window can be pending at once. push() fails until
+  //        window is committed. Use commit(0) to cancel window.
+  //
+  // len      - min. number of contiguous bytes needed. Set to -1 to get
+  //            any non-empty window (IN/OPT).
+  //
+  // reserved - number of bytes really reserved, can be greater than <len>
+  //            (OUT/OPT).
+  //
+  // RETURNS: Pointer to begin of reserved window,
+  //          NULL if there is no <len> contiguous bytes available or
+  //          previous window is not committed yet.
+  //
+
+  void *IOFifo::reserve(int len, int *reserved)
+  {
+    DBG_ENTER3("IOFifo::reserve");
+
+    void *window = NULL;
+
+    unsigned int contiguous = 0;
+
+    if (len <= 0)
+    {
+      len = 1;
+    }
+
+    FAILEX(reserved_, "ERROR: IOFifo::reserve() called twice without commit()"
+                          " on IOFifo PTR#%p.\n", this);
+
+    //
+    // Try ring first if there are no chunks queued after it.
+    //
+
+    if (chunkHead_ == NULL)
+    {
+      if (bytesLeft_ == capacity_)
+      {
+        readPos_  = 0;
+        writePos_ = 0;
+      }
+
+      contiguous = std::min(bytesLeft_, capacity_ - writePos_);
+
+      if (contiguous >= unsigned(len))
+      {
+        reserved_      = buffer_ + writePos_;
+        reservedLen_   = contiguous;
+        reservedChunk_ = NULL;
+      }
+    }
+
+    //
+    // Fall back to chunk if grow policy allows it.
+    //
+
+    if (reserved_ == NULL && unsigned(len) <= growLeft())
+    {
+      IOFifoChunk *chunk = chunkTail_;
+
+      if (chunk == NULL || chunk -> capacity_ - chunk -> writePos_ < unsigned(len))
+      {
+        chunk = chunkAppend(len);
+      }
+
+      if (chunk)
+      {
+        reserved_      = chunk -> data_ + chunk -> writePos_;
+        reservedLen_   = std::min(chunk -> capacity_ - chunk -> writePos_, growLeft());
+        reservedChunk_ = chunk;
+      }
+    }
+
+    window = reserved_;
+
+    fail:
+
+    //
+    // Don't return window pending from previous reserve() on error.
+    //
+
+    if (reserved)
+    {
+      *reserved = window ? reservedLen_ : 0;
+    }
+
+    DBG_LEAVE3("IOFifo::reserve");
+
+    return window;
+  }
+
+  //
+  // Reserve up to two free spans at the end of FIFO. Works like reserve(),
+  // but whole free space inside ring is returned even if it wraps around
+  // ring end. Designed to be passed to readv() / recvmsg().
+  //
+  // seg - table of at least 2 segments, where to store reserved spans (OUT).
+  //
+  // len - max. number of bytes to reserve. Set to -1 to reserve all free
+  //       space (IN/OPT).
+  //
+  // RETURNS: Number of segments filled (0 if fifo is full),
+  //          -1 if error.
+  //
+
+  int IOFifo::reserveSegments(IOFifoSegment *seg, int len)
+  {
+    DBG_ENTER3("IOFifo::reserveSegments");
+
+    int count = -1;
+
+    unsigned int maxLen = (len < 0) ? 0x7fffffff : unsigned(len);
+
+    FAILEX(reserved_, "ERROR: IOFifo::reserveSegments() called twice without"
+                          " commit() on IOFifo PTR#%p.\n", this);
+
+    count = 0;
+
+    if (chunkHead_ == NULL && bytesLeft_ > 0)
+    {
+      //
+      // Free space inside ring. Begins at writePos_, wraps around ring
+      // end if needed.
+      //
+
+      if (bytesLeft_ == capacity_)
+      {
+        readPos_  = 0;
+        writePos_ = 0;
+      }
+
+      seg[0].data_ = buffer_ + writePos_;
+      seg[0].size_ = std::min(std::min(bytesLeft_, capacity_ - writePos_), maxLen);
+
+      count = 1;
+
+      if (seg[0].size_ < bytesLeft_ && seg[0].size_ < maxLen)
+      {
+        seg[1].data_ = buffer_;
+        seg[1].size_ = std::min(bytesLeft_ - seg[0].size_, maxLen - seg[0].size_);
+
+        count = 2;
+      }
+
+      reserved_      = seg[0].data_;
+      reservedLen_   = seg[0].size_ + ((count == 2) ? seg[1].size_ : 0);
+      reservedChunk_ = NULL;
+    }
+    else if (reserve(1))
+    {
+      seg[0].data_ = reserved_;
+      seg[0].size_ = std::min(reservedLen_, maxLen);
+
+      reservedLen_ = seg[0].size_;
+
+      count = 1;
+    }
+
+    fail:
+
+    DBG_LEAVE3("IOFifo::reserveSegments");
+
+    return count;
+  }
+
+  //
+  // Append data written into window returned by reserve() or
+  // reserveSegments() to FIFO.
+  //
+  // len - number of bytes really written into window. Can be less than
+  //       reserved size. Set to 0 to cancel window (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 otherwise.
+  //
+
+  int IOFifo::commit(int len)
+  {
+    DBG_ENTER3("IOFifo::commit");
+
+    int exitCode = -1;
+
+    FAILEX(reserved_ == NULL, "ERROR: IOFifo::commit() called without"
+                                  " reserve() on IOFifo PTR#%p.\n", this);
+
+    FAILEX(len < 0 || unsigned(len) > reservedLen_,
+               "ERROR: Going to commit [%d] bytes to IOFifo PTR#%p,"
+                   " but only [%d] bytes reserved.\n", len, this, reservedLen_);
+
+    if (reservedChunk_)
+    {
+      reservedChunk_ -> writePos_ += len;
+
+      chunkBytes_ += len;
+
+      //
+      // Canceled window in empty chunk. Drop it to get back to ring.
+      //
+
+      if (reservedChunk_ -> readPos_ == reservedChunk_ -> writePos_ &&
+              reservedChunk_ == chunkHead_)
+      {
+        free(reservedChunk_);
+
+        chunkHead_ = NULL;
+        chunkTail_ = NULL;
+      }
+    }
+    else
+    {
+      writePos_ = (writePos_ + len) % capacity_;
+
+      bytesLeft_ -= len;
+    }
+
+    reserved_      = NULL;
+    reservedLen_   = 0;
+    reservedChunk_ = NULL;
+
+    DEBUG2("Committed [%d] bytes to IOFifo PTR#%p.\n", len, this);
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE3("IOFifo::commit");
+
+    return exitCode;
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                        Direct I/O between fifo and FD
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Read data from CRT FD directly into fifo free space without
+  // intermediate buffer. Wrapper for readv() and reserveSegments() / commit().
+  //
+  // fd  - CRT FD to read from (IN).
+  // len - max. number of bytes to read, -1 for all free space (IN/OPT).
+  //
+  // RETURNS: Number of bytes read,
+  //          0 if EOF,
+  //          -1 if error or fifo full (errno set by read()).
+  //
+
+  int IOFifo::readFrom(int fd, int len)
+  {
+    DBG_ENTER3("IOFifo::readFrom");
+
+    IOFifoSegment seg[2];
+
+    int readed = -1;
+    int count  = reserveSegments(seg, len);
+
+    FAILEX(count <= 0, "ERROR: No free space to read FD #%d into IOFifo PTR#%p.\n", fd, this);
+
+    #ifdef WIN32
+    {
+      readed = read(fd, seg[0].data_, seg[0].size_);
+    }
+    #else
+    {
+      struct iovec iov[2];
+
+      for (int i = 0; i < count; i++)
+      {
+        iov[i].iov_base = seg[i].data_;
+        iov[i].iov_len  = seg[i].size_;
+      }
+
+      readed = readv(fd, iov, count);
+    }
+    #endif
+
+    commit(readed > 0 ? readed : 0);
+
+    fail:
+
+    DBG_LEAVE3("IOFifo::readFrom");
+
+    return readed;
+  }
+
+  //
+  // Write data from fifo directly to CRT FD without intermediate buffer
+  // and remove written bytes from fifo. Wrapper for writev() and
+  // peekSegments() / eat().
+  //
+  // fd  - CRT FD to write to (IN).
+  // len - max. number of bytes to write, -1 for all data (IN/OPT).
+  //
+  // RETURNS: Number of bytes written,
+  //          -1 if error (errno set by write()).
+  //
+
+  int IOFifo::writeTo(int fd, int len)
+  {
+    DBG_ENTER3("IOFifo::writeTo");
+
+    IOFifoSegment seg[IOFIFO_MAX_SEGMENTS];
+
+    int written = 0;
+    int count   = peekSegments(seg, IOFIFO_MAX_SEGMENTS, len);
+
+    if (count > 0)
+    {
+      #ifdef WIN32
+      {
+        written = write(fd, seg[0].data_, seg[0].size_);
+      }
+      #else
+      {
+        struct iovec iov[IOFIFO_MAX_SEGMENTS];
+
+        for (int i = 0; i < count; i++)
+        {
+          iov[i].iov_base = seg[i].data_;
+          iov[i].iov_len  = seg[i].size_;
+        }
+
+        written = writev(fd, iov, count);
+      }
+      #endif
+
+      if (written > 0)
+      {
+        eat(written);
+      }
+    }
+
+    DBG_LEAVE3("IOFifo::writeTo");
+
+    return written;
+  }
+
   // ----------------------------------------------------------------------------
   //
   //                       Non destructive read (peek)
@@ -308,6 +920,77 @@ namespace Tegenaria
     return pop(dest, len, 1);
   }
 
+  //
+  // Get pointers to data stored in FIFO without copying it.
+  // Data in ring is returned as up to two spans (second one if data
+  // wraps around ring end), then one span per extra chunk.
+  //
+  // TIP#1: Pass returned spans to writev() and call eat() with number
+  //        of bytes written. See writeTo().
+  //
+  // seg      - table where to store spans (OUT).
+  // maxCount - number of elements in seg[] table (IN).
+  // len      - max. number of bytes to return, -1 for all data (IN/OPT).
+  //
+  // RETURNS: Number of spans stored in seg[].
+  //
+
+  int IOFifo::peekSegments(IOFifoSegment *seg, int maxCount, int len)
+  {
+    int count = 0;
+
+    unsigned int left    = (len < 0) ? size() : std::min(unsigned(len), size());
+    unsigned int ringLen = std::min(left, capacity_ - bytesLeft_);
+
+    IOFifoChunk *chunk = chunkHead_;
+
+    //
+    // Ring data. Begins at readPos_, wraps around ring end if needed.
+    //
+
+    if (ringLen > 0 && count < maxCount)
+    {
+      seg[count].data_ = buffer_ + readPos_;
+      seg[count].size_ = std::min(ringLen, capacity_ - readPos_);
+
+      left    -= seg[count].size_;
+      ringLen -= seg[count].size_;
+
+      count++;
+    }
+
+    if (ringLen > 0 && count < maxCount)
+    {
+      seg[count].data_ = buffer_;
+      seg[count].size_ = ringLen;
+
+      left -= ringLen;
+
+      count++;
+    }
+
+    //
+    // Extra chunks.
+    //
+
+    while (left > 0 && chunk && count < maxCount)
+    {
+      if (chunk -> writePos_ > chunk -> readPos_)
+      {
+        seg[count].data_ = chunk -> data_ + chunk -> readPos_;
+        seg[count].size_ = std::min(left, chunk -> writePos_ - chunk -> readPos_);
+
+        left -= seg[count].size_;
+
+        count++;
+      }
+
+      chunk = chunk -> next_;
+    }
+
+    return count;
+  }
+
   //
   // Peek QWORD from fifo begin, but do NOT remove it from buffer.
   //
@@ -377,10 +1060,10 @@ namespace Tegenaria
       uint8_t *src = (uint8_t *) &tmp;
       uint8_t *dst = (uint8_t *) &ret;
 
-      dst[0] = src[7];
-      dst[1] = src[6];
-      dst[2] = src[5];
-      dst[3] = src[4];
+      dst[0] = src[3];
+      dst[1] = src[2];
+      dst[2] = src[1];
+      dst[3] = src[0];
     }
 
     return ret;
@@ -399,9 +1082,9 @@ namespace Tegenaria
   {
     uint8_t ret = 0;
 
-    if (capacity_ - bytesLeft_ >= 1)
+    if (size() >= 1)
     {
-      ret = buffer_[writePos_];
+      peek(&ret, 1);
     }
 
     return ret;
@@ -439,10 +1122,16 @@ namespace Tegenaria
 
   //
   // Return number of free bytes, which can be append to fifo.
+  // If grow policy is set, it's number of bytes left to grow limit.
   //
 
   unsigned int IOFifo::bytesLeft()
   {
+    if (growChunk_)
+    {
+      return growLeft();
+    }
+
     return bytesLeft_;
   }
 
@@ -452,7 +1141,7 @@ namespace Tegenaria
 
   unsigned int IOFifo::size()
   {
-    return capacity_ - bytesLeft_;
+    return capacity_ - bytesLeft_ + chunkBytes_;
   }
 
   //
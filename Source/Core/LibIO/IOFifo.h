@@ -35,6 +35,40 @@ namespace Tegenaria
   #define IO_BIG_ENDIAN    1
   #define IO_LITTLE_ENDIAN 0
 
+  //
+  // Max. number of segments passed to one readv() / writev() call.
+  //
+
+  #define IOFIFO_MAX_SEGMENTS 16
+
+  //
+  // Contiguous span of data stored inside fifo (peekSegments) or
+  // free space reserved inside fifo (reserveSegments).
+  //
+
+  struct IOFifoSegment
+  {
+    char *data_;
+
+    unsigned int size_;
+  };
+
+  //
+  // Extra chunk allocated when fifo grows above ring capacity.
+  // Chunks are linked in FIFO order after data stored in ring.
+  //
+
+  struct IOFifoChunk
+  {
+    IOFifoChunk *next_;
+
+    unsigned int capacity_;
+    unsigned int readPos_;
+    unsigned int writePos_;
+
+    char data_[1];
+  };
+
   class IOFifo
   {
     private:
@@ -48,6 +82,32 @@ namespace Tegenaria
 
     Mutex *mutex_;
 
+    //
+    // Growth policy. Disabled if growChunk_ is 0.
+    //
+
+    IOFifoChunk *chunkHead_;
+    IOFifoChunk *chunkTail_;
+
+    unsigned int chunkBytes_;
+    unsigned int growChunk_;
+    unsigned int growLimit_;
+
+    //
+    // Pending write window created by reserve() and closed by commit().
+    // reservedChunk_ is NULL if window lies inside ring.
+    //
+
+    char *reserved_;
+
+    unsigned int reservedLen_;
+
+    IOFifoChunk *reservedChunk_;
+
+    IOFifoChunk *chunkAppend(unsigned int len);
+
+    unsigned int growLeft();
+
     public:
 
     //
@@ -72,10 +132,28 @@ namespace Tegenaria
 
     int peek(void *dst, int len = -1);
 
+    int peekSegments(IOFifoSegment *seg, int maxCount, int len = -1);
+
     uint64_t peekQword(int endian);
     uint32_t peekDword(int endian);
     uint8_t peekByte();
 
+    //
+    // Zero-copy write window (reserve, write data directly, commit).
+    //
+
+    void *reserve(int len, int *reserved = NULL);
+
+    int reserveSegments(IOFifoSegment *seg, int len = -1);
+    int commit(int len);
+
+    //
+    // Read/write directly between fifo and CRT FD.
+    //
+
+    int readFrom(int fd, int len = -1);
+    int writeTo(int fd, int len = -1);
+
     //
     // Multithread synchronization.
     //
@@ -90,6 +168,8 @@ namespace Tegenaria
     unsigned int bytesLeft();
     unsigned int size();
     unsigned int capacity();
+
+    void setGrowPolicy(unsigned int chunkSize, unsigned int maxSize = 0);
   };
 
 } /* namespace Tegenaria */
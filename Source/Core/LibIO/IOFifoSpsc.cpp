@@ -0,0 +1,433 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Lock-free cyclic buffer for one producer and one consumer.
+//
+//          Producer owns writePos_, consumer owns readPos_. Each side
+//          publishes own position with release store and reads other
+//          side's position with acquire load, so data written before
+//          position update is always visible to other side.
+//
+//          Positions are free running 32-bit counters:
+//
+//          size      = writePos_ - readPos_
+//          bytesLeft = capacity_ - size
+//          offset    = pos & mask_
+//
+//          Each side caches last seen position of other side and reloads
+//          it only when cached value says there is not enough data/space,
+//          so shared cache lines are touched rarely.
+//
+
+#include <cstring>
+#include <cstdlib>
+
+#include "IOFifoSpsc.h"
+#include <Tegenaria/Debug.h>
+
+//
+// Atomic load/store with acquire/release semantic.
+//
+
+#define IOFIFO_LOAD_ACQUIRE(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define IOFIFO_STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+namespace Tegenaria
+{
+  // ----------------------------------------------------------------------------
+  //
+  //                         Constructors and destructors
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Create new lock-free fifo with given capacity.
+  //
+  // capacity - size of fifo in bytes, rounded up to power of two (IN).
+  //
+
+  IOFifoSpsc::IOFifoSpsc(unsigned int capacity)
+  {
+    DBG_SET_ADD("IOFifoSpsc", this);
+
+    capacity_ = 1;
+
+    while (capacity_ < capacity && capacity_ < 0x80000000)
+    {
+      capacity_ <<= 1;
+    }
+
+    mask_       = capacity_ - 1;
+    buffer_     = (char *) malloc(capacity_);
+    writePos_   = 0;
+    readPos_    = 0;
+    readCache_  = 0;
+    writeCache_ = 0;
+
+    if (buffer_ == NULL)
+    {
+      Error("ERROR: Out of memory while creating IOFifoSpsc.\n");
+
+      capacity_ = 0;
+      mask_     = 0;
+    }
+  }
+
+  //
+  // Free buffers allocated in constructor.
+  //
+
+  IOFifoSpsc::~IOFifoSpsc()
+  {
+    DBG_SET_DEL("IOFifoSpsc", this);
+
+    if (buffer_)
+    {
+      free(buffer_);
+
+      buffer_ = NULL;
+    }
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                       Destructive functions (push/pop)
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Add data to the end of FIFO.
+  // Producer thread only.
+  //
+  // source - source buffer with data to append (IN).
+  // len    - number of bytes to append (IN).
+  //
+  // RETURNS: 0 if all bytes appended,
+  //          -1 if there is not enough space (nothing appended).
+  //
+
+  int IOFifoSpsc::push(void *source, int len)
+  {
+    char *src = (char *) source;
+
+    uint32_t pos    = writePos_;
+    uint32_t offset = 0;
+    uint32_t first  = 0;
+
+    if (len < 0)
+    {
+      return -1;
+    }
+
+    //
+    // Check is it sufficient space left. Reload consumer position
+    // only if cached one says fifo is full.
+    //
+
+    if (capacity_ - (pos - readCache_) < uint32_t(len))
+    {
+      readCache_ = IOFIFO_LOAD_ACQUIRE(readPos_);
+
+      if (capacity_ - (pos - readCache_) < uint32_t(len))
+      {
+        return -1;
+      }
+    }
+
+    //
+    // Write data to buffer. Wrap around the end if needed.
+    //
+
+    offset = pos & mask_;
+    first  = capacity_ - offset;
+
+    if (first > uint32_t(len))
+    {
+      first = len;
+    }
+
+    memcpy(buffer_ + offset, src, first);
+    memcpy(buffer_, src + first, len - first);
+
+    //
+    // Publish data to consumer.
+    //
+
+    IOFIFO_STORE_RELEASE(writePos_, pos + len);
+
+    return 0;
+  }
+
+  //
+  // Copy <len> bytes starting at position <pos> to <dst>.
+  //
+
+  void IOFifoSpsc::copyOut(void *dst, uint32_t pos, uint32_t len)
+  {
+    uint32_t offset = pos & mask_;
+    uint32_t first  = capacity_ - offset;
+
+    if (first > len)
+    {
+      first = len;
+    }
+
+    memcpy(dst, buffer_ + offset, first);
+    memcpy((char *) dst + first, buffer_, len - first);
+  }
+
+  //
+  // Pop data from the begin of FIFO.
+  // Consumer thread only.
+  //
+  // TIP#1: If dest buffer is NULL, data are popped from FIFO,
+  //        but don't written anywhere.
+  //
+  // TIP#2: Skip len parameter or set to -1 if you want to pop up
+  //        all data stored in queue.
+  //
+  // TIP#3: Use peekOnly flag to get data WITHOUT removing it from FIFO.
+  //
+  // dest     - buffer where to write popped data (OUT/OPT).
+  //
+  // len      - number of bytes to pop, if set to -1 all available data
+  //            will be popped (IN/OPT).
+  //
+  // peekOnly - set to 1 if you want copy data to dest buffer WITHOUT
+  //            remove it from buffer (IN/OPT).
+  //
+  // RETURNS: 0 if all bytes popped,
+  //          -1 if there is not enough data (nothing popped).
+  //
+
+  int IOFifoSpsc::pop(void *dest, int len, int peekOnly)
+  {
+    uint32_t pos   = readPos_;
+    uint32_t avail = writeCache_ - pos;
+
+    //
+    // Reload producer position only if cached one says there is
+    // not enough data.
+    //
+
+    if (len < 0 || avail < uint32_t(len))
+    {
+      writeCache_ = IOFIFO_LOAD_ACQUIRE(writePos_);
+
+      avail = writeCache_ - pos;
+    }
+
+    if (len < 0)
+    {
+      len = avail;
+    }
+
+    if (avail < uint32_t(len))
+    {
+      return -1;
+    }
+
+    if (dest)
+    {
+      copyOut(dest, pos, len);
+    }
+
+    //
+    // Give space back to producer.
+    //
+
+    if (peekOnly == 0)
+    {
+      IOFIFO_STORE_RELEASE(readPos_, pos + len);
+    }
+
+    return 0;
+  }
+
+  //
+  // Eat data from the begin of FIFO.
+  // Works as pop() method with destination set to NULL.
+  //
+  // len - number of bytes to eat (IN).
+  //
+  // RETURNS: 0 if all bytes eated,
+  //         -1 otherwise..
+  //
+
+  int IOFifoSpsc::eat(int len)
+  {
+    return pop(NULL, len);
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                       Non destructive read (peek)
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Copy <len> bytes from begin of FIFO to <dest>, but
+  // do NOT remove them from FIFO.
+  //
+  // Works as pop() with peekOnly flag set to 1.
+  //
+  // dest - buffer where to store readed data (OUT).
+  //
+  // len  - number of bytes to read. If set to -1 all
+  //        available data will be copied (IN/OPT).
+  //
+  // RETURNS: 0 if all bytes copied,
+  //         -1 otherwise.
+  //
+
+  int IOFifoSpsc::peek(void *dest, int len)
+  {
+    return pop(dest, len, 1);
+  }
+
+  //
+  // Peek QWORD from fifo begin, but do NOT remove it from buffer.
+  //
+  // WARNING: If there is less than 8 bytes in buffer, return value
+  //          is always zero.
+  //
+  // endian - set to IO_BIG_ENDIAN or IO_LITTLE_ENDIAN (IN).
+  //
+  // RETURNS: First QWORD in queue.
+  //
+
+  uint64_t IOFifoSpsc::peekQword(int endian)
+  {
+    uint64_t ret = 0;
+
+    uint8_t raw[8];
+
+    if (peek(raw, 8) == 0)
+    {
+      for (int i = 0; i < 8; i++)
+      {
+        if (endian == IO_BIG_ENDIAN)
+        {
+          ret = (ret << 8) | raw[i];
+        }
+        else
+        {
+          ret |= uint64_t(raw[i]) << (i * 8);
+        }
+      }
+    }
+
+    return ret;
+  }
+
+  //
+  // Peek DWORD from fifo begin, but do NOT remove it from buffer.
+  //
+  // WARNING: If there is less than 4 bytes in buffer, return value
+  //          is always zero.
+  //
+  // endian - set to IO_BIG_ENDIAN or IO_LITTLE_ENDIAN (IN).
+  //
+  // RETURNS: First DWORD in queue.
+  //
+
+  uint32_t IOFifoSpsc::peekDword(int endian)
+  {
+    uint32_t ret = 0;
+
+    uint8_t raw[4];
+
+    if (peek(raw, 4) == 0)
+    {
+      for (int i = 0; i < 4; i++)
+      {
+        if (endian == IO_BIG_ENDIAN)
+        {
+          ret = (ret << 8) | raw[i];
+        }
+        else
+        {
+          ret |= uint32_t(raw[i]) << (i * 8);
+        }
+      }
+    }
+
+    return ret;
+  }
+
+  //
+  // Peek byte from fifo begin, but do NOT remove it from buffer.
+  //
+  // WARNING: If there is less than 1 bytes in buffer, return value
+  //          is always zero.
+  //
+  // RETURNS: First byte in queue.
+  //
+
+  uint8_t IOFifoSpsc::peekByte()
+  {
+    uint8_t ret = 0;
+
+    peek(&ret, 1);
+
+    return ret;
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                              Getters and setters
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Return number of free bytes, which can be append to fifo.
+  //
+
+  unsigned int IOFifoSpsc::bytesLeft()
+  {
+    return capacity_ - size();
+  }
+
+  //
+  // Return number of bytes already stored inside fifo.
+  //
+
+  unsigned int IOFifoSpsc::size()
+  {
+    uint32_t readPos  = IOFIFO_LOAD_ACQUIRE(readPos_);
+    uint32_t writePos = IOFIFO_LOAD_ACQUIRE(writePos_);
+
+    return writePos - readPos;
+  }
+
+  //
+  // Return total fifo capacity in bytes.
+  //
+
+  unsigned int IOFifoSpsc::capacity()
+  {
+    return capacity_;
+  }
+} /* namespace Tegenaria */
@@ -0,0 +1,133 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef Tegenaria_Core_IOFifoSpsc_H
+#define Tegenaria_Core_IOFifoSpsc_H
+
+#include <stdint.h>
+
+#include "IOFifo.h"
+
+namespace Tegenaria
+{
+  //
+  // Assumed CPU cache line size. Producer and consumer counters are
+  // kept at least one line apart to avoid false sharing.
+  //
+
+  #define IOFIFO_CACHE_LINE 64
+
+  //
+  // Lock-free cyclic buffer for exactly one producer thread and exactly
+  // one consumer thread. No lock() / unlock() is needed.
+  //
+  // - push() MUST be called from producer thread only.
+  // - pop(), eat() and peekXXX() MUST be called from consumer thread only.
+  // - size() and bytesLeft() can be called from any thread, but result is
+  //   a snapshot only.
+  //
+  // Capacity is rounded up to power of two.
+  //
+
+  class IOFifoSpsc
+  {
+    private:
+
+    //
+    // Read-only after constructor.
+    //
+
+    char *buffer_;
+
+    uint32_t capacity_;
+    uint32_t mask_;
+
+    char padRead_[IOFIFO_CACHE_LINE];
+
+    //
+    // Producer side. writePos_ is published to consumer.
+    // readCache_ is last readPos_ seen by producer.
+    //
+    // Positions are free running counters, wrapped by mask_ on access.
+    //
+
+    volatile uint32_t writePos_;
+
+    uint32_t readCache_;
+
+    char padWrite_[IOFIFO_CACHE_LINE];
+
+    //
+    // Consumer side. readPos_ is published to producer.
+    // writeCache_ is last writePos_ seen by consumer.
+    //
+
+    volatile uint32_t readPos_;
+
+    uint32_t writeCache_;
+
+    char padEnd_[IOFIFO_CACHE_LINE];
+
+    void copyOut(void *dst, uint32_t pos, uint32_t len);
+
+    public:
+
+    //
+    // Constructors and destructors.
+    //
+
+    IOFifoSpsc(unsigned int capacity = IOFIFO_DEFAULT_BUFFER_SIZE);
+
+    ~IOFifoSpsc();
+
+    //
+    // Destructive methods (changes fifo).
+    //
+
+    int push(void *src, int len);
+    int pop(void *dst, int len = -1, int peekOnly = 0);
+    int eat(int len);
+
+    //
+    // Non-destructive read (read without changing fifo).
+    //
+
+    int peek(void *dst, int len = -1);
+
+    uint64_t peekQword(int endian);
+    uint32_t peekDword(int endian);
+    uint8_t peekByte();
+
+    //
+    // Getters and setters.
+    //
+
+    unsigned int bytesLeft();
+    unsigned int size();
+    unsigned int capacity();
+  };
+
+} /* namespace Tegenaria */
+
+#endif /* Tegenaria_Core_IOFifoSpsc_H */
@@ -33,6 +33,7 @@
 //
 
 #include "IOLoop.h"
+#include "IOReactor.h"
 #include <Tegenaria/Debug.h>
 
 #ifdef WIN32
@@ -42,6 +43,96 @@
 
 namespace Tegenaria
 {
+  //
+  // State shared between IOLoop() and reactor callback.
+  //
+
+  struct IOLoopCtx
+  {
+    int count_;
+    int inputs_;
+    int error_;
+
+    int *fd_;
+    int *direct_;
+
+    IOFifo *queue_;
+
+    IOCompletedProto *callback_;
+  };
+
+  //
+  // Reactor callback used by IOLoop() on Linux/MacOS.
+  // Pass event to caller and flush output queues filled by caller.
+  //
+
+  static void IOLoopDispatch(IOReactor *reactor, int fd, int event,
+                                 int count, IOFifo *queue, void *data)
+  {
+    IOLoopCtx *ctx = (IOLoopCtx *) data;
+
+    int direct = 0;
+
+    for (int i = 0; i < ctx -> count_; i++)
+    {
+      if (ctx -> fd_[i] == fd)
+      {
+        direct = ctx -> direct_[i];
+      }
+    }
+
+    switch(event)
+    {
+      case IOREACTOR_EVENT_READ:
+      case IOREACTOR_EVENT_WRITE:
+      {
+        if (ctx -> callback_)
+        {
+          ctx -> callback_(fd, count, direct, queue);
+        }
+
+        if (event == IOREACTOR_EVENT_READ)
+        {
+          for (int i = 0; i < ctx -> count_; i++)
+          {
+            if (ctx -> direct_[i] && ctx -> queue_[i].size() > 0)
+            {
+              reactor -> wantWrite(ctx -> fd_[i]);
+            }
+          }
+        }
+
+        break;
+      }
+
+      case IOREACTOR_EVENT_ERROR:
+      {
+        Error("ERROR: I/O error on FD #%d in IOLoop.\n"
+                  "Error code is : %d.\n", fd, count);
+
+        ctx -> error_ = 1;
+
+        //
+        // Fall through.
+        //
+      }
+
+      case IOREACTOR_EVENT_EOF:
+      {
+        DEBUG1("IOLoop: FD #%d closed.\n", fd);
+
+        if (direct == 0)
+        {
+          ctx -> inputs_--;
+        }
+
+        reactor -> removeFd(fd);
+
+        break;
+      }
+    }
+  }
+
   //
   // Template routine for main I/O loop.
   //
@@ -276,12 +367,64 @@ namespace Tegenaria
 
     //
     // Linux, MacOS.
-    // Select based loop.
+    // IOReactor based loop (epoll on Linux, poll() on other systems).
+    // Loop finished when all inputs are closed and all output queues
+    // are flushed.
     //
 
     #else
     {
-      Error("ERROR: IOLoop is not implemented.\n");
+      IOReactor reactor;
+
+      IOLoopCtx ctx;
+
+      int outputPending = 0;
+
+      ctx.count_    = count;
+      ctx.inputs_   = 0;
+      ctx.error_    = 0;
+      ctx.fd_       = fd;
+      ctx.direct_   = direct;
+      ctx.queue_    = queue;
+      ctx.callback_ = callback;
+
+      for (int i = 0; i < count; i++)
+      {
+        FAIL(reactor.addFd(fd[i], direct[i] ? IOREACTOR_OUTPUT : IOREACTOR_INPUT,
+                               &queue[i], IOLoopDispatch, &ctx));
+
+        if (direct[i] == 0)
+        {
+          ctx.inputs_++;
+        }
+      }
+
+      DEBUG1("IOLoop: Falling into main I/O loop...\n");
+
+      do
+      {
+        FAIL(reactor.runOnce(-1) < 0);
+
+        outputPending = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+          if (direct[i] && queue[i].size() > 0)
+          {
+            outputPending = 1;
+          }
+        }
+      }
+      while (ctx.error_ == 0 && reactor.count() > 0 &&
+                 (ctx.inputs_ > 0 || outputPending));
+
+      FAIL(ctx.error_);
+
+      exitCode = 0;
+
+      fail:
+
+      DEBUG1("IOLoop: Main I/O loop finished.\n");
     }
     #endif
 
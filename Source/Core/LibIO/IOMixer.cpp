@@ -181,6 +181,43 @@ namespace Tegenaria
     slave -> fdout_       = pout[1];
     slave -> this_        = this;
     slave -> flags_       = 0;
+    slave -> thread_      = NULL;
+    slave -> loop_        = -1;
+    slave -> busy_        = 0;
+    slave -> coalesce_    = 1;
+    slave -> txSent_      = 0;
+    slave -> txAcked_     = 0;
+    slave -> rxDone_      = 0;
+    slave -> rxAcked_     = 0;
+    slave -> rxQueue_     = NULL;
+    slave -> rxAsync_     = 0;
+    slave -> inputClosed_ = 0;
+    slave -> events_      = 0;
+
+    slave -> codec_         = IOCODEC_ZLIB;
+    slave -> compression_   = IOMIXER_COMPRESSION_OFF;
+    slave -> encoder_       = NULL;
+    slave -> encodeBuf_     = NULL;
+    slave -> encodeBufSize_ = 0;
+    slave -> compMisses_    = 0;
+    slave -> compSkip_      = 0;
+    slave -> compBackoff_   = 0;
+    slave -> cipher_        = NULL;
+
+    //
+    // Flow control enabled. Prepare receive queue and make slave output
+    // non-blocking, so slow slave never blocks master.
+    //
+
+    #ifndef WIN32
+    if (flowWindow_ > 0)
+    {
+      slave -> rxQueue_ = new IOFifo(flowWindow_);
+      slave -> rxAsync_ = 1;
+
+      fcntl(slave -> fdout_, F_SETFL, fcntl(slave -> fdout_, F_GETFL) | O_NONBLOCK);
+    }
+    #endif
 
     //
     // Prepare overlapped I/O and cancel event on Windows.
@@ -212,14 +249,28 @@ namespace Tegenaria
     slave -> writeMutex_.setName(mutexName);
 
     //
-    // Start up slave thread.
+    // Reactor mode. Attach slave to one of shared reactor loops.
+    // In this moment we're starting sending data from slave to master
+    // outputs.
+    //
+
+    if (mode_ == IOMIXER_MODE_REACTOR)
+    {
+      FAIL(reactorAttachSlave(slave));
+    }
+
+    //
+    // Thread mode. Start up slave thread.
     // In this moment we're starting sending data
     // from slaves to master outputs.
     //
 
-    slave -> thread_ = ThreadCreate((ThreadEntryProto) slaveLoop, slave);
+    else
+    {
+      slave -> thread_ = ThreadCreate((ThreadEntryProto) slaveLoop, slave);
 
-    DBG_SET_RENAME("thread", slave -> thread_, "IOMixer::slaveLoop");
+      DBG_SET_RENAME("thread", slave -> thread_, "IOMixer::slaveLoop");
+    }
 
     //
     // Store {ID |-> slave} pair for quick search for slave with given ID.
@@ -282,6 +333,32 @@ namespace Tegenaria
     zlibLoaded_ = 0;
     refCount_   = 1;
 
+    masterThread_    = NULL;
+    decodeBuf_       = NULL;
+    decodeBufSize_   = 0;
+    peerCaps_        = 0;
+    mode_            = IOMIXER_MODE_THREADS;
+    masterReactor_   = 0;
+    masterInBuf_     = NULL;
+    masterInBufSize_ = 0;
+    masterInLen_     = 0;
+
+    reactorIdleWaiters_ = 0;
+
+    sendQueue_        = NULL;
+    sendQueueSize_    = 0;
+    sendQueueLen_     = 0;
+    sendQueueFrames_  = 0;
+    sendQueueDelay_   = 0;
+    sendQueueFlusher_ = 0;
+    sendQueueThread_  = NULL;
+    sendQueueStop_    = 0;
+    statFrames_       = 0;
+    statWrites_       = 0;
+    flowWindow_       = 0;
+    flowPeerWindow_   = 0;
+    flowActive_       = 0;
+
     #ifdef WIN32
     memset(&masterInOV_, 0, sizeof(masterInOV_));
     memset(&masterOutOV_, 0, sizeof(masterOutOV_));
@@ -298,6 +375,9 @@ namespace Tegenaria
     masterEofSent_      = 0;
     masterEofReceived_  = 0;
 
+    masterReadCallback_  = NULL;
+    masterWriteCallback_ = NULL;
+    ioCancelCallback_    = NULL;
 
     slaveDeadCallback_ = NULL;
 
@@ -390,6 +470,32 @@ namespace Tegenaria
     zlibLoaded_ = 0;
     refCount_   = 1;
 
+    masterThread_    = NULL;
+    decodeBuf_       = NULL;
+    decodeBufSize_   = 0;
+    peerCaps_        = 0;
+    mode_            = IOMIXER_MODE_THREADS;
+    masterReactor_   = 0;
+    masterInBuf_     = NULL;
+    masterInBufSize_ = 0;
+    masterInLen_     = 0;
+
+    reactorIdleWaiters_ = 0;
+
+    sendQueue_        = NULL;
+    sendQueueSize_    = 0;
+    sendQueueLen_     = 0;
+    sendQueueFrames_  = 0;
+    sendQueueDelay_   = 0;
+    sendQueueFlusher_ = 0;
+    sendQueueThread_  = NULL;
+    sendQueueStop_    = 0;
+    statFrames_       = 0;
+    statWrites_       = 0;
+    flowWindow_       = 0;
+    flowPeerWindow_   = 0;
+    flowActive_       = 0;
+
     #ifdef WIN32
     memset(&masterInOV_, 0, sizeof(masterInOV_));
     memset(&masterOutOV_, 0, sizeof(masterOutOV_));
@@ -485,6 +591,19 @@ namespace Tegenaria
 
     IOMixerSlave *slave = getSlave(id);
 
+    //
+    // Reactor mode. Stop watching slave FD and wait until loop finished
+    // with it before close. Done even if slave is already detached,
+    // because loop may still be processing its last event.
+    //
+
+    if (slave && mode_ == IOMIXER_MODE_REACTOR)
+    {
+      reactorDetachSlave(slave);
+
+      slave = reactorWaitSlave(id);
+    }
+
     if (slave)
     {
       #ifdef WIN32
@@ -495,6 +614,26 @@ namespace Tegenaria
                   " for master FDs [%d][%d]...\n", slave -> id_,
                       slave -> fdout_, slave -> fdin_, masterOut_, masterIn_);
 
+      //
+      // Pass data still queued for slave if possible without blocking.
+      // Rest is dropped.
+      //
+
+      if (slave -> rxQueue_)
+      {
+        slave -> writeMutex_.lock();
+
+        slaveDrainLocked(slave, 0);
+
+        if (slave -> rxQueue_ -> size() > 0)
+        {
+          DEBUG1("IOMixer::removeSlave : WARNING: [%d] bytes queued for slave"
+                     " ID#%d dropped.\n", slave -> rxQueue_ -> size(), id);
+        }
+
+        slave -> writeMutex_.unlock();
+      }
+
       if (slave -> fdout_ != -1)
       {
         close(slave -> fdout_);
@@ -601,6 +740,26 @@ namespace Tegenaria
 
       DEBUG4("IOMixer::removeSlave : destroying slave ID#%d.\n", id);
 
+      if (slave -> rxQueue_)
+      {
+        delete slave -> rxQueue_;
+      }
+
+      if (slave -> encoder_)
+      {
+        delete slave -> encoder_;
+      }
+
+      if (slave -> encodeBuf_)
+      {
+        free(slave -> encodeBuf_);
+      }
+
+      if (slave -> cipher_)
+      {
+        delete slave -> cipher_;
+      }
+
       delete slave;
 
       slaves_.erase(id);
@@ -635,9 +794,33 @@ namespace Tegenaria
 
     FAILEX(init_ == 0, "ERROR: IOMixer object was not initiated correctly.\n");
 
-    masterThread_ = ThreadCreate((ThreadEntryProto) IOMixer::masterLoop, this);
+    //
+    // Announce flow control and supported codecs to remote. It must be
+    // sent before we start reading from master, so remote gets it before
+    // any data counted against its window.
+    //
+
+    FAIL(controlSend(IOMIXER_CONTROL_HELLO, codecCaps() |
+                         (flowWindow_ > 0 ? IOMIXER_CAPS_FLOW_CONTROL : 0),
+                             0, flowWindow_));
+
+    //
+    // Reactor mode. Dispatch master IN inside reactor loop if possible.
+    // Callback based master can't be polled, so it still needs own thread.
+    //
+
+    if (mode_ == IOMIXER_MODE_REACTOR &&
+            (masterInType_ == IOMIXER_TYPE_FD ||
+                 masterInType_ == IOMIXER_TYPE_SOCKET))
+    {
+      FAIL(reactorAttachMaster());
+    }
+    else
+    {
+      masterThread_ = ThreadCreate((ThreadEntryProto) IOMixer::masterLoop, this);
 
-    DBG_SET_RENAME("thread", masterThread_, "IOMixer::masterLoop");
+      DBG_SET_RENAME("thread", masterThread_, "IOMixer::masterLoop");
+    }
 
     //
     // Error handler.
@@ -678,6 +861,14 @@ namespace Tegenaria
 
       masterThread_ = NULL;
     }
+
+    //
+    // Stop reactor loops if any.
+    //
+
+    reactorStop();
+
+    return 0;
   }
 
   //
@@ -706,6 +897,8 @@ namespace Tegenaria
 
     int ret = -1;
 
+    int canceled = 0;
+
     IOMixer *this_ = slave -> this_;
 
     this_ -> addRef();
@@ -778,25 +971,82 @@ namespace Tegenaria
       #else
       {
         fd_set rfd;
+        fd_set wfd;
 
-        int fdmax = std::max(slave -> fdin_, slave -> cancelFd_[0]);
+        int fdmax  = slave -> cancelFd_[0];
+        int fdout  = -1;
+        int credit = this_ -> flowCredit(slave);
 
         FD_ZERO(&rfd);
+        FD_ZERO(&wfd);
 
-        FD_SET(slave -> fdin_, &rfd);
         FD_SET(slave -> cancelFd_[0], &rfd);
 
-        select(fdmax + 1, &rfd, NULL, NULL, NULL);
+        //
+        // Don't read from slave if remote window is full.
+        // We'll be woken up by slaveKick() when credits arrive.
+        //
+
+        if (credit > 0)
+        {
+          FD_SET(slave -> fdin_, &rfd);
+
+          fdmax = std::max(fdmax, slave -> fdin_);
+        }
+
+        //
+        // There are data queued for slave output.
+        // Wait until we can write them.
+        //
+
+        if (this_ -> slavePending(slave) > 0)
+        {
+          fdout = slave -> fdout_;
+
+          if (fdout != -1)
+          {
+            FD_SET(fdout, &wfd);
+
+            fdmax = std::max(fdmax, fdout);
+          }
+        }
+
+        if (select(fdmax + 1, &rfd, &wfd, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
 
-        if (FD_ISSET(slave -> cancelFd_[0], &rfd))
+          DBG_INFO("Select failed on slave #%d.\n", slave -> id_);
+
+          readed   = 0;
+          canceled = 1;
+        }
+        else if (FD_ISSET(slave -> cancelFd_[0], &rfd) && this_ -> slaveCanceled(slave))
         {
           DBG_INFO("Read canceled on slave #%d.\n", slave -> id_);
 
-          readed = 0;
+          readed   = 0;
+          canceled = 1;
         }
-        else if (FD_ISSET(slave -> fdin_, &rfd))
+        else
         {
-          readed = read(slave -> fdin_, buf, sizeof(buf));
+          if (fdout != -1 && FD_ISSET(fdout, &wfd))
+          {
+            this_ -> slaveDrain(slave, 0);
+          }
+
+          //
+          // Woken up by slaveKick() or slave output only.
+          //
+
+          if (credit <= 0 || FD_ISSET(slave -> fdin_, &rfd) == 0)
+          {
+            continue;
+          }
+
+          readed = read(slave -> fdin_, buf, std::min(int(sizeof(buf)), credit));
         }
       }
       #endif
@@ -812,12 +1062,17 @@ namespace Tegenaria
 
       DBG_IO_WRITE_BEGIN(this_ -> objectName(), 0, buf, readed);
 
-      ret = this_ -> masterEncode(id, buf, readed, slave -> flags_);
+      ret = this_ -> slaveEncode(slave, buf, readed);
 
       DBG_IO_WRITE_END(this_ -> objectName(), 0, buf, readed);
 
       FAIL(ret != 0);
 
+      if (readed > 0)
+      {
+        slave -> txSent_ += readed;
+      }
+
       FAIL(readed <= 0);
     }
 
@@ -830,6 +1085,13 @@ namespace Tegenaria
 
     slave -> eofSent_ == 1;
 
+    //
+    // Slave input finished, but there still may be data from remote
+    // queued for slave output. Pass them before we go away.
+    //
+
+    this_ -> slaveDrainWait(slave, canceled == 0 && ret == 0);
+
     DEBUG1("IOMixer::slaveLoop : Job for slave ID [%d] for FDs [%d][%d]"
                 " finished with code [%d].\n", slave -> id_, this_ -> masterOut_,
                     this_ -> masterIn_, GetLastError());
@@ -881,10 +1143,6 @@ namespace Tegenaria
     int len     = 0;
     int slaveId = 0;
 
-    IOMixerSlave *slave = NULL;
-
-    map<int, IOMixerSlave *>::iterator it;
-
     char data[IOMIXER_MAX_PACKET];
 
     int id   = -1;
@@ -916,67 +1174,10 @@ namespace Tegenaria
       FAIL(ret != 0);
 
       //
-      // <size> <= 0 means EOF or ERROR.
-      //
-
-      if (size <= 0)
-      {
-        //
-        // ID #0 is reserved for master.
-        // It means close master connection and leave master loop.
-        // EOF #0 is sent by remote via IOMixer::shutdown() function.
-        //
-
-        if (id == 0)
-        {
-          DEBUG1("IOMixer::masterLoop : Received EOF on master #0\n");
-
-          this_ -> masterEofReceived_ = 1;
-        }
-
-        //
-        // EOF on slave with id <ID>.
-        // Remove slave and go on.
-        //
-
-        else
-        {
-          DEBUG1("IOMixer::masterLoop : Received EOF on slave ID #%d.\n", id);
-
-          this_ -> slavesMutex_.lock();
-
-          slave =  this_ -> getSlave(id);
-
-          if (slave)
-          {
-            slave -> eofReceived_ = 1;
-
-            if (slave -> fdout_ != -1)
-            {
-              close(slave -> fdout_);
-
-              DBG_SET_DEL("CRT FD", slave -> fdout_);
-
-              slave -> fdout_ = -1;
-            }
-          }
-
-          this_ -> slavesMutex_.unlock();
-        }
-      }
-
-      //
-      // Otherwise, write <size> bytes of <data> to slave with ID <id>.
+      // Pass <data> to slave or handle EOF.
       //
 
-      else
-      {
-        DBG_IO_WRITE_BEGIN(this_ -> objectName(), id, data, size);
-
-        this_ -> slaveWrite(id, data, size);
-
-        DBG_IO_WRITE_END(this_ -> objectName(), id, data, size);
-      }
+      this_ -> masterDispatch(id, data, size);
     }
 
     //
@@ -1021,6 +1222,109 @@ namespace Tegenaria
     return 0;
   }
 
+  //
+  // Pass one packet decoded from master IN to related slave.
+  // Common code for master thread and reactor loop.
+  //
+  // id   - channel ID decoded from packet (IN).
+  // data - decoded <data> (IN).
+  // size - number of bytes in data[] buffer. Value <= 0 means EOF (IN).
+  //
+
+  void IOMixer::masterDispatch(int id, void *data, int size)
+  {
+    IOMixerSlave *slave = NULL;
+
+    //
+    // <size> <= 0 means EOF or ERROR.
+    //
+
+    if (size <= 0)
+    {
+      //
+      // ID #0 is reserved for master.
+      // It means close master connection and leave master loop.
+      // EOF #0 is sent by remote via IOMixer::shutdown() function.
+      //
+
+      if (id == 0)
+      {
+        DEBUG1("IOMixer::masterDispatch : Received EOF on master #0\n");
+
+        masterEofReceived_ = 1;
+      }
+
+      //
+      // EOF on slave with id <ID>.
+      // Remove slave and go on.
+      //
+
+      else
+      {
+        DEBUG1("IOMixer::masterDispatch : Received EOF on slave ID #%d.\n", id);
+
+        codecRelease(id);
+
+        slavesMutex_.lock();
+
+        slave = getSlave(id);
+
+        if (slave)
+        {
+          slave -> writeMutex_.lock();
+
+          slave -> eofReceived_ = 1;
+
+          //
+          // Close slave output now if there is no queued data.
+          // Otherwise it's closed after queue is written to slave.
+          //
+
+          if (slave -> rxAsync_ == 0)
+          {
+            slaveDrainLocked(slave, 1);
+          }
+
+          if (slave -> fdout_ != -1 &&
+                  (slave -> rxQueue_ == NULL || slave -> rxQueue_ -> size() == 0))
+          {
+            close(slave -> fdout_);
+
+            DBG_SET_DEL("CRT FD", slave -> fdout_);
+
+            slave -> fdout_ = -1;
+          }
+
+          slave -> writeMutex_.unlock();
+        }
+
+        slavesMutex_.unlock();
+      }
+    }
+
+    //
+    // Control packet on channel #0.
+    //
+
+    else if (id == 0)
+    {
+      controlDispatch(data, size);
+    }
+
+    //
+    // Otherwise, write <size> bytes of <data> to slave with ID <id>.
+    //
+
+    else
+    {
+      DBG_IO_WRITE_BEGIN(objectName(), id, data, size);
+
+      slaveWrite(id, data, size);
+
+      DBG_IO_WRITE_END(objectName(), id, data, size);
+    }
+  }
+
   //
   // Wait until 'master thread' and every 'slave threads' finished works.
   //
@@ -1108,19 +1412,55 @@ namespace Tegenaria
     }
     #endif
 
+    if (masterInBuf_)
+    {
+      free(masterInBuf_);
+
+      masterInBuf_ = NULL;
+    }
+
+    if (decodeBuf_)
+    {
+      free(decodeBuf_);
+
+      decodeBuf_ = NULL;
+    }
+
     //
-    // Free ZLib library if needed.
+    // Stop send queue flusher thread if any.
     //
 
-    if (zlib_)
+    if (sendQueueThread_)
     {
-      #ifdef WIN32
-      FreeLibrary(zlib_);
-      #else
-      dlclose(zlib_);
-      #endif
+      sendQueueStop_ = 1;
+
+      sendQueueSem_.signal();
+
+      ThreadWait(sendQueueThread_);
+      ThreadClose(sendQueueThread_);
+
+      sendQueueThread_ = NULL;
+    }
+
+    if (sendQueue_)
+    {
+      free(sendQueue_);
+
+      sendQueue_ = NULL;
+    }
+
+    //
+    // Free decoder contexts left by channels closed without EOF.
+    //
+
+    for (map<int, IOCodec *>::iterator it = decoders_.begin();
+             it != decoders_.end(); it++)
+    {
+      delete it -> second;
     }
 
+    decoders_.clear();
+
     DBG_SET_DEL("IOMixer", this);
 
     DBG_LEAVE("IOMixer::~IOMixer");
@@ -1129,46 +1469,42 @@ namespace Tegenaria
   //
   // Encode <data> into <id><flags><size><data> and write it into master OUT.
   //
-  // TIP: If <size> is <= 0, then <data> part will be skipped.
-  //      It's equal to sending EOF/error to other side, where remote
-  //      read() will return -1/0.
+  // TIP#1: If <size> is <= 0, then <data> part will be skipped.
+  //        It's equal to sending EOF/error to other side, where remote
+  //        read() will return -1/0.
   //
-  // id    - channel id where to send data (IN).
-  // buf   - buffer to send (IN).
-  // size  - size of buf[] buffer in bytes (IN).
-  // flags - combination of IOMIXER_FLAG_XXX flags (IN).
+  // TIP#2: <data> is NOT copied anywhere if packet is not queued.
+  //        Head and caller buffer are written to master in one
+  //        scatter/gather call.
+  //
+  // TIP#3: If coalesce is set and write coalescing is enabled, small
+  //        packets are queued and written later together with packets
+  //        from other slaves. See setWriteCoalescing().
+  //
+  // TIP#4: <data> MUST be already compressed and encrypted if needed and
+  //        <flags> must describe it. See slaveEncode().
+  //
+  // id       - channel id where to send data (IN).
+  // buf      - buffer to send (IN).
+  // size     - size of buf[] buffer in bytes (IN).
+  // flags    - combination of IOMIXER_FLAG_XXX flags (IN).
+  // coalesce - 1 if packet may be queued, 0 to write it at once (IN/OPT).
+  // tail     - extra bytes sent just after buf[], e.g. authentication tag (IN/OPT).
+  // tailSize - size of tail[] buffer in bytes (IN/OPT).
   //
   // RETURNS: 0 if OK.
   //
 
-  int IOMixer::masterEncode(int id, void *buf, int size, uint8_t flags)
+  int IOMixer::masterEncode(int id, void *buf, int size, uint8_t flags,
+                                int coalesce, void *tail, int tailSize)
   {
     DBG_ENTER5("IOMixer::masterEncode");
 
     int exitCode = -1;
 
-    int packetSize;
-
-    struct Packet
-    {
-      int32_t channelId_;
-      uint8_t flags_;
-      int32_t dataSize_;
-
-      char data_[1];
-    }
-    __attribute__((__packed__));
-
-    if (zlibLoaded_)
-    {
-      packetSize = zlibCompressBound_(size) + sizeof(Packet);
-    }
-    else
-    {
-      packetSize = size + sizeof(Packet);
-    }
+    IOMixerPacketHead head;
 
-    Packet *packet = (Packet *) malloc(packetSize);
+    IOVec iov[4];
 
     DEBUG4("IOMixer::masterEncode : Going to write [%d] bytes from slave ID [%d]"
               " to master [%d].\n", size, id, masterOut_);
@@ -1176,50 +1512,122 @@ namespace Tegenaria
     masterMutex_.lock();
 
     //
-    // Generate <id><flags><size><data> packet.
+    // Generate <id><flags><size> head.
     //
 
-    packet -> channelId_ = id;
-    packet -> flags_     = flags;
-    packet -> dataSize_  = size;
+    head.channelId_ = id;
+    head.flags_     = flags;
+    head.dataSize_  = size;
 
     //
-    // Compression enabled.
+    // EOF packet has no <data> to decode.
     //
 
-    if (size > 256 && flags & IOMIXER_FLAG_COMPRESSION_ON && zlibLoaded_)
+    if (size <= 0)
     {
-      int compSize = packetSize - sizeof(Packet);
-
-      int ret = zlibCompress_(packet -> data_, &compSize, buf, size);
-
-      FAILEX(ret != 0, "ERROR: Compression failed with code [%d].\n", ret);
-
-      packet -> dataSize_ = compSize;
+      head.flags_ &= ~(IOMIXER_FLAG_COMPRESSION_ON |
+                           IOMIXER_FLAG_CODEC_MASK |
+                               IOMIXER_FLAG_ENCRYPTION_ON);
 
-      DEBUG5("IOMixer::masterEncode : Compressed [%d] bytes into [%d] (ratio %lf%%).\n",
-                  size, compSize, double(compSize) / double(size) * 100.0);
-
-      size = compSize;
+      tailSize = 0;
     }
-
-    //
-    // Raw data.
-    //
-
-    else if (size > 0)
+    else
     {
-      packet -> flags_ &= ~IOMIXER_FLAG_COMPRESSION_ON;
-
-      memcpy(packet -> data_, buf, size);
+      head.dataSize_ += tailSize;
     }
 
     //
-    // Write <id><size> prefix.
+    // Write coalescing enabled and packet is small enough.
+    // Append <id><flags><size><data> to send queue.
     //
 
-    FAIL(masterWrite(packet, size + 9));
-
+    if (coalesce && size > 0 && sendQueueSize_ > 0 &&
+            int(sizeof(head)) + size + tailSize <= sendQueueSize_)
+    {
+      //
+      // Byte budget exceeded. Write pending packets first.
+      //
+
+      if (sendQueueLen_ + int(sizeof(head)) + size + tailSize > sendQueueSize_)
+      {
+        FAIL(masterFlushQueue());
+      }
+
+      memcpy(sendQueue_ + sendQueueLen_, &head, sizeof(head));
+      memcpy(sendQueue_ + sendQueueLen_ + sizeof(head), buf, size);
+
+      if (tailSize > 0)
+      {
+        memcpy(sendQueue_ + sendQueueLen_ + sizeof(head) + size, tail, tailSize);
+      }
+
+      sendQueueLen_ += sizeof(head) + size + tailSize;
+
+      sendQueueFrames_ ++;
+
+      //
+      // Threads mode. First packet queued schedules flush on flusher
+      // thread, which writes everything collected in the meantime when
+      // latency budget expires. Caller doesn't wait for it.
+      //
+      // Reactor mode. Queue is flushed by reactor loop at the end of
+      // every epoll_wait() batch.
+      //
+
+      if (mode_ == IOMIXER_MODE_THREADS && sendQueueFlusher_ == 0 && sendQueueThread_)
+      {
+        sendQueueFlusher_ = 1;
+
+        sendQueueSem_.signal();
+      }
+    }
+
+    //
+    // Write pending packets from send queue (if any), then
+    // <id><flags><size> head and <data> at once.
+    //
+
+    else
+    {
+      int count = 0;
+
+      if (sendQueueLen_ > 0)
+      {
+        iov[count].iov_base = sendQueue_;
+        iov[count].iov_len  = sendQueueLen_;
+
+        count ++;
+      }
+
+      iov[count].iov_base = &head;
+      iov[count].iov_len  = sizeof(head);
+
+      count ++;
+
+      if (size > 0)
+      {
+        iov[count].iov_base = buf;
+        iov[count].iov_len  = size;
+
+        count ++;
+      }
+
+      if (tailSize > 0)
+      {
+        iov[count].iov_base = tail;
+        iov[count].iov_len  = tailSize;
+
+        count ++;
+      }
+
+      statFrames_ += sendQueueFrames_ + 1;
+
+      sendQueueLen_    = 0;
+      sendQueueFrames_ = 0;
+
+      FAIL(masterWritev(iov, count));
+    }
+
     //
     // If <size> greater than zero write <size> bytes of <data>.
     //
@@ -1250,11 +1658,6 @@ namespace Tegenaria
 
     masterMutex_.unlock();
 
-    if (packet)
-    {
-      free(packet);
-    }
-
     DBG_LEAVE5("IOMixer::masterEncode");
 
     return exitCode;
@@ -1277,24 +1680,39 @@ namespace Tegenaria
 
     int exitCode = -1;
 
-    uint8_t flags;
+    IOMixerPacketHead head;
 
     //
-    // Read <id><flags><size> head.
+    // Read <id><flags><size> head at once.
+    // Drop plain packets sent to encrypted channel, they can't be
+    // authenticated.
     //
 
-    FAIL(masterRead(id, 4));
-    FAIL(masterRead(&flags, 1));
-    FAIL(masterRead(size, 4));
+    for (;;)
+    {
+      FAIL(masterRead(&head, sizeof(head)));
 
-    DEBUG3("IOMixer::masterDecode : Readed <%d><%d><%d> head"
-                " from master [%d].", *id, (int) flags, *size, masterIn_);
+      if ((head.flags_ & IOMIXER_FLAG_ENCRYPTION_ON) || cipherRequired(head.channelId_) == 0)
+      {
+        break;
+      }
 
-    //
-    // Fail if data[] too small to store whole <DATA>.
-    //
+      Error("ERROR: Dropped unencrypted packet for encrypted channel ID#%d.\n",
+                head.channelId_);
 
-    FAILEX(dataSize < *size, "ERROR: Packet too big.\n");
+      if (head.dataSize_ > 0)
+      {
+        FAILEX(dataSize < head.dataSize_, "ERROR: Packet too big.\n");
+
+        FAIL(masterRead(data, head.dataSize_));
+      }
+    }
+
+    *id   = head.channelId_;
+    *size = head.dataSize_;
+
+    DEBUG3("IOMixer::masterDecode : Readed <%d><%d><%d> head"
+                " from master [%d].", *id, (int) head.flags_, *size, masterIn_);
 
     //
     // If <size> greater than 0 read <size> bytes of <data>.
@@ -1303,50 +1721,85 @@ namespace Tegenaria
     if (*size > 0)
     {
       //
-      // Incoming data compressed.
+      // Incoming data compressed or encrypted.
       //
 
-      if (flags & IOMIXER_FLAG_COMPRESSION_ON)
+      if (head.flags_ & (IOMIXER_FLAG_COMPRESSION_ON | IOMIXER_FLAG_ENCRYPTION_ON))
       {
-        unsigned char *compData = (unsigned char *) malloc(*size);
+        int packetSize = *size;
+
+        //
+        // Compressed data can be a little bigger than original.
+        // Allocate work buffer once and reuse it for next packets.
+        // Two max packets is more than worst case of every codec.
+        //
 
-        int compSize = *size;
+        if (decodeBuf_ == NULL)
+        {
+          decodeBufSize_ = IOMIXER_MAX_PACKET * 2;
+
+          decodeBuf_ = (char *) malloc(decodeBufSize_);
+
+          FAILEX(decodeBuf_ == NULL, "ERROR: Out of memory.\n");
+        }
+
+        FAILEX(decodeBufSize_ < packetSize, "ERROR: Packet too big.\n");
 
         //
-        // Read compressed data.
+        // Read whole packet into work buffer.
         //
 
-        if (masterRead(compData, *size) != 0)
+        FAIL(masterRead(decodeBuf_, packetSize));
+
+        //
+        // Verify and decrypt in place. Packet, which can't be
+        // authenticated closes its channel like EOF.
+        //
+
+        if (head.flags_ & IOMIXER_FLAG_ENCRYPTION_ON)
         {
-          free(compData);
+          packetSize = cipherDecrypt(*id, decodeBuf_, packetSize);
+        }
 
-          goto fail;
+        if (packetSize <= 0)
+        {
+          *size = 0;
         }
 
         //
         // Decompress into caller buffer.
         //
 
-        if (zlibLoaded_)
+        else if (head.flags_ & IOMIXER_FLAG_COMPRESSION_ON)
         {
-          *size = dataSize;
+          *size = codecDecode(*id, head.flags_, decodeBuf_, packetSize, data, dataSize);
 
-          zlibUncompress_(data, size, compData, compSize);
+          FAIL(*size < 0);
         }
+
+        //
+        // Encrypted only. Copy plain data into caller buffer.
+        //
+
         else
         {
-          Error("ERROR: ZLib not available, but compressed data received.\n");
+          FAILEX(dataSize < packetSize, "ERROR: Packet too big.\n");
 
-          goto fail;
+          memcpy(data, decodeBuf_, packetSize);
+
+          *size = packetSize;
         }
       }
 
       //
       // Incoming data are uncompressed.
+      // Read directly into caller buffer.
       //
 
       else
       {
+        FAILEX(dataSize < *size, "ERROR: Packet too big.\n");
+
         FAIL(masterRead(data, *size));
       }
 
@@ -1523,6 +1976,211 @@ namespace Tegenaria
     return exitCode;
   }
 
+  //
+  // Atomic write many buffers to master OUT in one scatter/gather call.
+  //
+  // Uses sendmsg() for socket and writev() for CRT FD, so packet head
+  // and <data> doesn't need to be copied into one continuous buffer.
+  // Falls back to masterWrite() for every buffer, where scatter/gather
+  // is not available (callback master, Windows).
+  //
+  // WARNING: iov[] table is changed in place if partial write occured.
+  //
+  // iov   - table of buffers to write (IN/OUT).
+  // count - number of elements in iov[] table (IN).
+  //
+  // RETURNS: 0 if all data written
+  //         -1 if otherwise.
+  //
+
+  int IOMixer::masterWritev(IOVec *iov, int count)
+  {
+    DBG_ENTER5("IOMixer::masterWritev");
+
+    int exitCode = -1;
+
+    int written = -1;
+
+    //
+    // Reject if already sent master EOF to remote.
+    //
+
+    if (masterEofSent_)
+    {
+      DEBUG3("Master EOF already sent - write rejected.\n");
+    }
+
+    //
+    // Linux, MacOS. Socket or CRT FD.
+    //
+
+    #ifndef WIN32
+    else if (masterOutType_ == IOMIXER_TYPE_SOCKET ||
+                 masterOutType_ == IOMIXER_TYPE_FD)
+    {
+      while(count > 0)
+      {
+        if (masterOutType_ == IOMIXER_TYPE_SOCKET)
+        {
+          struct msghdr msg = {0};
+
+          msg.msg_iov    = iov;
+          msg.msg_iovlen = count;
+
+          written = sendmsg(masterOut_, &msg, 0);
+        }
+        else
+        {
+          written = writev(masterOut_, iov, count);
+        }
+
+        statWrites_ ++;
+
+        FAIL(written <= 0);
+
+        DBG_DUMP(iov[0].iov_base, min(int(iov[0].iov_len), written));
+
+        //
+        // Skip buffers written in whole and move into the middle
+        // of partially written one.
+        //
+
+        while(count > 0 && size_t(written) >= iov[0].iov_len)
+        {
+          written -= iov[0].iov_len;
+
+          iov ++;
+          count --;
+        }
+
+        if (count > 0)
+        {
+          iov[0].iov_base  = (char *) iov[0].iov_base + written;
+          iov[0].iov_len  -= written;
+        }
+      }
+    }
+    #endif
+
+    //
+    // Scatter/gather not available. Write buffers one by one.
+    //
+
+    else
+    {
+      for (int i = 0; i < count; i++)
+      {
+        FAIL(masterWrite(iov[i].iov_base, iov[i].iov_len));
+
+        statWrites_ ++;
+      }
+    }
+
+    exitCode = 0;
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    if (exitCode && quietMode_ == 0)
+    {
+      Error("ERROR: Cannot write to master OUT.\n"
+                "Error code is : %d.\n", GetLastError());
+    }
+
+    DBG_LEAVE5("IOMixer::masterWritev");
+
+    return exitCode;
+  }
+
+  //
+  // Thread routine to flush send queue when latency budget expires.
+  // Used internally in threads mode only. See setWriteCoalescing().
+  //
+  // Woken up by masterEncode() when first packet is queued. Sleeps
+  // <sendQueueDelay_> us and writes everything queued in the meantime.
+  // Queue could be already written by someone else in the meantime, then
+  // there is nothing to do.
+  //
+  // this_ - pointer to related IOMixer object (IN/OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::masterFlushLoop(IOMixer *this_)
+  {
+    DBG_ENTER("IOMixer::masterFlushLoop");
+
+    for (;;)
+    {
+      this_ -> sendQueueSem_.wait();
+
+      if (this_ -> sendQueueStop_)
+      {
+        break;
+      }
+
+      ThreadSleepUs(this_ -> sendQueueDelay_);
+
+      this_ -> masterMutex_.lock();
+
+      this_ -> sendQueueFlusher_ = 0;
+
+      if (this_ -> masterFlushQueue() && this_ -> quietMode_ == 0)
+      {
+        Error("ERROR: Cannot flush send queue to master OUT [%d].\n",
+                  this_ -> masterOut_);
+      }
+
+      this_ -> masterMutex_.unlock();
+    }
+
+    DBG_LEAVE("IOMixer::masterFlushLoop");
+
+    return 0;
+  }
+
+  //
+  // Write all packets collected in send queue to master OUT in one call.
+  // See setWriteCoalescing().
+  //
+  // WARNING: Caller MUST hold masterMutex_.
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::masterFlushQueue()
+  {
+    int exitCode = -1;
+
+    IOVec iov;
+
+    if (sendQueueLen_ > 0)
+    {
+      DEBUG4("IOMixer::masterFlushQueue : Writing [%d] queued packets"
+                 " ([%d] bytes) to master [%d].\n",
+                     sendQueueFrames_, sendQueueLen_, masterOut_);
+
+      iov.iov_base = sendQueue_;
+      iov.iov_len  = sendQueueLen_;
+
+      statFrames_ += sendQueueFrames_;
+
+      sendQueueLen_    = 0;
+      sendQueueFrames_ = 0;
+
+      FAIL(masterWritev(&iov, 1));
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
   //
   // Atomic read <size> bytes from master IN to <buf>.
   //
@@ -1701,7 +2359,6 @@ namespace Tegenaria
   int IOMixer::slaveWrite(int id, void *buf, int size)
   {
     int exitCode = -1;
-    int written  = -1;
 
     //
     // Search for slave with given ID.
@@ -1721,16 +2378,7 @@ namespace Tegenaria
       }
       else
       {
-        slave -> writeMutex_.lock();
-
-        DEBUG4("IOMixer::slaveWrite : Writing [%d] bytes to slave FD [%d]"
-                    " ID [%d]...\n", size, slave -> fdout_, id);
-
-        written = write(slave -> fdout_, buf, size);
-
-        slave -> writeMutex_.unlock();
-
-        FAIL(written != size);
+        FAIL(slaveDeliver(slave, buf, size));
       }
     }
 
@@ -1786,11 +2434,10 @@ namespace Tegenaria
 
     for (it = slaves_.begin(); it != slaves_.end(); it++)
     {
-      int id = it -> second -> id_;
+      DEBUG4("IOMixer::shutdown : Sending EOF on channel ID#%d...\n",
+                 it -> second -> id_);
 
-      DEBUG4("IOMixer::shutdown : Sending EOF on channel ID#%d...\n", id);
-
-      masterEncode(id, NULL, 0, 0);
+      slaveEncodeEof(it -> second);
 
       it -> second -> eofSent_ = 1;
     }
@@ -1872,6 +2519,8 @@ namespace Tegenaria
 
     map<int, IOMixerSlave *>::iterator it;
 
+    vector<int> deadIds;
+
     //
     // Join slave threads.
     //
@@ -1880,10 +2529,24 @@ namespace Tegenaria
 
     for (it = slaves_.begin(); it != slaves_.end(); it++)
     {
-      IOMixerSlave *sl = slaves_.begin() -> second;
+      IOMixerSlave *sl = it -> second;
 
       DEBUG4("IOMixer::flush : flushing slave ID#%d...\n", sl -> id_);
 
+      //
+      // Reactor mode. There is no slave thread to join.
+      // Detach slave from its loop, EOF is sent below.
+      //
+
+      if (sl -> loop_ != -1)
+      {
+        reactorDetachSlave(sl);
+
+        deadIds.push_back(sl -> id_);
+
+        continue;
+      }
+
       #ifdef WIN32
       {
         SetEvent(sl -> cancelEvent_);
@@ -1904,8 +2567,40 @@ namespace Tegenaria
       }
     }
 
+    //
+    // Wait until reactor loops released detached slaves and send EOF to
+    // remote in the same way as slaveLoop() does when read is canceled.
+    // Waiting releases slavesMutex_, so it's done after iterating over
+    // slaves_ map.
+    //
+
+    for (int i = 0; i < int(deadIds.size()); i++)
+    {
+      IOMixerSlave *sl = reactorWaitSlave(deadIds[i]);
+
+      if (sl && sl -> eofSent_ == 0)
+      {
+        slaveEncodeEof(sl);
+
+        sl -> eofSent_ = 1;
+      }
+    }
+
     slavesMutex_.unlock();
 
+    //
+    // Tell caller about slaves detached from reactor.
+    // Called outside lock, because callback may call removeSlave().
+    //
+
+    if (slaveDeadCallback_)
+    {
+      for (int i = 0; i < int(deadIds.size()); i++)
+      {
+        slaveDeadCallback_(deadIds[i], slaveDeadCallbackCtx_);
+      }
+    }
+
     DBG_LEAVE("IOMixer::flush");
 
     return 0;
@@ -1965,32 +2660,61 @@ namespace Tegenaria
   // channel. After that outcoming data on this channel will be
   // compressed/uncompressed.
   //
-  // id      - slave ID to change (IN).
-  // enabled - set to 1 to enable compression, 0 to disable (IN).
+  // Codec other than IOCODEC_ZLIB is used only if remote announced it
+  // in HELLO packet. Otherwise one-shot zlib is used. IOCODEC_ZLIB is
+  // upgraded to IOCODEC_ZLIB_STREAM automatically if remote supports it.
+  //
+  // id    - slave ID to change (IN).
+  //
+  // mode  - IOMIXER_COMPRESSION_ON to enable compression,
+  //         IOMIXER_COMPRESSION_OFF to disable it or
+  //         IOMIXER_COMPRESSION_ADAPTIVE to enable compression, but
+  //         send data raw as long as they don't compress (IN).
+  //
+  // codec - one of IOCODEC_XXX defines (IN/OPT).
   //
   // RETURNS: 0 if OK.
   //
 
-  int IOMixer::setSlaveCompression(int id, int enabled)
+  int IOMixer::setSlaveCompression(int id, int mode, int codec)
   {
     int exitCode = -1;
 
-    IOMixerSlave *slave = getSlave(id);
+    IOMixerSlave *slave = NULL;
+
+    slavesMutex_.lock();
+
+    slave = getSlave(id);
 
     FAILEX(slave == NULL, "ERROR: Incorrect slave ID#%d.\n", id);
 
-    FAILEX(zlibCompress_ == NULL, "ERROR: ZLib library not available.\n");
+    FAILEX(codec < 0 || codec > IOCODEC_MAX,
+               "ERROR: Unknown codec [%d].\n", codec);
 
-    if (enabled)
+    if (mode != IOMIXER_COMPRESSION_OFF)
     {
+      FAILEX(IOCodecIsAvailable(codec) == 0,
+                 "ERROR: Codec '%s' not available.\n", IOCodecName(codec));
+
+      slave -> codec_       = codec;
+      slave -> compression_ = mode;
+      slave -> compMisses_  = 0;
+      slave -> compSkip_    = 0;
+      slave -> compBackoff_ = 0;
+
       slave -> flags_ |= IOMIXER_FLAG_COMPRESSION_ON;
+
+      DEBUG1("IOMixer : Enabled %s compression on channel #%d (mode %d).\n",
+                 IOCodecName(codec), id, mode);
     }
     else
     {
+      slave -> compression_ = IOMIXER_COMPRESSION_OFF;
+
       slave -> flags_ &= ~IOMIXER_FLAG_COMPRESSION_ON;
-    }
 
-    DEBUG1("IOMixer : Enabled compression on channel #%d.\n.", id);
+      DEBUG1("IOMixer : Disabled compression on channel #%d.\n", id);
+    }
 
     //
     // Error handler.
@@ -2000,6 +2724,8 @@ namespace Tegenaria
 
     fail:
 
+    slavesMutex_.unlock();
+
     if (exitCode)
     {
       Error("ERROR: Cannot enable commpression on channel #%d.\n", id);
@@ -2009,53 +2735,274 @@ namespace Tegenaria
   }
 
   //
-  // Initialize ZLib library.
-  // Called internally only.
+  // Enable or disable write coalescing on master OUT.
+  //
+  // If enabled, small packets from many slaves are collected in one
+  // send queue and written to master OUT in one call, when:
+  //
+  // - queue reached <maxBytes> bytes OR
+  // - <maxDelayUs> microseconds elapsed since first packet was queued OR
+  // - non-queued packet (e.g. EOF) must be written to master OUT.
+  //
+  // In threads mode expired queue is written by extra flusher thread
+  // created here, so slaves never wait for latency budget.
+  //
+  // In reactor mode queue is also flushed at the end of every reactor
+  // loop iteration, so <maxDelayUs> is not used there.
+  //
+  // Packets greater than <maxBytes> are written directly.
+  // Latency sensitive slaves can opt out by setSlaveCoalescing().
+  //
+  // Disabled by default.
+  //
+  // maxBytes   - byte budget of send queue, e.g. 64KB.
+  //              Set to 0 to disable coalescing (IN).
+  //
+  // maxDelayUs - latency budget in microseconds, e.g. 200 (IN).
   //
   // RETURNS: 0 if OK.
   //
 
-  int IOMixer::initZLib()
+  int IOMixer::setWriteCoalescing(int maxBytes, int maxDelayUs)
   {
     int exitCode = -1;
 
-    #ifdef WIN32
+    char *newQueue = NULL;
+
+    FAILEX(maxBytes < 0, "ERROR: Wrong byte budget [%d].\n", maxBytes);
+    FAILEX(maxDelayUs < 0, "ERROR: Wrong latency budget [%d].\n", maxDelayUs);
+
+    if (maxBytes > 0)
     {
-      zlib_ = LoadLibrary("z.dll");
+      maxBytes = max(maxBytes, int(sizeof(IOMixerPacketHead)) + 1);
+    }
 
-      zlibCompress_      = (ZLibCompressProto) GetProcAddress(zlib_, "compress");
-      zlibUncompress_    = (ZLibUncompressProto) GetProcAddress(zlib_, "uncompress");
-      zlibCompressBound_ = (ZLibCompressBoundProto) GetProcAddress(zlib_, "compressBound");
+    masterMutex_.lock();
 
+    //
+    // Write already queued packets before we change the queue.
+    //
+
+    masterFlushQueue();
+
+    if (maxBytes > 0)
+    {
+      newQueue = (char *) realloc(sendQueue_, maxBytes);
     }
-    #else
+    else
+    {
+      free(sendQueue_);
+    }
+
+    if (maxBytes > 0 && newQueue == NULL)
     {
-      zlib_ = dlopen("libz.so", RTLD_LAZY);
+      masterMutex_.unlock();
 
-      zlibCompress_      = (ZLibCompressProto) dlsym(zlib_, "compress");
-      zlibUncompress_    = (ZLibUncompressProto) dlsym(zlib_, "uncompress");
-      zlibCompressBound_ = (ZLibCompressBoundProto) dlsym(zlib_, "compressBound");
+      FAILEX(1, "ERROR: Out of memory.\n");
     }
-    #endif
 
-    if (zlib_ && zlibCompress_ && zlibUncompress_ && zlibCompressBound_)
+    sendQueue_      = newQueue;
+    sendQueueSize_  = maxBytes;
+    sendQueueDelay_ = maxDelayUs;
+
+    //
+    // Start flusher thread on first use. It's left idle if coalescing
+    // is disabled later.
+    //
+
+    if (maxBytes > 0 && sendQueueThread_ == NULL)
     {
-      zlibLoaded_ = 1;
+      sendQueueThread_ = ThreadCreate((ThreadEntryProto) masterFlushLoop, this);
+
+      DBG_SET_RENAME("thread", sendQueueThread_, "IOMixer::masterFlushLoop");
+    }
+
+    masterMutex_.unlock();
+
+    FAILEX(maxBytes > 0 && sendQueueThread_ == NULL,
+               "ERROR: Cannot create send queue flusher thread.\n");
+
+    DEBUG1("IOMixer : Write coalescing set to [%d] bytes, [%d] us.\n",
+               maxBytes, maxDelayUs);
 
-      exitCode = 0;
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
 
-      DEBUG1("IOMixer::IOMixer : ZLib loaded.\n");
+    if (exitCode)
+    {
+      Error("ERROR: Cannot set write coalescing.\n");
     }
-    else
+
+    return exitCode;
+  }
+
+  //
+  // Enable or disable write coalescing for one slave.
+  // Packets from slave with coalescing disabled are written to master OUT
+  // immediately (together with packets already queued by other slaves).
+  //
+  // Coalescing is enabled on every slave by default, but it does nothing
+  // until enabled on whole IOMixer by setWriteCoalescing().
+  //
+  // id      - slave ID (IN).
+  // enabled - 1 to allow coalescing, 0 for latency sensitive slave (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::setSlaveCoalescing(int id, int enabled)
+  {
+    int exitCode = -1;
+
+    IOMixerSlave *slave = NULL;
+
+    slavesMutex_.lock();
+
+    slave = getSlave(id);
+
+    FAILEX(slave == NULL, "ERROR: Incorrect slave ID#%d.\n", id);
+
+    slave -> coalesce_ = enabled ? 1 : 0;
+
+    DEBUG1("IOMixer : Write coalescing on channel #%d set to [%d].\n", id, enabled);
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    slavesMutex_.unlock();
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot set write coalescing on channel #%d.\n", id);
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Retrieve master OUT write statistics.
+  //
+  // frames         - number of packets written to master OUT so far (OUT/OPT).
+  // writes         - number of write calls (syscalls) used to write
+  //                  them (OUT/OPT).
+  // framesPerWrite - average number of packets per one write call (OUT/OPT).
+  //
+
+  void IOMixer::getWriteStats(uint64_t *frames, uint64_t *writes, double *framesPerWrite)
+  {
+    masterMutex_.lock();
+
+    if (frames)
     {
-      zlibLoaded_ = 0;
+      *frames = statFrames_;
+    }
+
+    if (writes)
+    {
+      *writes = statWrites_;
+    }
+
+    if (framesPerWrite)
+    {
+      *framesPerWrite = statWrites_ ? double(statFrames_) / double(statWrites_) : 0.0;
+    }
+
+    masterMutex_.unlock();
+  }
+
+  //
+  // Enable authenticated encryption on selected channel.
+  // After that outcoming data on this channel are encrypted and
+  // incoming data MUST be encrypted by the same key on remote side.
+  //
+  // WARNING: Must be called on both sides before any data is sent on
+  //          the channel. Cipher can't be changed later.
+  //
+  // TIP#1: Data is compressed first (if enabled), then encrypted.
+  //
+  // TIP#2: Encryption is done in slave context, so many channels are
+  //        encrypted in parallel.
+  //
+  // TIP#3: Channel is closed like on EOF if incoming packet can't be
+  //        authenticated.
+  //
+  // TIP#4: EOF is authenticated too. Unencrypted packets (data or EOF)
+  //        received on encrypted channel are dropped.
+  //
+  // id     - slave ID to change (IN).
+  // cipher - cipher object e.g. created by SecureMixerCipherCreate(),
+  //          IOMixer takes ownership and frees it with slave (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::setSlaveEncryption(int id, IOCipher *cipher)
+  {
+    int exitCode = -1;
+
+    IOMixerSlave *slave = NULL;
+
+    slavesMutex_.lock();
+
+    slave = getSlave(id);
+
+    FAILEX(slave == NULL, "ERROR: Incorrect slave ID#%d.\n", id);
+    FAILEX(cipher == NULL, "ERROR: Cipher cannot be NULL.\n");
+    FAILEX(slave -> cipher_ != NULL, "ERROR: Encryption already enabled on channel #%d.\n", id);
+
+    FAILEX(cipher -> tagSize() < 0 || cipher -> tagSize() > IOMIXER_MAX_TAG,
+               "ERROR: Authentication tag too long.\n");
+
+    slave -> cipher_ = cipher;
+
+    slave -> flags_ |= IOMIXER_FLAG_ENCRYPTION_ON;
 
-      DEBUG1("WARNING: Cannot to load ZLib library. Compression not available.\n");
+    DEBUG1("IOMixer : Enabled encryption on channel #%d.\n", id);
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    slavesMutex_.unlock();
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot enable encryption on channel #%d.\n", id);
     }
 
     return exitCode;
   }
 
+  //
+  // Initialize ZLib library.
+  // Called internally only.
+  //
+  // Library is loaded once per process by IOCodec.cpp.
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::initZLib()
+  {
+    zlibLoaded_ = IOCodecIsAvailable(IOCODEC_ZLIB);
+
+    return zlibLoaded_ ? 0 : -1;
+  }
+
   //
   // Get object name generated in constructor.
   //
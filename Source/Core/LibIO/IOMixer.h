@@ -27,6 +27,27 @@
 
 #define IOMIXER_MAX_PACKET (1024 * 64)
 
+//
+// Maximum size of authentication tag appended to encrypted packets.
+//
+
+#define IOMIXER_MAX_TAG 32
+
+//
+// Maximum number of epoll events processed in one reactor loop iteration.
+//
+
+#define IOMIXER_REACTOR_MAX_EVENTS 64
+
+//
+// Reactor mode is epoll based, so it's available on Linux only.
+// Other systems stay in IOMIXER_MODE_THREADS, see setReactorMode().
+//
+
+#ifdef __linux__
+# define IOMIXER_HAVE_REACTOR
+#endif
+
 #ifdef WIN32
 # include <Winsock2.h>
 # include <windows.h>
@@ -35,6 +56,11 @@
 # include <unistd.h>
 # include <sys/socket.h>
 # include <dlfcn.h>
+# ifdef IOMIXER_HAVE_REACTOR
+#  include <sys/epoll.h>
+# endif
+# include <sys/uio.h>
+# include <errno.h>
 #endif
 
 #include <cstdio>
@@ -42,15 +68,21 @@
 #include <fcntl.h>
 #include <cstring>
 #include <set>
+#include <vector>
 
 #include <Tegenaria/Debug.h>
 #include <Tegenaria/Mutex.h>
+#include <Tegenaria/Semaphore.h>
 #include <Tegenaria/Thread.h>
 
+#include "IOFifo.h"
+#include "IOCodec.h"
+
 namespace Tegenaria
 {
   using std::map;
   using std::set;
+  using std::vector;
   using std::min;
   using std::max;
 
@@ -62,6 +94,53 @@ namespace Tegenaria
   #define IOMIXER_FLAG_COMPRESSION_ON (1 << 0)
   #define IOMIXER_FLAG_ENCRYPTION_ON  (1 << 1)
 
+  //
+  // IOCODEC_XXX codec used to compress packet, valid if
+  // IOMIXER_FLAG_COMPRESSION_ON is set. Zero means one-shot zlib, so
+  // packets from old peers are decoded in the old way.
+  //
+
+  #define IOMIXER_FLAG_CODEC_SHIFT 2
+  #define IOMIXER_FLAG_CODEC_MASK  (3 << IOMIXER_FLAG_CODEC_SHIFT)
+
+  //
+  // Compression modes. See IOMixer::setSlaveCompression().
+  //
+
+  #define IOMIXER_COMPRESSION_OFF      0
+  #define IOMIXER_COMPRESSION_ON       1
+  #define IOMIXER_COMPRESSION_ADAPTIVE 2
+
+  //
+  // I/O engines. See IOMixer::setReactorMode().
+  //
+
+  #define IOMIXER_MODE_THREADS 0
+  #define IOMIXER_MODE_REACTOR 1
+
+  //
+  // Control packets sent on channel #0 with <size> greater than zero.
+  // Old peers silently drop them, so they're used to negotiate
+  // optional protocol features. See IOMixerFlow.cpp.
+  //
+
+  #define IOMIXER_CONTROL_HELLO  1
+  #define IOMIXER_CONTROL_WINDOW 2
+
+  //
+  // Capabilities announced in IOMIXER_CONTROL_HELLO packet.
+  //
+
+  #define IOMIXER_CAPS_FLOW_CONTROL (1 << 0)
+  #define IOMIXER_CAPS_ZLIB_STREAM  (1 << 1)
+  #define IOMIXER_CAPS_LZ4          (1 << 2)
+
+  //
+  // Default per-slave receive window used by setFlowControl().
+  //
+
+  #define IOMIXER_DEFAULT_WINDOW (1024 * 256)
+
   //
   // Typedef.
   //
@@ -72,16 +151,50 @@ namespace Tegenaria
   typedef void (*IOSlaveDeadProto)(int id, void *ctx);
 
   //
-  // ZLib typedefs.
+  // Scatter/gather buffer used to write many buffers at once.
+  // Binary compatible with system iovec on Linux.
+  //
+
+  #ifdef WIN32
+  struct IOVec
+  {
+    void *iov_base;
+    size_t iov_len;
+  };
+  #else
+  typedef struct iovec IOVec;
+  #endif
+
+  //
+  // Head of every packet sent over master: <id><flags><size>.
+  // <size> bytes of <data> follows the head.
   //
 
-  typedef int (*ZLibCompressProto)(void *dest, int *destLen,
-                                       const void *source, int sourceLen);
+  struct IOMixerPacketHead
+  {
+    int32_t channelId_;
+    uint8_t flags_;
+    int32_t dataSize_;
+  }
+  __attribute__((__packed__));
 
-  typedef int (*ZLibUncompressProto)(void *dest, int *destLen,
-                                         const void *source, int sourceLen);
+  //
+  // <data> of control packet sent on channel #0.
+  // See IOMIXER_CONTROL_XXX defines.
+  //
+  // HELLO  : caps_ = IOMIXER_CAPS_XXX mask, value_ = receive window.
+  // WINDOW : value_ = total number of bytes passed to slave <channelId_>
+  //          since it was created.
+  //
 
-  typedef int (*ZLibCompressBoundProto)(int sourceLen);
+  struct IOMixerControl
+  {
+    uint8_t type_;
+    uint32_t caps_;
+    int32_t channelId_;
+    uint32_t value_;
+  }
+  __attribute__((__packed__));
 
   //
   // Forward declarations.
@@ -180,6 +293,118 @@ namespace Tegenaria
 
     ThreadHandle_t *thread_;
 
+    //
+    // Index of reactor loop serving this slave or -1 if slave is not
+    // attached to any reactor loop (IOMIXER_MODE_THREADS or detached).
+    //
+
+    int loop_;
+
+    //
+    // Set to 1 while reactor loop is processing data read from this slave.
+    // Set under IOMixer::slavesMutex_, cleared by reactorReleaseSlave().
+    //
+
+    volatile int busy_;
+
+    //
+    // Set to 0 to write packets from this slave to master OUT immediately
+    // even if write coalescing is enabled.
+    // See IOMixer::setSlaveCoalescing().
+    //
+
+    int coalesce_;
+
+    //
+    // Flow control. See IOMixerFlow.cpp.
+    //
+    // txSent_  - total number of <data> bytes sent to remote slave.
+    // txAcked_ - total number of bytes passed to remote slave, as
+    //            announced by remote in last WINDOW packet.
+    // rxDone_  - total number of bytes written to fdout_.
+    // rxAcked_ - rxDone_ value sent to remote in last WINDOW packet.
+    //
+    // Counters wrap around, only differences are meaningful.
+    //
+
+    volatile uint32_t txSent_;
+    volatile uint32_t txAcked_;
+    volatile uint32_t rxDone_;
+    volatile uint32_t rxAcked_;
+
+    //
+    // Data received from master, which could not be written to fdout_
+    // without blocking. Bounded by receive window.
+    // Protected by writeMutex_.
+    //
+
+    IOFifo *rxQueue_;
+
+    //
+    // Set to 1 while slave thread or reactor loop is able to write
+    // queued data to fdout_ when it becomes writable. Otherwise data
+    // from master is written in blocking mode.
+    //
+
+    int rxAsync_;
+
+    //
+    // Reactor mode only. inputClosed_ is set if EOF was read from fdin_,
+    // but rxQueue_ is still not empty. events_ are EPOLLIN/EPOLLOUT
+    // events currently watched by reactor loop.
+    //
+
+    int inputClosed_;
+    int events_;
+
+    //
+    // Compression. See IOMixer::setSlaveCompression().
+    //
+    // codec_       - IOCODEC_XXX codec requested by caller.
+    // compression_ - IOMIXER_COMPRESSION_XXX mode.
+    // encoder_     - encoder context, created on first compressed packet.
+    // encodeBuf_   - compressed <data> to send, allocated once.
+    //
+    // Used by slave thread or reactor loop serving slave only.
+    //
+
+    int codec_;
+    int compression_;
+
+    IOCodec *encoder_;
+
+    char *encodeBuf_;
+
+    int encodeBufSize_;
+
+    //
+    // Adaptive mode state.
+    //
+    // compMisses_  - number of packets in a row, which didn't compress.
+    // compSkip_    - number of packets to send raw before next probe.
+    // compBackoff_ - compSkip_ value used after next failed probe.
+    //
+
+    int compMisses_;
+    int compSkip_;
+    int compBackoff_;
+
+    //
+    // Authenticated cipher set by IOMixer::setSlaveEncryption() or NULL.
+    // Owned by IOMixer. Protected by slavesMutex_ on receive side.
+    //
+
+    IOCipher *cipher_;
+
+    //
+    // Held from encrypt until packet is passed to masterEncode(), so
+    // packets reach master in the same order as cipher numbered them,
+    // even if EOF is sent from other thread (see slaveEncodeEof()).
+    // Used only if cipher_ is set.
+    //
+
+    Mutex encodeMutex_;
+
     //
     // Pointer to related IOMixer object.
     //
@@ -194,6 +419,36 @@ namespace Tegenaria
     uint8_t flags_;
   };
 
+  //
+  // One epoll based reactor loop. Used in IOMIXER_MODE_REACTOR only.
+  // Many slaves (and optionally master IN) share one loop thread.
+  //
+
+  struct IOMixerLoop
+  {
+    int index_;
+
+    int epollFd_;
+
+    //
+    // Pipe pair to wake up loop blocked inside epoll_wait().
+    //
+
+    int wakeupFd_[2];
+
+    volatile int stop_;
+
+    //
+    // Buffer to read slave data into. One per loop, allocated once.
+    //
+
+    char *buf_;
+
+    ThreadHandle_t *thread_;
+
+    IOMixer *this_;
+  };
+
   //
   //
   //
@@ -235,6 +490,46 @@ namespace Tegenaria
 
     ThreadHandle_t *masterThread_;
 
+    //
+    // I/O engine. See IOMIXER_MODE_XXX defines.
+    //
+
+    int mode_;
+
+    //
+    // Reactor loops created by setReactorMode().
+    //
+
+    vector<IOMixerLoop *> loops_;
+
+    //
+    // Set to 1 if master IN is dispatched by reactor loop #0 instead
+    // of dedicated master thread.
+    //
+
+    int masterReactor_;
+
+    //
+    // Threads waiting in reactorWaitSlave() until reactor loop released
+    // slave. Loop signals reactorIdleSem_ once per waiter when it clears
+    // slave's busy flag. Counter is protected by reactorIdleMutex_.
+    //
+
+    Mutex reactorIdleMutex_;
+
+    Semaphore reactorIdleSem_;
+
+    int reactorIdleWaiters_;
+
+    //
+    // Partial <id><flags><size><data> packets read by reactor from master IN.
+    //
+
+    char *masterInBuf_;
+
+    int masterInBufSize_;
+    int masterInLen_;
+
   #ifdef WIN32
     OVERLAPPED masterInOV_;
     OVERLAPPED masterOutOV_;
@@ -266,6 +561,29 @@ namespace Tegenaria
 
     static int masterLoop(IOMixer *this_);
     static int slaveLoop(IOMixerSlave *slave);
+    static int masterFlushLoop(IOMixer *this_);
+
+    //
+    // Epoll based reactor used in IOMIXER_MODE_REACTOR.
+    // Internal use only.
+    //
+
+    static int reactorLoop(IOMixerLoop *loop);
+
+    int reactorStop();
+    int reactorAttachSlave(IOMixerSlave *slave);
+    int reactorDetachSlave(IOMixerSlave *slave);
+    IOMixerSlave *reactorWaitSlave(int id);
+    void reactorReleaseSlave(IOMixerSlave *slave);
+    int reactorAttachMaster();
+    int reactorDetachMaster();
+
+    int reactorUpdateSlave(IOMixerSlave *slave);
+
+    void reactorSlaveEvent(IOMixerLoop *loop, int id);
+    void reactorSlaveOutEvent(IOMixerLoop *loop, int id);
+    void reactorSlaveFinished(IOMixerLoop *loop, int id);
+    void reactorMasterEvent();
 
     //
     // Low-level functions to read/write single
@@ -274,9 +592,19 @@ namespace Tegenaria
     // Internal use only.
     //
 
-    int masterEncode(int id, void *data, int size, uint8_t flags);
+    int masterEncode(int id, void *data, int size, uint8_t flags,
+                         int coalesce = 0, void *tail = NULL, int tailSize = 0);
     int masterDecode(int *id, int *size, void *data, int dataSize);
 
+    //
+    // Pass one decoded packet to slave with given ID or handle EOF
+    // if <size> is <= 0. Common for master thread and reactor.
+    //
+    // Internal use only.
+    //
+
+    void masterDispatch(int id, void *data, int size);
+
     //
     // Wrappers for system read/write with master FD to hide
     // differences beetwen SOCKET and CRT FD on Windows.
@@ -286,6 +614,16 @@ namespace Tegenaria
 
     int masterRead(void *buf, int size);
     int masterWrite(void *buf, int size);
+    int masterWritev(IOVec *iov, int count);
+
+    //
+    // Write packets collected in send queue to master OUT.
+    // Caller MUST hold masterMutex_.
+    //
+    // Internal use only.
+    //
+
+    int masterFlushQueue();
 
     //
     // Helper function to write <size> bytes of <data>
@@ -296,6 +634,52 @@ namespace Tegenaria
 
     int slaveWrite(int id, void *buf, int size);
 
+    //
+    // Compression and encryption. Implemented in IOMixerCodec.cpp.
+    //
+    // slaveEncode() compresses and encrypts <data> in slave context (slave
+    // thread or reactor loop) and passes result to masterEncode(), so
+    // masterMutex_ is never held during compression or encryption.
+    //
+    // Internal use only.
+    //
+
+    int slaveEncode(IOMixerSlave *slave, void *buf, int size);
+    int slaveEncodeEof(IOMixerSlave *slave);
+
+    int codecSelect(IOMixerSlave *slave);
+    int codecDecode(int id, uint8_t flags, void *src, int srcSize, void *dst, int dstSize);
+
+    void codecRelease(int id);
+
+    int cipherDecrypt(int id, void *buf, int size);
+    int cipherRequired(int id);
+
+    uint32_t codecCaps();
+
+    //
+    // Flow control and control channel.
+    // Implemented in IOMixerFlow.cpp.
+    //
+    // Internal use only.
+    //
+
+    int controlSend(int type, uint32_t caps, int channelId, uint32_t value);
+
+    void controlDispatch(void *data, int size);
+
+    int flowCredit(IOMixerSlave *slave);
+    int flowAck(IOMixerSlave *slave);
+
+    int slaveDeliver(IOMixerSlave *slave, void *buf, int size);
+    int slaveDrain(IOMixerSlave *slave, int blocking);
+    int slaveDrainLocked(IOMixerSlave *slave, int blocking);
+    int slaveDrainWait(IOMixerSlave *slave, int wait);
+    int slavePending(IOMixerSlave *slave);
+    int slaveCanceled(IOMixerSlave *slave);
+
+    void slaveKick(IOMixerSlave *slave);
+
     //
     // Save that object is already corectly inited or not.
     //
@@ -311,22 +695,84 @@ namespace Tegenaria
     static Mutex instancesMutex_;
 
     //
-    // ZLib library loaded runtime.
+    // Set to 1 if ZLib library is available. See initZLib().
     //
 
-    #ifdef WIN32
-    HMODULE zlib_;
-    #else
-    void *zlib_;
-    #endif
-
     int zlibLoaded_;
 
-    ZLibCompressProto zlibCompress_;
+    //
+    // Decoder contexts for incoming compressed channels, created on
+    // first compressed packet and freed on channel EOF.
+    // Used by master thread (or reactor loop reading master IN) only.
+    //
+
+    map<int, IOCodec *> decoders_;
 
-    ZLibUncompressProto zlibUncompress_;
+    //
+    // Compressed <data> readed from master IN, allocated once.
+    // Used by master thread only.
+    //
+
+    char *decodeBuf_;
+
+    int decodeBufSize_;
+
+    //
+    // IOMIXER_CAPS_XXX codecs supported by both sides.
+    // Set when HELLO packet from remote is received.
+    //
 
-    ZLibCompressBoundProto zlibCompressBound_;
+    volatile uint32_t peerCaps_;
+
+    //
+    // Flow control. See setFlowControl().
+    //
+    // flowWindow_     - our per-slave receive window, 0 if disabled.
+    // flowPeerWindow_ - per-slave receive window announced by remote.
+    // flowActive_     - 1 if both sides agreed to use flow control.
+    //
+
+    int flowWindow_;
+    int flowPeerWindow_;
+
+    volatile int flowActive_;
+
+    //
+    // Write coalescing. Small packets from many slaves are collected
+    // in sendQueue_ and written to master OUT in one call.
+    // See setWriteCoalescing(). Protected by masterMutex_.
+    //
+    // sendQueueSize_    - byte budget, 0 if coalescing is disabled.
+    // sendQueueDelay_   - latency budget in us.
+    // sendQueueFlusher_ - 1 if flush is already scheduled on flusher
+    //                     thread for packets in the queue.
+    //
+    // sendQueueThread_  - threads mode only. Thread flushing the queue
+    //                     when latency budget expires. Woken up by
+    //                     sendQueueSem_. See masterFlushLoop().
+    //
+
+    char *sendQueue_;
+
+    int sendQueueSize_;
+    int sendQueueLen_;
+    int sendQueueFrames_;
+    int sendQueueDelay_;
+    int sendQueueFlusher_;
+
+    ThreadHandle_t *sendQueueThread_;
+
+    Semaphore sendQueueSem_;
+
+    volatile int sendQueueStop_;
+
+    //
+    // Number of packets and write calls sent to master OUT.
+    // See getWriteStats().
+    //
+
+    uint64_t statFrames_;
+    uint64_t statWrites_;
 
     //
     // Object name for debug purpose.
@@ -344,10 +790,24 @@ namespace Tegenaria
 
     int addSlave(int callerFds[2], int id = -1);
 
-    int setSlaveCompression(int id, int enabled);
+    int setSlaveCompression(int id, int mode, int codec = IOCODEC_ZLIB);
+
+    int setSlaveEncryption(int id, IOCipher *cipher);
+
+    int setSlaveCoalescing(int id, int enabled);
+
+    int setWriteCoalescing(int maxBytes, int maxDelayUs);
+
+    void getWriteStats(uint64_t *frames, uint64_t *writes, double *framesPerWrite = NULL);
 
     int removeSlave(int id);
 
+    int setReactorMode(int loopsCount = 1);
+
+    int setFlowControl(int windowSize = IOMIXER_DEFAULT_WINDOW);
+
+    int isFlowControlActive();
+
     int start();
     int stop();
     int shutdown();
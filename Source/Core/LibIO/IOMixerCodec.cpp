@@ -0,0 +1,569 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Per-channel compression and encryption for IOMixer.
+//
+//          Data are compressed and encrypted in slave context (slave
+//          thread or reactor loop serving slave) before packet reaches
+//          masterEncode(), so one channel never blocks other channels
+//          waiting for masterMutex_.
+//
+//          Encrypted packet carries authentication tag after <data>:
+//
+//          <id><flags | ENCRYPTION_ON><size + tagSize><data><tag>
+//
+//          EOF on encrypted channel is sent as encrypted packet with
+//          empty <data>, so it can't be forged:
+//
+//          <id><flags | ENCRYPTION_ON><tagSize><tag>
+//
+//          Codec used for packet is stored in packet flags:
+//
+//          <id><flags = COMPRESSION_ON | codec << 2><size><compressed data>
+//
+//          Codec 0 is one-shot zlib understood by every IOMixer version.
+//          Other codecs are used only if remote announced them in HELLO.
+//
+//          Adaptive mode (IOMIXER_COMPRESSION_ADAPTIVE):
+//
+//          - Every packet is compressed as long as it compresses well.
+//
+//          - After IOMIXER_ADAPTIVE_MISSES packets in a row compressed
+//            to more than IOMIXER_ADAPTIVE_RATIO% of input, next
+//            <backoff> packets are sent raw without trying compression.
+//
+//          - Then compression is probed again. Backoff is doubled after
+//            every failed probe up to IOMIXER_ADAPTIVE_BACKOFF_MAX and
+//            reset when data compress again.
+//
+
+#include "IOMixer.h"
+
+namespace Tegenaria
+{
+  //
+  // Packets smaller than this are sent raw. Stream codec keeps
+  // dictionary between packets, so even small packets compress well.
+  //
+
+  #define IOMIXER_COMPRESS_MIN        256
+  #define IOMIXER_COMPRESS_MIN_STREAM 32
+
+  //
+  // Adaptive mode tuning. See header above.
+  //
+
+  #define IOMIXER_ADAPTIVE_RATIO       90
+  #define IOMIXER_ADAPTIVE_MISSES      8
+  #define IOMIXER_ADAPTIVE_BACKOFF_MIN 64
+  #define IOMIXER_ADAPTIVE_BACKOFF_MAX 4096
+
+  //
+  // Get IOMIXER_CAPS_XXX mask of codecs available locally.
+  // Announced to remote in HELLO packet.
+  //
+
+  uint32_t IOMixer::codecCaps()
+  {
+    uint32_t caps = 0;
+
+    if (IOCodecIsAvailable(IOCODEC_ZLIB_STREAM))
+    {
+      caps |= IOMIXER_CAPS_ZLIB_STREAM;
+    }
+
+    if (IOCodecIsAvailable(IOCODEC_LZ4))
+    {
+      caps |= IOMIXER_CAPS_LZ4;
+    }
+
+    return caps;
+  }
+
+  //
+  // Choose codec for next packet from given slave.
+  //
+  // IOCODEC_ZLIB is upgraded to IOCODEC_ZLIB_STREAM if both sides
+  // support it. Codecs unknown to remote falls back to one-shot zlib.
+  //
+  // slave - slave, which is going to send packet (IN).
+  //
+  // RETURNS: IOCODEC_XXX codec or -1 if packet should be sent raw.
+  //
+
+  int IOMixer::codecSelect(IOMixerSlave *slave)
+  {
+    switch(slave -> codec_)
+    {
+      case IOCODEC_ZLIB:
+      case IOCODEC_ZLIB_STREAM:
+      {
+        if (peerCaps_ & IOMIXER_CAPS_ZLIB_STREAM)
+        {
+          return IOCODEC_ZLIB_STREAM;
+        }
+
+        break;
+      }
+
+      case IOCODEC_LZ4:
+      {
+        if (peerCaps_ & IOMIXER_CAPS_LZ4)
+        {
+          return IOCODEC_LZ4;
+        }
+
+        break;
+      }
+    }
+
+    return zlibLoaded_ ? IOCODEC_ZLIB : -1;
+  }
+
+  //
+  // Compress and encrypt <data> readed from slave if needed and write it
+  // as one <id><flags><size><data> packet to master OUT.
+  //
+  // MUST be called from slave context only (slave thread or reactor
+  // loop serving slave), because encoder and encode buffer are per-slave.
+  //
+  // slave - slave, where data was readed from (IN).
+  // buf   - data readed from slave, encrypted in place if needed (IN/OUT).
+  // size  - size of buf[] buffer in bytes, <= 0 means EOF (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::slaveEncode(IOMixerSlave *slave, void *buf, int size)
+  {
+    int exitCode = -1;
+
+    int codec    = -1;
+    int compSize = -1;
+    int minSize  = IOMIXER_COMPRESS_MIN;
+    int tagSize  = 0;
+
+    int locked   = 0;
+
+    char tag[IOMIXER_MAX_TAG];
+
+    uint8_t flags = slave -> flags_ & ~(IOMIXER_FLAG_COMPRESSION_ON |
+                                            IOMIXER_FLAG_CODEC_MASK |
+                                                IOMIXER_FLAG_ENCRYPTION_ON);
+
+    //
+    // EOF or error.
+    //
+
+    if (size <= 0)
+    {
+      return slaveEncodeEof(slave);
+    }
+
+    if (size > 0 && (slave -> flags_ & IOMIXER_FLAG_COMPRESSION_ON))
+    {
+      codec = codecSelect(slave);
+    }
+
+    if (codec == IOCODEC_ZLIB_STREAM)
+    {
+      minSize = IOMIXER_COMPRESS_MIN_STREAM;
+    }
+
+    //
+    // Adaptive mode. Data didn't compress recently, send raw until
+    // backoff expires.
+    //
+
+    if (codec != -1 && slave -> compSkip_ > 0)
+    {
+      slave -> compSkip_ --;
+
+      codec = -1;
+    }
+
+    if (codec != -1 && size >= minSize)
+    {
+      //
+      // Create encoder on first use or when codec was changed.
+      //
+
+      if (slave -> encoder_ == NULL || slave -> encoder_ -> id() != codec)
+      {
+        if (slave -> encoder_)
+        {
+          delete slave -> encoder_;
+        }
+
+        slave -> encoder_ = IOCodecCreate(codec, IOCODEC_ENCODER);
+
+        FAIL(slave -> encoder_ == NULL);
+
+        DEBUG2("IOMixer::slaveEncode : Using %s codec on slave ID#%d.\n",
+                   IOCodecName(codec), slave -> id_);
+      }
+
+      //
+      // Allocate work buffer once per slave.
+      //
+
+      if (slave -> encodeBufSize_ < slave -> encoder_ -> bound(IOMIXER_MAX_PACKET))
+      {
+        if (slave -> encodeBuf_)
+        {
+          free(slave -> encodeBuf_);
+        }
+
+        slave -> encodeBufSize_ = slave -> encoder_ -> bound(IOMIXER_MAX_PACKET);
+
+        slave -> encodeBuf_ = (char *) malloc(slave -> encodeBufSize_);
+
+        if (slave -> encodeBuf_ == NULL)
+        {
+          slave -> encodeBufSize_ = 0;
+
+          FAILEX(1, "ERROR: Out of memory.\n");
+        }
+      }
+
+      compSize = slave -> encoder_ -> encode(slave -> encodeBuf_,
+                                                 slave -> encodeBufSize_, buf, size);
+
+      FAILEX(compSize < 0, "ERROR: Cannot compress packet for slave ID#%d.\n", slave -> id_);
+
+      DEBUG5("IOMixer::slaveEncode : Compressed [%d] bytes into [%d] (ratio %lf%%).\n",
+                  size, compSize, double(compSize) / double(size) * 100.0);
+
+      //
+      // Adaptive mode. Count packets, which didn't compress.
+      //
+
+      if (slave -> compression_ == IOMIXER_COMPRESSION_ADAPTIVE)
+      {
+        if (int64_t(compSize) * 100 > int64_t(size) * IOMIXER_ADAPTIVE_RATIO)
+        {
+          slave -> compMisses_ ++;
+
+          if (slave -> compMisses_ >= IOMIXER_ADAPTIVE_MISSES)
+          {
+            slave -> compBackoff_ = min(max(slave -> compBackoff_ * 2,
+                                                IOMIXER_ADAPTIVE_BACKOFF_MIN),
+                                                    IOMIXER_ADAPTIVE_BACKOFF_MAX);
+
+            slave -> compSkip_   = slave -> compBackoff_;
+            slave -> compMisses_ = 0;
+
+            DEBUG2("IOMixer::slaveEncode : Data on slave ID#%d don't compress,"
+                       " sending next [%d] packets raw.\n",
+                           slave -> id_, slave -> compSkip_);
+          }
+        }
+        else
+        {
+          slave -> compMisses_  = 0;
+          slave -> compBackoff_ = 0;
+        }
+      }
+
+      //
+      // Stream codec state was already updated, so packet MUST be sent
+      // compressed. Packet codecs fall back to raw if nothing was saved.
+      //
+
+      if (slave -> encoder_ -> isStream() || compSize < size)
+      {
+        flags |= IOMIXER_FLAG_COMPRESSION_ON | (codec << IOMIXER_FLAG_CODEC_SHIFT);
+
+        buf  = slave -> encodeBuf_;
+        size = compSize;
+      }
+    }
+
+    //
+    // Encryption enabled. Encrypt in place, tag is appended by
+    // masterEncode() without copying <data>.
+    //
+
+    if (size > 0 && slave -> cipher_)
+    {
+      slave -> encodeMutex_.lock();
+
+      locked = 1;
+
+      FAILEX(slave -> cipher_ -> encrypt(buf, size, tag),
+                 "ERROR: Cannot encrypt packet for slave ID#%d.\n", slave -> id_);
+
+      tagSize = slave -> cipher_ -> tagSize();
+
+      flags |= IOMIXER_FLAG_ENCRYPTION_ON;
+    }
+
+    //
+    // Write <id><flags><size><data><tag> into master.
+    //
+
+    FAIL(masterEncode(slave -> id_, buf, size, flags,
+                          slave -> coalesce_, tag, tagSize));
+
+    exitCode = 0;
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    if (locked)
+    {
+      slave -> encodeMutex_.unlock();
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Send EOF on given slave to remote. On encrypted channel EOF is sent
+  // as authenticated packet with empty <data>, so remote can tell it
+  // from forged one.
+  //
+  // Can be called from any thread, cipher state is protected by
+  // slave encodeMutex_.
+  //
+  // slave - slave, which input is finished (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::slaveEncodeEof(IOMixerSlave *slave)
+  {
+    int exitCode = -1;
+
+    int tagSize = 0;
+
+    char tag[IOMIXER_MAX_TAG];
+    char empty[1];
+
+    uint8_t flags = slave -> flags_ & ~(IOMIXER_FLAG_COMPRESSION_ON |
+                                            IOMIXER_FLAG_CODEC_MASK);
+
+    if (slave -> cipher_ == NULL)
+    {
+      return masterEncode(slave -> id_, NULL, 0, flags);
+    }
+
+    slave -> encodeMutex_.lock();
+
+    FAILEX(slave -> cipher_ -> encrypt(empty, 0, tag),
+               "ERROR: Cannot encrypt EOF for slave ID#%d.\n", slave -> id_);
+
+    tagSize = slave -> cipher_ -> tagSize();
+
+    //
+    // Tag is the whole packet. Don't queue it, EOF is written at once
+    // like plain one.
+    //
+
+    FAIL(masterEncode(slave -> id_, tag, tagSize,
+                          flags | IOMIXER_FLAG_ENCRYPTION_ON, 0));
+
+    exitCode = 0;
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    slave -> encodeMutex_.unlock();
+
+    return exitCode;
+  }
+
+  //
+  // Decompress <data> of packet received from master.
+  //
+  // MUST be called from master reader context only (master thread
+  // or reactor loop reading master IN).
+  //
+  // id      - channel id, where packet was sent to (IN).
+  // flags   - packet flags with IOMIXER_FLAG_COMPRESSION_ON set (IN).
+  // src     - compressed <data> (IN).
+  // srcSize - size of src[] buffer in bytes (IN).
+  // dst     - buffer, where to store decompressed data (OUT).
+  // dstSize - size of dst[] buffer in bytes (IN).
+  //
+  // RETURNS: Number of bytes written to dst[] or -1 if error.
+  //
+
+  int IOMixer::codecDecode(int id, uint8_t flags, void *src,
+                               int srcSize, void *dst, int dstSize)
+  {
+    int decoded = -1;
+
+    int codec = (flags & IOMIXER_FLAG_CODEC_MASK) >> IOMIXER_FLAG_CODEC_SHIFT;
+
+    IOCodec *decoder = NULL;
+
+    map<int, IOCodec *>::iterator it = decoders_.find(id);
+
+    if (it != decoders_.end())
+    {
+      decoder = it -> second;
+    }
+
+    //
+    // Create decoder on first compressed packet or when remote
+    // switched to another codec.
+    //
+
+    if (decoder == NULL || decoder -> id() != codec)
+    {
+      if (decoder)
+      {
+        delete decoder;
+
+        decoders_.erase(id);
+      }
+
+      decoder = IOCodecCreate(codec, IOCODEC_DECODER);
+
+      FAILEX(decoder == NULL, "ERROR: Compressed data received for slave ID#%d,"
+                 " but codec '%s' is not available.\n", id, IOCodecName(codec));
+
+      decoders_[id] = decoder;
+    }
+
+    decoded = decoder -> decode(dst, dstSize, src, srcSize);
+
+    FAILEX(decoded < 0, "ERROR: Cannot decompress packet for slave ID#%d.\n", id);
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    return decoded;
+  }
+
+  //
+  // Free decoder context for given channel. Called when remote sent EOF,
+  // so there is no more compressed data on this channel.
+  //
+  // id - channel id (IN).
+  //
+
+  void IOMixer::codecRelease(int id)
+  {
+    map<int, IOCodec *>::iterator it = decoders_.find(id);
+
+    if (it != decoders_.end())
+    {
+      delete it -> second;
+
+      decoders_.erase(it);
+    }
+  }
+
+  //
+  // Verify and decrypt <data> of packet received from master in place.
+  //
+  // MUST be called from master reader context only (master thread
+  // or reactor loop reading master IN).
+  //
+  // id   - channel id, where packet was sent to (IN).
+  // buf  - <data><tag> received from master (IN/OUT).
+  // size - size of buf[] buffer in bytes including tag (IN).
+  //
+  // RETURNS: Number of decrypted bytes without tag,
+  //          or -1 if packet can't be authenticated.
+  //
+
+  int IOMixer::cipherDecrypt(int id, void *buf, int size)
+  {
+    int decrypted = -1;
+
+    int tagSize = 0;
+
+    IOMixerSlave *slave = NULL;
+
+    slavesMutex_.lock();
+
+    slave = getSlave(id);
+
+    FAILEX(slave == NULL || slave -> cipher_ == NULL,
+               "ERROR: Encrypted data received for slave ID#%d,"
+                   " but encryption is not enabled.\n", id);
+
+    tagSize = slave -> cipher_ -> tagSize();
+
+    FAILEX(size < tagSize, "ERROR: Encrypted packet too short.\n");
+
+    FAILEX(slave -> cipher_ -> decrypt(buf, size - tagSize, (char *) buf + size - tagSize),
+               "ERROR: Authentication failed for packet on slave ID#%d.\n", id);
+
+    decrypted = size - tagSize;
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    slavesMutex_.unlock();
+
+    return decrypted;
+  }
+
+  //
+  // Check does packets for given channel must be encrypted.
+  //
+  // id - channel id, where packet was sent to (IN).
+  //
+  // RETURNS: 1 if encryption is enabled on channel,
+  //          0 otherwise.
+  //
+
+  int IOMixer::cipherRequired(int id)
+  {
+    int required = 0;
+
+    IOMixerSlave *slave = NULL;
+
+    slavesMutex_.lock();
+
+    slave = getSlave(id);
+
+    if (slave && slave -> cipher_)
+    {
+      required = 1;
+    }
+
+    slavesMutex_.unlock();
+
+    return required;
+  }
+
+} /* namespace Tegenaria */
@@ -0,0 +1,786 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Credit based flow control for IOMixer channels.
+//
+//          Without flow control master thread writes every received
+//          packet to slave in blocking mode, so one slow slave blocks
+//          all other channels multiplexed on the same master.
+//
+//          With flow control:
+//
+//          - Every slave has bounded receive window. Packets, which can't
+//            be written to slave at once are queued in slave's rxQueue_
+//            and written later by slave thread or reactor loop.
+//
+//          - Sender never has more than <window> bytes in flight per
+//            slave. Receiver announces how many bytes it passed to slave
+//            by WINDOW control packets. Sender stops reading from slave
+//            until credits are back, so slow channel throttles itself only.
+//
+//          Feature is negotiated by HELLO packets sent on channel #0.
+//          Old peers drop them, so flow control is never used with them.
+//
+//          A                                  B
+//          | --- <0><HELLO><caps><window> --> |
+//          | <-- <0><HELLO><caps><window> --- |
+//          | --- <id><data> ----------------> | rxQueue_
+//          | <-- <0><WINDOW><id><rxDone> ---- |
+//
+
+#include "IOMixer.h"
+
+namespace Tegenaria
+{
+  //
+  // Write <size> bytes to FD, which can be in non-blocking mode.
+  // Wait until FD become writable if needed.
+  //
+  // fd   - FD to write (IN).
+  // buf  - data to write (IN).
+  // size - number of bytes to write (IN).
+  //
+  // RETURNS: 0 if all data written,
+  //          -1 otherwise.
+  //
+
+  static int IOMixerWriteAll(int fd, const char *buf, int size)
+  {
+    int written = -1;
+
+    while(size > 0)
+    {
+      written = write(fd, buf, size);
+
+      #ifndef WIN32
+      if (written < 0 && (errno == EAGAIN || errno == EINTR))
+      {
+        fd_set wfd;
+
+        FD_ZERO(&wfd);
+        FD_SET(fd, &wfd);
+
+        select(fd + 1, NULL, &wfd, NULL, NULL);
+
+        continue;
+      }
+      #endif
+
+      if (written <= 0)
+      {
+        return -1;
+      }
+
+      buf  += written;
+      size -= written;
+    }
+
+    return 0;
+  }
+
+  //
+  // Enable credit based flow control with given per-slave receive window.
+  //
+  // Flow control is used only if remote side enabled it too.
+  // Otherwise IOMixer works in the old way, where master thread blocks
+  // on slow slave.
+  //
+  // WARNING: Must be called before first addSlave() and start() call.
+  //
+  // windowSize - maximum number of bytes, which remote can send to one
+  //              slave before slave consumed them (IN/OPT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::setFlowControl(int windowSize)
+  {
+    DBG_ENTER("IOMixer::setFlowControl");
+
+    int exitCode = -1;
+
+    #ifdef WIN32
+    {
+      Error("ERROR: IOMixer flow control is not implemented on Windows.\n");
+    }
+    #else
+    {
+      FAILEX(init_ == 0, "ERROR: IOMixer object was not initiated correctly.\n");
+      FAILEX(windowSize <= 0, "ERROR: Wrong window size [%d].\n", windowSize);
+
+      slavesMutex_.lock();
+
+      if (slaves_.size() > 0)
+      {
+        slavesMutex_.unlock();
+
+        Error("ERROR: Flow control must be set before addSlave().\n");
+
+        goto fail;
+      }
+
+      flowWindow_ = windowSize;
+
+      slavesMutex_.unlock();
+
+      DEBUG1("IOMixer::setFlowControl : Receive window set to [%d] bytes"
+                 " for IOMixer PTR#%p.\n", windowSize, this);
+
+      exitCode = 0;
+    }
+    #endif
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    DBG_LEAVE("IOMixer::setFlowControl");
+
+    return exitCode;
+  }
+
+  //
+  // Check is flow control negotiated with remote side.
+  //
+  // RETURNS: 1 if flow control is in use,
+  //          0 otherwise.
+  //
+
+  int IOMixer::isFlowControlActive()
+  {
+    return flowActive_;
+  }
+
+  //
+  // Send one control packet on channel #0.
+  //
+  // type      - one of IOMIXER_CONTROL_XXX values (IN).
+  // caps      - IOMIXER_CAPS_XXX mask, used by HELLO only (IN).
+  // channelId - related slave ID, used by WINDOW only (IN).
+  // value     - packet specific value (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::controlSend(int type, uint32_t caps, int channelId, uint32_t value)
+  {
+    IOMixerControl msg;
+
+    msg.type_      = type;
+    msg.caps_      = caps;
+    msg.channelId_ = channelId;
+    msg.value_     = value;
+
+    DEBUG3("IOMixer::controlSend : Sending control packet type [%d]"
+               " caps [%x] channel [%d] value [%u].\n",
+                   type, caps, channelId, value);
+
+    return masterEncode(0, &msg, sizeof(msg), 0, 0);
+  }
+
+  //
+  // Handle control packet received on channel #0.
+  // Unknown packets are ignored to stay compatible with newer peers.
+  //
+  // data - <data> of control packet (IN).
+  // size - number of bytes in data[] buffer (IN).
+  //
+
+  void IOMixer::controlDispatch(void *data, int size)
+  {
+    IOMixerControl *msg = (IOMixerControl *) data;
+
+    IOMixerSlave *slave = NULL;
+
+    map<int, IOMixerSlave *>::iterator it;
+
+    map<int, uint32_t> acks;
+
+    map<int, uint32_t>::iterator ack;
+
+    if (size < int(sizeof(IOMixerControl)))
+    {
+      DEBUG1("IOMixer::controlDispatch : Too short control packet [%d] ignored.\n", size);
+
+      return;
+    }
+
+    switch(msg -> type_)
+    {
+      //
+      // Remote announced its capabilities.
+      //
+
+      case IOMIXER_CONTROL_HELLO:
+      {
+        DEBUG1("IOMixer::controlDispatch : Remote caps [%x], window [%u].\n",
+                   msg -> caps_, msg -> value_);
+
+        peerCaps_ = msg -> caps_ & codecCaps();
+
+        if (flowWindow_ > 0 && msg -> value_ > 0 &&
+                (msg -> caps_ & IOMIXER_CAPS_FLOW_CONTROL))
+        {
+          flowPeerWindow_ = min(msg -> value_, uint32_t(0x7fffffff));
+
+          flowActive_ = 1;
+
+          DEBUG1("IOMixer::controlDispatch : Flow control negotiated for"
+                     " IOMixer PTR#%p.\n", this);
+
+          //
+          // Data delivered to slaves before negotiation was never
+          // acknowledged, but remote counts it against our window.
+          // Give these credits back now, otherwise remote slave, which
+          // sent before HELLO, could wait for credits forever.
+          //
+
+          slavesMutex_.lock();
+
+          for (it = slaves_.begin(); it != slaves_.end(); it++)
+          {
+            slave = it -> second;
+
+            if (slave -> rxDone_ != slave -> rxAcked_)
+            {
+              slave -> rxAcked_ = slave -> rxDone_;
+
+              acks[slave -> id_] = slave -> rxAcked_;
+            }
+          }
+
+          slavesMutex_.unlock();
+
+          for (ack = acks.begin(); ack != acks.end(); ack++)
+          {
+            controlSend(IOMIXER_CONTROL_WINDOW, 0, ack -> first, ack -> second);
+          }
+        }
+
+        break;
+      }
+
+      //
+      // Remote passed some data to its slave. Give credits back
+      // to our side of slave and wake it up if it was waiting for them.
+      //
+
+      case IOMIXER_CONTROL_WINDOW:
+      {
+        slavesMutex_.lock();
+
+        slave = getSlave(msg -> channelId_);
+
+        if (slave && int32_t(msg -> value_ - slave -> txAcked_) > 0)
+        {
+          slave -> txAcked_ = msg -> value_;
+
+          slaveKick(slave);
+        }
+
+        slavesMutex_.unlock();
+
+        break;
+      }
+
+      default:
+      {
+        DEBUG1("IOMixer::controlDispatch : Unknown control packet"
+                   " type [%d] ignored.\n", msg -> type_);
+      }
+    }
+  }
+
+  //
+  // Get number of bytes, which can be read from slave and sent to remote
+  // without exceeding remote receive window.
+  //
+  // slave - related slave (IN).
+  //
+  // RETURNS: Number of bytes, which can be sent now (0 if none).
+  //
+
+  int IOMixer::flowCredit(IOMixerSlave *slave)
+  {
+    int credit = IOMIXER_MAX_PACKET;
+
+    if (flowActive_)
+    {
+      credit = flowPeerWindow_ - int(slave -> txSent_ - slave -> txAcked_);
+
+      credit = max(min(credit, IOMIXER_MAX_PACKET), 0);
+    }
+
+    return credit;
+  }
+
+  //
+  // Tell remote how many bytes we passed to slave if at least half
+  // of receive window was consumed since last WINDOW packet.
+  //
+  // slave - related slave (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::flowAck(IOMixerSlave *slave)
+  {
+    uint32_t done = slave -> rxDone_;
+
+    if (flowActive_ && int(done - slave -> rxAcked_) >= max(flowWindow_ / 2, 1))
+    {
+      slave -> rxAcked_ = done;
+
+      return controlSend(IOMIXER_CONTROL_WINDOW, 0, slave -> id_, done);
+    }
+
+    return 0;
+  }
+
+  //
+  // Wake up slave thread or reactor loop, because credits arrived
+  // or new data were queued for slave.
+  //
+  // slave - slave to wake up (IN).
+  //
+
+  void IOMixer::slaveKick(IOMixerSlave *slave)
+  {
+    #ifndef WIN32
+    {
+      if (slave -> loop_ != -1)
+      {
+        reactorUpdateSlave(slave);
+      }
+      else if (slave -> thread_ && slave -> cancelFd_[1] != -1)
+      {
+        if (write(slave -> cancelFd_[1], "k", 1) <= 0)
+        {
+          DEBUG1("WARNING: Cannot wake up slave ID#%d.\n", slave -> id_);
+        }
+      }
+    }
+    #endif
+  }
+
+  //
+  // Check is slave thread woken up by cancel request or by slaveKick().
+  // Consumes pending wake up bytes from cancel pipe.
+  //
+  // slave - related slave (IN).
+  //
+  // RETURNS: 1 if slave thread should finish,
+  //          0 if it's only woken up by slaveKick().
+  //
+
+  int IOMixer::slaveCanceled(IOMixerSlave *slave)
+  {
+    int canceled = 0;
+
+    #ifndef WIN32
+    {
+      char buf[64];
+
+      int readed = read(slave -> cancelFd_[0], buf, sizeof(buf));
+
+      if (readed <= 0)
+      {
+        canceled = 1;
+      }
+
+      for (int i = 0; i < readed; i++)
+      {
+        if (buf[i] != 'k')
+        {
+          canceled = 1;
+        }
+      }
+    }
+    #endif
+
+    return canceled;
+  }
+
+  //
+  // Get number of bytes queued for slave, which are still not written
+  // to fdout_.
+  //
+  // slave - related slave (IN).
+  //
+  // RETURNS: Number of queued bytes.
+  //
+
+  int IOMixer::slavePending(IOMixerSlave *slave)
+  {
+    int pending = 0;
+
+    if (slave -> rxQueue_)
+    {
+      slave -> writeMutex_.lock();
+
+      pending = slave -> rxQueue_ -> size();
+
+      slave -> writeMutex_.unlock();
+    }
+
+    return pending;
+  }
+
+  //
+  // Pass <size> bytes received from master to slave output.
+  //
+  // If flow control is active data, which can't be written without
+  // blocking are queued and written later by slave thread or reactor.
+  // Otherwise data are written in blocking mode.
+  //
+  // slave - destination slave (IN).
+  // buf   - data to write (IN).
+  // size  - number of bytes in buf[] (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::slaveDeliver(IOMixerSlave *slave, void *buf, int size)
+  {
+    int exitCode = -1;
+    int written  = 0;
+    int queued   = 0;
+    int kick     = 0;
+
+    char *src = (char *) buf;
+
+    slave -> writeMutex_.lock();
+
+    DEBUG4("IOMixer::slaveDeliver : Writing [%d] bytes to slave FD [%d]"
+                " ID [%d]...\n", size, slave -> fdout_, slave -> id_);
+
+    FAIL(slave -> fdout_ == -1);
+
+    if (slave -> rxQueue_)
+    {
+      queued = slave -> rxQueue_ -> size();
+    }
+
+    //
+    // Flow control. Never block master on slow slave.
+    //
+
+    #ifndef WIN32
+    if (flowActive_ && slave -> rxAsync_)
+    {
+      //
+      // Nothing queued before. Try to write directly.
+      //
+
+      if (queued == 0)
+      {
+        written = write(slave -> fdout_, src, size);
+
+        if (written < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+          written = 0;
+        }
+
+        FAIL(written < 0);
+
+        slave -> rxDone_ += written;
+
+        src  += written;
+        size -= written;
+      }
+
+      //
+      // Queue the rest. Slave thread or reactor loop will write it
+      // when slave become writable.
+      //
+
+      if (size > 0 && slave -> rxQueue_ -> bytesLeft() >= unsigned(size))
+      {
+        slave -> rxQueue_ -> push(src, size);
+
+        kick = (queued == 0);
+
+        size = 0;
+      }
+
+      //
+      // Remote sent more than our window, e.g. data sent before flow
+      // control was negotiated. Fall back to blocking write below.
+      //
+
+      else if (size > 0)
+      {
+        DEBUG1("IOMixer::slaveDeliver : Receive window exceeded on slave"
+                   " ID#%d, falling back to blocking write.\n", slave -> id_);
+      }
+    }
+    #endif
+
+    //
+    // Blocking write. Write queued data first to keep order.
+    //
+
+    if (size > 0)
+    {
+      FAIL(slaveDrainLocked(slave, 1));
+
+      FAIL(IOMixerWriteAll(slave -> fdout_, src, size));
+
+      slave -> rxDone_ += size;
+    }
+
+    exitCode = 0;
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    slave -> writeMutex_.unlock();
+
+    if (kick)
+    {
+      slaveKick(slave);
+    }
+
+    if (exitCode == 0)
+    {
+      exitCode = flowAck(slave);
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Write data queued in rxQueue_ to slave output.
+  // If remote already closed channel and queue become empty, slave
+  // output is closed too.
+  //
+  // WARNING: Caller MUST hold slave -> writeMutex_.
+  //
+  // slave    - related slave (IN/OUT).
+  // blocking - 1 to write all queued data even if we need to wait,
+  //            0 to stop as soon as slave output would block (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::slaveDrainLocked(IOMixerSlave *slave, int blocking)
+  {
+    int exitCode = -1;
+
+    IOFifoSegment seg;
+
+    int written = -1;
+
+    //
+    // Write queued data straight from fifo memory, without copying it
+    // to temporary buffer first.
+    //
+
+    while(slave -> rxQueue_ && slave -> rxQueue_ -> size() > 0 && slave -> fdout_ != -1)
+    {
+      if (blocking)
+      {
+        slave -> rxQueue_ -> peekSegments(&seg, 1);
+
+        FAIL(IOMixerWriteAll(slave -> fdout_, seg.data_, seg.size_));
+
+        slave -> rxQueue_ -> eat(seg.size_);
+
+        written = seg.size_;
+      }
+      else
+      {
+        written = slave -> rxQueue_ -> writeTo(slave -> fdout_);
+
+        #ifndef WIN32
+        if (written < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+          break;
+        }
+        #endif
+
+        FAIL(written <= 0);
+      }
+
+      slave -> rxDone_ += written;
+
+      DEBUG4("IOMixer::slaveDrainLocked : Written [%d] queued bytes to slave ID#%d.\n",
+                 written, slave -> id_);
+    }
+
+    //
+    // Remote closed channel and everything was passed to slave.
+    // Close slave output now.
+    //
+
+    if (slave -> eofReceived_ && slave -> fdout_ != -1 &&
+            (slave -> rxQueue_ == NULL || slave -> rxQueue_ -> size() == 0))
+    {
+      DEBUG1("IOMixer::slaveDrainLocked : Closing output of slave ID#%d.\n", slave -> id_);
+
+      close(slave -> fdout_);
+
+      DBG_SET_DEL("CRT FD", slave -> fdout_);
+
+      slave -> fdout_ = -1;
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    //
+    // Slave output is broken. Nobody will read queued data anymore.
+    //
+
+    if (exitCode && slave -> rxQueue_ && slave -> rxQueue_ -> size() > 0)
+    {
+      DEBUG1("IOMixer::slaveDrainLocked : Output of slave ID#%d is broken,"
+                 " dropping [%d] queued bytes.\n",
+                     slave -> id_, slave -> rxQueue_ -> size());
+
+      slave -> rxQueue_ -> eat(slave -> rxQueue_ -> size());
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Write data queued in rxQueue_ to slave output.
+  // Thread safe wrapper for slaveDrainLocked().
+  //
+  // slave    - related slave (IN/OUT).
+  // blocking - 1 to wait until all queued data written (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::slaveDrain(IOMixerSlave *slave, int blocking)
+  {
+    int exitCode = -1;
+
+    slave -> writeMutex_.lock();
+
+    exitCode = slaveDrainLocked(slave, blocking);
+
+    slave -> writeMutex_.unlock();
+
+    if (exitCode == 0)
+    {
+      exitCode = flowAck(slave);
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Called by slave thread, when slave input is finished.
+  // Wait until data queued for slave are written to its output
+  // and stop accepting new data in non-blocking mode.
+  //
+  // slave - related slave (IN/OUT).
+  // wait  - 1 to wait for queued data, 0 to return immediately (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::slaveDrainWait(IOMixerSlave *slave, int wait)
+  {
+    #ifndef WIN32
+    {
+      fd_set rfd;
+      fd_set wfd;
+
+      int fdmax = -1;
+      int fd    = -1;
+
+      while(wait && dead_ == 0)
+      {
+        //
+        // Nothing left. Next data from master will be written in
+        // blocking mode.
+        //
+
+        slave -> writeMutex_.lock();
+
+        if (slave -> rxQueue_ == NULL || slave -> rxQueue_ -> size() == 0 ||
+                slave -> fdout_ == -1)
+        {
+          slave -> rxAsync_ = 0;
+
+          slave -> writeMutex_.unlock();
+
+          return 0;
+        }
+
+        fd    = slave -> fdout_;
+        fdmax = max(fd, slave -> cancelFd_[0]);
+
+        FD_ZERO(&rfd);
+        FD_ZERO(&wfd);
+
+        FD_SET(slave -> cancelFd_[0], &rfd);
+        FD_SET(fd, &wfd);
+
+        slave -> writeMutex_.unlock();
+
+        if (select(fdmax + 1, &rfd, &wfd, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+
+          break;
+        }
+
+        if (FD_ISSET(slave -> cancelFd_[0], &rfd) && slaveCanceled(slave))
+        {
+          break;
+        }
+
+        if (FD_ISSET(fd, &wfd) && slaveDrain(slave, 0))
+        {
+          break;
+        }
+      }
+    }
+    #endif
+
+    slave -> writeMutex_.lock();
+
+    slave -> rxAsync_ = 0;
+
+    slave -> writeMutex_.unlock();
+
+    return 0;
+  }
+
+} /* namespace Tegenaria */
@@ -0,0 +1,1206 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Epoll based I/O engine for IOMixer (IOMIXER_MODE_REACTOR).
+//          Linux only, other systems use IOMIXER_MODE_THREADS.
+//
+//          Instead of one thread per slave, all slave FDs (and master IN
+//          if it's FD or socket) are watched by one or N shared reactor
+//          loops. Wire format <id><flags><size><data> is the same in both
+//          modes, so reactor and thread based mixers can talk each other.
+//
+//          Slave #1 \
+//          Slave #2 -> [loop #0] \
+//          ...                   -> master OUT
+//          Slave #3 -> [loop #1] /
+//          Slave #4 /
+//
+
+#include "IOMixer.h"
+
+namespace Tegenaria
+{
+  //
+  // Keys stored in epoll_event.data.u64 to recognize special FDs.
+  // Any other value is slave ID, optionally combined with
+  // IOMIXER_REACTOR_KEY_OUT for slave output (fdout_).
+  //
+
+  #define IOMIXER_REACTOR_KEY_MASTER uint64_t(-1)
+  #define IOMIXER_REACTOR_KEY_WAKEUP uint64_t(-2)
+  #define IOMIXER_REACTOR_KEY_OUT    (uint64_t(1) << 32)
+
+  //
+  // Switch IOMixer into reactor mode, where slaves are served by
+  // <loopsCount> shared epoll loops instead of one thread per slave.
+  //
+  // Master IN is dispatched by loop #0 if it's FD or socket. Callback
+  // based master IN still uses own master thread, because it can't be
+  // polled.
+  //
+  // TIP#1: Reactor mode needs epoll (Linux). On other systems mixer stays
+  //        in IOMIXER_MODE_THREADS and 0 is returned.
+  //
+  // WARNING#1: Must be called before first addSlave() and start() call.
+  //
+  // WARNING#2: In reactor mode slave dead callback is called from
+  //            reactor loop. It should NOT drop the last reference to
+  //            IOMixer object.
+  //
+  // loopsCount - number of reactor loops (threads) to create.
+  //              Slaves are assigned to loops in round-robin order (IN/OPT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::setReactorMode(int loopsCount)
+  {
+    DBG_ENTER("IOMixer::setReactorMode");
+
+    int exitCode = -1;
+
+    int locked = 0;
+
+    #ifndef IOMIXER_HAVE_REACTOR
+    {
+      Error("WARNING: IOMixer reactor mode is not available on this system,"
+                " using threads mode.\n");
+
+      exitCode = 0;
+    }
+    #else
+    {
+      IOMixerLoop *loop = NULL;
+
+      struct epoll_event ev = {0};
+
+      FAILEX(init_ == 0, "ERROR: IOMixer object was not initiated correctly.\n");
+      FAILEX(loopsCount <= 0, "ERROR: Wrong loops count [%d].\n", loopsCount);
+      FAILEX(mode_ == IOMIXER_MODE_REACTOR, "ERROR: Reactor mode already set.\n");
+
+      slavesMutex_.lock();
+
+      locked = 1;
+
+      if (slaves_.size() > 0)
+      {
+        Error("ERROR: Reactor mode must be set before addSlave().\n");
+
+        goto fail;
+      }
+
+      for (int i = 0; i < loopsCount; i++)
+      {
+        loop = (IOMixerLoop *) calloc(1, sizeof(IOMixerLoop));
+
+        FAILEX(loop == NULL, "ERROR: Out of memory.\n");
+
+        loop -> index_       = i;
+        loop -> this_        = this;
+        loop -> wakeupFd_[0] = -1;
+        loop -> wakeupFd_[1] = -1;
+        loop -> epollFd_     = epoll_create(IOMIXER_REACTOR_MAX_EVENTS);
+        loop -> buf_         = (char *) malloc(IOMIXER_MAX_PACKET);
+
+        loops_.push_back(loop);
+
+        FAILEX(loop -> epollFd_ < 0, "ERROR: Cannot create epoll for reactor loop #%d.\n", i);
+        FAILEX(loop -> buf_ == NULL, "ERROR: Out of memory.\n");
+        FAILEX(pipe(loop -> wakeupFd_), "ERROR: Cannot create wakeup pipe for loop #%d.\n", i);
+
+        DBG_SET_ADD("fd", loop -> epollFd_, "IOMixerLoop::epollFd_");
+        DBG_SET_ADD("fd", loop -> wakeupFd_[0], "IOMixerLoop::wakeupFd_[0]");
+        DBG_SET_ADD("fd", loop -> wakeupFd_[1], "IOMixerLoop::wakeupFd_[1]");
+
+        ev.events   = EPOLLIN;
+        ev.data.u64 = IOMIXER_REACTOR_KEY_WAKEUP;
+
+        FAILEX(epoll_ctl(loop -> epollFd_, EPOLL_CTL_ADD, loop -> wakeupFd_[0], &ev),
+                   "ERROR: Cannot add wakeup pipe to reactor loop #%d.\n", i);
+
+        loop -> thread_ = ThreadCreate((ThreadEntryProto) reactorLoop, loop);
+
+        DBG_SET_RENAME("thread", loop -> thread_, "IOMixer::reactorLoop");
+      }
+
+      mode_ = IOMIXER_MODE_REACTOR;
+
+      slavesMutex_.unlock();
+
+      locked = 0;
+
+      DEBUG1("IOMixer::setReactorMode : Created [%d] reactor loops for IOMixer PTR#%p.\n",
+                 loopsCount, this);
+
+      exitCode = 0;
+    }
+    #endif
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    if (locked)
+    {
+      slavesMutex_.unlock();
+    }
+
+    if (exitCode && mode_ != IOMIXER_MODE_REACTOR && loops_.size() > 0)
+    {
+      reactorStop();
+    }
+
+    DBG_LEAVE("IOMixer::setReactorMode");
+
+    return exitCode;
+  }
+
+  //
+  // Stop and free all reactor loops created by setReactorMode().
+  // Slaves still attached to loops are detached, but NOT removed.
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorStop()
+  {
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      map<int, IOMixerSlave *>::iterator it;
+
+      if (loops_.empty())
+      {
+        return 0;
+      }
+
+      DEBUG1("IOMixer::reactorStop : Stopping [%d] reactor loops for IOMixer PTR#%p...\n",
+                 int(loops_.size()), this);
+
+      //
+      // Wake up and join all loops.
+      //
+
+      for (int i = 0; i < int(loops_.size()); i++)
+      {
+        IOMixerLoop *loop = loops_[i];
+
+        loop -> stop_ = 1;
+
+        if (loop -> thread_)
+        {
+          if (write(loop -> wakeupFd_[1], "x", 1) <= 0)
+          {
+            DEBUG1("WARNING: Cannot wake up reactor loop #%d.\n", i);
+          }
+
+          ThreadWait(loop -> thread_);
+          ThreadClose(loop -> thread_);
+
+          loop -> thread_ = NULL;
+        }
+      }
+
+      //
+      // No loop is running now. Mark all slaves as detached.
+      //
+
+      slavesMutex_.lock();
+
+      for (it = slaves_.begin(); it != slaves_.end(); it++)
+      {
+        it -> second -> writeMutex_.lock();
+
+        it -> second -> loop_    = -1;
+        it -> second -> events_  = 0;
+        it -> second -> rxAsync_ = 0;
+
+        it -> second -> writeMutex_.unlock();
+      }
+
+      masterReactor_ = 0;
+
+      slavesMutex_.unlock();
+
+      //
+      // Free loops.
+      //
+
+      for (int i = 0; i < int(loops_.size()); i++)
+      {
+        IOMixerLoop *loop = loops_[i];
+
+        if (loop -> epollFd_ >= 0)
+        {
+          close(loop -> epollFd_);
+
+          DBG_SET_DEL("fd", loop -> epollFd_);
+        }
+
+        for (int j = 0; j < 2; j++)
+        {
+          if (loop -> wakeupFd_[j] >= 0)
+          {
+            close(loop -> wakeupFd_[j]);
+
+            DBG_SET_DEL("fd", loop -> wakeupFd_[j]);
+          }
+        }
+
+        free(loop -> buf_);
+        free(loop);
+      }
+
+      loops_.clear();
+    }
+    #endif
+
+    return 0;
+  }
+
+  //
+  // Attach slave to one of reactor loops.
+  // Called internally from addSlave() with slavesMutex_ locked.
+  //
+  // slave - slave to attach (IN/OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorAttachSlave(IOMixerSlave *slave)
+  {
+    int exitCode = -1;
+
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      struct epoll_event ev = {0};
+
+      IOMixerLoop *loop = NULL;
+
+      FAILEX(loops_.empty(), "ERROR: Reactor loops not created.\n");
+
+      loop = loops_[slave -> id_ % loops_.size()];
+
+      //
+      // Loop must never block on slave read.
+      // It's our own side of pipe, so nobody else is affected.
+      //
+
+      fcntl(slave -> fdin_, F_SETFL, fcntl(slave -> fdin_, F_GETFL) | O_NONBLOCK);
+
+      ev.events   = EPOLLIN;
+      ev.data.u64 = uint64_t(slave -> id_);
+
+      FAILEX(epoll_ctl(loop -> epollFd_, EPOLL_CTL_ADD, slave -> fdin_, &ev),
+                 "ERROR: Cannot add slave ID#%d to reactor loop #%d.\n",
+                     slave -> id_, loop -> index_);
+
+      slave -> loop_   = loop -> index_;
+      slave -> events_ = EPOLLIN;
+
+      DEBUG2("IOMixer::reactorAttachSlave : Slave ID#%d attached to reactor loop #%d.\n",
+                 slave -> id_, loop -> index_);
+
+      exitCode = 0;
+    }
+    #endif
+
+    fail:
+
+    return exitCode;
+  }
+
+  //
+  // Detach slave from its reactor loop. Loop may still be processing
+  // data read from slave when we return, use reactorWaitSlave() before
+  // closing slave FDs.
+  //
+  // Called internally with slavesMutex_ locked.
+  //
+  // slave - slave to detach (IN/OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorDetachSlave(IOMixerSlave *slave)
+  {
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      struct epoll_event ev = {0};
+
+      slave -> writeMutex_.lock();
+
+      if (slave -> loop_ != -1 && slave -> loop_ < int(loops_.size()))
+      {
+        DEBUG2("IOMixer::reactorDetachSlave : Detaching slave ID#%d from reactor loop #%d...\n",
+                   slave -> id_, slave -> loop_);
+
+        if (slave -> events_ & EPOLLIN)
+        {
+          epoll_ctl(loops_[slave -> loop_] -> epollFd_, EPOLL_CTL_DEL, slave -> fdin_, &ev);
+        }
+
+        if ((slave -> events_ & EPOLLOUT) && slave -> fdout_ != -1)
+        {
+          epoll_ctl(loops_[slave -> loop_] -> epollFd_, EPOLL_CTL_DEL, slave -> fdout_, &ev);
+        }
+      }
+
+      //
+      // Nobody watches slave output from now. Data from master will be
+      // written to slave in blocking mode.
+      //
+
+      slave -> loop_    = -1;
+      slave -> events_  = 0;
+      slave -> rxAsync_ = 0;
+
+      slave -> writeMutex_.unlock();
+    }
+    #endif
+
+    return 0;
+  }
+
+  //
+  // Wait until reactor loop finished processing slave with given ID.
+  // Slave must be detached by reactorDetachSlave() before, so loop will
+  // not pick it up again.
+  //
+  // Called internally with slavesMutex_ locked. Lock is released while
+  // waiting, so other loops are not stalled, and locked again before
+  // return. Slave could be removed by another thread in the meantime,
+  // so caller must use returned pointer instead of the old one.
+  //
+  // id - ID of slave to wait for (IN).
+  //
+  // RETURNS: Pointer to idle slave,
+  //          or NULL if slave was removed while waiting.
+  //
+
+  IOMixerSlave *IOMixer::reactorWaitSlave(int id)
+  {
+    IOMixerSlave *slave = getSlave(id);
+
+    while (slave)
+    {
+      //
+      // Check busy flag and register as waiter under the same lock,
+      // which loop uses to clear the flag, so wake up can't be lost.
+      //
+
+      reactorIdleMutex_.lock();
+
+      if (slave -> busy_ == 0)
+      {
+        reactorIdleMutex_.unlock();
+
+        break;
+      }
+
+      reactorIdleWaiters_ ++;
+
+      reactorIdleMutex_.unlock();
+
+      DEBUG2("IOMixer::reactorWaitSlave : Waiting for reactor loop to release"
+                 " slave ID#%d...\n", id);
+
+      slavesMutex_.unlock();
+
+      reactorIdleSem_.wait();
+
+      slavesMutex_.lock();
+
+      //
+      // Semaphore is shared by all slaves. Check again.
+      //
+
+      slave = getSlave(id);
+    }
+
+    return slave;
+  }
+
+  //
+  // Clear slave's busy flag set by reactor loop and wake up threads
+  // waiting in reactorWaitSlave().
+  //
+  // WARNING: Slave may be freed by woken thread, don't touch it
+  //          after this call.
+  //
+  // slave - slave released by reactor loop (IN/OUT).
+  //
+
+  void IOMixer::reactorReleaseSlave(IOMixerSlave *slave)
+  {
+    reactorIdleMutex_.lock();
+
+    slave -> busy_ = 0;
+
+    for (int i = 0; i < reactorIdleWaiters_; i++)
+    {
+      reactorIdleSem_.signal();
+    }
+
+    reactorIdleWaiters_ = 0;
+
+    reactorIdleMutex_.unlock();
+  }
+
+  //
+  // Update events watched for slave in its reactor loop:
+  //
+  // - EPOLLIN on slave input if it's not closed and remote window is
+  //   not full.
+  //
+  // - EPOLLOUT on slave output if there are data queued for slave.
+  //
+  // slave - related slave (IN/OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorUpdateSlave(IOMixerSlave *slave)
+  {
+    int exitCode = -1;
+
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      struct epoll_event ev = {0};
+
+      int epollFd = -1;
+      int events  = 0;
+
+      slave -> writeMutex_.lock();
+
+      if (slave -> loop_ == -1)
+      {
+        slave -> writeMutex_.unlock();
+
+        return 0;
+      }
+
+      epollFd = loops_[slave -> loop_] -> epollFd_;
+
+      if (slave -> inputClosed_ == 0 && flowCredit(slave) > 0)
+      {
+        events |= EPOLLIN;
+      }
+
+      if (slave -> rxQueue_ && slave -> rxQueue_ -> size() > 0 && slave -> fdout_ != -1)
+      {
+        events |= EPOLLOUT;
+      }
+
+      //
+      // Slave input. Removed from epoll set instead of clearing EPOLLIN,
+      // because EPOLLHUP would be still reported otherwise.
+      //
+
+      if ((events & EPOLLIN) && (slave -> events_ & EPOLLIN) == 0)
+      {
+        ev.events   = EPOLLIN;
+        ev.data.u64 = uint64_t(slave -> id_);
+
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, slave -> fdin_, &ev))
+        {
+          Error("ERROR: Cannot add slave ID#%d input to reactor.\n", slave -> id_);
+        }
+      }
+      else if ((events & EPOLLIN) == 0 && (slave -> events_ & EPOLLIN))
+      {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, slave -> fdin_, &ev);
+      }
+
+      //
+      // Slave output. Watched only while there are queued data.
+      //
+
+      if ((events & EPOLLOUT) && (slave -> events_ & EPOLLOUT) == 0)
+      {
+        ev.events   = EPOLLOUT;
+        ev.data.u64 = uint64_t(slave -> id_) | IOMIXER_REACTOR_KEY_OUT;
+
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, slave -> fdout_, &ev))
+        {
+          Error("ERROR: Cannot add slave ID#%d output to reactor.\n", slave -> id_);
+        }
+      }
+      else if ((events & EPOLLOUT) == 0 && (slave -> events_ & EPOLLOUT) && slave -> fdout_ != -1)
+      {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, slave -> fdout_, &ev);
+      }
+
+      slave -> events_ = events;
+
+      slave -> writeMutex_.unlock();
+
+      exitCode = 0;
+    }
+    #endif
+
+    return exitCode;
+  }
+
+  //
+  // Attach master IN to reactor loop #0.
+  // Called internally from start().
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorAttachMaster()
+  {
+    int exitCode = -1;
+
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      struct epoll_event ev = {0};
+
+      FAILEX(loops_.empty(), "ERROR: Reactor loops not created.\n");
+
+      //
+      // Buffer big enough to store one whole packet including compressed
+      // data, which can be a little bigger than original.
+      //
+
+      if (masterInBuf_ == NULL)
+      {
+        masterInBufSize_ = IOMIXER_MAX_PACKET * 2;
+
+        masterInBuf_ = (char *) malloc(masterInBufSize_);
+
+        FAILEX(masterInBuf_ == NULL, "ERROR: Out of memory.\n");
+      }
+
+      masterInLen_   = 0;
+      masterReactor_ = 1;
+
+      ev.events   = EPOLLIN;
+      ev.data.u64 = IOMIXER_REACTOR_KEY_MASTER;
+
+      FAILEX(epoll_ctl(loops_[0] -> epollFd_, EPOLL_CTL_ADD, masterIn_, &ev),
+                 "ERROR: Cannot add master IN [%d] to reactor loop.\n", masterIn_);
+
+      DEBUG1("IOMixer::reactorAttachMaster : Master IN [%d] attached to reactor loop #0.\n",
+                 masterIn_);
+
+      exitCode = 0;
+    }
+    #endif
+
+    fail:
+
+    if (exitCode)
+    {
+      masterReactor_ = 0;
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Stop watching master IN inside reactor.
+  // Called internally from reactor loop #0, when master EOF received
+  // or connection broken.
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorDetachMaster()
+  {
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      struct epoll_event ev = {0};
+
+      if (masterReactor_ && loops_.size() > 0)
+      {
+        epoll_ctl(loops_[0] -> epollFd_, EPOLL_CTL_DEL, masterIn_, &ev);
+      }
+
+      masterReactor_ = 0;
+    }
+    #endif
+
+    return 0;
+  }
+
+  //
+  // Reactor loop routine. One loop = one thread shared by many slaves.
+  // Used internally only.
+  //
+  // -> slave1 \
+  // -> slave2 -> [loop] -> master
+  // -> slave3 /
+  //
+  // loop - pointer to related loop context (IN/OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOMixer::reactorLoop(IOMixerLoop *loop)
+  {
+    DBG_ENTER("IOMixer::reactorLoop");
+
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      struct epoll_event events[IOMIXER_REACTOR_MAX_EVENTS];
+
+      IOMixer *this_ = loop -> this_;
+
+      char dummy[64];
+
+      int eventsCount = 0;
+
+      DEBUG1("IOMixer::reactorLoop : Reactor loop #%d started.\n", loop -> index_);
+
+      while(loop -> stop_ == 0)
+      {
+        eventsCount = epoll_wait(loop -> epollFd_, events,
+                                     IOMIXER_REACTOR_MAX_EVENTS, -1);
+
+        if (eventsCount < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+
+          Error("ERROR: epoll_wait() failed in reactor loop #%d."
+                    " Error code is : %d.\n", loop -> index_, errno);
+
+          break;
+        }
+
+        for (int i = 0; i < eventsCount && loop -> stop_ == 0; i++)
+        {
+          switch(events[i].data.u64)
+          {
+            //
+            // Wake up request. Just drain pipe.
+            //
+
+            case IOMIXER_REACTOR_KEY_WAKEUP:
+            {
+              if (read(loop -> wakeupFd_[0], dummy, sizeof(dummy)) < 0)
+              {
+                DEBUG1("WARNING: Cannot drain wakeup pipe in loop #%d.\n", loop -> index_);
+              }
+
+              break;
+            }
+
+            //
+            // Data on master IN.
+            //
+
+            case IOMIXER_REACTOR_KEY_MASTER:
+            {
+              this_ -> reactorMasterEvent();
+
+              break;
+            }
+
+            //
+            // Data on one of slaves.
+            //
+
+            default:
+            {
+              if (events[i].data.u64 & IOMIXER_REACTOR_KEY_OUT)
+              {
+                this_ -> reactorSlaveOutEvent(loop, int(events[i].data.u64 & 0xffffffff));
+              }
+              else
+              {
+                this_ -> reactorSlaveEvent(loop, int(events[i].data.u64));
+              }
+            }
+          }
+        }
+
+        //
+        // Write packets coalesced during this batch.
+        //
+
+        this_ -> masterMutex_.lock();
+
+        if (this_ -> masterFlushQueue() != 0 && this_ -> quietMode_ == 0)
+        {
+          Error("ERROR: Cannot flush send queue in reactor loop #%d.\n", loop -> index_);
+        }
+
+        this_ -> masterMutex_.unlock();
+      }
+
+      DEBUG1("IOMixer::reactorLoop : Reactor loop #%d finished.\n", loop -> index_);
+    }
+    #endif
+
+    DBG_LEAVE("IOMixer::reactorLoop");
+
+    return 0;
+  }
+
+  //
+  // Handle readable slave inside reactor loop. Reactor counterpart
+  // of one slaveLoop() iteration.
+  //
+  // Copy <data> readed from slave into <id><flags><size><data> written
+  // to master OUT. If slave reached EOF, EOF packet is sent and slave
+  // is detached from loop.
+  //
+  // loop - loop, where event arrived (IN).
+  // id   - ID of readable slave (IN).
+  //
+
+  void IOMixer::reactorSlaveEvent(IOMixerLoop *loop, int id)
+  {
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      IOMixerSlave *slave = NULL;
+
+      int readed   = -1;
+      int ret      = -1;
+      int fd       = -1;
+      int finished = 0;
+      int credit   = 0;
+
+      //
+      // Find slave and mark it as busy, so removeSlave() will wait
+      // until we finished.
+      //
+
+      slavesMutex_.lock();
+
+      slave = getSlave(id);
+
+      if (slave == NULL || slave -> loop_ != loop -> index_ || dead_)
+      {
+        slavesMutex_.unlock();
+
+        return;
+      }
+
+      slave -> busy_ = 1;
+
+      fd     = slave -> fdin_;
+      credit = flowCredit(slave);
+
+      slavesMutex_.unlock();
+
+      //
+      // Remote window is full. Stop watching slave until credits arrive.
+      //
+
+      if (credit <= 0)
+      {
+        reactorUpdateSlave(slave);
+
+        reactorReleaseSlave(slave);
+
+        return;
+      }
+
+      //
+      // Read <data> from slave.
+      //
+
+      DBG_IO_READ_BEGIN(objectName(), id, loop -> buf_, credit);
+
+      readed = read(fd, loop -> buf_, credit);
+
+      DBG_IO_READ_END(objectName(), id, loop -> buf_, readed);
+
+      if (readed < 0 && (errno == EAGAIN || errno == EINTR))
+      {
+        //
+        // Spurious wake up. Nothing to do.
+        //
+      }
+
+      //
+      // Write <id><flags><readed><data> into master.
+      // Zero or negative <readed> means EOF sent to remote.
+      //
+
+      else
+      {
+        DEBUG4("IOMixer::reactorSlaveEvent : Readed [%d] bytes from slave"
+                    " FD [%d] ID [%d].\n", readed, fd, id);
+
+        DBG_IO_WRITE_BEGIN(objectName(), 0, loop -> buf_, readed);
+
+        ret = slaveEncode(slave, loop -> buf_, readed);
+
+        DBG_IO_WRITE_END(objectName(), 0, loop -> buf_, readed);
+
+        if (ret != 0 || readed <= 0)
+        {
+          finished = 1;
+        }
+        else
+        {
+          slave -> txSent_ += readed;
+        }
+      }
+
+      //
+      // Slave input finished, but there are still data from remote queued
+      // for slave output. Keep slave attached until they're written.
+      //
+
+      if (finished && ret == 0 && slave -> rxAsync_ && slavePending(slave) > 0)
+      {
+        slave -> inputClosed_ = 1;
+        slave -> eofSent_     = 1;
+
+        finished = 0;
+      }
+
+      //
+      // Flow control. Stop or resume watching slave if needed.
+      //
+
+      if (finished == 0 && slave -> rxQueue_)
+      {
+        reactorUpdateSlave(slave);
+      }
+
+      //
+      // Release slave. Must be done before taking slavesMutex_ again to
+      // avoid dead lock with removeSlave() waiting for us.
+      //
+
+      reactorReleaseSlave(slave);
+
+      //
+      // EOF or error. Slave finished.
+      // Detach it from loop and tell caller.
+      //
+
+      if (finished)
+      {
+        reactorSlaveFinished(loop, id);
+      }
+    }
+    #endif
+  }
+
+  //
+  // Handle writable slave output inside reactor loop. Write data queued
+  // for slave by slaveDeliver().
+  //
+  // loop - loop, where event arrived (IN).
+  // id   - ID of writable slave (IN).
+  //
+
+  void IOMixer::reactorSlaveOutEvent(IOMixerLoop *loop, int id)
+  {
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      IOMixerSlave *slave = NULL;
+
+      int finished = 0;
+
+      slavesMutex_.lock();
+
+      slave = getSlave(id);
+
+      if (slave == NULL || slave -> loop_ != loop -> index_ || dead_)
+      {
+        slavesMutex_.unlock();
+
+        return;
+      }
+
+      slave -> busy_ = 1;
+
+      slavesMutex_.unlock();
+
+      slaveDrain(slave, 0);
+
+      //
+      // Slave input was closed before and all queued data are written.
+      // Nothing more to do with this slave.
+      //
+
+      if (slave -> inputClosed_ && slavePending(slave) == 0)
+      {
+        finished = 1;
+      }
+      else
+      {
+        reactorUpdateSlave(slave);
+      }
+
+      reactorReleaseSlave(slave);
+
+      if (finished)
+      {
+        reactorSlaveFinished(loop, id);
+      }
+    }
+    #endif
+  }
+
+  //
+  // Detach finished slave from reactor loop and tell caller.
+  // Reactor counterpart of slaveLoop() exit.
+  //
+  // loop - loop, where slave was attached (IN).
+  // id   - ID of finished slave (IN).
+  //
+
+  void IOMixer::reactorSlaveFinished(IOMixerLoop *loop, int id)
+  {
+    IOMixerSlave *slave = NULL;
+
+    int finished = 0;
+
+    DEBUG1("IOMixer::reactorSlaveFinished : Job for slave ID [%d] for FDs [%d][%d]"
+                " finished.\n", id, masterOut_, masterIn_);
+
+    slavesMutex_.lock();
+
+    slave = getSlave(id);
+
+    if (slave && slave -> loop_ == loop -> index_)
+    {
+      reactorDetachSlave(slave);
+
+      slave -> eofSent_ = 1;
+
+      finished = 1;
+    }
+
+    slavesMutex_.unlock();
+
+    if (finished && slaveDeadCallback_)
+    {
+      slaveDeadCallback_(id, slaveDeadCallbackCtx_);
+    }
+  }
+
+  //
+  // Handle readable master IN inside reactor loop #0. Reactor counterpart
+  // of masterLoop().
+  //
+  // Read as many bytes as available without blocking, then dispatch every
+  // complete <id><flags><size><data> packet. Incomplete tail is kept
+  // until next event.
+  //
+
+  void IOMixer::reactorMasterEvent()
+  {
+    #ifdef IOMIXER_HAVE_REACTOR
+    {
+      int readed   = -1;
+      int offset   = 0;
+      int finished = 0;
+
+      int id   = 0;
+      int size = 0;
+
+      IOMixerPacketHead head;
+
+      char *data = NULL;
+
+      if (masterReactor_ == 0)
+      {
+        return;
+      }
+
+      //
+      // Read available bytes. Loop is level triggered and master IN is
+      // readable here, so below calls don't block.
+      //
+
+      if (masterInType_ == IOMIXER_TYPE_SOCKET)
+      {
+        readed = recv(masterIn_, masterInBuf_ + masterInLen_,
+                          masterInBufSize_ - masterInLen_, MSG_DONTWAIT);
+      }
+      else
+      {
+        readed = read(masterIn_, masterInBuf_ + masterInLen_,
+                          masterInBufSize_ - masterInLen_);
+      }
+
+      if (readed < 0 && (errno == EAGAIN || errno == EINTR))
+      {
+        return;
+      }
+
+      if (readed <= 0)
+      {
+        finished = 1;
+      }
+      else
+      {
+        DBG_DUMP(masterInBuf_ + masterInLen_, readed);
+
+        masterInLen_ += readed;
+      }
+
+      //
+      // Dispatch every complete packet.
+      //
+
+      while(finished == 0 && masterInLen_ - offset >= int(sizeof(head)))
+      {
+        memcpy(&head, masterInBuf_ + offset, sizeof(head));
+
+        id   = head.channelId_;
+        size = head.dataSize_;
+
+        DEBUG3("IOMixer::reactorMasterEvent : Readed <%d><%d><%d> head"
+                    " from master [%d].", id, int(head.flags_), size, masterIn_);
+
+        if (size > masterInBufSize_ - int(sizeof(head)))
+        {
+          Error("ERROR: Packet too big.\n");
+
+          finished = 1;
+
+          break;
+        }
+
+        //
+        // Wait for rest of packet.
+        //
+
+        if (size > 0 && masterInLen_ - offset - int(sizeof(head)) < size)
+        {
+          break;
+        }
+
+        data = masterInBuf_ + offset + sizeof(head);
+
+        offset += sizeof(head) + max(size, 0);
+
+        //
+        // Drop plain packets sent to encrypted channel, they can't be
+        // authenticated.
+        //
+
+        if ((head.flags_ & IOMIXER_FLAG_ENCRYPTION_ON) == 0 && cipherRequired(id))
+        {
+          Error("ERROR: Dropped unencrypted packet for encrypted channel ID#%d.\n", id);
+
+          continue;
+        }
+
+        //
+        // Incoming data encrypted.
+        // Verify and decrypt in place. Packet, which can't be
+        // authenticated closes its channel like EOF.
+        //
+
+        if (size > 0 && (head.flags_ & IOMIXER_FLAG_ENCRYPTION_ON))
+        {
+          size = max(cipherDecrypt(id, data, size), 0);
+        }
+
+        //
+        // Incoming data compressed.
+        // Decompress into loop buffer.
+        //
+
+        if (size > 0 && (head.flags_ & IOMIXER_FLAG_COMPRESSION_ON))
+        {
+          size = codecDecode(id, head.flags_, data, size,
+                                 loops_[0] -> buf_, IOMIXER_MAX_PACKET);
+
+          FAIL(size < 0);
+
+          data = loops_[0] -> buf_;
+        }
+
+        masterDispatch(id, data, size);
+
+        if (masterEofReceived_)
+        {
+          finished = 1;
+        }
+      }
+
+      //
+      // Move incomplete tail to the begin of buffer.
+      //
+
+      if (offset > 0)
+      {
+        memmove(masterInBuf_, masterInBuf_ + offset, masterInLen_ - offset);
+
+        masterInLen_ -= offset;
+      }
+
+      goto done;
+
+      //
+      // Error handler.
+      //
+
+      fail:
+
+      finished = 1;
+
+      done:
+
+      //
+      // Master EOF or connection broken.
+      //
+
+      if (finished)
+      {
+        DEBUG1("IOMixer::reactorMasterEvent : Master IN [%d] finished.\n", masterIn_);
+
+        if (masterEofReceived_ == 0)
+        {
+          if (quietMode_ == 0)
+          {
+            Error("IOMixer::reactorMasterEvent : connection broken.\n");
+          }
+
+          masterEofReceived_ = 1;
+        }
+
+        reactorDetachMaster();
+
+        //
+        // Tell caller about master #0 dead.
+        //
+
+        if (slaveDeadCallback_)
+        {
+          slaveDeadCallback_(0, slaveDeadCallbackCtx_);
+        }
+      }
+    }
+    #endif
+  }
+} /* namespace Tegenaria */
@@ -0,0 +1,952 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Single thread epoll based reactor pumping data between FDs
+//          and IOFifo queues. Systems without epoll use poll() instead.
+//
+//          fd #1 --> [ queue #1 ] --> callback
+//          fd #2 <-- [ queue #2 ] <-- wantWrite()
+//          ...
+//
+//          Input FDs are watched in edge-triggered mode, so every event
+//          is served by reading until EAGAIN directly into queue memory
+//          (IOFifo::readFrom()). If queue becomes full, FD is remembered
+//          as pending and read again as soon as queue has free space.
+//
+//          poll() is level-triggered, so input FDs with full queue and
+//          output FDs with empty queue are not polled at all. This gives
+//          the same behaviour as edge-triggered epoll.
+//
+//          Idle timeouts are served by hashed timer wheel with
+//          IOREACTOR_WHEEL_SLOTS slots, one slot per tick. Any I/O on FD
+//          moves its timer forward.
+//
+
+#include <cstring>
+#include <cstdlib>
+
+#include "IOReactor.h"
+#include <Tegenaria/Debug.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <unistd.h>
+# include <fcntl.h>
+# include <errno.h>
+# include <time.h>
+#endif
+
+namespace Tegenaria
+{
+  // ----------------------------------------------------------------------------
+  //
+  //                         Constructors and destructors
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Create empty reactor.
+  //
+  // tickMs - resolution of idle timers in ms (IN/OPT).
+  //
+
+  IOReactor::IOReactor(int tickMs)
+  {
+    DBG_SET_ADD("IOReactor", this);
+
+    epollFd_     = -1;
+    wakeupFd_[0] = -1;
+    wakeupFd_[1] = -1;
+    stop_        = 0;
+    tickMs_      = (tickMs > 0) ? tickMs : IOREACTOR_DEFAULT_TICK;
+    timersCount_ = 0;
+
+    memset(wheel_, 0, sizeof(wheel_));
+
+    lastTick_ = getTick();
+
+    #ifdef WIN32
+    {
+      Error("ERROR: IOReactor is not implemented on Windows.\n");
+    }
+    #elif defined(IOREACTOR_USE_EPOLL)
+    {
+      struct epoll_event ev = {0};
+
+      epollFd_ = epoll_create(IOREACTOR_MAX_EVENTS);
+
+      if (epollFd_ < 0 || pipe(wakeupFd_))
+      {
+        Error("ERROR: Cannot create epoll for IOReactor PTR#%p.\n", this);
+      }
+      else
+      {
+        DBG_SET_ADD("fd", epollFd_, "IOReactor::epollFd_");
+        DBG_SET_ADD("fd", wakeupFd_[0], "IOReactor::wakeupFd_[0]");
+        DBG_SET_ADD("fd", wakeupFd_[1], "IOReactor::wakeupFd_[1]");
+
+        fcntl(wakeupFd_[0], F_SETFL, fcntl(wakeupFd_[0], F_GETFL) | O_NONBLOCK);
+
+        ev.events  = EPOLLIN;
+        ev.data.fd = wakeupFd_[0];
+
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_[0], &ev);
+      }
+    }
+
+    //
+    // poll() based. Only wakeup pipe is needed, poll set is built
+    // on every runOnce() call.
+    //
+
+    #else
+    {
+      if (pipe(wakeupFd_))
+      {
+        Error("ERROR: Cannot create wakeup pipe for IOReactor PTR#%p.\n", this);
+
+        wakeupFd_[0] = -1;
+        wakeupFd_[1] = -1;
+      }
+      else
+      {
+        DBG_SET_ADD("fd", wakeupFd_[0], "IOReactor::wakeupFd_[0]");
+        DBG_SET_ADD("fd", wakeupFd_[1], "IOReactor::wakeupFd_[1]");
+
+        fcntl(wakeupFd_[0], F_SETFL, fcntl(wakeupFd_[0], F_GETFL) | O_NONBLOCK);
+      }
+    }
+    #endif
+  }
+
+  //
+  // Free resources allocated by reactor.
+  // FDs added by addFd() are NOT closed.
+  //
+
+  IOReactor::~IOReactor()
+  {
+    DBG_SET_DEL("IOReactor", this);
+
+    std::map<int, IOReactorEntry *>::iterator it;
+
+    for (it = entries_.begin(); it != entries_.end(); it++)
+    {
+      free(it -> second);
+    }
+
+    entries_.clear();
+
+    #ifndef WIN32
+    for (int i = 0; i < 2; i++)
+    {
+      if (wakeupFd_[i] != -1)
+      {
+        close(wakeupFd_[i]);
+
+        DBG_SET_DEL("fd", wakeupFd_[i]);
+      }
+    }
+
+    if (epollFd_ != -1)
+    {
+      close(epollFd_);
+
+      DBG_SET_DEL("fd", epollFd_);
+    }
+    #endif
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                                Watched FDs
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Start watching FD.
+  //
+  // TIP#1: FD is switched into non-blocking mode.
+  //
+  // TIP#2: The same IOFifo can be passed as input queue for one FD
+  //        and output queue for another one to pump data between them.
+  //
+  // fd        - FD or socket to watch (IN).
+  //
+  // direct    - IOREACTOR_INPUT if data should be read from FD into queue,
+  //             IOREACTOR_OUTPUT if data from queue should be written to
+  //             FD (IN).
+  //
+  // queue     - FIFO to read into or write from (IN/OUT).
+  //
+  // callback  - function called when data was read/written, EOF, error or
+  //             idle timeout occured on FD (IN).
+  //
+  // ctx       - caller defined data passed to callback (IN/OPT).
+  //
+  // timeoutMs - idle timeout in ms, after which IOREACTOR_EVENT_TIMEOUT
+  //             is reported. Set to -1 for infinite (IN/OPT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOReactor::addFd(int fd, int direct, IOFifo *queue,
+                           IOReactorProto callback, void *ctx, int timeoutMs)
+  {
+    DBG_ENTER3("IOReactor::addFd");
+
+    int exitCode = -1;
+
+    #ifdef WIN32
+    {
+      Error("ERROR: IOReactor is not implemented on Windows.\n");
+    }
+    #else
+    {
+      IOReactorEntry *entry = NULL;
+
+      FAILEX(wakeupFd_[0] < 0, "ERROR: IOReactor PTR#%p was not initiated correctly.\n", this);
+      FAILEX(fd < 0, "ERROR: Wrong FD passed to IOReactor::addFd().\n");
+      FAILEX(queue == NULL, "ERROR: Queue cannot be NULL in IOReactor::addFd().\n");
+      FAILEX(entries_.count(fd), "ERROR: FD #%d already added to IOReactor PTR#%p.\n", fd, this);
+
+      FAILEX(direct != IOREACTOR_INPUT && direct != IOREACTOR_OUTPUT,
+                 "ERROR: Wrong direction [%d] for FD #%d.\n", direct, fd);
+
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+      entry = (IOReactorEntry *) calloc(1, sizeof(IOReactorEntry));
+
+      FAILEX(entry == NULL, "ERROR: Out of memory.\n");
+
+      entry -> fd_        = fd;
+      entry -> direct_    = direct;
+      entry -> queue_     = queue;
+      entry -> callback_  = callback;
+      entry -> ctx_       = ctx;
+      entry -> timeoutMs_ = timeoutMs;
+      entry -> slot_      = -1;
+
+      #ifdef IOREACTOR_USE_EPOLL
+      {
+        struct epoll_event ev = {0};
+
+        ev.events  = EPOLLET | ((direct == IOREACTOR_INPUT) ? EPOLLIN : EPOLLOUT);
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev))
+        {
+          Error("ERROR: Cannot add FD #%d to IOReactor PTR#%p.\n"
+                    "Error code is : %d.\n", fd, this, errno);
+
+          free(entry);
+
+          goto fail;
+        }
+      }
+      #endif
+
+      entries_[fd] = entry;
+
+      timerLink(entry);
+
+      DEBUG2("Added FD #%d to IOReactor PTR#%p as %s.\n",
+                 fd, this, direct == IOREACTOR_INPUT ? "input" : "output");
+    }
+    #endif
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE3("IOReactor::addFd");
+
+    return exitCode;
+  }
+
+  //
+  // Stop watching FD. FD itself is NOT closed.
+  // Can be called from inside callback.
+  //
+  // fd - FD passed to addFd() before (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOReactor::removeFd(int fd)
+  {
+    DBG_ENTER3("IOReactor::removeFd");
+
+    int exitCode = -1;
+
+    std::map<int, IOReactorEntry *>::iterator it = entries_.find(fd);
+
+    IOReactorEntry *entry = NULL;
+
+    FAILEX(it == entries_.end(), "ERROR: FD #%d not found in IOReactor PTR#%p.\n", fd, this);
+
+    entry = it -> second;
+
+    #ifdef IOREACTOR_USE_EPOLL
+    {
+      struct epoll_event ev = {0};
+
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &ev);
+    }
+    #endif
+
+    timerUnlink(entry);
+
+    entries_.erase(it);
+
+    free(entry);
+
+    DEBUG2("Removed FD #%d from IOReactor PTR#%p.\n", fd, this);
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE3("IOReactor::removeFd");
+
+    return exitCode;
+  }
+
+  //
+  // Change idle timeout for FD. Timer is restarted from now.
+  //
+  // fd        - FD passed to addFd() before (IN).
+  // timeoutMs - new timeout in ms or -1 for infinite (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOReactor::setTimeout(int fd, int timeoutMs)
+  {
+    std::map<int, IOReactorEntry *>::iterator it = entries_.find(fd);
+
+    if (it == entries_.end())
+    {
+      Error("ERROR: FD #%d not found in IOReactor PTR#%p.\n", fd, this);
+
+      return -1;
+    }
+
+    timerUnlink(it -> second);
+
+    it -> second -> timeoutMs_ = timeoutMs;
+
+    timerLink(it -> second);
+
+    return 0;
+  }
+
+  //
+  // Inform reactor that new data was pushed into output queue.
+  // Data is written at once as long as FD accepts it, rest is written
+  // when FD becomes writable again.
+  //
+  // fd - output FD passed to addFd() before (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOReactor::wantWrite(int fd)
+  {
+    std::map<int, IOReactorEntry *>::iterator it = entries_.find(fd);
+
+    if (it == entries_.end() || it -> second -> direct_ != IOREACTOR_OUTPUT)
+    {
+      Error("ERROR: Output FD #%d not found in IOReactor PTR#%p.\n", fd, this);
+
+      return -1;
+    }
+
+    dispatchWrite(it -> second);
+
+    return 0;
+  }
+
+  //
+  // Return number of watched FDs.
+  //
+
+  int IOReactor::count()
+  {
+    return int(entries_.size());
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                                Timer wheel
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Get current monotonic time in ticks.
+  //
+
+  uint64_t IOReactor::getTick()
+  {
+    #ifdef WIN32
+    {
+      return uint64_t(GetTickCount()) / tickMs_;
+    }
+    #else
+    {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+
+      return (uint64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000) / tickMs_;
+    }
+    #endif
+  }
+
+  //
+  // Put entry into wheel slot matching its deadline.
+  // Does nothing if entry has no timeout.
+  //
+
+  void IOReactor::timerLink(IOReactorEntry *entry)
+  {
+    if (entry -> timeoutMs_ <= 0)
+    {
+      return;
+    }
+
+    entry -> deadline_  = getTick() + (entry -> timeoutMs_ + tickMs_ - 1) / tickMs_;
+    entry -> slot_      = int(entry -> deadline_ % IOREACTOR_WHEEL_SLOTS);
+    entry -> timerPrev_ = NULL;
+    entry -> timerNext_ = wheel_[entry -> slot_];
+
+    if (entry -> timerNext_)
+    {
+      entry -> timerNext_ -> timerPrev_ = entry;
+    }
+
+    wheel_[entry -> slot_] = entry;
+
+    timersCount_++;
+  }
+
+  //
+  // Remove entry from wheel.
+  //
+
+  void IOReactor::timerUnlink(IOReactorEntry *entry)
+  {
+    if (entry -> slot_ < 0)
+    {
+      return;
+    }
+
+    if (entry -> timerPrev_)
+    {
+      entry -> timerPrev_ -> timerNext_ = entry -> timerNext_;
+    }
+    else
+    {
+      wheel_[entry -> slot_] = entry -> timerNext_;
+    }
+
+    if (entry -> timerNext_)
+    {
+      entry -> timerNext_ -> timerPrev_ = entry -> timerPrev_;
+    }
+
+    entry -> slot_      = -1;
+    entry -> timerPrev_ = NULL;
+    entry -> timerNext_ = NULL;
+
+    timersCount_--;
+  }
+
+  //
+  // Walk slots passed since last call and report idle timeout for
+  // expired entries. Entries with deadline in further wheel rounds
+  // are skipped.
+  //
+  // Expired timer is started again before callback is called, so
+  // callback can removeFd() or setTimeout() freely.
+  //
+
+  void IOReactor::timerExpire()
+  {
+    uint64_t now = getTick();
+
+    uint64_t first = lastTick_ + 1;
+
+    std::vector<int> expired;
+
+    if (now < first)
+    {
+      return;
+    }
+
+    if (now - first >= IOREACTOR_WHEEL_SLOTS)
+    {
+      first = now - IOREACTOR_WHEEL_SLOTS + 1;
+    }
+
+    lastTick_ = now;
+
+    for (uint64_t tick = first; tick <= now && timersCount_ > 0; tick++)
+    {
+      IOReactorEntry *entry = wheel_[tick % IOREACTOR_WHEEL_SLOTS];
+
+      while (entry)
+      {
+        if (entry -> deadline_ <= now)
+        {
+          expired.push_back(entry -> fd_);
+        }
+
+        entry = entry -> timerNext_;
+      }
+    }
+
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+      std::map<int, IOReactorEntry *>::iterator it = entries_.find(expired[i]);
+
+      if (it != entries_.end() && it -> second -> deadline_ <= now)
+      {
+        timerUnlink(it -> second);
+        timerLink(it -> second);
+
+        DEBUG3("Idle timeout on FD #%d in IOReactor PTR#%p.\n", expired[i], this);
+
+        dispatch(expired[i], IOREACTOR_EVENT_TIMEOUT, 0);
+      }
+    }
+  }
+
+  //
+  // Get epoll_wait()/poll() timeout. Reactor wakes up every tick as long as
+  // at least one timer is armed. Don't wait at all if one of pending
+  // inputs got free space in its queue (e.g. queue was popped between
+  // runOnce() calls).
+  //
+
+  int IOReactor::nextTimeout(int timeoutMs)
+  {
+    for (size_t i = 0; i < pending_.size(); i++)
+    {
+      std::map<int, IOReactorEntry *>::iterator it = entries_.find(pending_[i]);
+
+      if (it != entries_.end() && it -> second -> queue_ -> bytesLeft() > 0)
+      {
+        return 0;
+      }
+    }
+
+    if (timersCount_ > 0 && (timeoutMs < 0 || timeoutMs > tickMs_))
+    {
+      return tickMs_;
+    }
+
+    return timeoutMs;
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                                 Dispatching
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Call user callback for FD if FD is still watched.
+  //
+
+  void IOReactor::dispatch(int fd, int event, int count)
+  {
+    std::map<int, IOReactorEntry *>::iterator it = entries_.find(fd);
+
+    if (it != entries_.end() && it -> second -> callback_)
+    {
+      IOReactorEntry *entry = it -> second;
+
+      entry -> callback_(this, fd, event, count, entry -> queue_, entry -> ctx_);
+    }
+  }
+
+  //
+  // Read from input FD until EAGAIN, EOF or queue full.
+  // Data is read directly into queue memory.
+  //
+
+  void IOReactor::dispatchRead(IOReactorEntry *entry)
+  {
+    int fd    = entry -> fd_;
+    int total = 0;
+    int event = 0;
+    int code  = 0;
+
+    IOFifo *queue = entry -> queue_;
+
+    #ifndef WIN32
+    for (;;)
+    {
+      int readed = 0;
+
+      //
+      // Queue full. Read again when queue has free space.
+      //
+
+      if (queue -> bytesLeft() == 0)
+      {
+        if (entry -> readPending_ == 0)
+        {
+          entry -> readPending_ = 1;
+
+          pending_.push_back(fd);
+        }
+
+        break;
+      }
+
+      readed = queue -> readFrom(fd);
+
+      if (readed > 0)
+      {
+        total += readed;
+      }
+      else if (readed == 0)
+      {
+        event = IOREACTOR_EVENT_EOF;
+
+        break;
+      }
+      else if (errno == EINTR)
+      {
+        continue;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        break;
+      }
+      else
+      {
+        event = IOREACTOR_EVENT_ERROR;
+        code  = errno;
+
+        break;
+      }
+    }
+    #endif
+
+    if (total > 0)
+    {
+      timerUnlink(entry);
+      timerLink(entry);
+
+      dispatch(fd, IOREACTOR_EVENT_READ, total);
+    }
+
+    if (event)
+    {
+      DEBUG2("%s on FD #%d in IOReactor PTR#%p.\n",
+                 event == IOREACTOR_EVENT_EOF ? "EOF" : "Error", fd, this);
+
+      dispatch(fd, event, code);
+    }
+  }
+
+  //
+  // Write queued data to output FD until queue empty or EAGAIN.
+  // Data is written directly from queue memory.
+  //
+
+  void IOReactor::dispatchWrite(IOReactorEntry *entry)
+  {
+    int fd    = entry -> fd_;
+    int total = 0;
+    int code  = 0;
+
+    IOFifo *queue = entry -> queue_;
+
+    #ifndef WIN32
+    while (queue -> size() > 0)
+    {
+      int written = queue -> writeTo(fd);
+
+      if (written > 0)
+      {
+        total += written;
+      }
+      else if (written < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        break;
+      }
+      else
+      {
+        code = (written < 0) ? errno : EPIPE;
+
+        break;
+      }
+    }
+    #endif
+
+    if (total > 0)
+    {
+      timerUnlink(entry);
+      timerLink(entry);
+
+      dispatch(fd, IOREACTOR_EVENT_WRITE, total);
+    }
+
+    if (code)
+    {
+      DEBUG2("Error on FD #%d in IOReactor PTR#%p.\n", fd, this);
+
+      dispatch(fd, IOREACTOR_EVENT_ERROR, code);
+    }
+  }
+
+  // ----------------------------------------------------------------------------
+  //
+  //                                  Main loop
+  //
+  // ----------------------------------------------------------------------------
+
+  //
+  // Wait for events and dispatch them once.
+  //
+  // timeoutMs - max. time to wait for events in ms or -1 for infinite (IN/OPT).
+  //
+  // RETURNS: Number of FD events dispatched,
+  //          -1 if error.
+  //
+
+  int IOReactor::runOnce(int timeoutMs)
+  {
+    int eventsCount = -1;
+
+    #ifdef WIN32
+    {
+      Error("ERROR: IOReactor is not implemented on Windows.\n");
+    }
+    #else
+    {
+      std::vector<int> ready;
+
+      std::vector<int> pending;
+
+      //
+      // Linux. Wait on epoll.
+      //
+
+      #ifdef IOREACTOR_USE_EPOLL
+      {
+        struct epoll_event events[IOREACTOR_MAX_EVENTS];
+
+        eventsCount = epoll_wait(epollFd_, events,
+                                     IOREACTOR_MAX_EVENTS, nextTimeout(timeoutMs));
+
+        for (int i = 0; i < eventsCount; i++)
+        {
+          ready.push_back(events[i].data.fd);
+        }
+      }
+
+      //
+      // Other systems. Build poll set from current entries.
+      // Skip inputs blocked on full queue and outputs with nothing
+      // to write, otherwise level-triggered poll() would spin.
+      //
+
+      #else
+      {
+        std::vector<struct pollfd> fds;
+
+        std::map<int, IOReactorEntry *>::iterator it;
+
+        struct pollfd pfd = {0};
+
+        pfd.fd     = wakeupFd_[0];
+        pfd.events = POLLIN;
+
+        fds.push_back(pfd);
+
+        for (it = entries_.begin(); it != entries_.end(); it++)
+        {
+          IOReactorEntry *entry = it -> second;
+
+          pfd.fd     = entry -> fd_;
+          pfd.events = 0;
+
+          if (entry -> direct_ == IOREACTOR_INPUT && entry -> readPending_ == 0)
+          {
+            pfd.events = POLLIN;
+          }
+          else if (entry -> direct_ == IOREACTOR_OUTPUT && entry -> queue_ -> size() > 0)
+          {
+            pfd.events = POLLOUT;
+          }
+
+          if (pfd.events)
+          {
+            fds.push_back(pfd);
+          }
+        }
+
+        eventsCount = poll(&fds[0], fds.size(), nextTimeout(timeoutMs));
+
+        for (size_t i = 0; eventsCount > 0 && i < fds.size(); i++)
+        {
+          if (fds[i].revents)
+          {
+            ready.push_back(fds[i].fd);
+          }
+        }
+      }
+      #endif
+
+      if (eventsCount < 0)
+      {
+        if (errno != EINTR)
+        {
+          Error("ERROR: Cannot wait for events in IOReactor PTR#%p.\n"
+                    "Error code is : %d.\n", this, errno);
+
+          return -1;
+        }
+
+        eventsCount = 0;
+      }
+
+      //
+      // Dispatch FD events. FD can be removed by callback in the
+      // meantime, so look up entry for every event.
+      //
+
+      for (size_t i = 0; i < ready.size(); i++)
+      {
+        int fd = ready[i];
+
+        std::map<int, IOReactorEntry *>::iterator it;
+
+        if (fd == wakeupFd_[0])
+        {
+          char buf[64];
+
+          while (read(fd, buf, sizeof(buf)) > 0);
+
+          continue;
+        }
+
+        it = entries_.find(fd);
+
+        if (it == entries_.end())
+        {
+          continue;
+        }
+
+        if (it -> second -> direct_ == IOREACTOR_INPUT)
+        {
+          dispatchRead(it -> second);
+        }
+        else
+        {
+          dispatchWrite(it -> second);
+        }
+      }
+
+      //
+      // Retry inputs, which were stopped on full queue, if queue
+      // was drained in the meantime.
+      //
+
+      pending.swap(pending_);
+
+      for (size_t i = 0; i < pending.size(); i++)
+      {
+        std::map<int, IOReactorEntry *>::iterator it = entries_.find(pending[i]);
+
+        if (it == entries_.end() || it -> second -> readPending_ == 0)
+        {
+          continue;
+        }
+
+        if (it -> second -> queue_ -> bytesLeft() > 0)
+        {
+          it -> second -> readPending_ = 0;
+
+          dispatchRead(it -> second);
+        }
+        else
+        {
+          pending_.push_back(pending[i]);
+        }
+      }
+
+      timerExpire();
+    }
+    #endif
+
+    return eventsCount;
+  }
+
+  //
+  // Dispatch events until stop() is called or there are no FDs left.
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int IOReactor::run()
+  {
+    while (stop_ == 0 && entries_.size() > 0)
+    {
+      if (runOnce(-1) < 0)
+      {
+        return -1;
+      }
+    }
+
+    return 0;
+  }
+
+  //
+  // Break run() loop. Can be called from any thread.
+  //
+
+  void IOReactor::stop()
+  {
+    stop_ = 1;
+
+    #ifndef WIN32
+    if (wakeupFd_[1] != -1 && write(wakeupFd_[1], "x", 1) < 0)
+    {
+      Error("ERROR: Cannot wake up IOReactor PTR#%p.\n", this);
+    }
+    #endif
+  }
+} /* namespace Tegenaria */
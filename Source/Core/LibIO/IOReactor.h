@@ -0,0 +1,211 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef Tegenaria_Core_IOReactor_H
+#define Tegenaria_Core_IOReactor_H
+
+//
+// Linux uses epoll. Other POSIX systems (MacOS, BSD) fall back to poll().
+//
+
+#if defined(__linux__)
+# define IOREACTOR_USE_EPOLL
+# include <sys/epoll.h>
+#elif !defined(WIN32)
+# include <poll.h>
+#endif
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "IOFifo.h"
+
+namespace Tegenaria
+{
+  //
+  // Defines.
+  //
+
+  #define IOREACTOR_MAX_EVENTS   64
+  #define IOREACTOR_WHEEL_SLOTS  512
+  #define IOREACTOR_DEFAULT_TICK 10
+
+  //
+  // Direction of FD added to reactor.
+  //
+
+  #define IOREACTOR_INPUT  0
+  #define IOREACTOR_OUTPUT 1
+
+  //
+  // Events passed to callback.
+  //
+
+  #define IOREACTOR_EVENT_READ    1
+  #define IOREACTOR_EVENT_WRITE   2
+  #define IOREACTOR_EVENT_EOF     4
+  #define IOREACTOR_EVENT_ERROR   8
+  #define IOREACTOR_EVENT_TIMEOUT 16
+
+  class IOReactor;
+
+  //
+  // Callback called by reactor when something happens on FD.
+  //
+  // reactor - reactor object, which dispatched event (IN).
+  // fd      - related FD (IN).
+  // event   - one of IOREACTOR_EVENT_XXX values (IN).
+  // count   - number of bytes read into/written from queue (IN).
+  // queue   - FIFO associated with FD (IN/OUT).
+  // ctx     - caller context passed to addFd() (IN).
+  //
+
+  typedef void (*IOReactorProto)(IOReactor *reactor, int fd, int event,
+                                     int count, IOFifo *queue, void *ctx);
+
+  //
+  // One FD watched by reactor.
+  //
+
+  struct IOReactorEntry
+  {
+    int fd_;
+    int direct_;
+
+    IOFifo *queue_;
+
+    IOReactorProto callback_;
+
+    void *ctx_;
+
+    //
+    // Timer wheel. Entry is linked into wheel slot, while idle
+    // timeout is set.
+    //
+
+    int timeoutMs_;
+    int slot_;
+
+    uint64_t deadline_;
+
+    IOReactorEntry *timerPrev_;
+    IOReactorEntry *timerNext_;
+
+    //
+    // Input is readable, but queue was full when last read.
+    //
+
+    int readPending_;
+  };
+
+  //
+  // Single thread epoll (Linux) or poll() (other systems) based reactor.
+  //
+  // - Input FDs are read in edge-triggered mode straight into its IOFifo.
+  // - Output FDs are written from its IOFifo as soon as data is queued
+  //   (see wantWrite()) and FD is writable.
+  // - Every FD can have own idle timeout served by timer wheel.
+  //
+  // WARNING: All methods except stop() MUST be called from the thread,
+  //          which runs the reactor (or before run() is called).
+  //
+
+  class IOReactor
+  {
+    private:
+
+    int epollFd_;
+    int wakeupFd_[2];
+    int stop_;
+    int tickMs_;
+
+    std::map<int, IOReactorEntry *> entries_;
+
+    //
+    // Input FDs waiting for free space in its queue.
+    //
+
+    std::vector<int> pending_;
+
+    //
+    // Timer wheel.
+    //
+
+    IOReactorEntry *wheel_[IOREACTOR_WHEEL_SLOTS];
+
+    uint64_t lastTick_;
+
+    int timersCount_;
+
+    uint64_t getTick();
+
+    void timerLink(IOReactorEntry *entry);
+    void timerUnlink(IOReactorEntry *entry);
+    void timerExpire();
+
+    int nextTimeout(int timeoutMs);
+
+    void dispatchRead(IOReactorEntry *entry);
+    void dispatchWrite(IOReactorEntry *entry);
+    void dispatch(int fd, int event, int count);
+
+    public:
+
+    //
+    // Constructors and destructors.
+    //
+
+    IOReactor(int tickMs = IOREACTOR_DEFAULT_TICK);
+
+    ~IOReactor();
+
+    //
+    // Watched FDs.
+    //
+
+    int addFd(int fd, int direct, IOFifo *queue, IOReactorProto callback,
+                  void *ctx = NULL, int timeoutMs = -1);
+
+    int removeFd(int fd);
+
+    int setTimeout(int fd, int timeoutMs);
+
+    int wantWrite(int fd);
+
+    int count();
+
+    //
+    // Main loop.
+    //
+
+    int runOnce(int timeoutMs = -1);
+    int run();
+
+    void stop();
+  };
+
+} /* namespace Tegenaria */
+
+#endif /* Tegenaria_Core_IOReactor_H */
@@ -37,6 +37,10 @@
 # include <io.h>
 #else
 # include <unistd.h>
+# include <poll.h>
+# include <stdint.h>
+# include <errno.h>
+# include <time.h>
 #endif
 
 namespace Tegenaria
@@ -324,23 +328,50 @@ namespace Tegenaria
 
     //
     // Linux, MacOS.
-    // Select based.
+    // Poll based. Works with any FD number (select() is limited to
+    // FD_SETSIZE). Wait is restarted on EINTR with time left to
+    // monotonic deadline.
     //
 
     #else
     {
-      fd_set rfd;
+      struct pollfd pfd;
 
-      struct timeval tv;
+      struct timespec ts;
 
-      FD_ZERO(&rfd);
+      int64_t deadline = 0;
+      int64_t now      = 0;
 
-      FD_SET(fd, &rfd);
+      int ret = -1;
 
-      tv.tv_sec  = timeout / 1000;
-      tv.tv_usec = (timeout % 1000) * 1000;
+      pfd.fd      = fd;
+      pfd.events  = POLLIN;
+      pfd.revents = 0;
 
-      if (select(fd + 1, &rfd, NULL, NULL, &tv) > 0 && FD_ISSET(fd, &rfd))
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+
+      deadline = int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000 + timeout;
+
+      for (;;)
+      {
+        ret = poll(&pfd, 1, timeout);
+
+        if (ret >= 0 || errno != EINTR)
+        {
+          break;
+        }
+
+        if (timeout > 0)
+        {
+          clock_gettime(CLOCK_MONOTONIC, &ts);
+
+          now = int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+
+          timeout = (deadline > now) ? int(deadline - now) : 0;
+        }
+      }
+
+      if (ret > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR)))
       {
         exitCode = read(fd, buf, size);
       }
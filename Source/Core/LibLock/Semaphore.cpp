@@ -35,11 +35,13 @@ namespace Tegenaria
   {
     //
     // Windows.
+    // Counting semaphore like POSIX one. Don't limit counter to 1,
+    // otherwise signals sent before wait() are lost.
     //
 
     #ifdef WIN32
     {
-      semaphore_ = CreateSemaphore(NULL, initValue, 1, NULL);
+      semaphore_ = CreateSemaphore(NULL, initValue, MAXLONG, NULL);
     }
 
     //
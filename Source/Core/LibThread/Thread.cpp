@@ -94,6 +94,8 @@ namespace Tegenaria
 
       free(ctx);
     }
+
+    return NULL;
   }
 
   //
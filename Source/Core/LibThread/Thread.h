@@ -63,7 +63,7 @@ namespace Tegenaria
 
   template<class T> ThreadHandle_t *ThreadCreate(int (*entry)(T *), void *ctx)
   {
-    ThreadCreate((ThreadEntryProto) entry, ctx);
+    return ThreadCreate((ThreadEntryProto) entry, ctx);
   }
 
   //
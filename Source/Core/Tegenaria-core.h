@@ -35,8 +35,10 @@
 #include "Error.h"
 #include "File.h"
 #include "IOFifo.h"
+#include "IOFifoSpsc.h"
 #include "IOLoop.h"
 #include "IOMixer.h"
+#include "IOReactor.h"
 #include "IOTime.h"
 #include "Ipc.h"
 #include "Job.h"
@@ -0,0 +1,185 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2026 Tegenaria contributors                                  */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Check LZ4_decompress_safe() against malformed blocks.
+// Every block is copied into exact-size heap buffer, so out of bounds
+// reads are caught by memory checkers (valgrind, -fsanitize=address).
+//
+// Usage: LZ4-example [fuzzRounds]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <lz4.h>
+
+#define BLOCK_SIZE (1024 * 16)
+
+//
+// Decompress copy of block and check it's rejected.
+//
+// RETURNS: 0 if block was rejected, 1 otherwise.
+//
+
+static int ExpectMalformed(const char *name, const unsigned char *block,
+                               int blockSize, int dstCapacity)
+{
+  char *src = (char *) malloc(blockSize);
+  char *dst = (char *) malloc(dstCapacity > 0 ? dstCapacity : 1);
+
+  int ret = 0;
+
+  memcpy(src, block, blockSize);
+
+  ret = LZ4_decompress_safe(src, dst, blockSize, dstCapacity);
+
+  free(src);
+  free(dst);
+
+  if (ret >= 0)
+  {
+    printf("FAIL: %s accepted (%d).\n", name, ret);
+
+    return 1;
+  }
+
+  printf("OK  : %s rejected.\n", name);
+
+  return 0;
+}
+
+//
+// Entry point.
+//
+
+int main(int argc, char **argv)
+{
+  //
+  // Hand-made malformed blocks.
+  //
+
+  static const unsigned char endsAfterMatch[]  = {0x40, 'a', 'b', 'c', 'd', 0x04, 0x00};
+  static const unsigned char shortLiterals[]   = {0x50, 'a'};
+  static const unsigned char shortLitLength[]  = {0xf0};
+  static const unsigned char endlessLitLen[]   = {0xf0, 0xff, 0xff, 0xff};
+  static const unsigned char shortOffset[]     = {0x10, 'a', 0x01};
+  static const unsigned char zeroOffset[]      = {0x10, 'a', 0x00, 0x00, 0x00};
+  static const unsigned char farOffset[]       = {0x10, 'a', 0x05, 0x00, 0x00};
+  static const unsigned char endlessMatchLen[] = {0x1f, 'a', 0x01, 0x00, 0xff, 0xff};
+
+  static const unsigned char longLiterals[]    = {0x30, 'a', 'b', 'c'};
+
+  char orig[BLOCK_SIZE];
+  char packed[LZ4_COMPRESSBOUND(BLOCK_SIZE)];
+  char unpacked[BLOCK_SIZE];
+
+  int packedSize = 0;
+  int failed     = 0;
+  int rounds     = 10000;
+
+  if (argc > 1)
+  {
+    rounds = atoi(argv[1]);
+  }
+
+  failed += ExpectMalformed("block ending after match", endsAfterMatch, sizeof(endsAfterMatch), 64);
+  failed += ExpectMalformed("truncated literals", shortLiterals, sizeof(shortLiterals), 64);
+  failed += ExpectMalformed("truncated literals length", shortLitLength, sizeof(shortLitLength), 64);
+  failed += ExpectMalformed("unterminated literals length", endlessLitLen, sizeof(endlessLitLen), 64);
+  failed += ExpectMalformed("truncated offset", shortOffset, sizeof(shortOffset), 64);
+  failed += ExpectMalformed("zero offset", zeroOffset, sizeof(zeroOffset), 64);
+  failed += ExpectMalformed("offset before output", farOffset, sizeof(farOffset), 64);
+  failed += ExpectMalformed("unterminated match length", endlessMatchLen, sizeof(endlessMatchLen), 64);
+  failed += ExpectMalformed("output too small", longLiterals, sizeof(longLiterals), 2);
+
+  //
+  // Valid block must still decode.
+  //
+
+  for (int i = 0; i < BLOCK_SIZE; i++)
+  {
+    orig[i] = "tegenaria"[i % 9] ^ ((i / 512) & 3);
+  }
+
+  packedSize = LZ4_compress_default(orig, packed, BLOCK_SIZE, sizeof(packed));
+
+  if (packedSize <= 0
+          || LZ4_decompress_safe(packed, unpacked, packedSize, BLOCK_SIZE) != BLOCK_SIZE
+              || memcmp(orig, unpacked, BLOCK_SIZE) != 0)
+  {
+    printf("FAIL: valid block round trip.\n");
+
+    failed++;
+  }
+
+  //
+  // Every truncated valid block must be rejected.
+  //
+
+  for (int i = 1; i < packedSize; i++)
+  {
+    char *src = (char *) malloc(i);
+
+    memcpy(src, packed, i);
+
+    if (LZ4_decompress_safe(src, unpacked, i, BLOCK_SIZE) == BLOCK_SIZE)
+    {
+      printf("FAIL: block truncated to %d bytes decoded.\n", i);
+
+      failed++;
+    }
+
+    free(src);
+  }
+
+  //
+  // Random corruption. Result doesn't matter, decoder must only stay
+  // inside buffers.
+  //
+
+  srand(1);
+
+  for (int i = 0; i < rounds; i++)
+  {
+    int size = 1 + rand() % packedSize;
+
+    char *src = (char *) malloc(size);
+
+    memcpy(src, packed, size);
+
+    for (int j = rand() % 8; j >= 0; j--)
+    {
+      src[rand() % size] = char(rand());
+    }
+
+    LZ4_decompress_safe(src, unpacked, size, 1 + rand() % BLOCK_SIZE);
+
+    free(src);
+  }
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+
+  return failed ? 1 : 0;
+}
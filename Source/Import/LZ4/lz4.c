@@ -0,0 +1,446 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2026 Tegenaria contributors                                  */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Minimal implementation of LZ4 block format written from the format
+// specification. It does not contain any code from upstream liblz4.
+//
+// Block is a sequence of:
+//
+//   token (1 byte) : high nibble = literals length, low nibble = match length - 4
+//   [extra literals length bytes, if high nibble = 15]
+//   literals
+//   offset (2 bytes, little endian)
+//   [extra match length bytes, if low nibble = 15]
+//
+// Last sequence contains literals only. Last 5 bytes are always literals
+// and last match must start at least 12 bytes before end of block.
+//
+
+#include <string.h>
+#include <stdint.h>
+
+#include "lz4.h"
+
+#define LZ4_MINMATCH     4
+#define LZ4_MFLIMIT      12
+#define LZ4_LASTLITERALS 5
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG     12
+#define LZ4_HASH_SIZE    (1 << LZ4_HASH_LOG)
+#define LZ4_RUN_MASK     15
+#define LZ4_ML_MASK      15
+
+static uint32_t LZ4_read32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+static uint32_t LZ4_hash(uint32_t sequence)
+{
+  return (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+//
+// Write length overflow in 255-bytes chunks.
+//
+
+static uint8_t *LZ4_writeLength(uint8_t *op, int len)
+{
+  while (len >= 255)
+  {
+    *op++ = 255;
+
+    len -= 255;
+  }
+
+  *op++ = (uint8_t) len;
+
+  return op;
+}
+
+//
+// Worst case compressed size for given input size.
+//
+// inputSize - size of input data in bytes (IN).
+//
+// RETURNS: Max. size of compressed data,
+//          or 0 if input size is out of range.
+//
+
+int LZ4_compressBound(int inputSize)
+{
+  return LZ4_COMPRESSBOUND(inputSize);
+}
+
+//
+// Compress buffer into LZ4 block.
+//
+// src         - data to compress (IN).
+// dst         - buffer, where to store compressed block (OUT).
+// srcSize     - size of src[] buffer in bytes (IN).
+// dstCapacity - size of dst[] buffer in bytes (IN).
+//
+// RETURNS: Size of compressed block in bytes,
+//          or 0 if dst[] buffer is too small.
+//
+
+int LZ4_compress_default(const char *src, char *dst,
+                             int srcSize, int dstCapacity)
+{
+  uint16_t table[LZ4_HASH_SIZE];
+
+  const uint8_t *ip     = (const uint8_t *) src;
+  const uint8_t *base   = ip;
+  const uint8_t *anchor = ip;
+  const uint8_t *iend   = ip + srcSize;
+  const uint8_t *mflimit    = iend - LZ4_MFLIMIT;
+  const uint8_t *matchlimit = iend - LZ4_LASTLITERALS;
+
+  uint8_t *op   = (uint8_t *) dst;
+  uint8_t *oend = op + dstCapacity;
+
+  int litLen = 0;
+
+  if (srcSize < 0 || srcSize > LZ4_MAX_INPUT_SIZE || dstCapacity <= 0)
+  {
+    return 0;
+  }
+
+  //
+  // Hash table stores 16-bit positions. Inputs greater than 64 KB are
+  // compressed as independent 64 KB windows to keep table small and
+  // offsets always in range.
+  //
+
+  memset(table, 0, sizeof(table));
+
+  if (srcSize >= LZ4_MFLIMIT + 1)
+  {
+    ip++;
+
+    while (ip < mflimit)
+    {
+      const uint8_t *match;
+
+      uint32_t h = LZ4_hash(LZ4_read32(ip));
+
+      int matchLen;
+
+      //
+      // Rebase window every 64 KB.
+      //
+
+      if (ip - base > 0xFFFF)
+      {
+        base = ip - 1;
+
+        memset(table, 0, sizeof(table));
+      }
+
+      match = base + table[h];
+
+      table[h] = (uint16_t) (ip - base);
+
+      if (match >= ip
+              || ip - match > LZ4_MAX_DISTANCE
+                  || LZ4_read32(match) != LZ4_read32(ip))
+      {
+        ip++;
+
+        continue;
+      }
+
+      //
+      // Match found. Extend it backward over pending literals.
+      //
+
+      while (ip > anchor && match > (const uint8_t *) src && ip[-1] == match[-1])
+      {
+        ip--;
+        match--;
+      }
+
+      //
+      // Extend match forward.
+      //
+
+      matchLen = LZ4_MINMATCH;
+
+      while (ip + matchLen < matchlimit && ip[matchLen] == match[matchLen])
+      {
+        matchLen++;
+      }
+
+      //
+      // Emit sequence: token, literals, offset, match length.
+      //
+
+      litLen = (int) (ip - anchor);
+
+      if (op + 1 + litLen / 255 + 1 + litLen + 2 + (matchLen - LZ4_MINMATCH) / 255 + 1 > oend)
+      {
+        return 0;
+      }
+
+      {
+        uint8_t *token = op++;
+
+        int ml = matchLen - LZ4_MINMATCH;
+
+        int offset = (int) (ip - match);
+
+        if (litLen >= LZ4_RUN_MASK)
+        {
+          *token = LZ4_RUN_MASK << 4;
+
+          op = LZ4_writeLength(op, litLen - LZ4_RUN_MASK);
+        }
+        else
+        {
+          *token = (uint8_t) (litLen << 4);
+        }
+
+        memcpy(op, anchor, litLen);
+
+        op += litLen;
+
+        *op++ = (uint8_t) (offset & 0xff);
+        *op++ = (uint8_t) (offset >> 8);
+
+        if (ml >= LZ4_ML_MASK)
+        {
+          *token |= LZ4_ML_MASK;
+
+          op = LZ4_writeLength(op, ml - LZ4_ML_MASK);
+        }
+        else
+        {
+          *token |= (uint8_t) ml;
+        }
+      }
+
+      ip    += matchLen;
+      anchor = ip;
+
+      //
+      // Index position just before next search to catch repeats.
+      //
+
+      if (ip < mflimit && ip - 2 >= base)
+      {
+        table[LZ4_hash(LZ4_read32(ip - 2))] = (uint16_t) (ip - 2 - base);
+      }
+    }
+  }
+
+  //
+  // Last literals.
+  //
+
+  litLen = (int) (iend - anchor);
+
+  if (op + 1 + litLen / 255 + 1 + litLen > oend)
+  {
+    return 0;
+  }
+
+  if (litLen >= LZ4_RUN_MASK)
+  {
+    *op++ = LZ4_RUN_MASK << 4;
+
+    op = LZ4_writeLength(op, litLen - LZ4_RUN_MASK);
+  }
+  else
+  {
+    *op++ = (uint8_t) (litLen << 4);
+  }
+
+  memcpy(op, anchor, litLen);
+
+  op += litLen;
+
+  return (int) (op - (uint8_t *) dst);
+}
+
+//
+// Decompress LZ4 block. Safe against malformed input - never reads
+// outside src[] and never writes outside dst[].
+//
+// src            - compressed block (IN).
+// dst            - buffer, where to store decompressed data (OUT).
+// compressedSize - size of compressed block in bytes (IN).
+// dstCapacity    - size of dst[] buffer in bytes (IN).
+//
+// RETURNS: Number of decompressed bytes,
+//          or negative value if block is malformed or dst[] too small.
+//
+
+int LZ4_decompress_safe(const char *src, char *dst,
+                            int compressedSize, int dstCapacity)
+{
+  const uint8_t *ip   = (const uint8_t *) src;
+  const uint8_t *iend = NULL;
+
+  uint8_t *op     = (uint8_t *) dst;
+  uint8_t *ostart = op;
+  uint8_t *oend   = NULL;
+
+  if (src == NULL || dst == NULL || compressedSize <= 0 || dstCapacity < 0)
+  {
+    return -1;
+  }
+
+  iend = ip + compressedSize;
+  oend = op + dstCapacity;
+
+  //
+  // Every read from ip[] below is preceded by check against iend.
+  // Block must end with literals-only sequence, so running out of
+  // input anywhere else means malformed block.
+  //
+
+  for (;;)
+  {
+    unsigned token;
+
+    size_t litLen;
+    size_t matchLen;
+    size_t offset;
+
+    const uint8_t *match;
+
+    if (ip >= iend)
+    {
+      return -1;
+    }
+
+    token = *ip++;
+
+    //
+    // Literals.
+    //
+
+    litLen = token >> 4;
+
+    if (litLen == LZ4_RUN_MASK)
+    {
+      unsigned s;
+
+      do
+      {
+        if (ip >= iend)
+        {
+          return -1;
+        }
+
+        s = *ip++;
+
+        litLen += s;
+      }
+      while (s == 255 && litLen <= (size_t) (iend - ip));
+    }
+
+    if (litLen > (size_t) (iend - ip) || litLen > (size_t) (oend - op))
+    {
+      return -1;
+    }
+
+    memcpy(op, ip, litLen);
+
+    op += litLen;
+    ip += litLen;
+
+    //
+    // Last sequence has literals only.
+    //
+
+    if (ip == iend)
+    {
+      break;
+    }
+
+    //
+    // Match.
+    //
+
+    if (iend - ip < 2)
+    {
+      return -1;
+    }
+
+    offset = ip[0] | (ip[1] << 8);
+
+    ip += 2;
+
+    if (offset == 0 || offset > (size_t) (op - ostart))
+    {
+      return -1;
+    }
+
+    match = op - offset;
+
+    matchLen = token & LZ4_ML_MASK;
+
+    if (matchLen == LZ4_ML_MASK)
+    {
+      unsigned s;
+
+      do
+      {
+        if (ip >= iend)
+        {
+          return -1;
+        }
+
+        s = *ip++;
+
+        matchLen += s;
+      }
+      while (s == 255 && matchLen <= (size_t) (oend - op));
+    }
+
+    matchLen += LZ4_MINMATCH;
+
+    if (matchLen > (size_t) (oend - op))
+    {
+      return -1;
+    }
+
+    //
+    // Byte copy, because match may overlap with output.
+    //
+
+    while (matchLen--)
+    {
+      *op++ = *match++;
+    }
+  }
+
+  return (int) (op - ostart);
+}
@@ -0,0 +1,67 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2026 Tegenaria contributors                                  */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Minimal implementation of LZ4 block format.
+//
+// Exported functions are compatible subset of upstream lz4.h API, so
+// data produced here can be decoded by upstream liblz4 and vice versa.
+//
+// Only raw blocks are supported (no frame format, no dictionaries).
+//
+
+#ifndef Tegenaria_Import_LZ4_H
+#define Tegenaria_Import_LZ4_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//
+// Max. input size accepted by compressor.
+//
+
+#define LZ4_MAX_INPUT_SIZE 0x7E000000
+
+//
+// Worst case compressed size for given input size.
+//
+
+#define LZ4_COMPRESSBOUND(isize) \
+  ((unsigned) (isize) > (unsigned) LZ4_MAX_INPUT_SIZE ? 0 : (isize) + ((isize) / 255) + 16)
+
+int LZ4_compressBound(int inputSize);
+
+int LZ4_compress_default(const char *src, char *dst,
+                             int srcSize, int dstCapacity);
+
+int LZ4_decompress_safe(const char *src, char *dst,
+                            int compressedSize, int dstCapacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* Tegenaria_Import_LZ4_H */
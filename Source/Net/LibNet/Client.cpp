@@ -23,7 +23,7 @@
 /******************************************************************************/
 
 //
-// Purpose: TCP/IP4 client.
+// Purpose: TCP/IP client.
 //
 // Usage:
 //
@@ -40,64 +40,100 @@
 #include "NetInternal.h"
 #include "NetTcpConnection.h"
 
+//
+// Delay in ms before next address is tried if previous connect
+// attempt is still in progress.
+//
+
+#define NET_CONNECT_ATTEMPT_DELAY 250
+
 namespace Tegenaria
 {
   //
-  // Open connection to server.
-  //
-  // host    - server's ip address or hostname eg. "google.pl" (IN).
-  // port    - port, on which server is listening (IN).
-  // timeout - timeout in miliseconds (IN/OPT).
-  //
-  // RETURNS: Pointer to new allocated NetConnection or
-  //          NULL if error.
-  //
-  // WARNING: Caller MUST delete returned NetConnection object.
+  // Order resolved addresses for connection racing (RFC 8305).
+  // Address families are interleaved starting from family of first address
+  // returned by resolver e.g. v6, v4, v6, v4, ...
+  // Used internally only.
   //
-  // TIP: Use read/write method fro NetConnection to communicate with
-  //      remote host.
+  // addrs - list of addresses to reorder (IN/OUT).
   //
 
-  NetConnection *NetConnect(const char *host, int port, int timeout)
+  static void NetConnectSortAddrs(vector<struct sockaddr_storage> &addrs)
   {
-    DBG_ENTER("NetConnect");
+    vector<struct sockaddr_storage> primary;
+    vector<struct sockaddr_storage> secondary;
 
-    int exitCode = -1;
-
-    SOCKET sock = -1;
-
-    struct sockaddr_in sa = {0};
+    if (addrs.empty())
+    {
+      return;
+    }
 
-    NetConnection *nc = NULL;
+    for (size_t i = 0; i < addrs.size(); i++)
+    {
+      if (addrs[i].ss_family == addrs[0].ss_family)
+      {
+        primary.push_back(addrs[i]);
+      }
+      else
+      {
+        secondary.push_back(addrs[i]);
+      }
+    }
 
-    int connected = 0;
+    addrs.clear();
 
-    vector<string> ip;
+    for (size_t i = 0; i < primary.size() || i < secondary.size(); i++)
+    {
+      if (i < primary.size())
+      {
+        addrs.push_back(primary[i]);
+      }
 
-    //
-    // Check args.
-    //
+      if (i < secondary.size())
+      {
+        addrs.push_back(secondary[i]);
+      }
+    }
+  }
 
-    FAILEX(host == NULL, "ERROR: Host cannot be NULL in NetConnect().\n");
-    FAILEX(port == 0,    "ERROR: Port cannot be 0 in NetConnect().\n");
+  //
+  // Start non-blocking connect to one address.
+  // Used internally only.
+  //
+  // addr      - address to connect to (IN).
+  // connected - set to 1 if connection established immediately (OUT).
+  //
+  // RETURNS: Socket with connect in progress or
+  //          -1 if connect failed immediately.
+  //
 
-    //
-    // Initialize WinSock 2.2 on windows.
-    //
+  static SOCKET NetConnectStart(struct sockaddr_storage *addr, int *connected)
+  {
+    SOCKET sock = -1;
 
-    FAIL(_NetInit());
+    socklen_t addrLen = 0;
 
-    //
-    // Resolve hostname.
-    //
+    *connected = 0;
 
-    FAIL(NetResolveIp(ip, host));
+    if (addr -> ss_family == AF_INET)
+    {
+      addrLen = sizeof(struct sockaddr_in);
+    }
+    else
+    {
+      addrLen = sizeof(struct sockaddr_in6);
+    }
 
     //
     // Create socket.
     //
 
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    sock = socket(addr -> ss_family, SOCK_STREAM, 0);
+
+    if (int(sock) == -1)
+    {
+      return -1;
+    }
 
     DBG_SET_ADD("socket", sock, "OUT");
 
@@ -105,19 +141,20 @@ namespace Tegenaria
     // Set socket to non-block mode.
     //
 
-    FAIL(NetSetNonBlockMode(sock));
+    if (NetSetNonBlockMode(sock))
+    {
+      closesocket(sock);
+
+      DBG_SET_DEL("socket", sock);
+
+      return -1;
+    }
 
     //
     // Async connect.
     //
 
-    sa.sin_family      = AF_INET;
-    sa.sin_addr.s_addr = inet_addr(ip[0].c_str());
-    sa.sin_port        = htons(port);
-
-    DBG_MSG3("NetConnect : Connecting to '%s:%d' on SOCKET #%d...\n", host, port, sock);
-
-    if (connect(sock, (struct sockaddr *) &sa, sizeof(sa)) < 0)
+    if (connect(sock, (struct sockaddr *) addr, addrLen) < 0)
     {
       //
       // Windows.
@@ -135,14 +172,14 @@ namespace Tegenaria
 
           case WSAEISCONN:
           {
-            connected = 1;
+            *connected = 1;
 
             break;
           }
 
           //
           // Work in progress.
-          // Handle in select below.
+          // Handle in NetConnect() below.
           //
 
           case WSAEWOULDBLOCK:
@@ -152,14 +189,18 @@ namespace Tegenaria
           }
 
           //
-          // Unexpected error.
+          // Unexpected error e.g. network unreachable.
           //
 
           default:
           {
-            Error("ERROR: Unexpected connect() error code '%d'.\n", lastError);
+            DEBUG1("NetConnect : connect() failed with code '%d'.\n", lastError);
+
+            closesocket(sock);
+
+            DBG_SET_DEL("socket", sock);
 
-            goto fail;
+            return -1;
           }
         }
       }
@@ -178,14 +219,14 @@ namespace Tegenaria
 
           case EISCONN:
           {
-            connected = 1;
+            *connected = 1;
 
             break;
           }
 
           //
           // Work in progress.
-          // Handle in select below.
+          // Handle in NetConnect() below.
           //
 
           case EINPROGRESS:
@@ -195,58 +236,220 @@ namespace Tegenaria
           }
 
           //
-          // Unexpected error.
+          // Unexpected error e.g. network unreachable.
           //
 
           default:
           {
-            Error("ERROR: Unexpected connect() error code '%d'.\n", errno);
+            DEBUG1("NetConnect : connect() failed with code '%d'.\n", errno);
 
-            goto fail;
+            closesocket(sock);
+
+            DBG_SET_DEL("socket", sock);
+
+            return -1;
           }
         }
       }
       #endif
+    }
+    else
+    {
+      *connected = 1;
+    }
+
+    return sock;
+  }
+
+  //
+  // Open connection to server.
+  //
+  // If host resolves to many addresses, connects are raced in parallel
+  // (happy eyeballs, RFC 8305). Next address is tried if previous one
+  // did not answer within NET_CONNECT_ATTEMPT_DELAY ms or failed.
+  // First established connection wins, remaining ones are closed.
+  //
+  // host    - server's ip address or hostname eg. "google.pl" (IN).
+  // port    - port, on which server is listening (IN).
+  // timeout - timeout in miliseconds, -1 for infinite (IN/OPT).
+  //
+  // RETURNS: Pointer to new allocated NetConnection or
+  //          NULL if error.
+  //
+  // WARNING: Caller MUST delete returned NetConnection object.
+  //
+  // TIP: Use read/write method fro NetConnection to communicate with
+  //      remote host.
+  //
+
+  NetConnection *NetConnect(const char *host, int port, int timeout)
+  {
+    DBG_ENTER("NetConnect");
+
+    int exitCode = -1;
+
+    SOCKET sock = -1;
+
+    struct sockaddr_in sa = {0};
+
+    NetConnection *nc = NULL;
+
+    int connected = 0;
+
+    int lastError = 0;
+
+    size_t next   = 0;
+    size_t winner = 0;
+
+    int64_t deadline    = _NetGetTimeMs() + timeout;
+    int64_t nextAttempt = 0;
+
+    vector<struct sockaddr_storage> addrs;
+
+    vector<int> pending;
+
+    vector<size_t> pendingAddr;
+
+    //
+    // Check args.
+    //
+
+    FAILEX(host == NULL, "ERROR: Host cannot be NULL in NetConnect().\n");
+    FAILEX(port == 0,    "ERROR: Port cannot be 0 in NetConnect().\n");
+
+    //
+    // Initialize WinSock 2.2 on windows.
+    //
+
+    FAIL(_NetInit());
+
+    //
+    // Resolve hostname.
+    //
+
+    FAIL(_NetResolve(addrs, host, port, timeout));
+
+    NetConnectSortAddrs(addrs);
+
+    DBG_MSG3("NetConnect : Connecting to '%s:%d' using [%d] address(es)...\n",
+                 host, port, int(addrs.size()));
+
+    //
+    // Race connects until one succeed or all failed.
+    //
+
+    while(int(sock) == -1)
+    {
+      int64_t now = _NetGetTimeMs();
+
+      int wait = -1;
+
+      vector<int> events;
+      vector<int> revents;
+
+      FAILEX(timeout >= 0 && now >= deadline,
+                 "ERROR: Timeout while connecting to '%s':'%d'.\n", host, port);
+
+      //
+      // Start next attempt if previous ones are silent for too long
+      // or there is nothing in progress.
+      //
+
+      if (next < addrs.size() && (now >= nextAttempt || pending.empty()))
+      {
+        SOCKET s = NetConnectStart(&addrs[next], &connected);
+
+        if (connected)
+        {
+          sock   = s;
+          winner = next;
+
+          break;
+        }
+
+        if (int(s) != -1)
+        {
+          pending.push_back(s);
+          pendingAddr.push_back(next);
+
+          nextAttempt = now + NET_CONNECT_ATTEMPT_DELAY;
+        }
+        else
+        {
+          lastError = GetLastError();
+        }
+
+        next++;
+
+        continue;
+      }
+
+      //
+      // All addresses failed.
+      //
+
+      FAILEX(pending.empty(), "ERROR: connect() failed with error %d.\n", lastError);
 
       //
-      // If still not connected.
+      // Wait until any pending connect finished, next attempt should
+      // be started or timeout reached.
       //
 
-      if (connected == 0)
+      if (timeout >= 0)
       {
-        fd_set fdset;
+        wait = int(deadline - now);
+      }
+
+      if (next < addrs.size() && (wait < 0 || nextAttempt - now < wait))
+      {
+        wait = int(nextAttempt - now);
+      }
+
+      events.resize(pending.size(), NET_WAIT_WRITE);
+      revents.resize(pending.size(), 0);
+
+      FAIL(_NetPoll(&pending[0], &events[0], &revents[0], int(pending.size()), wait) < 0);
 
-        struct timeval tv;
+      //
+      // Check finished connects.
+      //
 
+      for (int i = int(pending.size()) - 1; i >= 0; i--)
+      {
         int valopt = 0;
 
         socklen_t len = sizeof(valopt);
 
-        tv.tv_sec  = timeout / 1000;
-        tv.tv_usec = timeout % 1000 * 1000;
+        if (revents[i] == 0)
+        {
+          continue;
+        }
 
-        FD_ZERO(&fdset);
+        getsockopt(pending[i], SOL_SOCKET, SO_ERROR, (char *) (&valopt), &len);
 
-        FD_SET(sock, &fdset);
+        if (valopt == 0 && (revents[i] & NET_WAIT_WRITE))
+        {
+          sock   = pending[i];
+          winner = pendingAddr[i];
 
-        FAILEX(select(sock + 1, NULL, &fdset, NULL, &tv) <= 0,
-                 "ERROR: Timeout while connecting to '%s':'%d'.\n", host, port);
+          pending.erase(pending.begin() + i);
+          pendingAddr.erase(pendingAddr.begin() + i);
 
-        len = sizeof(int);
+          break;
+        }
+
+        DEBUG1("NetConnect : connect() failed with error %d.\n", valopt);
 
-        getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *) (&valopt), &len);
+        lastError = valopt;
 
-        FAILEX(valopt, "ERROR: connect() failed with error %d.\n", valopt);
+        closesocket(pending[i]);
 
-        connected = 1;
+        DBG_SET_DEL("socket", pending[i]);
+
+        pending.erase(pending.begin() + i);
+        pendingAddr.erase(pendingAddr.begin() + i);
       }
     }
-    else
-    {
-      connected = 1;
-    }
-
-    FAIL(connected == 0);
 
     //
     // Set back to block mode.
@@ -256,8 +459,14 @@ namespace Tegenaria
 
     //
     // Wrap connected socket into connection object.
+    // IPv6 peer address does not fit into sockaddr_in and is left zeroed.
     //
 
+    if (addrs[winner].ss_family == AF_INET)
+    {
+      memcpy(&sa, &addrs[winner], sizeof(sa));
+    }
+
     nc = new NetTcpConnection(NULL, sock, NULL, sa);
 
     nc -> setState(NET_STATE_ESTABLISHED);
@@ -274,6 +483,17 @@ namespace Tegenaria
 
     fail:
 
+    //
+    // Close connects, which lost the race.
+    //
+
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+      closesocket(pending[i]);
+
+      DBG_SET_DEL("socket", pending[i]);
+    }
+
     if (exitCode)
     {
       Error("ERROR: Cannot connect to '%s:%d'.\n"
@@ -0,0 +1,411 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Client side connection pool.
+//
+// Connections are kept idle per host:port after use and reused by next
+// NetPoolConnect() to the same endpoint instead of connecting from scratch.
+//
+// Usage:
+//
+//   NetConnection *nc = NetPoolConnect(host, port)
+//   nc -> request(...)
+//   NetPoolRelease(nc)
+//
+// WARNING: Release connection with NetPoolRelease(nc, 0) if protocol state
+//          is not clean e.g. after error or server said goodbye.
+//
+
+#pragma qcbuild_set_file_title("Client connection pool");
+
+#include "Net.h"
+#include "NetInternal.h"
+
+#include <list>
+#include <map>
+
+#include <Tegenaria/Mutex.h>
+
+namespace Tegenaria
+{
+  using std::list;
+  using std::map;
+
+  //
+  // Idle connection waiting in pool.
+  //
+
+  struct NetPoolEntry
+  {
+    NetConnection *nc_;
+
+    int64_t idleSince_;
+  };
+
+  static NetPoolConfig NetPoolCfg =
+  {
+    NET_POOL_MAX_IDLE,
+    NET_POOL_IDLE_TIMEOUT,
+    NET_POOL_KEEPALIVE
+  };
+
+  //
+  // Idle connections indexed by "host:port" and connections currently
+  // lent to caller with theirs "host:port" key.
+  //
+
+  static map<string, list<NetPoolEntry> > NetPoolIdle;
+
+  static map<NetConnection *, string> NetPoolBusy;
+
+  static Mutex NetPoolMutex;
+
+  //
+  // Check is idle connection still usable.
+  // Idle connection should never be readable. Readable socket means
+  // peer closed connection or sent unexpected data, which would
+  // desynchronize next request.
+  // Used internally only.
+  //
+  // nc - connection to check (IN).
+  //
+  // RETURNS: 1 if connection can be reused,
+  //          0 otherwise.
+  //
+
+  static int NetPoolIsAlive(NetConnection *nc)
+  {
+    if (nc -> getState() != NET_STATE_ESTABLISHED || nc -> getSocket() == -1)
+    {
+      return 0;
+    }
+
+    return (_NetWait(nc -> getSocket(), NET_WAIT_READ, 0) == 0);
+  }
+
+  //
+  // Close connections collected by pool functions.
+  // Called outside pool lock.
+  // Used internally only.
+  //
+
+  static void NetPoolClose(vector<NetConnection *> &dead)
+  {
+    for (size_t i = 0; i < dead.size(); i++)
+    {
+      dead[i] -> shutdown();
+      dead[i] -> release();
+    }
+
+    dead.clear();
+  }
+
+  //
+  // Get connection to server from pool or open new one if there is no
+  // idle connection to given host:port.
+  //
+  // Idle connections are health checked before reuse. Dead or expired
+  // ones are closed and skipped.
+  //
+  // host    - server's ip address or hostname eg. "google.pl" (IN).
+  // port    - port, on which server is listening (IN).
+  // timeout - timeout in miliseconds used if new connect needed (IN/OPT).
+  //
+  // RETURNS: Pointer to NetConnection or
+  //          NULL if error.
+  //
+  // WARNING: Caller MUST return connection with NetPoolRelease().
+  //
+
+  NetConnection *NetPoolConnect(const char *host, int port, int timeout)
+  {
+    DBG_ENTER("NetPoolConnect");
+
+    int exitCode = -1;
+
+    NetConnection *nc = NULL;
+
+    vector<NetConnection *> dead;
+
+    char key[512];
+
+    //
+    // Check args.
+    //
+
+    FAILEX(host == NULL, "ERROR: Host cannot be NULL in NetPoolConnect().\n");
+    FAILEX(port == 0,    "ERROR: Port cannot be 0 in NetPoolConnect().\n");
+
+    snprintf(key, sizeof(key) - 1, "%s:%d", host, port);
+
+    key[sizeof(key) - 1] = 0;
+
+    //
+    // Try idle connections first. Most recently used first.
+    //
+
+    NetPoolMutex.lock();
+
+    {
+      list<NetPoolEntry> &idle = NetPoolIdle[key];
+
+      int64_t now = _NetGetTimeMs();
+
+      while(nc == NULL && !idle.empty())
+      {
+        NetPoolEntry entry = idle.back();
+
+        idle.pop_back();
+
+        if (now - entry.idleSince_ < NetPoolCfg.idleTimeout_
+                && NetPoolIsAlive(entry.nc_))
+        {
+          nc = entry.nc_;
+        }
+        else
+        {
+          dead.push_back(entry.nc_);
+        }
+      }
+
+      if (nc)
+      {
+        NetPoolBusy[nc] = key;
+      }
+    }
+
+    NetPoolMutex.unlock();
+
+    NetPoolClose(dead);
+
+    //
+    // No idle connection. Open new one.
+    //
+
+    if (nc == NULL)
+    {
+      nc = NetConnect(host, port, timeout);
+
+      FAIL(nc == NULL);
+
+      if (NetPoolCfg.keepAlive_ > 0)
+      {
+        nc -> setKeepAlive(NetPoolCfg.keepAlive_);
+      }
+
+      NetPoolMutex.lock();
+
+      NetPoolBusy[nc] = key;
+
+      NetPoolMutex.unlock();
+    }
+    else
+    {
+      DEBUG2("NetPoolConnect : Reused connection PTR [%p] to '%s'.\n", nc, key);
+    }
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot get pooled connection to '%s:%d'.\n", host, port);
+    }
+
+    DBG_LEAVE("NetPoolConnect");
+
+    return nc;
+  }
+
+  //
+  // Return connection retrieved from NetPoolConnect() back to pool.
+  //
+  // nc       - connection returned by NetPoolConnect() before (IN).
+  // reusable - 1 if connection can be reused by next caller,
+  //            0 to close it (IN/OPT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int NetPoolRelease(NetConnection *nc, int reusable)
+  {
+    DBG_ENTER("NetPoolRelease");
+
+    int exitCode = -1;
+
+    vector<NetConnection *> dead;
+
+    map<NetConnection *, string>::iterator it;
+
+    //
+    // Check args.
+    //
+
+    FAILEX(nc == NULL, "ERROR: 'nc' cannot be NULL in NetPoolRelease().\n");
+
+    NetPoolMutex.lock();
+
+    it = NetPoolBusy.find(nc);
+
+    if (it == NetPoolBusy.end())
+    {
+      NetPoolMutex.unlock();
+
+      Error("ERROR: Connection PTR [%p] does not come from pool.\n", nc);
+
+      goto fail;
+    }
+
+    {
+      list<NetPoolEntry> &idle = NetPoolIdle[it -> second];
+
+      int64_t now = _NetGetTimeMs();
+
+      NetPoolBusy.erase(it);
+
+      //
+      // Drop expired connections from the oldest.
+      //
+
+      while(!idle.empty() && now - idle.front().idleSince_ >= NetPoolCfg.idleTimeout_)
+      {
+        dead.push_back(idle.front().nc_);
+
+        idle.pop_front();
+      }
+
+      //
+      // Keep connection for reuse if there is place for it.
+      //
+
+      if (reusable && int(idle.size()) < NetPoolCfg.maxIdle_
+              && nc -> getState() == NET_STATE_ESTABLISHED)
+      {
+        NetPoolEntry entry = {nc, now};
+
+        idle.push_back(entry);
+      }
+      else
+      {
+        dead.push_back(nc);
+      }
+    }
+
+    NetPoolMutex.unlock();
+
+    NetPoolClose(dead);
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE("NetPoolRelease");
+
+    return exitCode;
+  }
+
+  //
+  // Change client connection pool configuration.
+  // Fields set to 0 are defaulted, see NetPoolConfig in Net.h.
+  //
+  // config - new pool configuration (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int NetPoolSetConfig(NetPoolConfig *config)
+  {
+    int exitCode = -1;
+
+    FAILEX(config == NULL, "ERROR: 'config' cannot be NULL in NetPoolSetConfig().\n");
+
+    NetPoolMutex.lock();
+
+    NetPoolCfg = *config;
+
+    if (NetPoolCfg.maxIdle_ <= 0)
+    {
+      NetPoolCfg.maxIdle_ = NET_POOL_MAX_IDLE;
+    }
+
+    if (NetPoolCfg.idleTimeout_ <= 0)
+    {
+      NetPoolCfg.idleTimeout_ = NET_POOL_IDLE_TIMEOUT;
+    }
+
+    if (NetPoolCfg.keepAlive_ == 0)
+    {
+      NetPoolCfg.keepAlive_ = NET_POOL_KEEPALIVE;
+    }
+
+    NetPoolMutex.unlock();
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
+  //
+  // Close all idle connections kept in pool.
+  // Connections currently lent to callers are not affected.
+  //
+
+  void NetPoolFlush()
+  {
+    vector<NetConnection *> dead;
+
+    map<string, list<NetPoolEntry> >::iterator it;
+
+    NetPoolMutex.lock();
+
+    for (it = NetPoolIdle.begin(); it != NetPoolIdle.end(); it++)
+    {
+      list<NetPoolEntry>::iterator jt;
+
+      for (jt = it -> second.begin(); jt != it -> second.end(); jt++)
+      {
+        dead.push_back(jt -> nc_);
+      }
+    }
+
+    NetPoolIdle.clear();
+
+    NetPoolMutex.unlock();
+
+    NetPoolClose(dead);
+  }
+
+} /* namespace Tegenaria */
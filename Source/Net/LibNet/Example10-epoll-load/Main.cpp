@@ -0,0 +1,404 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Example shows how to set up HP server with run time connection limits
+// and load test it with many idle and active connections from one box.
+// Code works on Linux only.
+//
+// Usage: example10 [idle connections] [active connections] [seconds] [workers]
+//                  [listen mode] [edge triggered]
+//
+// Defaults are 100000 idle and 10000 active connections for 10 seconds.
+// Listen mode is 0 for shared listener, 1 for SO_REUSEPORT listener per
+// worker and 2 for EPOLLEXCLUSIVE (see NET_HP_LISTEN_XXX). Set edge
+// triggered to 1 to read sockets until EAGAIN with EPOLLET.
+//
+// TIP #1: Client and server run inside the same process, so about
+//         2 * (idle + active) FDs are needed. Raise hard RLIMIT_NOFILE
+//         (e.g. ulimit -Hn) and fs.nr_open before running with defaults.
+//
+// TIP #2: Client connections are spread over 127.0.0.x destination
+//         addresses to avoid running out of ephemeral ports.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <Tegenaria/Net.h>
+#include <Tegenaria/Thread.h>
+#include <Tegenaria/Debug.h>
+
+#ifndef WIN32
+# include <errno.h>
+# include <time.h>
+# include <sys/epoll.h>
+# include <sys/resource.h>
+#endif
+
+using namespace Tegenaria;
+
+#define LOAD_PORT           6666
+#define LOAD_MSG_SIZE       64
+#define LOAD_CONNS_PER_ADDR 20000
+#define LOAD_MAX_PENDING    512
+#define LOAD_MAX_WORKERS    64
+
+//
+// Handler called when something to read on given fd.
+// Write back readed data to client.
+//
+
+void DataHandler(NetHpContext *ctx, int fd, void *buf, int len)
+{
+  NetHpWrite(ctx, fd, buf, len);
+}
+
+//
+// Thread running HP server.
+//
+
+int ServerThread(void *data)
+{
+  NetHpConfig *config = (NetHpConfig *) data;
+
+  return NetHpServerLoopEx(LOAD_PORT, NULL, NULL, DataHandler, config);
+}
+
+#ifndef WIN32
+
+//
+// Get monotonic time in ms.
+//
+
+static double GetTimeMs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//
+// Get number of connections accepted by server so far.
+//
+
+static int GetServerConns(int *rejected = NULL)
+{
+  NetHpStats stats[LOAD_MAX_WORKERS];
+
+  int workers = NetHpServerGetStats(LOAD_PORT, stats, LOAD_MAX_WORKERS);
+
+  int active = 0;
+
+  if (rejected)
+  {
+    *rejected = 0;
+  }
+
+  for (int i = 0; i < workers; i++)
+  {
+    active += stats[i].activeConns_;
+
+    if (rejected)
+    {
+      *rejected += int(stats[i].rejected_);
+    }
+  }
+
+  return workers < 0 ? -1 : active;
+}
+
+//
+// Open <count> connections to server. Connections are throttled to not
+// overflow listen backlog.
+//
+// fds   - table, where to store opened sockets (OUT).
+// count - number of connections to open (IN).
+// base  - number of connections already opened by caller (IN).
+//
+// RETURNS: 0 if OK.
+//
+
+static int OpenConnections(std::vector<int> &fds, int count, int base)
+{
+  struct sockaddr_in addr = {0};
+
+  for (int i = 0; i < count; i++)
+  {
+    int id = base + i;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock == -1)
+    {
+      Error("ERROR: Cannot create socket #%d, error code is %d.\n", id, errno);
+
+      return -1;
+    }
+
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(LOAD_PORT);
+    addr.sin_addr.s_addr = htonl(0x7f000001 + id / LOAD_CONNS_PER_ADDR);
+
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+      Error("ERROR: Cannot connect socket #%d, error code is %d.\n", id, errno);
+
+      close(sock);
+
+      return -1;
+    }
+
+    fds.push_back(sock);
+
+    //
+    // Wait until server catch up.
+    //
+
+    while (GetServerConns() < id + 1 - LOAD_MAX_PENDING)
+    {
+      ThreadSleepMs(1);
+    }
+  }
+
+  return 0;
+}
+
+//
+// Send and receive echo messages over active connections.
+//
+// fds     - active connections (IN).
+// seconds - test duration (IN).
+//
+// RETURNS: Number of completed echo round trips.
+//
+
+static long long RunEcho(std::vector<int> &fds, int seconds)
+{
+  char msg[LOAD_MSG_SIZE];
+
+  std::vector<int> received(fds.size(), 0);
+
+  struct epoll_event ev = {0};
+
+  struct epoll_event events[256];
+
+  long long trips = 0;
+
+  int epollFd = epoll_create(256);
+
+  double deadline = GetTimeMs() + seconds * 1000.0;
+
+  memset(msg, 'x', sizeof(msg));
+
+  for (size_t i = 0; i < fds.size(); i++)
+  {
+    ev.events   = EPOLLIN;
+    ev.data.u32 = i;
+
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev);
+
+    write(fds[i], msg, sizeof(msg));
+  }
+
+  while (GetTimeMs() < deadline)
+  {
+    int n = epoll_wait(epollFd, events, 256, 100);
+
+    for (int j = 0; j < n; j++)
+    {
+      int i = events[j].data.u32;
+
+      char buf[LOAD_MSG_SIZE];
+
+      int readed = read(fds[i], buf, LOAD_MSG_SIZE - received[i]);
+
+      if (readed <= 0)
+      {
+        Error("ERROR: Active connection #%d broken.\n", i);
+
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fds[i], NULL);
+
+        continue;
+      }
+
+      received[i] += readed;
+
+      if (received[i] == LOAD_MSG_SIZE)
+      {
+        received[i] = 0;
+
+        trips++;
+
+        write(fds[i], msg, sizeof(msg));
+      }
+    }
+  }
+
+  close(epollFd);
+
+  return trips;
+}
+
+#endif /* !WIN32 */
+
+//
+// Entry point.
+//
+
+int main(int argc, char **argv)
+{
+  DBG_HEAD("TEGENARIA-EPOLL-LOAD\nBuild [%s, %s]\n", __DATE__, __TIME__);
+
+  #ifdef WIN32
+  {
+    Error("This example works on Linux only.\n");
+
+    return -1;
+  }
+  #else
+
+  int idleCount   = argc > 1 ? atoi(argv[1]) : 100000;
+  int activeCount = argc > 2 ? atoi(argv[2]) : 10000;
+  int seconds     = argc > 3 ? atoi(argv[3]) : 10;
+  int workers     = argc > 4 ? atoi(argv[4]) : 0;
+  int listenMode  = argc > 5 ? atoi(argv[5]) : NET_HP_LISTEN_SHARED;
+  int edge        = argc > 6 ? atoi(argv[6]) : 0;
+
+  int rejected = 0;
+
+  double t0 = 0;
+
+  long long trips = 0;
+
+  std::vector<int> idleFds;
+  std::vector<int> activeFds;
+
+  NetHpStats stats[LOAD_MAX_WORKERS];
+
+  NetHpConfig config = {0};
+
+  struct rlimit fdsLimit;
+
+  //
+  // Client and server share the same process, so split available FDs.
+  //
+
+  getrlimit(RLIMIT_NOFILE, &fdsLimit);
+
+  fdsLimit.rlim_cur = fdsLimit.rlim_max;
+
+  setrlimit(RLIMIT_NOFILE, &fdsLimit);
+
+  if (int(fdsLimit.rlim_cur) < 2 * (idleCount + activeCount) + 256)
+  {
+    Error("ERROR: Open files limit [%d] too low for [%d] connections.\n",
+              int(fdsLimit.rlim_cur), idleCount + activeCount);
+
+    return -1;
+  }
+
+  //
+  // Start server in background thread.
+  //
+
+  config.maxConns_   = idleCount + activeCount;
+  config.workers_    = workers;
+  config.listenMode_    = listenMode;
+  config.edgeTriggered_ = edge;
+
+  ThreadCreate(ServerThread, &config);
+
+  while (GetServerConns() < 0)
+  {
+    ThreadSleepMs(10);
+  }
+
+  //
+  // Open idle connections.
+  //
+
+  printf("Opening %d idle connections...\n", idleCount);
+
+  t0 = GetTimeMs();
+
+  if (OpenConnections(idleFds, idleCount, 0))
+  {
+    return -1;
+  }
+
+  printf("Opened %d idle connections in %.0lf ms.\n", idleCount, GetTimeMs() - t0);
+
+  //
+  // Open active connections and run echo traffic over them.
+  //
+
+  printf("Opening %d active connections...\n", activeCount);
+
+  if (OpenConnections(activeFds, activeCount, idleCount))
+  {
+    return -1;
+  }
+
+  while (GetServerConns() < idleCount + activeCount)
+  {
+    ThreadSleepMs(10);
+  }
+
+  printf("Running echo for %d seconds...\n", seconds);
+
+  trips = RunEcho(activeFds, seconds);
+
+  printf("Completed %lld round trips (%.0lf per second).\n",
+             trips, double(trips) / seconds);
+
+  //
+  // Print per-worker counters.
+  //
+
+  workers = NetHpServerGetStats(LOAD_PORT, stats, LOAD_MAX_WORKERS);
+
+  for (int i = 0; i < workers; i++)
+  {
+    printf("Worker #%d: active [%d], accepted [%lld], rejected [%lld].\n",
+               i, stats[i].activeConns_, (long long) stats[i].accepted_,
+                   (long long) stats[i].rejected_);
+  }
+
+  printf("Server holds %d connections.\n", GetServerConns(&rejected));
+
+  if (GetServerConns() != idleCount + activeCount || rejected)
+  {
+    Error("ERROR: Some connections lost.\n");
+
+    return -1;
+  }
+
+  return 0;
+
+  #endif
+}
@@ -59,6 +59,28 @@ using std::vector;
 #define NET_STATE_LISTENING   2
 #define NET_STATE_ESTABLISHED 3
 
+//
+// Events for NetWaitMany().
+//
+
+#define NET_WAIT_READ  1
+#define NET_WAIT_WRITE 2
+#define NET_WAIT_ERROR 4
+
+//
+// Default accept queue size per worker in pooled NetServerCreateEx() mode.
+//
+
+#define NET_SERVER_QUEUE_PER_WORKER 16
+
+//
+// Client connection pool defaults, see NetPoolSetConfig().
+//
+
+#define NET_POOL_MAX_IDLE     8
+#define NET_POOL_IDLE_TIMEOUT 60000
+#define NET_POOL_KEEPALIVE    30
+
 //
 // Typedef.
 //
@@ -82,6 +104,73 @@ namespace Tegenaria
     int port_;
   };
 
+  //
+  // Item passed to NetWaitMany().
+  //
+
+  struct NetWaitItem
+  {
+    NetConnection *conn_;
+
+    int events_;
+    int revents_;
+  };
+
+  //
+  // Server configuration passed to NetServerCreateEx().
+  //
+  // workers_   - number of pooled threads serving connections. If 0, new
+  //              thread is created for every connection (default).
+  //
+  // queueSize_ - max. number of accepted connections waiting for free
+  //              worker. Connections over limit are closed immediately.
+  //              Defaulted to NET_SERVER_QUEUE_PER_WORKER * workers_.
+  //
+
+  struct NetServerConfig
+  {
+    int workers_;
+    int queueSize_;
+  };
+
+  //
+  // Pooled server counters returned by NetServerGetStats().
+  //
+
+  struct NetServerStats
+  {
+    int workers_;
+    int busyWorkers_;
+    int queueSize_;
+    int queueDepth_;
+    int maxQueueDepth_;
+
+    int64_t accepted_;
+    int64_t rejected_;
+    int64_t served_;
+  };
+
+  //
+  // Client connection pool configuration passed to NetPoolSetConfig().
+  //
+  // maxIdle_     - max. number of idle connections kept per host:port.
+  //                Defaulted to NET_POOL_MAX_IDLE.
+  //
+  // idleTimeout_ - idle connections older than this value in ms are
+  //                closed. Defaulted to NET_POOL_IDLE_TIMEOUT.
+  //
+  // keepAlive_   - TCP keepalive interval in seconds set on pooled
+  //                connections, -1 to disable. Defaulted to
+  //                NET_POOL_KEEPALIVE.
+  //
+
+  struct NetPoolConfig
+  {
+    int maxIdle_;
+    int idleTimeout_;
+    int keepAlive_;
+  };
+
 } /* namespace Tegenaria */
 
 //
@@ -140,6 +229,11 @@ namespace Tegenaria
   NetConnection *NetServerCreate(int port, NetHandleConnProto handler,
                                      void *custom = NULL);
 
+  NetConnection *NetServerCreateEx(int port, NetHandleConnProto handler,
+                                       void *custom, NetServerConfig *config);
+
+  int NetServerGetStats(NetConnection *serverConn, NetServerStats *stats);
+
   int NetServerTerminate(NetConnection *serverConn);
 
   int NetServerLoop(NetConnection *serverConn);
@@ -152,6 +246,14 @@ namespace Tegenaria
 
   NetConnection *NetConnect(const char *ip, int port, int timeout = 10000);
 
+  NetConnection *NetPoolConnect(const char *host, int port, int timeout = 10000);
+
+  int NetPoolRelease(NetConnection *nc, int reusable = 1);
+
+  int NetPoolSetConfig(NetPoolConfig *config);
+
+  void NetPoolFlush();
+
   int NetRequest(int fd[2], int *serverCode, char *serverMsg,
                      int serverMsgSize, const char *fmt, ...);
 
@@ -185,6 +287,8 @@ namespace Tegenaria
 
   int NetResolveIp(vector<string> &ips, const char *host);
 
+  int NetWaitMany(NetWaitItem *items, int count, int timeout = -1);
+
   //
   // SMTP client.
   //
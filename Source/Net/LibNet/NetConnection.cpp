@@ -49,6 +49,7 @@
 #pragma qcbuild_set_file_title("NetConnection class");
 
 #include "NetConnection.h"
+#include "NetInternal.h"
 
 namespace Tegenaria
 {
@@ -185,6 +186,86 @@ namespace Tegenaria
     Error("ERROR: read() is NOT implemented.\n");
   }
 
+  //
+  // Send <len> bytes from file <fd> starting at <offset>.
+  //
+  // Generic version reads file into user space and passes it to write().
+  // Used as fallback if zero-copy is not possible e.g. if write()
+  // encrypts data (TLS) or if file doesn't support sendfile().
+  //
+  // fd      - CRT FD of opened file (IN).
+  // offset  - file position, where to start from (IN).
+  // len     - number of bytes to send (IN).
+  // timeout - timeout in miliseconds for whole operation (IN).
+  //
+  // TIP #1: File position of fd is NOT changed on Linux.
+  //
+  // RETURNS: Number of bytes sent or
+  //          -1 if error.
+  //
+
+  int64_t NetConnection::sendFile(int fd, int64_t offset, int64_t len, int timeout)
+  {
+    char buf[16384];
+
+    int64_t totalSent = 0;
+
+    int64_t deadline = _NetGetTimeMs() + timeout;
+
+    int readed = 0;
+
+    int left = timeout;
+
+    while (totalSent < len)
+    {
+      //
+      // Read next piece of file.
+      //
+
+      #ifdef WIN32
+      {
+        readed = -1;
+
+        if (_lseeki64(fd, offset + totalSent, SEEK_SET) != -1)
+        {
+          readed = _read(fd, buf, int(std::min(len - totalSent, int64_t(sizeof(buf)))));
+        }
+      }
+      #else
+      {
+        readed = pread(fd, buf, size_t(std::min(len - totalSent, int64_t(sizeof(buf)))),
+                           off_t(offset + totalSent));
+      }
+      #endif
+
+      if (readed <= 0)
+      {
+        Error("ERROR: Cannot read file FD #%d at offset [%lld].\n",
+                  fd, (long long) (offset + totalSent));
+
+        return -1;
+      }
+
+      //
+      // Write it to connection.
+      //
+
+      if (timeout > 0)
+      {
+        left = int(std::max(deadline - _NetGetTimeMs(), int64_t(1)));
+      }
+
+      if (write(buf, readed, left) != readed)
+      {
+        return -1;
+      }
+
+      totalSent += readed;
+    }
+
+    return totalSent;
+  }
+
   //
   // Cancel all pending I/O associated with connection (if any).
   //
@@ -30,11 +30,181 @@
 #pragma qcbuild_set_private(1)
 
 #include <Tegenaria/Debug.h>
+#include <Tegenaria/Mutex.h>
 #include "NetEpollServer.h"
 #include "Utils.h"
 
 namespace Tegenaria
 {
+  //
+  // Running servers by port. Used by NetEpollServerGetStats().
+  //
+
+  static map<int, NetEpollServer *> NetEpollServers;
+
+  static Mutex NetEpollServersMutex("NetEpollServers");
+
+  //
+  // Closed mailboxes ready to reuse. Guarded by NetEpollServersMutex.
+  // Touched only when server starts or stops, never when posting.
+  //
+
+  static NetEpollMailbox *NetEpollFreeMailboxes = NULL;
+
+  //
+  // Last mailbox generation. Unique inside process, so stale handle
+  // never matches mailbox reused by another worker.
+  //
+
+  static int64_t NetEpollLastGeneration = 0;
+
+  //
+  // Last connection ID. Unique inside process, so stale handle
+  // never matches connection accepted by another server.
+  //
+
+  static int64_t NetEpollLastId = 0;
+
+  //
+  // Get epoll events set for connection FD.
+  // Used internally only.
+  //
+  // ctx - epoll queue context (IN).
+  //
+  // RETURNS: EPOLLIN, EPOLLOUT if send queue is not empty and EPOLLET
+  //          in edge triggered mode.
+  //
+
+  static unsigned int NetEpollGetEvents(NetEpollContext *ctx)
+  {
+    unsigned int events = EPOLLIN;
+
+    if (ctx -> sendArmed_)
+    {
+      events |= EPOLLOUT;
+    }
+
+    if (ctx -> worker_ && ctx -> worker_ -> server_ -> edgeTriggered_)
+    {
+      events |= EPOLLET;
+    }
+
+    return events;
+  }
+
+  //
+  // Free one send queue chunk. Close file owned by file chunk.
+  // Used internally only.
+  //
+  // chunk - chunk to free (IN).
+  //
+
+  static void NetEpollChunkFree(NetEpollChunk *chunk)
+  {
+    if (chunk -> fileFd_ != -1)
+    {
+      close(chunk -> fileFd_);
+    }
+
+    free(chunk);
+  }
+
+  //
+  // Timer callbacks called from worker's timer wheel.
+  // Used internally only.
+  //
+  // Activity is saved as wheel tick in lastActive_ and lastWrite_ only.
+  // If there was activity since timer was armed, timer is moved to
+  // remaining time instead of closing connection.
+  //
+
+  static void NetEpollIdleTimeout(NetTimer *timer, void *data)
+  {
+    NetEpollContext *ctx = (NetEpollContext *) data;
+
+    NetEpollWorker *worker = ctx -> worker_;
+
+    int timeout = worker -> server_ -> idleTimeout_;
+
+    int elapsed = int(worker -> wheel_.now_ - ctx -> lastActive_) * worker -> wheel_.tickMs_;
+
+    if (elapsed < timeout)
+    {
+      NetTimerAdd(&worker -> wheel_, timer, timeout - elapsed);
+    }
+    else
+    {
+      DBG_MSG("Idle timeout on FD #%d, closing connection.\n", ctx -> fd_);
+
+      worker -> timedOut_++;
+
+      close(ctx -> fd_);
+
+      NetEpollContextDestroy(ctx);
+    }
+  }
+
+  static void NetEpollWriteTimeout(NetTimer *timer, void *data)
+  {
+    NetEpollContext *ctx = (NetEpollContext *) data;
+
+    NetEpollWorker *worker = ctx -> worker_;
+
+    int timeout = worker -> server_ -> writeTimeout_;
+
+    int elapsed = int(worker -> wheel_.now_ - ctx -> lastWrite_) * worker -> wheel_.tickMs_;
+
+    if (elapsed < timeout)
+    {
+      NetTimerAdd(&worker -> wheel_, timer, timeout - elapsed);
+    }
+    else
+    {
+      DBG_MSG("Write stalled on FD #%d (%d bytes queued), closing connection.\n",
+                  ctx -> fd_, ctx -> sendBytes_);
+
+      worker -> timedOut_++;
+
+      close(ctx -> fd_);
+
+      NetEpollContextDestroy(ctx);
+    }
+  }
+
+  static void NetEpollUserTimeout(NetTimer *timer, void *data)
+  {
+    NetEpollContext *ctx = (NetEpollContext *) data;
+
+    if (ctx -> userTimerHandler_)
+    {
+      ctx -> lastError_ = NET_EPOLL_SUCCESS;
+
+      ctx -> userTimerHandler_(ctx, ctx -> fd_);
+
+      //
+      // Write inside handler failed and socket is already closed.
+      //
+
+      if (ctx -> lastError_ == NET_EPOLL_ERROR)
+      {
+        NetEpollContextDestroy(ctx);
+      }
+    }
+  }
+
+  //
+  // Mark connection as active, used to detect idle connections.
+  // Used internally only.
+  //
+
+  static inline void NetEpollTouch(NetEpollContext *ctx)
+  {
+    if (ctx -> worker_)
+    {
+      ctx -> lastActive_ = ctx -> worker_ -> wheel_.now_;
+    }
+  }
+
   //
   // Allocate new epoll context and associate it with given fd.
   //
@@ -80,6 +250,10 @@ namespace Tegenaria
     ctx -> closeHandler_ = closeHandler;
     ctx -> dataHandler_  = dataHandler;
 
+    NetTimerInit(&ctx -> idleTimer_, NetEpollIdleTimeout, ctx);
+    NetTimerInit(&ctx -> writeTimer_, NetEpollWriteTimeout, ctx);
+    NetTimerInit(&ctx -> userTimer_, NetEpollUserTimeout, ctx);
+
     //
     // Error handler.
     //
@@ -108,9 +282,43 @@ namespace Tegenaria
         ctx -> closeHandler_(ctx, ctx -> fd_);
       }
 
-      if (ctx -> data_)
+      //
+      // Update per-worker and per-server connection counters.
+      //
+
+      if (ctx -> worker_)
+      {
+        vector<NetEpollContext *> *conns = ctx -> worker_ -> conns_;
+
+        if (conns && ctx -> fd_ >= 0 && ctx -> fd_ < int(conns -> size())
+                && (*conns)[ctx -> fd_] == ctx)
+        {
+          (*conns)[ctx -> fd_] = NULL;
+        }
+
+        NetTimerCancel(&ctx -> worker_ -> wheel_, &ctx -> idleTimer_);
+        NetTimerCancel(&ctx -> worker_ -> wheel_, &ctx -> writeTimer_);
+        NetTimerCancel(&ctx -> worker_ -> wheel_, &ctx -> userTimer_);
+
+        ctx -> worker_ -> activeConns_--;
+
+        __sync_sub_and_fetch(&ctx -> worker_ -> server_ -> activeConns_, 1);
+
+        DBG_MSG("Closed connection (currently %d connections in worker #%d)\n",
+                    ctx -> worker_ -> activeConns_, ctx -> worker_ -> index_);
+      }
+
+      //
+      // Free send queue.
+      //
+
+      while (ctx -> sendHead_)
       {
-        free(ctx -> data_);
+        NetEpollChunk *next = ctx -> sendHead_ -> next_;
+
+        NetEpollChunkFree(ctx -> sendHead_);
+
+        ctx -> sendHead_ = next;
       }
 
       free(ctx);
@@ -123,7 +331,7 @@ namespace Tegenaria
   // Slave loop to handle one worker thread.
   // Used internally only.
   //
-  // data - pointer to listenCtx struct created in NetEpollServerLoop() (IN/OUT).
+  // data - pointer to NetEpollWorker struct created in NetEpollServerLoopEx() (IN/OUT).
   //
   // RETURNS: 0 if OK.
   //
@@ -154,12 +362,13 @@ namespace Tegenaria
     int eventstriggered = 0;
     int newconns        = 0;
     int fd              = -1;
+    int mailPending     = 0;
 
     struct epoll_event *events = NULL;
 
-    int activeconns = 0;
+    NetEpollWorker *worker = (NetEpollWorker *) data;
 
-    NetEpollContext *listenCtx = (NetEpollContext *) data;
+    NetEpollContext *listenCtx = &worker -> listenCtx_;
 
     NetEpollContext *ctx = NULL;
 
@@ -171,6 +380,16 @@ namespace Tegenaria
 
     FAILEX(events == NULL, "ERROR: out of memory.\n");
 
+    //
+    // Allocate read buffer shared by all connections served by worker.
+    //
+
+    worker -> readBufSize_ = worker -> server_ -> readBufferSize_;
+
+    worker -> readBuf_ = (char *) malloc(worker -> readBufSize_);
+
+    FAILEX(worker -> readBuf_ == NULL, "ERROR: out of memory.\n");
+
     //
     // Fall into main interrupt-triggerd polling queue loop.
     //
@@ -179,17 +398,26 @@ namespace Tegenaria
     {
       //
       // Wait for events.
+      // Wake up every wheel tick if any timer is armed.
       //
 
-      eventstriggered = epoll_wait(listenCtx -> epollFd_, events, NET_EPOLL_MAXEVENTS, -1);
+      eventstriggered = epoll_wait(listenCtx -> epollFd_, events, NET_EPOLL_MAXEVENTS,
+                                       NetTimerWheelGetTimeout(&worker -> wheel_, -1));
 
       if (eventstriggered == -1)
       {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
         Fatal("FATAL: epoll wait returned -1.\n");
       }
 
       DEBUG2("Event triggered: %d\n", eventstriggered);
 
+      mailPending = 0;
+
       //
       // Serve all events.
       //
@@ -200,22 +428,32 @@ namespace Tegenaria
 
         fd = ctx -> fd_;
 
+        //
+        // Work posted to worker's mailbox from other threads.
+        // Served after the whole batch, because posted close may free
+        // contexts, which are still referenced by next events[].
+        //
+
+        if (ctx == &worker -> mailCtx_)
+        {
+          mailPending = 1;
+        }
+
         //
         // Event on listening socket.
         // We're expecting new incoming connetions here.
         //
 
-        if (fd == listenCtx -> fd_)
+        else if (fd == listenCtx -> fd_)
         {
           DEBUG3("NetEpollServerLoop : Accept event on FD #%d/%p.\n", fd, ctx);
 
-          newconns = NetEpollAccept(ctx, fd, activeconns);
+          newconns = NetEpollAccept(ctx, fd);
 
           if (newconns > 0)
           {
-            activeconns += newconns;
-
-            DBG_MSG("Added %d new fd to list (currently %d connections in event loop)\n", newconns, activeconns);
+            DBG_MSG("Added %d new fd to list (currently %d connections in worker #%d)\n",
+                        newconns, worker -> activeConns_, worker -> index_);
           }
         }
 
@@ -237,10 +475,6 @@ namespace Tegenaria
 
             close(fd);
 
-            activeconns--;
-
-            DBG_MSG("Closed connection (currently %d connections in event loop)\n", activeconns);
-
             //
             // Free related epoll context.
             //
@@ -260,34 +494,29 @@ namespace Tegenaria
 
             if(NetEpollWriteEvent(ctx, fd))
             {
-              activeconns--;
-
-              DBG_MSG("Closed connection (currently %d connections in event loop)\n",activeconns);
-
               //
               // Free related epoll context.
               //
 
               NetEpollContextDestroy(ctx);
+
+              continue;
             }
           }
 
           //
           // Read ready event.
+          // Read events stay enabled while send queue is not empty.
           //
 
-          else if (events[i].events & EPOLLIN)
+          if (events[i].events & EPOLLIN)
           {
-            DEBUG3("NetEpollServerLoop : Write event on FD #%d/%p.\n", fd, ctx);
+            DEBUG3("NetEpollServerLoop : Read event on FD #%d/%p.\n", fd, ctx);
 
             NetEpollReadEvent(ctx, fd);
 
             if (ctx -> lastError_ == NET_EPOLL_EOF || ctx -> lastError_ == NET_EPOLL_ERROR)
             {
-              activeconns--;
-
-              DBG_MSG("Closed connection (currently %d connections in event loop)\n",activeconns);
-
               //
               // Free related epoll context.
               //
@@ -298,7 +527,22 @@ namespace Tegenaria
         }
       }
 
-      DEBUG2("Looping event loop.\n", activeconns);
+      //
+      // Serve posted work.
+      //
+
+      if (mailPending)
+      {
+        NetEpollMailboxEvent(worker);
+      }
+
+      //
+      // Serve expired timers.
+      //
+
+      NetTimerWheelRun(&worker -> wheel_);
+
+      DEBUG2("Looping event loop.\n");
     }
 
     //
@@ -319,6 +563,13 @@ namespace Tegenaria
       free(events);
     }
 
+    if (worker -> readBuf_)
+    {
+      free(worker -> readBuf_);
+
+      worker -> readBuf_ = NULL;
+    }
+
     DBG_LEAVE("NetEpollServerSlaveLoop");
 
     return 0;
@@ -328,7 +579,7 @@ namespace Tegenaria
 
   //
   // Main server loop.
-  // Create non-blocking epoll based TCP server.
+  // Create non-blocking epoll based TCP server with default configuration.
   //
   // port         - listening port (IN).
   // openHandler  - handler called when new connection arrived (IN/OPT).
@@ -339,6 +590,7 @@ namespace Tegenaria
   //
   // TIP #1: Use NetEpollWrite() to write data inside data handler.
   // TIP #2: Use NetEpollRead() to read data inside data handler.
+  // TIP #3: Use NetEpollServerLoopEx() to set connection limits.
   //
   // RETURNS: 0 if terminated correctly by NetEpollServerKill(),
   //         -1 if error.
@@ -348,7 +600,43 @@ namespace Tegenaria
                              NetEpollCloseProto closeHandler,
                                  NetEpollDataProto dataHandler)
   {
-    DBG_ENTER("NetEpollServerLoop");
+    return NetEpollServerLoopEx(port, openHandler, closeHandler, dataHandler, NULL);
+  }
+
+  //
+  // Main server loop.
+  // Create non-blocking epoll based TCP server.
+  //
+  // port         - listening port (IN).
+  // openHandler  - handler called when new connection arrived (IN/OPT).
+  // closeHandler - handler called when existing connection closed (IN/OPT).
+  //
+  // dataHandler  - handler called when something to read on one of existing
+  //                connection (IN).
+  //
+  // config       - run time limits, see NetEpollConfig in NetEpollServer.h.
+  //                Default values are used if NULL (IN/OPT).
+  //
+  // TIP #1: RLIMIT_NOFILE is raised to fit connections limit. If it can't
+  //         be raised, connections limit is lowered to current limit.
+  //
+  // TIP #2: Use NetEpollServerGetStats() to get per-worker counters while
+  //         server is running.
+  //
+  // TIP #3: Set config.listenMode_ to NET_HP_LISTEN_REUSEPORT to give every
+  //         worker own listening socket and avoid waking up all workers on
+  //         every new connection.
+  //
+  // RETURNS: 0 if terminated correctly by NetEpollServerKill(),
+  //         -1 if error.
+  //
+
+  int NetEpollServerLoopEx(int port, NetEpollOpenProto openHandler,
+                               NetEpollCloseProto closeHandler,
+                                   NetEpollDataProto dataHandler,
+                                       NetEpollConfig *config)
+  {
+    DBG_ENTER("NetEpollServerLoopEx");
 
     int exitCode = -1;
 
@@ -369,134 +657,470 @@ namespace Tegenaria
 
     #else
 
-    int listensocket;
-    int epollfd;
+    int listensocket = -1;
+    int workersocket = -1;
+    int epollfd      = -1;
+    int registered   = 0;
+    int listenMode   = NET_HP_LISTEN_SHARED;
 
     struct epoll_event ev = {0};
 
-    NetEpollContext listenCtx[64] = {0};
+    struct rlimit fdsLimit;
 
-    ThreadHandle_t *workerThread[64];
+    NetEpollConfig cfg = {0};
 
-    //
-    // Check and change if needed the per-user limit of open files.
-    //
+    NetEpollServer server = {0};
 
-    FAIL(NetSetFDsLimit(NET_EPOLL_MAXCONNS + 1));
+    NetEpollWorker *workers = NULL;
 
     //
-    // Start listening socket on given port.
+    // Apply defaults.
     //
 
-    listensocket = NetEpollListen(port);
+    if (config)
+    {
+      cfg = *config;
+    }
 
-    FAIL(listensocket < 0);
+    if (cfg.maxConns_ <= 0)
+    {
+      cfg.maxConns_ = NET_EPOLL_MAXCONNS;
+    }
 
-    //
-    // Create worker threads.
-    //
+    if (cfg.workers_ <= 0)
+    {
+      cfg.workers_ = NetGetCpuNumber();
+    }
 
-    for (int i = 0; i < NetGetCpuNumber(); i++)
+    if (cfg.workers_ > NET_EPOLL_MAXTHREADS)
     {
-      //
-      // Set up epoll queue for worker.
-      //
+      cfg.workers_ = NET_EPOLL_MAXTHREADS;
+    }
 
-      epollfd = epoll_create(NET_EPOLL_MAXEVENTS);
+    if (cfg.backlog_ <= 0)
+    {
+      cfg.backlog_ = SOMAXCONN;
+    }
 
-      if (epollfd == -1)
-      {
-        Fatal("FATAL: Could not create epoll FD.");
-      }
+    listenMode = cfg.listenMode_;
+
+    //
+    // Check and change if needed the per-user limit of open files.
+    // If we can't get enough FDs, serve as many connections as we can.
+    //
 
-      listenCtx[i].lastError_    = NET_EPOLL_SUCCESS;
-      listenCtx[i].epollFd_      = epollfd;
-      listenCtx[i].openHandler_  = openHandler;
-      listenCtx[i].closeHandler_ = closeHandler;
-      listenCtx[i].dataHandler_  = dataHandler;
-      listenCtx[i].fd_           = listensocket;
+    if (NetSetFDsLimit(cfg.maxConns_ + cfg.workers_ + NET_EPOLL_FDS_SLACK))
+    {
+      FAILEX(getrlimit(RLIMIT_NOFILE, &fdsLimit),
+                 "ERROR: Cannot get open files limit.\n");
 
       //
-      // Add listening socket to epoll.
+      // Hard limit is too low, but raise soft limit as far as possible.
       //
 
-      ev.events   = EPOLLIN;
-      ev.data.ptr = &listenCtx[i];
+      if (fdsLimit.rlim_cur < fdsLimit.rlim_max
+              && NetSetFDsLimit(int(fdsLimit.rlim_max)) == 0)
+      {
+        fdsLimit.rlim_cur = fdsLimit.rlim_max;
+      }
 
-      FAILEX(epoll_ctl(epollfd, EPOLL_CTL_ADD, listensocket, &ev) == -1,
-                 "ERROR: epoll_ctl failure on listening socket #%d.\n", listensocket);
+      FAILEX(int(fdsLimit.rlim_cur) <= cfg.workers_ + NET_EPOLL_FDS_SLACK,
+                 "ERROR: Open files limit [%d] is too low.\n", int(fdsLimit.rlim_cur));
 
-      workerThread[i] = ThreadCreate(NetEpollServerSlaveLoop, &listenCtx[i]);
+      cfg.maxConns_ = int(fdsLimit.rlim_cur) - cfg.workers_ - NET_EPOLL_FDS_SLACK;
 
-      DBG_INFO("NetEpollServerLoop: Craeted worker ID#%d.\n", i);
+      Error("WARNING: Connections limit lowered to [%d] due to open files limit.\n",
+                cfg.maxConns_);
     }
 
+    DBG_INFO("NetEpollServerLoop: Max. [%d] connections, [%d] per worker,"
+                 " [%d] workers.\n", cfg.maxConns_, cfg.maxConnsPerWorker_, cfg.workers_);
+
     //
-    // Wait until workers finished.
+    // Start one, shared listening socket on given port.
+    // In SO_REUSEPORT mode every worker creates own socket below.
     //
 
-    for (int i = 0; i < NetGetCpuNumber(); i++)
+    if (listenMode != NET_HP_LISTEN_REUSEPORT)
     {
-      ThreadWait(workerThread[i]);
-      ThreadClose(workerThread[i]);
-
-      workerThread[i] = NULL;
+      listensocket = NetEpollListen(port, cfg.backlog_);
 
-      DBG_INFO("NetEpollServerLoop: Worker #%d finished.\n", i);
+      FAIL(listensocket < 0);
     }
 
     //
-    // Error handler.
+    // Set up server state.
     //
 
-    exitCode = 0;
+    workers = (NetEpollWorker *) calloc(cfg.workers_, sizeof(NetEpollWorker));
 
-    fail:
+    FAILEX(workers == NULL, "ERROR: Out of memory.\n");
 
-    if (exitCode)
-    {
-      Error("ERROR: Cannot create epoll server loop.\n");
-    }
+    server.port_         = port;
+    server.maxConns_     = cfg.maxConns_;
+    server.workersCount_ = cfg.workers_;
+    server.activeConns_  = 0;
+    server.workers_      = workers;
 
-    if (listensocket != -1)
+    server.sendHighWater_    = cfg.sendHighWater_;
+    server.highWaterHandler_ = (NetEpollHighWaterProto) cfg.highWaterHandler_;
+
+    if (server.sendHighWater_ <= 0)
     {
-      close(listensocket);
+      server.sendHighWater_ = NET_EPOLL_SEND_HIGH_WATER;
     }
 
-    DBG_LEAVE("NetEpollServerLoop");
+    server.edgeTriggered_   = cfg.edgeTriggered_;
+    server.readBufferSize_  = cfg.readBufferSize_;
+    server.readFairnessCap_ = cfg.readFairnessCap_;
 
-    return 0;
+    if (server.readBufferSize_ <= 0)
+    {
+      server.readBufferSize_ = NET_EPOLL_READ_SLAB;
+    }
 
-    #endif
-  }
+    if (server.readFairnessCap_ <= 0)
+    {
+      server.readFairnessCap_ = NET_EPOLL_READ_FAIRNESS;
+    }
 
-  //
-  // This functions creates non-block listening socket.
-  //
-  // port - listening port (IN).
-  //
-  // RETURNS: Listening socket
-  //          or -1 if error.
-  //
+    server.idleTimeout_  = cfg.idleTimeout_;
+    server.writeTimeout_ = cfg.writeTimeout_;
 
-  int NetEpollListen(int port)
-  {
-    //
-    // Windows.
-    //
+    NetEpollServersMutex.lock();
 
-    #ifdef WIN32
+    if (NetEpollServers.count(port) == 0)
     {
-      Error("NetEpollListen() not implemented on Windows.\n");
+      NetEpollServers[port] = &server;
 
-      return -1;
+      registered = 1;
     }
 
+    NetEpollServersMutex.unlock();
+
     //
-    // Linux.
+    // Create worker threads.
     //
 
-    #else
+    for (int i = 0; i < cfg.workers_; i++)
+    {
+      //
+      // Set up epoll queue for worker.
+      //
+
+      epollfd = epoll_create(NET_EPOLL_MAXEVENTS);
+
+      if (epollfd == -1)
+      {
+        Fatal("FATAL: Could not create epoll FD.");
+      }
+
+      workers[i].index_    = i;
+      workers[i].maxConns_ = cfg.maxConnsPerWorker_;
+      workers[i].server_   = &server;
+
+      NetTimerWheelInit(&workers[i].wheel_);
+
+      workers[i].listenCtx_.lastError_    = NET_EPOLL_SUCCESS;
+      workers[i].listenCtx_.epollFd_      = epollfd;
+      workers[i].listenCtx_.openHandler_  = openHandler;
+      workers[i].listenCtx_.closeHandler_ = closeHandler;
+      workers[i].listenCtx_.dataHandler_  = dataHandler;
+      workers[i].listenCtx_.fd_           = -1;
+      workers[i].listenCtx_.worker_       = &workers[i];
+
+      //
+      // Set up mailbox to receive work from other threads.
+      //
+
+      workers[i].conns_   = new vector<NetEpollContext *>();
+      workers[i].mailbox_ = NetEpollMailboxOpen();
+
+      FAILEX(workers[i].mailbox_ == NULL,
+                 "ERROR: Cannot create mailbox for worker #%d.\n", i);
+
+      workers[i].mailCtx_.fd_      = workers[i].mailbox_ -> fd_;
+      workers[i].mailCtx_.epollFd_ = epollfd;
+      workers[i].mailCtx_.worker_  = &workers[i];
+
+      ev.events   = EPOLLIN;
+      ev.data.ptr = &workers[i].mailCtx_;
+
+      FAILEX(epoll_ctl(epollfd, EPOLL_CTL_ADD, workers[i].mailCtx_.fd_, &ev) == -1,
+                 "ERROR: epoll_ctl failure on eventfd #%d.\n", workers[i].mailCtx_.fd_);
+
+      //
+      // Create own listening socket for worker in SO_REUSEPORT mode.
+      // If SO_REUSEPORT is not supported, go back to one shared socket
+      // registered with EPOLLEXCLUSIVE.
+      //
+
+      workersocket = listensocket;
+
+      if (listenMode == NET_HP_LISTEN_REUSEPORT)
+      {
+        workersocket = NetEpollListen(port, cfg.backlog_, 1);
+
+        if (workersocket < 0 && i == 0)
+        {
+          Error("WARNING: SO_REUSEPORT not available, using EPOLLEXCLUSIVE.\n");
+
+          listenMode = NET_HP_LISTEN_EXCLUSIVE;
+
+          listensocket = NetEpollListen(port, cfg.backlog_);
+
+          workersocket = listensocket;
+        }
+
+        FAIL(workersocket < 0);
+      }
+
+      workers[i].listenCtx_.fd_ = workersocket;
+
+      //
+      // Add listening socket to epoll.
+      //
+
+      ev.events   = EPOLLIN;
+      ev.data.ptr = &workers[i].listenCtx_;
+
+      if (listenMode == NET_HP_LISTEN_EXCLUSIVE)
+      {
+        ev.events |= EPOLLEXCLUSIVE;
+
+        //
+        // EPOLLEXCLUSIVE is available since Linux 4.5.
+        //
+
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, workersocket, &ev) == -1)
+        {
+          FAILEX(i > 0, "ERROR: epoll_ctl failure on listening socket #%d.\n", workersocket);
+
+          Error("WARNING: EPOLLEXCLUSIVE not available, using shared listener.\n");
+
+          listenMode = NET_HP_LISTEN_SHARED;
+
+          ev.events = EPOLLIN;
+        }
+      }
+
+      if (listenMode != NET_HP_LISTEN_EXCLUSIVE)
+      {
+        FAILEX(epoll_ctl(epollfd, EPOLL_CTL_ADD, workersocket, &ev) == -1,
+                   "ERROR: epoll_ctl failure on listening socket #%d.\n", workersocket);
+      }
+
+      workers[i].thread_ = ThreadCreate(NetEpollServerSlaveLoop, &workers[i]);
+
+      DBG_INFO("NetEpollServerLoop: Craeted worker ID#%d.\n", i);
+    }
+
+    //
+    // Wait until workers finished.
+    //
+
+    for (int i = 0; i < cfg.workers_; i++)
+    {
+      ThreadWait(workers[i].thread_);
+      ThreadClose(workers[i].thread_);
+
+      workers[i].thread_ = NULL;
+
+      DBG_INFO("NetEpollServerLoop: Worker #%d finished.\n", i);
+    }
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create epoll server loop.\n");
+    }
+
+    if (registered)
+    {
+      NetEpollServersMutex.lock();
+
+      NetEpollServers.erase(port);
+
+      NetEpollServersMutex.unlock();
+    }
+
+    if (workers)
+    {
+      for (int i = 0; i < cfg.workers_; i++)
+      {
+        if (workers[i].thread_)
+        {
+          ThreadKill(workers[i].thread_);
+          ThreadClose(workers[i].thread_);
+        }
+
+        if (workers[i].listenCtx_.epollFd_ > 0)
+        {
+          close(workers[i].listenCtx_.epollFd_);
+        }
+
+        //
+        // Own worker's listener in SO_REUSEPORT mode.
+        //
+
+        if (workers[i].listenCtx_.fd_ > 0 && workers[i].listenCtx_.fd_ != listensocket)
+        {
+          close(workers[i].listenCtx_.fd_);
+        }
+
+        //
+        // Mailbox. Reject messages posted from now on and free messages
+        // never served.
+        //
+
+        if (workers[i].mailbox_)
+        {
+          NetEpollMailboxClose(workers[i].mailbox_);
+        }
+
+        delete workers[i].conns_;
+      }
+
+      free(workers);
+    }
+
+    if (listensocket != -1)
+    {
+      close(listensocket);
+    }
+
+    DBG_LEAVE("NetEpollServerLoopEx");
+
+    return exitCode;
+
+    #endif
+  }
+
+  //
+  // Set one-shot user timer for connection. Timer is served by worker's
+  // timer wheel, inside the same thread, which calls data handler.
+  //
+  // ctx       - epoll context received in handlers parameters (IN).
+  // timeoutMs - time to expire in ms, 0 to cancel timer (IN).
+  // callback  - function called when timer expires (IN).
+  //
+  // TIP#1: Call NetEpollSetTimer() again inside callback to get periodic
+  //        timer.
+  //
+  // WARNING: Must be called from handlers only (worker's thread).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetEpollSetTimer(NetEpollContext *ctx, int timeoutMs, NetEpollTimerProto callback)
+  {
+    int exitCode = -1;
+
+    FAILEX(ctx == NULL || ctx -> worker_ == NULL,
+               "ERROR: Epoll context PTR #%p is not served by worker.\n", ctx);
+
+    if (timeoutMs <= 0 || callback == NULL)
+    {
+      NetTimerCancel(&ctx -> worker_ -> wheel_, &ctx -> userTimer_);
+    }
+    else
+    {
+      ctx -> userTimerHandler_ = callback;
+
+      NetTimerAdd(&ctx -> worker_ -> wheel_, &ctx -> userTimer_, timeoutMs);
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
+  //
+  // Get per-worker counters of running epoll server.
+  //
+  // port       - port passed to NetEpollServerLoop[Ex]() (IN).
+  // stats      - table, where to store counters for every worker (OUT).
+  // maxWorkers - number of elements in stats[] table (IN).
+  //
+  // RETURNS: Number of workers stored in stats[],
+  //          -1 if there is no epoll server running on given port.
+  //
+
+  int NetEpollServerGetStats(int port, NetEpollStats *stats, int maxWorkers)
+  {
+    int count = -1;
+
+    NetEpollServersMutex.lock();
+
+    map<int, NetEpollServer *>::iterator it = NetEpollServers.find(port);
+
+    if (it != NetEpollServers.end())
+    {
+      NetEpollServer *server = it -> second;
+
+      count = server -> workersCount_;
+
+      if (count > maxWorkers)
+      {
+        count = maxWorkers;
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        stats[i].activeConns_ = server -> workers_[i].activeConns_;
+        stats[i].accepted_    = server -> workers_[i].accepted_;
+        stats[i].rejected_    = server -> workers_[i].rejected_;
+        stats[i].timedOut_    = server -> workers_[i].timedOut_;
+      }
+    }
+
+    NetEpollServersMutex.unlock();
+
+    return count;
+  }
+
+  //
+  // This functions creates non-block listening socket.
+  //
+  // port      - listening port (IN).
+  // backlog   - maximum length of pending connections queue, SOMAXCONN used
+  //             if 0 (IN/OPT).
+  //
+  // reusePort - set SO_REUSEPORT flag to allow many listening sockets on the
+  //             same port, one per worker (IN/OPT).
+  //
+  // RETURNS: Listening socket
+  //          or -1 if error.
+  //
+
+  int NetEpollListen(int port, int backlog, int reusePort)
+  {
+    //
+    // Windows.
+    //
+
+    #ifdef WIN32
+    {
+      Error("NetEpollListen() not implemented on Windows.\n");
+
+      return -1;
+    }
+
+    //
+    // Linux.
+    //
+
+    #else
 
     DBG_ENTER("NetEpollListen");
 
@@ -532,6 +1156,18 @@ namespace Tegenaria
     FAILEX(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
                          &reuseAddress, sizeof(reuseAddress)) == -1,
                              "ERROR: Cannot set reuse flag on socket #%d.\n", sock);
+
+    //
+    // Set port reuse to allow one listening socket per worker.
+    //
+
+    if (reusePort)
+    {
+      FAILEX(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+                           &reusePort, sizeof(reusePort)) == -1,
+                               "ERROR: Cannot set SO_REUSEPORT on socket #%d.\n", sock);
+    }
+
     //
     // Bind socket to IP address.
     //
@@ -543,7 +1179,12 @@ namespace Tegenaria
     // Listen for incoming connection.
     //
 
-    FAILEX(listen(sock, NET_EPOLL_MAXCONNS) == -1,
+    if (backlog <= 0)
+    {
+      backlog = SOMAXCONN;
+    }
+
+    FAILEX(listen(sock, backlog) == -1,
                "ERROR: Cannot listen on socket #%d.\n", sock);
 
     DBG_INFO("Listening on port %d...\n", port);
@@ -590,13 +1231,14 @@ namespace Tegenaria
   //
   // listensocket - listening socket related with event (IN).
   //
-  // activeconns  - number of already active connections on listensocket (IN).
+  // TIP#1: Connections over per-worker or per-server limit are closed
+  //        immediately and counted in worker's rejected_ counter.
   //
   // RETURNS: Number of new accepted connections,
   //          or -1 if error.
   //
 
-  int NetEpollAccept(NetEpollContext *listenCtx, int listensocket, int activeconns)
+  int NetEpollAccept(NetEpollContext *listenCtx, int listensocket)
   {
     //
     // Windows.
@@ -627,6 +1269,8 @@ namespace Tegenaria
 
     NetEpollContext *ctx = NULL;
 
+    NetEpollWorker *worker = listenCtx -> worker_;
+
     //
     // Accept connections until something to accept.
     //
@@ -655,6 +1299,18 @@ namespace Tegenaria
           break;
         }
 
+        //
+        // Out of FDs. Leave pending connections in backlog until some
+        // existing connection is closed instead of busy looping here.
+        //
+
+        if ((errno == EMFILE) || (errno == ENFILE))
+        {
+          Error("ERROR: Cannot accept new connection, out of FDs.\n");
+
+          break;
+        }
+
         //
         // We did not break, error occurred
         //
@@ -670,9 +1326,19 @@ namespace Tegenaria
       // Check limit of connection.
       //
 
-      if ((activeconns + 1) >= NET_EPOLL_MAXEVENTS)
+      if (worker)
       {
-        Fatal("FATAL: Too many open connections at FD#%d.\n", newfd);
+        if ((worker -> maxConns_ > 0 && worker -> activeConns_ >= worker -> maxConns_)
+                || (worker -> server_ -> activeConns_ >= worker -> server_ -> maxConns_))
+        {
+          DBG_MSG("Too many open connections, rejecting FD#%d.\n", newfd);
+
+          close(newfd);
+
+          worker -> rejected_++;
+
+          continue;
+        }
       }
 
       //
@@ -688,14 +1354,50 @@ namespace Tegenaria
       {
         Error("Cannot allocate new epoll context.\n");
 
+        close(newfd);
+
         continue;
       }
 
       //
-      // Available for input and non edge_triggered.
+      // Account new connection in worker and server counters.
       //
 
-      ev.events   = EPOLLIN;
+      if (worker)
+      {
+        ctx -> worker_ = worker;
+        ctx -> id_     = __atomic_add_fetch(&NetEpollLastId, 1, __ATOMIC_RELAXED);
+
+        if (newfd >= int(worker -> conns_ -> size()))
+        {
+          worker -> conns_ -> resize(std::max(newfd + 1, 2 * int(worker -> conns_ -> size())));
+        }
+
+        (*worker -> conns_)[newfd] = ctx;
+
+        worker -> activeConns_++;
+        worker -> accepted_++;
+
+        //
+        // Start idle timer.
+        //
+
+        NetEpollTouch(ctx);
+
+        if (worker -> server_ -> idleTimeout_ > 0)
+        {
+          NetTimerAdd(&worker -> wheel_, &ctx -> idleTimer_,
+                          worker -> server_ -> idleTimeout_);
+        }
+
+        __sync_add_and_fetch(&worker -> server_ -> activeConns_, 1);
+      }
+
+      //
+      // Available for input. Edge triggered if set in config.
+      //
+
+      ev.events   = NetEpollGetEvents(ctx);
       ev.data.ptr = ctx;
 
       if (epoll_ctl(ctx -> epollFd_, EPOLL_CTL_ADD, newfd, &ev) == -1)
@@ -726,24 +1428,130 @@ namespace Tegenaria
   }
 
   //
-  // Push data to write queue for delay write, when socket will became ready
-  // to write.
-  // Used internally only if blocked write failed or only part of data
-  // written in NetEpollWrite().
-  //
-  // ctx     - epoll queue context created in NetEpollServerLoop function (IN).
-  // fd      - CRT FD configured to work with epoll queue (IN).
-  // buf     - source buffer with data to write (IN).
-  // len     - number of bytes in buf[] (IN).
+  // Notify user about send queue crossing high-water mark or being drained
+  // back to empty. Handler is called once per every crossing.
+  // Used internally only.
   //
-  // written - how many bytes already sent, only remaining part will be
-  //           processed (IN).
+  // ctx    - epoll queue context (IN/OUT).
+  // fd     - CRT FD configured to work with epoll queue (IN).
+  // queued - number of bytes queued, 0 means queue drained (IN).
   //
 
-  void NetEpollDelayWrite(NetEpollContext *ctx, int fd,
-                              char *buf, int len, int written)
+  static void NetEpollHighWater(NetEpollContext *ctx, int fd, int queued)
   {
-    DBG_ENTER("NetEpollDelayWrite");
+    NetEpollHighWaterProto handler = NULL;
+
+    if (ctx -> worker_)
+    {
+      handler = ctx -> worker_ -> server_ -> highWaterHandler_;
+    }
+
+    if (queued > 0 && ctx -> highWaterHit_ == 0)
+    {
+      DBG_MSG("WARNING: Send queue for FD #%d reached high-water mark"
+                  " (%d bytes queued).\n", fd, queued);
+
+      ctx -> highWaterHit_ = 1;
+
+      if (handler)
+      {
+        handler(ctx, fd, queued);
+      }
+    }
+    else if (queued == 0 && ctx -> highWaterHit_)
+    {
+      ctx -> highWaterHit_ = 0;
+
+      if (handler)
+      {
+        handler(ctx, fd, 0);
+      }
+    }
+  }
+
+  //
+  // Enable write ready events for connection with non-empty send queue.
+  // Read events stay enabled.
+  // Used internally only.
+  //
+  // ctx - epoll queue context (IN/OUT).
+  // fd  - CRT FD configured to work with epoll queue (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  static int NetEpollArmWrite(NetEpollContext *ctx, int fd)
+  {
+    int exitCode = -1;
+
+    #ifndef WIN32
+
+    struct epoll_event ev = {0};
+
+    if (ctx -> sendArmed_ == 0)
+    {
+      ctx -> sendArmed_ = 1;
+
+      //
+      // Start write stall timer.
+      //
+
+      if (ctx -> worker_)
+      {
+        ctx -> lastWrite_ = ctx -> worker_ -> wheel_.now_;
+
+        if (ctx -> worker_ -> server_ -> writeTimeout_ > 0)
+        {
+          NetTimerAdd(&ctx -> worker_ -> wheel_, &ctx -> writeTimer_,
+                          ctx -> worker_ -> server_ -> writeTimeout_);
+        }
+      }
+
+      ev.events   = NetEpollGetEvents(ctx);
+      ev.data.ptr = ctx;
+
+      FAILEX(epoll_ctl(ctx -> epollFd_, EPOLL_CTL_MOD, fd, &ev) == -1,
+                 "ERROR: epoll_ctl failure on FD #%d.\n", fd);
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    #endif
+
+    return exitCode;
+  }
+
+  //
+  // Push data to send queue for delay write, when socket will became ready
+  // to write.
+  // Used internally only if blocked write failed or only part of data
+  // written in NetEpollWrite().
+  //
+  // ctx     - epoll queue context created in NetEpollServerLoop function (IN).
+  // fd      - CRT FD configured to work with epoll queue (IN).
+  // buf     - source buffer with data to write (IN).
+  // len     - number of bytes in buf[] (IN).
+  //
+  // written - how many bytes already sent, only remaining part will be
+  //           processed (IN).
+  //
+  // TIP #1: Data is appended to free space in last chunk first, then new
+  //         chunk is allocated for the rest. Queue is drained by writev()
+  //         in NetEpollWriteEvent().
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetEpollDelayWrite(NetEpollContext *ctx, int fd,
+                             char *buf, int len, int written)
+  {
+    DBG_ENTER("NetEpollDelayWrite");
+
+    int exitCode = -1;
 
     //
     // Windows.
@@ -760,73 +1568,101 @@ namespace Tegenaria
 
     #else
 
-    //
-    // Will simply not mark the socket, discard the data,
-    // and keep the socket in the loop.
-    //
+    char *src = buf + written;
 
-    if(NET_EPOLL_TCP_SEND_BUFFER_CORRECT == 0)
-    {
-      return;
-    }
+    int toQueue = len - written;
 
-    struct epoll_event ev = {0};
+    int highWater = NET_EPOLL_SEND_HIGH_WATER;
 
-    DBG_MSG("WARNING: Socket became write blocked"
-                " (still %d/%d bytes to send).", written, len);
+    int capacity = 0;
 
-    //
-    // Remove the socket from the queue
-    //
+    int n = 0;
+
+    NetEpollChunk *chunk = ctx -> sendTail_;
 
-    if (epoll_ctl(ctx -> epollFd_, EPOLL_CTL_DEL, fd, NULL) == -1)
+    DBG_MSG("WARNING: Socket became write blocked"
+                " (still %d/%d bytes to send).\n", written, len);
+
+    if (ctx -> worker_)
     {
-      Fatal("FATAL: epoll_ctl removal failure on fd %d", fd);
+      highWater = ctx -> worker_ -> server_ -> sendHighWater_;
     }
 
     //
-    // Check if we already have an entry (we shouldn't).
-    // If we have data in send buffer append data to it.
+    // Fill free space in last chunk first.
     //
 
-    if (ctx -> len_ > 0)
+    if (chunk && chunk -> fileFd_ == -1)
     {
-      int oldLen = ctx -> len_;
+      n = std::min(chunk -> capacity_ - chunk -> writePos_, toQueue);
 
-      ctx -> len_  = oldLen + len - written;
-      ctx -> data_ = realloc(ctx -> data_, ctx -> len_);
+      memcpy(chunk -> data_ + chunk -> writePos_, src, n);
 
-      memcpy((char *) ctx -> data_ + oldLen, buf + written, len - written);
+      chunk -> writePos_ += n;
+
+      src     += n;
+      toQueue -= n;
     }
 
     //
-    // Buffer empty.
-    // Create new one.
+    // Allocate new chunk for the rest.
+    // Big writes go into one chunk to keep iovec table short.
     //
 
-    else
+    if (toQueue > 0)
     {
-      ctx -> len_  = len - written;
-      ctx -> data_ = realloc(ctx -> data_, ctx -> len_);
+      capacity = std::max(NET_EPOLL_SEND_CHUNK, toQueue);
+
+      chunk = (NetEpollChunk *) malloc(sizeof(NetEpollChunk) + capacity);
+
+      FAILEX(chunk == NULL, "ERROR: Out of memory.\n");
+
+      chunk -> next_      = NULL;
+      chunk -> capacity_  = capacity;
+      chunk -> readPos_   = 0;
+      chunk -> writePos_  = toQueue;
+      chunk -> fileFd_    = -1;
+
+      memcpy(chunk -> data_, src, toQueue);
+
+      if (ctx -> sendTail_)
+      {
+        ctx -> sendTail_ -> next_ = chunk;
+      }
+      else
+      {
+        ctx -> sendHead_ = chunk;
+      }
 
-      memmove(ctx -> data_, buf + written, ctx -> len_);
+      ctx -> sendTail_ = chunk;
     }
 
+    ctx -> sendBytes_ += len - written;
+
     //
-    // Readd the socket to the queue.
+    // Watch for write ready event, but keep read events enabled.
     //
 
-    ev.events   = EPOLLOUT;
-    ev.data.ptr = ctx;
+    FAIL(NetEpollArmWrite(ctx, fd));
+
+    //
+    // Tell user, that client is too slow.
+    //
 
-    if(epoll_ctl(ctx -> epollFd_, EPOLL_CTL_ADD, fd, &ev) == -1)
+    if (ctx -> sendBytes_ >= highWater)
     {
-      Fatal("FATAL: epoll_ctl failure on readdition of fd %d", fd);
+      NetEpollHighWater(ctx, fd, ctx -> sendBytes_);
     }
 
+    exitCode = 0;
+
+    fail:
+
     #endif
 
     DBG_LEAVE("NetEpollDelayWrite");
+
+    return exitCode;
   }
 
   //
@@ -878,7 +1714,7 @@ namespace Tegenaria
         // FD busy right now, go away and try once again later.
         //
 
-        if((errno == EAGAIN) && (errno == EWOULDBLOCK))
+        if((errno == EAGAIN) || (errno == EWOULDBLOCK))
         {
           ret = NET_EPOLL_WOULD_BLOCK;
         }
@@ -953,7 +1789,15 @@ namespace Tegenaria
   // buf - destination buffer (OUT).
   // len - number of bytes to read (IN).
   //
-  // RETURNS: Number of bytes written or
+  // TIP #1: Data, which can't be written immediately is queued and sent
+  //         when socket becomes writable.
+  //
+  // TIP #2: If queue already holds data and len bytes more would cross
+  //         high-water mark, whole buffer is refused with
+  //         NET_EPOLL_WOULD_BLOCK. Data is never cut in the middle.
+  //
+  // RETURNS: Number of bytes written or queued,
+  //          NET_EPOLL_WOULD_BLOCK if send queue is full,
   //          -1 if error.
   //
 
@@ -980,6 +1824,8 @@ namespace Tegenaria
 
     #else
     {
+      int highWater = NET_EPOLL_SEND_HIGH_WATER;
+
       //
       // Check args.
       //
@@ -988,109 +1834,196 @@ namespace Tegenaria
                  "ERROR: FD #%d doesn't match epoll context PTR #%p.\n",
                      fd, ctx);
 
+      if (ctx -> worker_)
+      {
+        highWater = ctx -> worker_ -> server_ -> sendHighWater_;
+      }
+
       //
-      // Note that this is a bit tricky. It is possible that the write does not return the number of bytes
-      // that we tried to send to it. (This could be the case because TCP's send buffer is full, and the receiver's
-      // flow control is blocking it.) Although unlikely, we do try to not loose data here, and keep a userspace
-      // buffer active to send it the next time the socket becomes writable. In addition, we then have
-      // remove the "read" event, and schedule the write event.
+      // There is already data waiting in send queue. Append new data
+      // at the end to keep order, but don't let the queue grow over
+      // high-water mark.
       //
 
-      if (ctx -> len_ == 0)
+      if (ctx -> sendHead_)
       {
-        written = write(fd, buf, len);
+        if (ctx -> sendBytes_ + len > highWater)
+        {
+          NetEpollHighWater(ctx, fd, ctx -> sendBytes_);
+
+          ctx -> lastError_ = NET_EPOLL_WOULD_BLOCK;
+
+          ret = NET_EPOLL_WOULD_BLOCK;
+
+          goto fail;
+        }
+
+        written = 0;
       }
 
       //
-      // Write error or socket not ready.
+      // Send queue empty, try to write directly.
       //
 
-      if (written == -1)
+      else
       {
+        written = write(fd, buf, len);
+
         //
-        // Socket not ready.
-        // Delay writing to next write ready event.
+        // Write error or socket not ready.
         //
 
-        if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        if (written == -1)
         {
-          DBG_MSG("WARNING: Send-buffer full for connection %d\n", fd);
+          //
+          // Socket not ready.
+          // Delay writing to next write ready event.
+          //
 
-          NetEpollDelayWrite(ctx, fd, (char *) buf, len, 0);
+          if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+          {
+            DBG_MSG("WARNING: Send-buffer full for connection %d\n", fd);
 
-          ret = len;
+            written = 0;
+          }
 
-          ctx -> lastError_ = NET_EPOLL_WOULD_BLOCK;
-        }
+          //
+          // Write error. Close socket.
+          //
 
-        //
-        // Write error. Close socket.
-        //
+          else
+          {
+            Error("ERROR: Cannot write to FD #%d due to unexpected reason (hence closing it)."
+                      " Reason: %s\n", fd, strerror(errno));
 
-        else
-        {
-          Error("ERROR: Cannot write to FD #%d due to unexpected reason (hence closing it)."
-                    " Reason: %s\n", fd, strerror(errno));
+            close(fd);
 
-          close(fd);
+            ctx -> lastError_ = NET_EPOLL_ERROR;
 
-          ctx -> lastError_ = NET_EPOLL_ERROR;
+            ret = NET_EPOLL_ERROR;
 
-          ret = NET_EPOLL_ERROR;
+            goto fail;
+          }
         }
       }
 
       //
-      // Data partially written.
-      // Delay writing remaining part to next write ready event.
+      // Data not written or partially written.
+      // Queue remaining part to next write ready event.
       //
 
-      else if (written < len)
+      if (written > 0)
+      {
+        NetEpollTouch(ctx);
+      }
+
+      if (written < len && NetEpollDelayWrite(ctx, fd, (char *) buf, len, written))
       {
-        NetEpollDelayWrite(ctx, fd, (char *) buf, len, written);
+        close(fd);
 
-        ctx -> lastError_ = NET_EPOLL_SUCCESS;
+        ctx -> lastError_ = NET_EPOLL_ERROR;
 
-        ret = len;
+        ret = NET_EPOLL_ERROR;
+
+        goto fail;
       }
 
+      ctx -> lastError_ = NET_EPOLL_SUCCESS;
+
+      ret = len;
+    }
+
+    fail:
+
+    #endif
+
+    DBG_LEAVE("NetEpollWrite");
+
+    return ret;
+  }
+
+  //
+  // Copy <len> bytes from file to connection through user space.
+  // Fallback for files, which don't support sendfile().
+  // Used internally only.
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  static int NetEpollSendFileCopy(NetEpollContext *ctx, int fd, int fileFd,
+                                      int64_t offset, int64_t len)
+  {
+    int exitCode = -1;
+
+    #ifndef WIN32
+
+    char buf[NET_EPOLL_SEND_CHUNK];
+
+    int readed = 0;
+
+    while (len > 0)
+    {
+      readed = pread(fileFd, buf, size_t(std::min(len, int64_t(sizeof(buf)))), off_t(offset));
+
+      FAILEX(readed <= 0, "ERROR: Cannot read file FD #%d at offset [%lld].\n",
+                 fileFd, (long long) offset);
+
       //
-      // Whole data written.
+      // Data queued already, append to keep order. Posted data is never
+      // refused due to high-water mark.
       //
 
+      if (ctx -> sendHead_)
+      {
+        FAIL(NetEpollDelayWrite(ctx, fd, buf, readed, 0));
+      }
       else
       {
-        ret = len;
-
-        ctx -> lastError_ = NET_EPOLL_SUCCESS;
+        FAIL(NetEpollWrite(ctx, fd, buf, readed) != readed);
       }
+
+      offset += readed;
+      len    -= readed;
     }
 
+    exitCode = 0;
+
     fail:
 
     #endif
 
-    DBG_LEAVE("NetEpollWrite");
-
-    return ret;
+    return exitCode;
   }
 
   //
-  // Handle epoll read ready event on given FD.
-  // Called internally only from NetEpollServerLoop().
+  // Send <len> bytes from file <fileFd> starting at <offset> to FD created
+  // by epoll server. File data is copied by kernel directly to socket
+  // (sendfile) without passing it through user space.
   //
-  // ctx - epoll queue context created in NetEpollServerLoop (IN).
-  // fd  - fd, where to read data from (IN).
+  // ctx    - epoll queue context (IN).
+  // fd     - CRT FD configured to work with epoll queue (IN).
+  // fileFd - CRT FD of opened file (IN).
+  // offset - file position, where to start from (IN).
+  // len    - number of bytes to send (IN).
   //
-  // RETURNS: 1 if socket closed inside function,
-  //          0 otherwise.
+  // TIP #1: Function never blocks. Part, which can't be sent immediately,
+  //         is queued and sent on write ready events in order with data
+  //         written by NetEpollWrite().
+  //
+  // TIP #2: fileFd is duplicated if needed. Caller can close it just
+  //         after call.
+  //
+  // RETURNS: 0 if OK,
+  //          NET_EPOLL_ERROR if error.
   //
 
-  int NetEpollReadEvent(NetEpollContext *ctx, int fd)
+  int NetEpollSendFile(NetEpollContext *ctx, int fd, int fileFd,
+                           int64_t offset, int64_t len)
   {
-    DBG_ENTER("NetEpollReadEvent");
+    DBG_ENTER("NetEpollSendFile");
 
-    int ret = -1;
+    int ret = NET_EPOLL_ERROR;
 
     //
     // Windows.
@@ -1098,7 +2031,7 @@ namespace Tegenaria
 
     #ifdef WIN32
     {
-      Error("NetEpollReadEvent() not implemented on Windows.\n");
+      Error("NetEpollSendFile() not implemented on Windows.\n");
     }
 
     //
@@ -1106,95 +2039,145 @@ namespace Tegenaria
     //
 
     #else
+    {
+      NetEpollChunk *chunk = NULL;
 
-    int readed = 0;
-
-    int socketClosed = 0;
+      off_t pos = off_t(offset);
 
-    char buf[NET_EPOLL_READBUFF];
+      ssize_t sent = 0;
 
-    //
-    // Note that because we potentially have a lot of data,
-    // we might need to do this in a few loops.
-    //
+      FAILEX(ctx -> fd_ != fd,
+                 "ERROR: FD #%d doesn't match epoll context PTR #%p.\n",
+                     fd, ctx);
 
-    ctx -> lastError_ = NET_EPOLL_SUCCESS;
+      FAILEX(len < 0, "ERROR: Invalid length [%lld].\n", (long long) len);
 
-    while(ctx -> lastError_ == NET_EPOLL_SUCCESS)
-    {
-      readed = NetEpollRead(ctx, fd, buf, sizeof(buf));
+      //
+      // Send queue empty, try to send directly.
+      //
 
-      switch(readed)
+      while (ctx -> sendHead_ == NULL && len > 0)
       {
-        //
-        // Read error.
-        //
+        sent = sendfile(fd, fileFd, &pos,
+                            size_t(std::min(len, int64_t(NET_EPOLL_SENDFILE_CHUNK))));
 
-        case NET_EPOLL_ERROR:
+        if (sent > 0)
         {
-          Error("ERROR: Cannot read data from FD #%d.\n", fd);
+          offset += sent;
+          len    -= sent;
 
-          break;
+          NetEpollTouch(ctx);
         }
-
-        //
-        // EOF readed.
-        //
-
-        case NET_EPOLL_EOF:
+        else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
         {
           break;
         }
-
-        //
-        // FD not ready right now, go away and try again.
-        //
-
-        case NET_EPOLL_WOULD_BLOCK:
+        else if (sent == -1 && errno == EINTR)
         {
-          break;
+          continue;
         }
 
         //
-        // Data readed.
-        // Call user handler.
+        // sendfile() not supported for this file.
         //
 
-        default:
+        else if (sent == -1 && (errno == EINVAL || errno == ENOSYS))
         {
-          if (ctx -> dataHandler_)
-          {
-            ctx -> dataHandler_(ctx, fd, buf, readed);
-          }
+          FAIL(NetEpollSendFileCopy(ctx, fd, fileFd, offset, len));
 
-          break;
+          len = 0;
         }
-      }
-    }
+        else
+        {
+          Error("ERROR: Cannot send file FD #%d to FD #%d (hence closing it)."
+                    " Reason: %s\n", fileFd, fd,
+                        sent ? strerror(errno) : "unexpected end of file");
 
-    ret = 0;
+          close(fd);
 
-    #endif
+          ctx -> lastError_ = NET_EPOLL_ERROR;
 
-    DBG_LEAVE("NetEpollReadEvent");
+          goto fail;
+        }
+      }
+
+      //
+      // Queue remaining part of file. It will be sent on next write
+      // ready events.
+      //
+
+      if (len > 0)
+      {
+        chunk = (NetEpollChunk *) malloc(sizeof(NetEpollChunk));
+
+        FAILEX(chunk == NULL, "ERROR: Out of memory.\n");
+
+        chunk -> next_       = NULL;
+        chunk -> capacity_   = 0;
+        chunk -> readPos_    = 0;
+        chunk -> writePos_   = 0;
+        chunk -> fileFd_     = dup(fileFd);
+        chunk -> fileOffset_ = offset;
+        chunk -> fileLeft_   = len;
+
+        if (chunk -> fileFd_ == -1)
+        {
+          Error("ERROR: Cannot duplicate file FD #%d.\n", fileFd);
+
+          free(chunk);
+
+          goto fail;
+        }
+
+        if (ctx -> sendTail_)
+        {
+          ctx -> sendTail_ -> next_ = chunk;
+        }
+        else
+        {
+          ctx -> sendHead_ = chunk;
+        }
+
+        ctx -> sendTail_ = chunk;
+
+        FAIL(NetEpollArmWrite(ctx, fd));
+      }
+
+      ctx -> lastError_ = NET_EPOLL_SUCCESS;
+
+      ret = 0;
+    }
+
+    fail:
+
+    #endif
+
+    DBG_LEAVE("NetEpollSendFile");
 
     return ret;
   }
 
   //
-  // Handle epoll write ready event on given FD.
+  // Handle epoll read ready event on given FD.
   // Called internally only from NetEpollServerLoop().
   //
   // ctx - epoll queue context created in NetEpollServerLoop (IN).
-  // fd  - fd, where to write data to (IN).
+  // fd  - fd, where to read data from (IN).
+  //
+  // TIP #1: Data is read into worker's read buffer and passed to data
+  //         handler directly. Buffer is valid inside handler only.
+  //
+  // TIP #2: Socket is read until EAGAIN, but not more than read fairness
+  //         cap per one wake up. In edge triggered mode FD is re-armed
+  //         if there is still data left to read.
   //
   // RETURNS: 1 if socket closed inside function,
   //          0 otherwise.
   //
 
-  int NetEpollWriteEvent(NetEpollContext *ctx, int fd)
+  int NetEpollReadEvent(NetEpollContext *ctx, int fd)
   {
-    DBG_ENTER("NetEpollWriteEvent");
+    DBG_ENTER("NetEpollReadEvent");
 
     int ret = -1;
 
@@ -1204,7 +2187,7 @@ namespace Tegenaria
 
     #ifdef WIN32
     {
-      Error("NetEpollWriteEvent() not implemented on Windows.\n");
+      Error("NetEpollReadEvent() not implemented on Windows.\n");
     }
 
     //
@@ -1213,140 +2196,1005 @@ namespace Tegenaria
 
     #else
 
-    char *storedbuffer;
+    int readed = 0;
 
-    int storedsize  = 0;
-    int closedconns = 0;
-    int written   = 0;
+    int drained = 0;
 
-    struct epoll_event ev = {0};
+    int total = 0;
 
-    storedbuffer = (char *) ctx -> data_;
+    int edgeTriggered = 0;
 
-    if (storedbuffer == NULL)
-    {
-      Fatal("FATAL: socket was write blocked, but out of memory.\n");
-    }
+    int fairnessCap = NET_EPOLL_READ_FAIRNESS;
 
-    storedsize = ctx -> len_;
+    char stackBuf[NET_EPOLL_READBUFF];
 
-    if (storedsize == -1)
-    {
-      Fatal("FATAL: socket was write blocked, but out of memory.\n");
-    }
+    char *buf = stackBuf;
 
-    //
-    // Set delay buffer as empty.
-    //
+    int bufSize = sizeof(stackBuf);
 
-    ctx -> len_ = 0;
+    struct epoll_event ev = {0};
 
     //
-    // Now we can again start to attempt to write this data to the socket
+    // Use worker's read buffer if possible.
     //
 
-    written = write(fd, storedbuffer, storedsize);
+    if (ctx -> worker_ && ctx -> worker_ -> readBuf_)
+    {
+      buf     = ctx -> worker_ -> readBuf_;
+      bufSize = ctx -> worker_ -> readBufSize_;
+
+      edgeTriggered = ctx -> worker_ -> server_ -> edgeTriggered_;
+      fairnessCap   = ctx -> worker_ -> server_ -> readFairnessCap_;
+    }
 
     //
-    // Write failed.
+    // Note that because we potentially have a lot of data,
+    // we might need to do this in a few loops.
     //
 
-    if(written == -1)
+    ctx -> lastError_ = NET_EPOLL_SUCCESS;
+
+    while(ctx -> lastError_ == NET_EPOLL_SUCCESS)
     {
-      //
-      // Something went wrong. Either we are blocking (buffer full), or there was a real error
-      //
+      readed = NetEpollRead(ctx, fd, buf, bufSize);
 
-      if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      switch(readed)
       {
-        DBG_MSG("WARNING: write-blocked socket became ready for"
-                  " writing, but blocked again immediately! (fd %d)\n", fd);
+        //
+        // Read error.
+        //
+
+        case NET_EPOLL_ERROR:
+        {
+          Error("ERROR: Cannot read data from FD #%d.\n", fd);
+
+          break;
+        }
+
+        //
+        // EOF readed.
+        //
+
+        case NET_EPOLL_EOF:
+        {
+          break;
+        }
+
+        //
+        // FD not ready right now, go away and try again.
+        //
+
+        case NET_EPOLL_WOULD_BLOCK:
+        {
+          drained = 1;
+
+          break;
+        }
 
         //
-        // We again did not succeed in sending everything we wanted to send.
-        // Stop echoing, and queue the data until the socket becomes ready.
+        // Data readed.
+        // Call user handler.
         //
 
-        NetEpollDelayWrite(ctx, fd, storedbuffer, storedsize, 0);
+        default:
+        {
+          if (ctx -> dataHandler_)
+          {
+            ctx -> dataHandler_(ctx, fd, buf, readed);
+          }
+
+          total += readed;
+
+          NetEpollTouch(ctx);
+
+          //
+          // Level triggered: short read means socket buffer is empty.
+          // Don't waste syscall for EAGAIN, epoll reports remaining
+          // data or EOF again anyway.
+          //
+
+          if (edgeTriggered == 0 && readed < bufSize)
+          {
+            drained = 1;
+          }
 
-        return 0;
+          break;
+        }
       }
-      else
-      {
-        Error("Could not read from socket (fd %d) due to "
-                  "unexpected reason (hence closing it). Reason: %s\n",
-                      fd, strerror(errno));
 
-        close(fd);
+      //
+      // Give other connections a chance.
+      //
 
-        return 1;
+      if (drained || total >= fairnessCap)
+      {
+        break;
       }
     }
 
     //
-    // Written only part of data.
+    // Edge triggered: we stopped before EAGAIN, so epoll won't report
+    // remaining data again. Re-arm FD to get next event.
     //
 
-    else if (written < storedsize)
+    if (edgeTriggered && drained == 0
+            && ctx -> lastError_ != NET_EPOLL_EOF
+                && ctx -> lastError_ != NET_EPOLL_ERROR)
     {
-      //
-      // We did not sent all the bytes we wanted to send.
-      // Stop echoing, and queue the data until the socket becomes ready.
-      //
+      ev.events   = NetEpollGetEvents(ctx);
+      ev.data.ptr = ctx;
 
-      DBG_MSG("WARNING: write-blocked socket became ready for writing, but blocked again immediately! (fd %d)\n", fd);
+      if (epoll_ctl(ctx -> epollFd_, EPOLL_CTL_MOD, fd, &ev) == -1)
+      {
+        Fatal("FATAL: epoll_ctl failure on FD #%d.\n", fd);
+      }
+    }
 
-      NetEpollDelayWrite(ctx, fd, storedbuffer, storedsize, written);
+    ret = 0;
 
-      return 0;
-    }
+    #endif
 
-    //
-    // Whole buffer written.
-    //
+    DBG_LEAVE("NetEpollReadEvent");
 
-    else if (written == storedsize)
-    {
-      free(ctx -> data_);
+    return ret;
+  }
 
-      ctx -> data_ = NULL;
-    }
+  //
+  // Handle epoll write ready event on given FD.
+  // Called internally only from NetEpollServerLoop().
+  //
+  // ctx - epoll queue context created in NetEpollServerLoop (IN).
+  // fd  - fd, where to write data to (IN).
+  //
+  // RETURNS: 1 if socket closed inside function,
+  //          0 otherwise.
+  //
+
+  int NetEpollWriteEvent(NetEpollContext *ctx, int fd)
+  {
+    DBG_ENTER("NetEpollWriteEvent");
+
+    int ret = -1;
 
     //
-    // At this point, we have successfully written our data. We can now
-    // finally reenable read events. Remove the socket from the queue
+    // Windows.
     //
 
-    if (epoll_ctl(ctx -> epollFd_, EPOLL_CTL_DEL, fd, NULL) == -1)
+    #ifdef WIN32
     {
-      Fatal("FATAL: epoll_ctl removal failure on fd %d", fd);
+      Error("NetEpollWriteEvent() not implemented on Windows.\n");
     }
 
     //
-    // Readd the socket to the queue.
+    // Linux.
     //
 
+    #else
+
+    struct iovec iov[NET_EPOLL_SEND_MAX_IOV];
+
+    struct epoll_event ev = {0};
+
+    NetEpollChunk *chunk = NULL;
+
+    int count = 0;
+
+    int blocked = 0;
+
+    int written = 0;
+
+    off_t fileOffset = 0;
+
     //
-    // Available for read and non edge_triggered.
+    // Send queued chunks until queue empty or socket blocked again.
     //
 
-    ev.events   = EPOLLIN;
-    ev.data.ptr = ctx;
-
-    if (epoll_ctl(ctx -> epollFd_, EPOLL_CTL_ADD, fd, &ev) == -1)
+    while (ctx -> sendHead_ && blocked == 0)
     {
-      Fatal("FATAL: epoll_ctl failure on readdition of fd %d", fd);
-    }
+      //
+      // File chunk on queue head. Send it by sendfile().
+      //
 
-    DBG_MSG("INFO: write-blocked socket became ready"
-                " for writing, and userspace buffer was cleared! (fd %d)\n", fd);
+      if (ctx -> sendHead_ -> fileFd_ != -1)
+      {
+        chunk = ctx -> sendHead_;
 
-    ret = 0;
+        fileOffset = off_t(chunk -> fileOffset_);
 
-    #endif
+        written = sendfile(fd, chunk -> fileFd_, &fileOffset,
+                               size_t(std::min(chunk -> fileLeft_,
+                                                   int64_t(NET_EPOLL_SENDFILE_CHUNK))));
 
-    DBG_LEAVE("NetEpollWriteEvent");
+        if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+          blocked = 1;
 
-    return ret;
+          continue;
+        }
+
+        if (written == -1 && errno == EINTR)
+        {
+          continue;
+        }
+
+        if (written <= 0)
+        {
+          Error("ERROR: Cannot send file FD #%d to FD #%d (hence closing it)."
+                    " Reason: %s\n", chunk -> fileFd_, fd,
+                        written ? strerror(errno) : "unexpected end of file");
+
+          close(fd);
+
+          ret = 1;
+
+          goto fail;
+        }
+
+        chunk -> fileOffset_ += written;
+        chunk -> fileLeft_   -= written;
+
+        if (ctx -> worker_)
+        {
+          ctx -> lastWrite_ = ctx -> worker_ -> wheel_.now_;
+
+          NetEpollTouch(ctx);
+        }
+
+        if (chunk -> fileLeft_ == 0)
+        {
+          ctx -> sendHead_ = chunk -> next_;
+
+          if (ctx -> sendHead_ == NULL)
+          {
+            ctx -> sendTail_ = NULL;
+          }
+
+          NetEpollChunkFree(chunk);
+        }
+
+        continue;
+      }
+
+      //
+      // Gather up to NET_EPOLL_SEND_MAX_IOV chunks into one writev() call.
+      // Stop on first file chunk.
+      //
+
+      count = 0;
+
+      for (chunk = ctx -> sendHead_;
+               chunk && chunk -> fileFd_ == -1 && count < NET_EPOLL_SEND_MAX_IOV;
+                   chunk = chunk -> next_)
+      {
+        iov[count].iov_base = chunk -> data_ + chunk -> readPos_;
+        iov[count].iov_len  = chunk -> writePos_ - chunk -> readPos_;
+
+        count++;
+      }
+
+      written = writev(fd, iov, count);
+
+      //
+      // Write failed.
+      //
+
+      if (written == -1)
+      {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+          DBG_MSG("WARNING: write-blocked socket became ready for"
+                    " writing, but blocked again immediately! (fd %d)\n", fd);
+
+          blocked = 1;
+
+          continue;
+        }
+
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        Error("Could not write to socket (fd %d) due to "
+                  "unexpected reason (hence closing it). Reason: %s\n",
+                      fd, strerror(errno));
+
+        close(fd);
+
+        ret = 1;
+
+        goto fail;
+      }
+
+      //
+      // Pop sent data from queue. Free chunks sent completely.
+      //
+
+      ctx -> sendBytes_ -= written;
+
+      if (written > 0 && ctx -> worker_)
+      {
+        ctx -> lastWrite_ = ctx -> worker_ -> wheel_.now_;
+
+        NetEpollTouch(ctx);
+      }
+
+      while (written > 0)
+      {
+        chunk = ctx -> sendHead_;
+
+        if (written >= chunk -> writePos_ - chunk -> readPos_)
+        {
+          written -= chunk -> writePos_ - chunk -> readPos_;
+
+          ctx -> sendHead_ = chunk -> next_;
+
+          NetEpollChunkFree(chunk);
+        }
+        else
+        {
+          chunk -> readPos_ += written;
+
+          written = 0;
+        }
+      }
+
+      if (ctx -> sendHead_ == NULL)
+      {
+        ctx -> sendTail_ = NULL;
+      }
+    }
+
+    //
+    // Whole queue written. We don't need write events anymore.
+    //
+
+    if (ctx -> sendHead_ == NULL)
+    {
+      //
+      // Close was posted by NetEpollPostClose(), when data was still
+      // queued. Close it now.
+      //
+
+      if (ctx -> closePending_)
+      {
+        close(fd);
+
+        ret = 1;
+
+        goto fail;
+      }
+
+      ctx -> sendArmed_ = 0;
+
+      if (ctx -> worker_)
+      {
+        NetTimerCancel(&ctx -> worker_ -> wheel_, &ctx -> writeTimer_);
+      }
+
+      ev.events   = NetEpollGetEvents(ctx);
+      ev.data.ptr = ctx;
+
+      if (epoll_ctl(ctx -> epollFd_, EPOLL_CTL_MOD, fd, &ev) == -1)
+      {
+        Fatal("FATAL: epoll_ctl failure on FD #%d.\n", fd);
+      }
+
+      DBG_MSG("INFO: write-blocked socket became ready"
+                  " for writing, and userspace buffer was cleared! (fd %d)\n", fd);
+
+      NetEpollHighWater(ctx, fd, 0);
+    }
+
+    ret = 0;
+
+    fail:
+
+    #endif
+
+    DBG_LEAVE("NetEpollWriteEvent");
+
+    return ret;
+  }
+
+  //
+  // Push message to worker's mailbox. Can be called from any thread.
+  // Lock-free, multi producer, single consumer queue.
+  // Used internally only.
+  //
+  // mailbox - mailbox, where to push message (IN/OUT).
+  // msg     - message to push (IN).
+  //
+
+  static void NetEpollMailboxPush(NetEpollMailbox *mailbox, NetEpollMessage *msg)
+  {
+    NetEpollMessage *prev = NULL;
+
+    msg -> next_ = NULL;
+
+    prev = __atomic_exchange_n(&mailbox -> tail_, msg, __ATOMIC_ACQ_REL);
+
+    __atomic_store_n(&prev -> next_, msg, __ATOMIC_RELEASE);
+  }
+
+  //
+  // Pop one message from worker's mailbox.
+  // Called by worker thread only.
+  //
+  // mailbox - mailbox, where to pop message from (IN/OUT).
+  //
+  // RETURNS: Popped message, caller must free it,
+  //          NULL if queue empty or producer didn't finish push yet.
+  //          In second case producer will wake worker again.
+  //
+
+  static NetEpollMessage *NetEpollMailboxPop(NetEpollMailbox *mailbox)
+  {
+    NetEpollMessage *stub = &mailbox -> stub_;
+    NetEpollMessage *head = mailbox -> head_;
+    NetEpollMessage *next = __atomic_load_n(&head -> next_, __ATOMIC_ACQUIRE);
+
+    //
+    // Skip stub node.
+    //
+
+    if (head == stub)
+    {
+      if (next == NULL)
+      {
+        return NULL;
+      }
+
+      mailbox -> head_ = next;
+
+      head = next;
+      next = __atomic_load_n(&head -> next_, __ATOMIC_ACQUIRE);
+    }
+
+    if (next)
+    {
+      mailbox -> head_ = next;
+
+      return head;
+    }
+
+    //
+    // Head is the last node. Push stub behind it to pop it safely.
+    //
+
+    if (head != __atomic_load_n(&mailbox -> tail_, __ATOMIC_ACQUIRE))
+    {
+      return NULL;
+    }
+
+    NetEpollMailboxPush(mailbox, stub);
+
+    next = __atomic_load_n(&head -> next_, __ATOMIC_ACQUIRE);
+
+    if (next)
+    {
+      mailbox -> head_ = next;
+
+      return head;
+    }
+
+    return NULL;
+  }
+
+  //
+  // Open empty mailbox. Reuse closed one if possible.
+  // Used internally only.
+  //
+  // RETURNS: Opened mailbox,
+  //          NULL if error.
+  //
+
+  NetEpollMailbox *NetEpollMailboxOpen()
+  {
+    int exitCode = -1;
+
+    NetEpollMailbox *mailbox = NULL;
+
+    #ifndef WIN32
+
+    NetEpollServersMutex.lock();
+
+    mailbox = NetEpollFreeMailboxes;
+
+    if (mailbox)
+    {
+      NetEpollFreeMailboxes = mailbox -> nextFree_;
+    }
+
+    NetEpollServersMutex.unlock();
+
+    if (mailbox == NULL)
+    {
+      mailbox = (NetEpollMailbox *) calloc(1, sizeof(NetEpollMailbox));
+
+      FAILEX(mailbox == NULL, "ERROR: Out of memory.\n");
+    }
+
+    mailbox -> stub_.next_ = NULL;
+    mailbox -> head_       = &mailbox -> stub_;
+    mailbox -> tail_       = &mailbox -> stub_;
+    mailbox -> signaled_   = 0;
+    mailbox -> posters_    = 0;
+    mailbox -> nextFree_   = NULL;
+
+    mailbox -> fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    FAILEX(mailbox -> fd_ == -1, "ERROR: Cannot create eventfd.\n");
+
+    //
+    // Open for posting. Must be the last step.
+    //
+
+    __atomic_store_n(&mailbox -> generation_,
+                         __atomic_add_fetch(&NetEpollLastGeneration, 1, __ATOMIC_RELAXED),
+                             __ATOMIC_SEQ_CST);
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode && mailbox)
+    {
+      NetEpollServersMutex.lock();
+
+      mailbox -> nextFree_ = NetEpollFreeMailboxes;
+
+      NetEpollFreeMailboxes = mailbox;
+
+      NetEpollServersMutex.unlock();
+
+      mailbox = NULL;
+    }
+
+    #endif
+
+    return mailbox;
+  }
+
+  //
+  // Close mailbox opened by NetEpollMailboxOpen() before.
+  // Messages posted from now on are rejected, messages never served
+  // are freed.
+  // Called internally only, when worker thread is already finished.
+  //
+  // mailbox - mailbox to close (IN/OUT).
+  //
+
+  void NetEpollMailboxClose(NetEpollMailbox *mailbox)
+  {
+    #ifndef WIN32
+
+    NetEpollMessage *msg = NULL;
+
+    //
+    // Reject new posters and wait until posters already inside
+    // NetEpollPostMessage() finished. Posting is just push and eventfd
+    // write, so it never takes long.
+    //
+
+    __atomic_store_n(&mailbox -> generation_, 0, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&mailbox -> posters_, __ATOMIC_SEQ_CST) > 0)
+    {
+      sched_yield();
+    }
+
+    //
+    // Free messages never served.
+    //
+
+    while ((msg = NetEpollMailboxPop(mailbox)) != NULL)
+    {
+      if (msg != &mailbox -> stub_)
+      {
+        free(msg);
+      }
+    }
+
+    if (mailbox -> fd_ != -1)
+    {
+      close(mailbox -> fd_);
+
+      mailbox -> fd_ = -1;
+    }
+
+    //
+    // Keep memory for next worker. Stale handles may still point here.
+    //
+
+    NetEpollServersMutex.lock();
+
+    mailbox -> nextFree_ = NetEpollFreeMailboxes;
+
+    NetEpollFreeMailboxes = mailbox;
+
+    NetEpollServersMutex.unlock();
+
+    #endif
+  }
+
+  //
+  // Serve one posted write inside worker thread.
+  // Used internally only.
+  //
+  // Posted data is never refused. If send queue is already over
+  // high-water mark, data is queued anyway and high-water handler is
+  // called to slow down the poster.
+  //
+  // ctx - epoll context of connection (IN/OUT).
+  // msg - posted message (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if connection failed. Socket is already closed and
+  //         ctx -> lastError_ is set to NET_EPOLL_ERROR, caller must free
+  //         the context.
+  //
+
+  static int NetEpollMailboxWrite(NetEpollContext *ctx, NetEpollMessage *msg)
+  {
+    if (ctx -> sendHead_)
+    {
+      if (NetEpollDelayWrite(ctx, ctx -> fd_, msg -> buf_, msg -> len_, 0))
+      {
+        close(ctx -> fd_);
+
+        ctx -> lastError_ = NET_EPOLL_ERROR;
+
+        return -1;
+      }
+
+      if (ctx -> sendBytes_ > ctx -> worker_ -> server_ -> sendHighWater_)
+      {
+        NetEpollHighWater(ctx, ctx -> fd_, ctx -> sendBytes_);
+      }
+    }
+    else if (NetEpollWrite(ctx, ctx -> fd_, msg -> buf_, msg -> len_) == NET_EPOLL_ERROR)
+    {
+      return -1;
+    }
+
+    return 0;
+  }
+
+  //
+  // Serve messages posted to worker's mailbox.
+  // Called internally only from NetEpollServerSlaveLoop() on eventfd event.
+  //
+  // worker - worker owning the mailbox (IN/OUT).
+  //
+  // RETURNS: Number of served messages.
+  //
+
+  int NetEpollMailboxEvent(NetEpollWorker *worker)
+  {
+    DBG_ENTER3("NetEpollMailboxEvent");
+
+    int served = 0;
+
+    #ifndef WIN32
+
+    uint64_t value = 0;
+
+    NetEpollMailbox *mailbox = worker -> mailbox_;
+
+    NetEpollMessage *msg = NULL;
+
+    NetEpollContext *ctx = NULL;
+
+    //
+    // Reset eventfd and signaled flag BEFORE draining the queue.
+    // Messages pushed after that wake worker again.
+    //
+
+    if (read(mailbox -> fd_, &value, sizeof(value)) == -1 && errno != EAGAIN)
+    {
+      Error("ERROR: Cannot read eventfd #%d.\n", mailbox -> fd_);
+    }
+
+    __atomic_store_n(&mailbox -> signaled_, 0, __ATOMIC_SEQ_CST);
+
+    while ((msg = NetEpollMailboxPop(mailbox)) != NULL)
+    {
+      //
+      // Find target connection. Skip message if connection was closed
+      // or FD was reused by another connection in the meantime.
+      //
+
+      ctx = NULL;
+
+      if (msg -> fd_ >= 0 && msg -> fd_ < int(worker -> conns_ -> size()))
+      {
+        ctx = (*worker -> conns_)[msg -> fd_];
+
+        if (ctx && (ctx -> id_ != msg -> id_ || ctx -> closePending_))
+        {
+          ctx = NULL;
+        }
+      }
+
+      switch(msg -> type_)
+      {
+        case NET_EPOLL_POST_WRITE:
+        {
+          if (ctx)
+          {
+            NetEpollMailboxWrite(ctx, msg);
+          }
+
+          break;
+        }
+
+        //
+        // Close connection. If there is still data queued, close it
+        // after queue drained.
+        //
+
+        case NET_EPOLL_POST_CLOSE:
+        {
+          if (ctx && ctx -> sendHead_)
+          {
+            ctx -> closePending_ = 1;
+          }
+          else if (ctx)
+          {
+            close(ctx -> fd_);
+
+            NetEpollContextDestroy(ctx);
+
+            ctx = NULL;
+          }
+
+          break;
+        }
+
+        //
+        // Call posted function. Call it even if connection is gone to
+        // give caller chance to free its data.
+        //
+
+        case NET_EPOLL_POST_CALL:
+        {
+          if (ctx)
+          {
+            ctx -> lastError_ = NET_EPOLL_SUCCESS;
+          }
+
+          msg -> callback_(ctx, ctx ? ctx -> fd_ : -1, msg -> data_);
+
+          break;
+        }
+      }
+
+      //
+      // Write inside message failed. Socket is already closed, free
+      // related epoll context the same way as after data handler.
+      //
+
+      if (ctx && ctx -> lastError_ == NET_EPOLL_ERROR)
+      {
+        NetEpollContextDestroy(ctx);
+      }
+
+      free(msg);
+
+      served++;
+    }
+
+    #endif
+
+    DBG_LEAVE3("NetEpollMailboxEvent");
+
+    return served;
+  }
+
+  //
+  // Allocate message and post it to worker owning the connection.
+  // Wake worker by eventfd if it's not signaled already.
+  // Lock-free, doesn't take any global lock.
+  // Used internally only.
+  //
+  // handle   - connection handle from NetEpollGetHandle() (IN).
+  // type     - one of NET_EPOLL_POST_XXX (IN).
+  // buf      - data to copy into message (IN/OPT).
+  // len      - number of bytes in buf[] (IN/OPT).
+  // callback - function to call in worker thread (IN/OPT).
+  // data     - parameter passed to callback (IN/OPT).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  static int NetEpollPostMessage(NetEpollHandle *handle, int type,
+                                     void *buf, int len,
+                                         NetEpollPostProto callback, void *data)
+  {
+    int exitCode = -1;
+
+    #ifndef WIN32
+
+    NetEpollMailbox *mailbox = NULL;
+
+    NetEpollMessage *msg = NULL;
+
+    uint64_t one = 1;
+
+    int pinned = 0;
+
+    FAILEX(handle == NULL || handle -> mailbox_ == NULL,
+               "ERROR: Invalid connection handle PTR #%p.\n", handle);
+
+    FAILEX(len < 0, "ERROR: Invalid length [%d].\n", len);
+
+    mailbox = (NetEpollMailbox *) handle -> mailbox_;
+
+    msg = (NetEpollMessage *) malloc(sizeof(NetEpollMessage) + len);
+
+    FAILEX(msg == NULL, "ERROR: Out of memory.\n");
+
+    msg -> type_     = type;
+    msg -> fd_       = handle -> fd_;
+    msg -> id_       = handle -> id_;
+    msg -> callback_ = callback;
+    msg -> data_     = data;
+    msg -> len_      = len;
+
+    if (len > 0)
+    {
+      memcpy(msg -> buf_, buf, len);
+    }
+
+    //
+    // Server could be stopped in the meantime. Pin mailbox and check
+    // generation again, so NetEpollMailboxClose() waits until message
+    // is pushed and worker woken. Posters coming after close are
+    // rejected by first check without pinning, so they never delay close.
+    //
+
+    if (__atomic_load_n(&mailbox -> generation_, __ATOMIC_SEQ_CST) == handle -> generation_)
+    {
+      __atomic_add_fetch(&mailbox -> posters_, 1, __ATOMIC_SEQ_CST);
+
+      pinned = 1;
+    }
+
+    FAILEX(pinned == 0
+               || __atomic_load_n(&mailbox -> generation_, __ATOMIC_SEQ_CST) != handle -> generation_,
+                   "ERROR: Connection handle PTR #%p refers to stopped server.\n", handle);
+
+    NetEpollMailboxPush(mailbox, msg);
+
+    msg = NULL;
+
+    //
+    // Wake only the owning worker and only if nobody did it before.
+    //
+
+    if (__atomic_exchange_n(&mailbox -> signaled_, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+      if (write(mailbox -> fd_, &one, sizeof(one)) == -1)
+      {
+        Error("ERROR: Cannot signal eventfd #%d.\n", mailbox -> fd_);
+      }
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    if (pinned)
+    {
+      __atomic_sub_fetch(&mailbox -> posters_, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if (msg)
+    {
+      free(msg);
+    }
+
+    #endif
+
+    return exitCode;
+  }
+
+  //
+  // Get connection handle, which can be passed to other threads and used
+  // with NetEpollPostXXX() functions.
+  //
+  // WARNING: Must be called from handlers only (worker's thread).
+  //
+  // ctx    - epoll context received in handlers parameters (IN).
+  // fd     - FD received in handlers parameters (IN).
+  // handle - buffer, where to store handle (OUT).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetEpollGetHandle(NetEpollContext *ctx, int fd, NetEpollHandle *handle)
+  {
+    int exitCode = -1;
+
+    FAILEX(ctx == NULL || ctx -> worker_ == NULL,
+               "ERROR: Epoll context PTR #%p is not served by worker.\n", ctx);
+
+    FAILEX(handle == NULL, "ERROR: 'handle' cannot be NULL.\n");
+
+    handle -> mailbox_    = ctx -> worker_ -> mailbox_;
+    handle -> generation_ = ctx -> worker_ -> mailbox_ -> generation_;
+    handle -> fd_         = fd;
+    handle -> id_         = ctx -> id_;
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
+  //
+  // Write data to connection from any thread. Data is copied and written
+  // by worker owning the connection, in posting order.
+  //
+  // handle - connection handle from NetEpollGetHandle() (IN).
+  // buf    - data to write (IN).
+  // len    - number of bytes in buf[] (IN).
+  //
+  // TIP #1: Data posted after connection closed is silently dropped.
+  //
+  // TIP #2: Posting to connection of stopped server fails with -1.
+  //
+  // RETURNS: 0 if data posted,
+  //         -1 if error.
+  //
+
+  int NetEpollPostWrite(NetEpollHandle *handle, void *buf, int len)
+  {
+    return NetEpollPostMessage(handle, NET_EPOLL_POST_WRITE, buf, len, NULL, NULL);
+  }
+
+  //
+  // Close connection from any thread. Data posted before is sent first.
+  //
+  // handle - connection handle from NetEpollGetHandle() (IN).
+  //
+  // RETURNS: 0 if close posted,
+  //         -1 if error.
+  //
+
+  int NetEpollPostClose(NetEpollHandle *handle)
+  {
+    return NetEpollPostMessage(handle, NET_EPOLL_POST_CLOSE, NULL, 0, NULL, NULL);
+  }
+
+  //
+  // Call function inside worker owning the connection from any thread.
+  // Inside callback it's safe to use all NetEpollXXX(ctx, ...) functions.
+  //
+  // handle   - connection handle from NetEpollGetHandle() (IN).
+  // callback - function to call (IN).
+  // data     - custom parameter passed to callback (IN/OPT).
+  //
+  // TIP #1: Callback is called with ctx = NULL and fd = -1 if connection
+  //         was closed in the meantime.
+  //
+  // RETURNS: 0 if call posted,
+  //         -1 if error.
+  //
+
+  int NetEpollPostCall(NetEpollHandle *handle, NetEpollPostProto callback, void *data)
+  {
+    if (callback == NULL)
+    {
+      Error("ERROR: 'callback' cannot be NULL.\n");
+
+      return -1;
+    }
+
+    return NetEpollPostMessage(handle, NET_EPOLL_POST_CALL, NULL, 0, callback, data);
   }
 } /* namespace Tegenaria */
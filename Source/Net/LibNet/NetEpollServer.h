@@ -38,15 +38,38 @@
 # include <netinet/in.h>
 # include <arpa/inet.h>
 # include <fcntl.h>
+# include <sys/uio.h>
+# include <sys/eventfd.h>
+# include <sched.h>
+# include <sys/sendfile.h>
+
+//
+// Missing in older system headers.
+//
+
+# ifndef EPOLLEXCLUSIVE
+#  define EPOLLEXCLUSIVE (1u << 28)
+# endif
+
+# ifndef SO_REUSEPORT
+#  define SO_REUSEPORT 15
+# endif
 #endif
 
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
 #include <Tegenaria/Debug.h>
 #include <Tegenaria/Thread.h>
 
+#include "NetHpServer.h"
+#include "NetTimerWheel.h"
+
 namespace Tegenaria
 {
   using std::map;
+  using std::vector;
 
   //
   // Defines.
@@ -57,18 +80,62 @@ namespace Tegenaria
   #define NET_EPOLL_ERROR       -1
   #define NET_EPOLL_WOULD_BLOCK -2
 
-  #define NET_EPOLL_MAXCONNS     255/*200000*/
-  #define NET_EPOLL_MAXEVENTS    256/*200001*/
+  //
+  // NET_EPOLL_MAXCONNS  - default connections limit for whole server,
+  //                       can be changed at run time by NetEpollConfig.
+  //
+  // NET_EPOLL_MAXEVENTS - max. number of events fetched by one
+  //                       epoll_wait() call. It's NOT connections limit.
+  //
+  // NET_EPOLL_FDS_SLACK - extra FDs reserved above connections limit
+  //                       when sizing RLIMIT_NOFILE (listeners, epoll
+  //                       FDs, logs etc.).
+  //
+  // NET_EPOLL_READ_SLAB       - default size of per-worker read buffer.
+  // NET_EPOLL_READ_FAIRNESS   - default max. number of bytes read from one
+  //                             connection per one wake up.
+  //
+  // NET_EPOLL_SEND_CHUNK      - size of one send queue chunk.
+  // NET_EPOLL_SEND_MAX_IOV    - max. number of chunks sent by one writev().
+  // NET_EPOLL_SEND_HIGH_WATER - default max. number of bytes queued for
+  //                             one connection.
+  //
+  // NET_EPOLL_SENDFILE_CHUNK  - max. number of bytes sent by one
+  //                             sendfile() call.
+  //
+
+  #define NET_EPOLL_MAXCONNS     200000
+  #define NET_EPOLL_MAXEVENTS    256
   #define NET_EPOLL_READBUFF     8096
-  #define NET_EPOLL_MAXTHREADS   16
+  #define NET_EPOLL_MAXTHREADS   64
+  #define NET_EPOLL_FDS_SLACK    64
+
+  #define NET_EPOLL_READ_SLAB       (64 * 1024)
+  #define NET_EPOLL_READ_FAIRNESS   (1024 * 1024)
+
+  #define NET_EPOLL_SEND_CHUNK      16384
+  #define NET_EPOLL_SEND_MAX_IOV    64
+  #define NET_EPOLL_SEND_HIGH_WATER (4 * 1024 * 1024)
+  #define NET_EPOLL_SENDFILE_CHUNK  (1024 * 1024)
 
   #define NET_EPOLL_TCP_SEND_BUFFER_CORRECT 1
 
+  //
+  // Message types posted to worker's mailbox.
+  //
+
+  #define NET_EPOLL_POST_WRITE 1
+  #define NET_EPOLL_POST_CLOSE 2
+  #define NET_EPOLL_POST_CALL  3
+
   //
   // Forward definitions.
   //
 
   struct NetEpollContext;
+  struct NetEpollWorker;
+  struct NetEpollServer;
+  struct NetEpollMailbox;
 
   //
   // Typedef.
@@ -77,11 +144,71 @@ namespace Tegenaria
   typedef void (*NetEpollCloseProto)(NetEpollContext *ctx, int fd);
   typedef void (*NetEpollOpenProto)(NetEpollContext *ctx, int fd);
   typedef void (*NetEpollDataProto)(NetEpollContext *ctx, int fd, void *buf, int len);
+  typedef void (*NetEpollHighWaterProto)(NetEpollContext *ctx, int fd, int queued);
+  typedef void (*NetEpollTimerProto)(NetEpollContext *ctx, int fd);
+  typedef void (*NetEpollPostProto)(NetEpollContext *ctx, int fd, void *data);
 
   //
   // Structs.
   //
 
+  //
+  // Run time configuration and per-worker counters are shared with
+  // NetHpServer, see NetHpConfig and NetHpStats in NetHpServer.h.
+  //
+
+  typedef NetHpConfig NetEpollConfig;
+  typedef NetHpStats  NetEpollStats;
+  typedef NetHpHandle NetEpollHandle;
+
+  //
+  // One chunk of per-connection send queue.
+  // Data to send is in data_[readPos_, writePos_).
+  //
+  // File chunk (fileFd_ != -1) has no data_[]. File range
+  // [fileOffset_, fileOffset_ + fileLeft_) is sent by sendfile() instead.
+  // File chunks are not counted in sendBytes_.
+  //
+
+  struct NetEpollChunk
+  {
+    NetEpollChunk *next_;
+
+    int capacity_;
+    int readPos_;
+    int writePos_;
+
+    int fileFd_;
+
+    int64_t fileOffset_;
+    int64_t fileLeft_;
+
+    char data_[1];
+  };
+
+  //
+  // One message posted to worker's mailbox from any thread.
+  // Data to write is copied into buf_[len_].
+  //
+
+  struct NetEpollMessage
+  {
+    NetEpollMessage *volatile next_;
+
+    int type_;
+    int fd_;
+
+    int64_t id_;
+
+    NetEpollPostProto callback_;
+
+    void *data_;
+
+    int len_;
+
+    char buf_[1];
+  };
+
   struct NetEpollContext
   {
     void *custom_;
@@ -91,13 +218,58 @@ namespace Tegenaria
     int fd_;
 
     //
-    // Delayed write if blocking write couldn't be complited
-    // immediatelly.
+    // Worker serving this FD.
     //
 
-    int len_;
+    NetEpollWorker *worker_;
 
-    void *data_;
+    //
+    // Unique connection ID inside process, see NetEpollHandle.
+    //
+
+    int64_t id_;
+
+    //
+    // Close connection when send queue drained (NetEpollPostClose).
+    //
+
+    int closePending_;
+
+    //
+    // Send queue with data, which couldn't be written immediately.
+    // Drained by writev() on EPOLLOUT event.
+    //
+
+    NetEpollChunk *sendHead_;
+    NetEpollChunk *sendTail_;
+
+    int sendBytes_;
+    int sendArmed_;
+    int highWaterHit_;
+
+    //
+    // Timers served by worker's timer wheel:
+    //
+    // idleTimer_  - closes connection if nothing read or written
+    //               for idle timeout.
+    //
+    // writeTimer_ - closes connection if send queue made no progress
+    //               for write timeout.
+    //
+    // userTimer_  - set by NetEpollSetTimer().
+    //
+    // Activity is saved as wheel tick only. Timers are moved lazily when
+    // they expire, not on every read or write.
+    //
+
+    NetTimer idleTimer_;
+    NetTimer writeTimer_;
+    NetTimer userTimer_;
+
+    uint64_t lastActive_;
+    uint64_t lastWrite_;
+
+    NetEpollTimerProto userTimerHandler_;
 
     //
     // User handlers.
@@ -108,14 +280,143 @@ namespace Tegenaria
     NetEpollDataProto dataHandler_;
   };
 
+  //
+  // Mailbox to pass work to worker from other threads.
+  //
+  // Mailboxes are never freed, but reused by workers started later, so
+  // handle kept after server stopped still points to valid memory.
+  // Posting thread accepts handle only if its generation matches current
+  // mailbox generation.
+  //
+  // fd_         - eventfd registered in worker's epoll.
+  // tail_       - lock-free MPSC queue, pushed by any thread.
+  // head_       - popped by worker only.
+  // signaled_   - 1 if eventfd already signaled, other posters
+  //               don't need to wake worker again.
+  // generation_ - unique inside process while mailbox is open, 0 if
+  //               mailbox is closed.
+  // posters_    - number of threads posting to mailbox right now.
+  //               Mailbox is not closed until it drops to zero.
+  //
+
+  struct NetEpollMailbox
+  {
+    int fd_;
+
+    NetEpollMessage *volatile tail_;
+    NetEpollMessage *head_;
+    NetEpollMessage stub_;
+
+    volatile int signaled_;
+
+    volatile int64_t generation_;
+
+    volatile int posters_;
+
+    //
+    // Next mailbox on free list, used when mailbox is closed only.
+    //
+
+    NetEpollMailbox *nextFree_;
+  };
+
+  //
+  // One worker thread with own epoll queue.
+  // Counters are written by worker thread only.
+  //
+
+  struct NetEpollWorker
+  {
+    int index_;
+    int maxConns_;
+
+    volatile int activeConns_;
+
+    volatile int64_t accepted_;
+    volatile int64_t rejected_;
+    volatile int64_t timedOut_;
+
+    NetEpollContext listenCtx_;
+
+    //
+    // Timers of all connections served by this worker.
+    //
+
+    NetTimerWheel wheel_;
+
+    //
+    // Read buffer shared by all connections served by this worker.
+    // Passed to data handler without copying.
+    //
+
+    char *readBuf_;
+
+    int readBufSize_;
+
+    NetEpollServer *server_;
+
+    ThreadHandle_t *thread_;
+
+    //
+    // Mailbox to pass work from other threads. mailCtx_ wraps mailbox's
+    // eventfd registered in worker's epoll.
+    //
+
+    NetEpollMailbox *mailbox_;
+
+    NetEpollContext mailCtx_;
+
+    //
+    // Connections served by worker indexed by FD.
+    // Used to validate handles on posted messages.
+    //
+
+    vector<NetEpollContext *> *conns_;
+  };
+
+  //
+  // State of one running server.
+  //
+
+  struct NetEpollServer
+  {
+    int port_;
+    int maxConns_;
+    int workersCount_;
+    int sendHighWater_;
+    int edgeTriggered_;
+    int readBufferSize_;
+    int readFairnessCap_;
+    int idleTimeout_;
+    int writeTimeout_;
+
+    NetEpollHighWaterProto highWaterHandler_;
+
+    volatile int activeConns_;
+
+    NetEpollWorker *workers_;
+  };
+
   //
   // Internal functions.
   //
 
-  int NetEpollListen(int port);
-  int NetEpollAccept(NetEpollContext *ctx, int listensocket, int activeconns);
+  NetEpollContext *NetEpollContextCreate(int epollFd, int fd,
+                                             NetEpollOpenProto openHandler,
+                                                 NetEpollCloseProto closeHandler,
+                                                     NetEpollDataProto dataHandler);
+
+  void NetEpollContextDestroy(NetEpollContext *ctx);
+
+  int NetEpollListen(int port, int backlog = 0, int reusePort = 0);
+  int NetEpollAccept(NetEpollContext *ctx, int listensocket);
   int NetEpollReadEvent(NetEpollContext *ctx, int fd);
   int NetEpollWriteEvent(NetEpollContext *ctx, int currfd);
+  int NetEpollMailboxEvent(NetEpollWorker *worker);
+
+  NetEpollMailbox *NetEpollMailboxOpen();
+
+  void NetEpollMailboxClose(NetEpollMailbox *mailbox);
 
   //
   // Exported functions.
@@ -125,9 +426,27 @@ namespace Tegenaria
                              NetEpollCloseProto closeHandler,
                                  NetEpollDataProto dataHandler);
 
+  int NetEpollServerLoopEx(int port, NetEpollOpenProto openHandler,
+                               NetEpollCloseProto closeHandler,
+                                   NetEpollDataProto dataHandler,
+                                       NetEpollConfig *config);
+
+  int NetEpollServerGetStats(int port, NetEpollStats *stats, int maxWorkers);
+
+  int NetEpollSetTimer(NetEpollContext *ctx, int timeoutMs, NetEpollTimerProto callback);
+
+  int NetEpollGetHandle(NetEpollContext *ctx, int fd, NetEpollHandle *handle);
+
+  int NetEpollPostWrite(NetEpollHandle *handle, void *buf, int len);
+  int NetEpollPostClose(NetEpollHandle *handle);
+  int NetEpollPostCall(NetEpollHandle *handle, NetEpollPostProto callback, void *data);
+
   int NetEpollRead(NetEpollContext *ctx, int fd, void *buf, int len);
   int NetEpollWrite(NetEpollContext *ctx, int fd, void *buf, int len);
 
+  int NetEpollSendFile(NetEpollContext *ctx, int fd, int fileFd,
+                           int64_t offset, int64_t len);
+
 } /* namespace Tegenaria */
 
 #endif /* Tegenaria_Core_EpollServer_H */
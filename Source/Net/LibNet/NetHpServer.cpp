@@ -91,6 +91,84 @@ namespace Tegenaria
     #endif
   }
 
+  //
+  // Create TCP server with run time connection limits.
+  //
+  // port         - listening port (IN).
+  // openHandler  - handler called when new connection arrived (IN/OPT).
+  // closeHandler - handler called when existing connection closed (IN/OPT).
+  //
+  // dataHandler  - handler called when something to read on one of existing
+  //                connection (IN).
+  //
+  // config       - connections limits and number of workers, default
+  //                values used if NULL (IN/OPT).
+  //
+  // TIP #1: Config is used by epoll server only, it's ignored on Windows.
+  //
+  // RETURNS: 0 if terminated correctly,
+  //         -1 if error.
+  //
+
+  int NetHpServerLoopEx(int port, NetHpOpenProto openHandler,
+                            NetHpCloseProto closeHandler,
+                                NetHpDataProto dataHandler,
+                                    NetHpConfig *config)
+  {
+    //
+    // Windows.
+    // Create IO Completion Port server.
+    //
+
+    #ifdef WIN32
+    {
+      return NetHpServerLoop(port, openHandler, closeHandler, dataHandler);
+    }
+
+    #else
+
+    //
+    // Linux.
+    // Create epoll server.
+    //
+
+    {
+      NetEpollOpenProto epollOpen   = (NetEpollOpenProto) openHandler;
+      NetEpollCloseProto epollClose = (NetEpollCloseProto) closeHandler;
+      NetEpollDataProto epollData   = (NetEpollDataProto) dataHandler;
+
+      return NetEpollServerLoopEx(port, epollOpen, epollClose, epollData, config);
+    }
+
+    #endif
+  }
+
+  //
+  // Get per-worker counters of server running on given port.
+  //
+  // port       - port passed to NetHpServerLoop[Ex]() (IN).
+  // stats      - table, where to store counters for every worker (OUT).
+  // maxWorkers - number of elements in stats[] table (IN).
+  //
+  // RETURNS: Number of workers stored in stats[],
+  //          -1 if error or no server running on given port.
+  //
+
+  int NetHpServerGetStats(int port, NetHpStats *stats, int maxWorkers)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpServerGetStats() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      return NetEpollServerGetStats(port, stats, maxWorkers);
+    }
+    #endif
+  }
+
   //
   // Write <len> bytes to FD received inside NetHpData handler called
   // from NetHpServerLoop().
@@ -137,4 +215,180 @@ namespace Tegenaria
 
     #endif
   }
+
+  //
+  // Send <len> bytes from file <fileFd> starting at <offset> to remote
+  // client. File data is passed from kernel directly to socket
+  // (sendfile) without copying it into user space.
+  //
+  // TIP #1: Caller should use this function inside data handler
+  //         specified to NetHpServerLoop() like NetHpWrite().
+  //
+  // TIP #2: Function never blocks. Remaining part is sent in background,
+  //         in order with data written by NetHpWrite(). Caller can close
+  //         fileFd just after call.
+  //
+  // ctx    - context received in handler parameters (IN).
+  // fd     - FD received in handler parameters (IN).
+  // fileFd - CRT FD of opened file (IN).
+  // offset - file position, where to start from (IN).
+  // len    - number of bytes to send (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetHpSendFile(NetHpContext *ctx, int fd, int fileFd, int64_t offset, int64_t len)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpSendFile() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      NetEpollContext *epollCtx = (NetEpollContext *) ctx;
+
+      return NetEpollSendFile(epollCtx, fd, fileFd, offset, len);
+    }
+    #endif
+  }
+
+  //
+  // Set one-shot timer for connection. Callback is called inside the same
+  // thread, which calls data handler for this connection.
+  //
+  // ctx       - context received in handler parameters (IN).
+  // timeoutMs - time to expire in ms, 0 to cancel timer (IN).
+  // callback  - function called when timer expires (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetHpSetTimer(NetHpContext *ctx, int timeoutMs, NetHpTimerProto callback)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpSetTimer() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      NetEpollContext *epollCtx = (NetEpollContext *) ctx;
+
+      return NetEpollSetTimer(epollCtx, timeoutMs, (NetEpollTimerProto) callback);
+    }
+    #endif
+  }
+
+  //
+  // Get connection handle, which can be passed to other threads and used
+  // with NetHpPostXXX() functions.
+  //
+  // WARNING: Must be called from handlers only (worker's thread).
+  //
+  // ctx    - context received in handler parameters (IN).
+  // fd     - FD received in handler parameters (IN).
+  // handle - buffer, where to store handle (OUT).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetHpGetHandle(NetHpContext *ctx, int fd, NetHpHandle *handle)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpGetHandle() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      return NetEpollGetHandle((NetEpollContext *) ctx, fd, handle);
+    }
+    #endif
+  }
+
+  //
+  // Write data to connection from any thread. Data is copied and written
+  // by worker owning the connection, in posting order. Only owning worker
+  // is woken up.
+  //
+  // handle - connection handle from NetHpGetHandle() (IN).
+  // buf    - data to write (IN).
+  // len    - number of bytes in buf[] (IN).
+  //
+  // RETURNS: 0 if data posted,
+  //         -1 if error.
+  //
+
+  int NetHpPostWrite(NetHpHandle *handle, void *buf, int len)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpPostWrite() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      return NetEpollPostWrite(handle, buf, len);
+    }
+    #endif
+  }
+
+  //
+  // Close connection from any thread. Data posted before is sent first.
+  //
+  // handle - connection handle from NetHpGetHandle() (IN).
+  //
+  // RETURNS: 0 if close posted,
+  //         -1 if error.
+  //
+
+  int NetHpPostClose(NetHpHandle *handle)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpPostClose() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      return NetEpollPostClose(handle);
+    }
+    #endif
+  }
+
+  //
+  // Call function inside worker owning the connection from any thread.
+  // Inside callback it's safe to call NetHpWrite() and NetHpSetTimer().
+  //
+  // handle   - connection handle from NetHpGetHandle() (IN).
+  // callback - function to call (IN).
+  // data     - custom parameter passed to callback (IN/OPT).
+  //
+  // RETURNS: 0 if call posted,
+  //         -1 if error.
+  //
+
+  int NetHpPostCall(NetHpHandle *handle, NetHpPostProto callback, void *data)
+  {
+    #ifdef WIN32
+    {
+      Error("NetHpPostCall() not implemented on Windows.\n");
+
+      return -1;
+    }
+    #else
+    {
+      return NetEpollPostCall(handle, (NetEpollPostProto) callback, data);
+    }
+    #endif
+  }
 } /* namespace Tegenaria */
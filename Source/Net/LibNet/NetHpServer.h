@@ -25,8 +25,35 @@
 #ifndef Tegenaria_Core_HPServer_H
 #define Tegenaria_Core_HPServer_H
 
+#include <stdint.h>
+
 namespace Tegenaria
 {
+  //
+  // Defines.
+  //
+
+  //
+  // How workers get new connections (see NetHpConfig.listenMode_):
+  //
+  // NET_HP_LISTEN_SHARED    - one listening socket in every worker's epoll
+  //                           set. Every worker wakes up on new connection.
+  //
+  // NET_HP_LISTEN_REUSEPORT - every worker owns its own SO_REUSEPORT
+  //                           listener, kernel balances connections between
+  //                           them. Falls back to NET_HP_LISTEN_EXCLUSIVE
+  //                           if SO_REUSEPORT is not supported.
+  //
+  // NET_HP_LISTEN_EXCLUSIVE - one listening socket registered with
+  //                           EPOLLEXCLUSIVE, only one worker wakes up.
+  //                           Falls back to NET_HP_LISTEN_SHARED on old
+  //                           kernels.
+  //
+
+  #define NET_HP_LISTEN_SHARED    0
+  #define NET_HP_LISTEN_REUSEPORT 1
+  #define NET_HP_LISTEN_EXCLUSIVE 2
+
   //
   // Structs.
   //
@@ -48,6 +75,156 @@ namespace Tegenaria
   typedef void (*NetHpCloseProto)(NetHpContext *ctx, int fd);
   typedef void (*NetHpDataProto)(NetHpContext *ctx, int fd, void *buf, int len);
 
+  //
+  // Called when connection's send queue grows over high-water mark
+  // (queued > 0) and again when queue is fully drained (queued = 0).
+  //
+
+  typedef void (*NetHpHighWaterProto)(NetHpContext *ctx, int fd, int queued);
+
+  //
+  // Called when timer set by NetHpSetTimer() expires.
+  //
+
+  typedef void (*NetHpTimerProto)(NetHpContext *ctx, int fd);
+
+  //
+  // Called inside worker thread for function posted by NetHpPostCall().
+  // If connection was closed before, ctx is NULL and fd is -1.
+  //
+
+  typedef void (*NetHpPostProto)(NetHpContext *ctx, int fd, void *data);
+
+  //
+  // Connection handle, which can be passed to other threads.
+  // Get it by NetHpGetHandle() inside handler.
+  //
+
+  struct NetHpHandle
+  {
+    //
+    // Mailbox of worker owning the connection. Handle is rejected if
+    // server was stopped and mailbox reused by another worker.
+    //
+
+    void *mailbox_;
+
+    int64_t generation_;
+
+    int fd_;
+
+    //
+    // Unique connection ID. Handle is rejected if FD was closed
+    // and reused by another connection.
+    //
+
+    int64_t id_;
+  };
+
+  //
+  // Run time server configuration passed to NetHpServerLoopEx().
+  // Zero in any field means default value.
+  //
+
+  struct NetHpConfig
+  {
+    //
+    // Max. number of connections served at once by whole server.
+    // Default is NET_EPOLL_MAXCONNS, but it's lowered automatically
+    // if RLIMIT_NOFILE can't be raised high enough.
+    //
+
+    int maxConns_;
+
+    //
+    // Max. number of connections served at once by one worker.
+    // Default is no per-worker limit.
+    //
+
+    int maxConnsPerWorker_;
+
+    //
+    // Number of worker threads. Default is number of CPU cores.
+    //
+
+    int workers_;
+
+    //
+    // Listen backlog. Default is SOMAXCONN.
+    //
+
+    int backlog_;
+
+    //
+    // One of NET_HP_LISTEN_XXX values. Default is NET_HP_LISTEN_SHARED.
+    //
+
+    int listenMode_;
+
+    //
+    // Max. number of bytes queued for one slow client. Writes over this
+    // limit are refused. Default is NET_EPOLL_SEND_HIGH_WATER.
+    //
+
+    int sendHighWater_;
+
+    //
+    // Handler called when send queue reaches high-water mark and when
+    // it's drained back to empty (OPT).
+    //
+
+    NetHpHighWaterProto highWaterHandler_;
+
+    //
+    // Set to 1 to use edge triggered epoll events. Socket is read until
+    // EAGAIN then. Default is level triggered.
+    //
+
+    int edgeTriggered_;
+
+    //
+    // Size of per-worker read buffer passed to data handler.
+    // Default is NET_EPOLL_READ_SLAB.
+    //
+
+    int readBufferSize_;
+
+    //
+    // Max. number of bytes read from one connection per one wake up,
+    // other connections are served first if exceeded.
+    // Default is NET_EPOLL_READ_FAIRNESS.
+    //
+
+    int readFairnessCap_;
+
+    //
+    // Close connection if nothing was read or written for given time
+    // in ms. Default is 0 (never).
+    //
+
+    int idleTimeout_;
+
+    //
+    // Close connection if queued data couldn't be sent for given time
+    // in ms (client stopped reading). Default is 0 (never).
+    //
+
+    int writeTimeout_;
+  };
+
+  //
+  // Per worker counters returned by NetHpServerGetStats().
+  //
+
+  struct NetHpStats
+  {
+    int activeConns_;
+
+    int64_t accepted_;
+    int64_t rejected_;
+    int64_t timedOut_;
+  };
+
   //
   // Exported functions.
   //
@@ -56,8 +233,25 @@ namespace Tegenaria
                           NetHpCloseProto closeHandler,
                               NetHpDataProto dataHandler);
 
+  int NetHpServerLoopEx(int port, NetHpOpenProto openHandler,
+                            NetHpCloseProto closeHandler,
+                                NetHpDataProto dataHandler,
+                                    NetHpConfig *config);
+
+  int NetHpServerGetStats(int port, NetHpStats *stats, int maxWorkers);
+
   int NetHpWrite(NetHpContext *ctx, int fd, void *buf, int len);
 
+  int NetHpSendFile(NetHpContext *ctx, int fd, int fileFd, int64_t offset, int64_t len);
+
+  int NetHpSetTimer(NetHpContext *ctx, int timeoutMs, NetHpTimerProto callback);
+
+  int NetHpGetHandle(NetHpContext *ctx, int fd, NetHpHandle *handle);
+
+  int NetHpPostWrite(NetHpHandle *handle, void *buf, int len);
+  int NetHpPostClose(NetHpHandle *handle);
+  int NetHpPostCall(NetHpHandle *handle, NetHpPostProto callback, void *data);
+
 } /* namespace Tegenaria */
 
 #endif /* Tegenaria_Core_HPServer_H */
@@ -31,6 +31,7 @@
 #ifndef Tegenaria_Core_NetInternal_H
 #define Tegenaria_Core_NetInternal_H
 
+#include <vector>
 
 #ifdef WIN32
 
@@ -70,6 +71,7 @@
   #define closesocket(X) close(X)
 
   #include <unistd.h>
+  #include <stdint.h>
   #include <sys/types.h>
   #include <sys/socket.h>
   #include <netinet/in.h>
@@ -106,6 +108,15 @@ namespace Tegenaria
 
   int _NetInit();
 
+  int64_t _NetGetTimeMs();
+
+  int _NetPoll(int *fd, int *events, int *revents, int count, int timeout);
+
+  int _NetWait(int sock, int events, int timeout, int cancelFd = -1);
+
+  int _NetResolve(std::vector<struct sockaddr_storage> &addrs,
+                      const char *host, int port, int timeout);
+
 } /* namespace Tegenaria */
 
 #endif /* Tegenaria_Core_NetInternal_H */
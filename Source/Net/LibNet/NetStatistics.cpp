@@ -27,8 +27,10 @@
 
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <sys/time.h>
 #include <cmath>
+#include <Tegenaria/Debug.h>
 #include "NetStatistics.h"
 
 namespace Tegenaria
@@ -37,15 +39,371 @@ namespace Tegenaria
   #define snprintf _snprintf
   #endif
 
+  //
+  // Shard assigned to current thread, -1 if not assigned yet.
+  //
+
+  static __thread int NetStatShardIndex = -1;
+
+  static int NetStatShardNext = 0;
+
+  //
+  // Fallback shard used by writers when shards array could not be
+  // allocated. Its content is never read back.
+  //
+
+  static NetStatShard NetStatShardDummy;
+
+  //
+  // Get index of most significant bit set in non-zero value.
+  // Used internally only.
+  //
+
+  static int NetStatMsb(uint64_t value)
+  {
+    return 63 - __builtin_clzll(value);
+  }
+
+  //
+  // ----------------------------------------------------------------------------
+  //
+  //                               NetHistogram
+  //
+  // ----------------------------------------------------------------------------
+  //
+
+  //
+  // Get bucket index for given value.
+  // Used internally only.
+  //
+
+  static int NetHistogramIndex(uint64_t value)
+  {
+    int msb = 0;
+
+    if (value >= (uint64_t(1) << NET_STAT_HIST_MAX_BITS))
+    {
+      value = (uint64_t(1) << NET_STAT_HIST_MAX_BITS) - 1;
+    }
+
+    if (value < NET_STAT_HIST_SUB_COUNT)
+    {
+      return int(value);
+    }
+
+    msb = NetStatMsb(value);
+
+    return (msb - NET_STAT_HIST_SUB_BITS + 1) * NET_STAT_HIST_SUB_COUNT
+               + int((value >> (msb - NET_STAT_HIST_SUB_BITS)) & (NET_STAT_HIST_SUB_COUNT - 1));
+  }
+
+  //
+  // Get middle value of bucket with given index.
+  // Used internally only.
+  //
+
+  static uint64_t NetHistogramValue(int index)
+  {
+    int range = index / NET_STAT_HIST_SUB_COUNT;
+    int sub   = index % NET_STAT_HIST_SUB_COUNT;
+
+    uint64_t lower = 0;
+    uint64_t width = 0;
+
+    if (range == 0)
+    {
+      return uint64_t(index);
+    }
+
+    lower = uint64_t(NET_STAT_HIST_SUB_COUNT + sub) << (range - 1);
+    width = uint64_t(1) << (range - 1);
+
+    return lower + (width - 1) / 2;
+  }
+
+  //
+  // Count one value. Thread safe.
+  //
+
+  void NetHistogram::insert(uint64_t value)
+  {
+    __atomic_fetch_add(&buckets_[NetHistogramIndex(value)], 1, __ATOMIC_RELAXED);
+  }
+
+  //
+  // Add counts from another histogram to this one.
+  // Source can be updated by other threads in the meantime.
+  //
+
+  void NetHistogram::merge(const NetHistogram *src)
+  {
+    for (int i = 0; i < NET_STAT_HIST_BUCKETS; i++)
+    {
+      buckets_[i] += __atomic_load_n(&src -> buckets_[i], __ATOMIC_RELAXED);
+    }
+  }
+
+  //
+  // Get number of counted values.
+  //
+
+  uint64_t NetHistogram::getCount() const
+  {
+    uint64_t count = 0;
+
+    for (int i = 0; i < NET_STAT_HIST_BUCKETS; i++)
+    {
+      count += buckets_[i];
+    }
+
+    return count;
+  }
+
+  //
+  // Get value below which given percent of values falls.
+  //
+  // percent - percent in <0;100> range e.g. 99.9 for p999 (IN).
+  //
+  // RETURNS: Value with relative error up to 1 / NET_STAT_HIST_SUB_COUNT,
+  //          or 0 if histogram is empty.
+  //
+
+  uint64_t NetHistogram::getPercentile(double percent) const
+  {
+    uint64_t count = getCount();
+    uint64_t rank  = 0;
+    uint64_t acc   = 0;
+
+    if (count == 0)
+    {
+      return 0;
+    }
+
+    rank = uint64_t(ceil(count * percent / 100.0));
+
+    if (rank < 1)
+    {
+      rank = 1;
+    }
+
+    for (int i = 0; i < NET_STAT_HIST_BUCKETS; i++)
+    {
+      acc += buckets_[i];
+
+      if (acc >= rank)
+      {
+        return NetHistogramValue(i);
+      }
+    }
+
+    return NetHistogramValue(NET_STAT_HIST_BUCKETS - 1);
+  }
+
+  void NetHistogram::clear()
+  {
+    memset(buckets_, 0, sizeof(buckets_));
+  }
+
+  //
+  // ----------------------------------------------------------------------------
+  //
+  //                               NetStatistics
+  //
+  // ----------------------------------------------------------------------------
+  //
+
   //
   // Create new clear net statistics with no any fields set.
   //
 
   NetStatistics::NetStatistics()
   {
+    avgLock_ = 0;
+
+    shards_ = (NetStatShard *) calloc(NET_STAT_SHARDS, sizeof(NetStatShard));
+
+    if (shards_ == NULL)
+    {
+      Error("ERROR: Out of memory while allocating net statistics.\n");
+    }
+
     reset();
   }
 
+  //
+  // Copy constructor. Copies current state of source statistics.
+  //
+
+  NetStatistics::NetStatistics(const NetStatistics &src)
+  {
+    avgLock_ = 0;
+
+    shards_ = (NetStatShard *) calloc(NET_STAT_SHARDS, sizeof(NetStatShard));
+
+    if (shards_ == NULL)
+    {
+      Error("ERROR: Out of memory while allocating net statistics.\n");
+    }
+
+    *this = src;
+  }
+
+  NetStatistics::~NetStatistics()
+  {
+    free(shards_);
+  }
+
+  NetStatistics &NetStatistics::operator=(const NetStatistics &src)
+  {
+    if (this != &src)
+    {
+      uploadSpeedAvg_   = src.uploadSpeedAvg_;
+      downloadSpeedAvg_ = src.downloadSpeedAvg_;
+      requestTimeAvg_   = src.requestTimeAvg_;
+      requestSpeedAvg_  = src.requestSpeedAvg_;
+      pingAvg_          = src.pingAvg_;
+
+      resetTime_ = src.resetTime_;
+
+      if (shards_ && src.shards_)
+      {
+        memcpy(shards_, src.shards_, NET_STAT_SHARDS * sizeof(NetStatShard));
+      }
+      else if (shards_)
+      {
+        memset(shards_, 0, NET_STAT_SHARDS * sizeof(NetStatShard));
+      }
+
+      partialReadTriggered_  = src.partialReadTriggered_;
+      partialWriteTriggered_ = src.partialWriteTriggered_;
+
+      fieldsSet_ = src.fieldsSet_;
+    }
+
+    return *this;
+  }
+
+  //
+  // Get counters shard assigned to current thread.
+  // Threads are assigned to shards round robin at first use.
+  // Used internally only.
+  //
+  // RETURNS: Pointer to shard owned by current thread,
+  //          or pointer to dummy shard if shards array was not allocated.
+  //
+
+  NetStatShard *NetStatistics::getShard()
+  {
+    if (shards_ == NULL)
+    {
+      return &NetStatShardDummy;
+    }
+
+    if (NetStatShardIndex == -1)
+    {
+      NetStatShardIndex = __sync_fetch_and_add(&NetStatShardNext, 1) % NET_STAT_SHARDS;
+    }
+
+    return &shards_[NetStatShardIndex];
+  }
+
+  //
+  // Mark given NET_STAT_FIELD_XXX fields as set.
+  // Used internally only.
+  //
+
+  void NetStatistics::setFields(unsigned int fields)
+  {
+    if ((fieldsSet_ & fields) != fields)
+    {
+      __sync_fetch_and_or(&fieldsSet_, fields);
+    }
+  }
+
+  //
+  // Merge one counter from all shards.
+  // Used internally only.
+  //
+
+  int64_t NetStatistics::sumShards(int64_t NetStatShard::*field)
+  {
+    int64_t ret = 0;
+
+    for (int i = 0; shards_ && i < NET_STAT_SHARDS; i++)
+    {
+      ret += __atomic_load_n(&(shards_[i].*field), __ATOMIC_RELAXED);
+    }
+
+    return ret;
+  }
+
+  int64_t NetStatistics::maxShards(int64_t NetStatShard::*field)
+  {
+    int64_t ret = 0;
+
+    for (int i = 0; shards_ && i < NET_STAT_SHARDS; i++)
+    {
+      int64_t value = __atomic_load_n(&(shards_[i].*field), __ATOMIC_RELAXED);
+
+      if (value > ret)
+      {
+        ret = value;
+      }
+    }
+
+    return ret;
+  }
+
+  //
+  // Merge one histogram from all shards into dst.
+  // Used internally only.
+  //
+
+  void NetStatistics::mergeHistogram(NetHistogram *dst, NetHistogram NetStatShard::*field)
+  {
+    dst -> clear();
+
+    for (int i = 0; shards_ && i < NET_STAT_SHARDS; i++)
+    {
+      dst -> merge(&(shards_[i].*field));
+    }
+  }
+
+  //
+  // Read moving average under lock.
+  // Used internally only.
+  //
+
+  double NetStatistics::getAvg(MathWeightAvg *avg)
+  {
+    double ret = 0.0;
+
+    while (__sync_lock_test_and_set(&avgLock_, 1))
+    {
+    }
+
+    ret = avg -> getValue();
+
+    __sync_lock_release(&avgLock_);
+
+    return ret;
+  }
+
+  //
+  // Atomic max. Used internally only.
+  //
+
+  static void NetStatAtomicMax(int64_t *dst, int64_t value)
+  {
+    int64_t curr = __atomic_load_n(dst, __ATOMIC_RELAXED);
+
+    while (value > curr
+               && !__atomic_compare_exchange_n(dst, &curr, value, true,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+  }
+
   //
   // Convert net statistics into human readable string.
   //
@@ -56,127 +414,149 @@ namespace Tegenaria
 
     int quality = this -> getNetworkQuality();
 
+    NetStatSnapshot snap;
+
     string ret = "Network statistics:\n";
 
-    snprintf(buf, sizeof(buf) - 1, "  Connection time : %lf s.\n", (getTimeMs() - resetTime_) / 1000.0);
+    getSnapshot(&snap);
+
+    snprintf(buf, sizeof(buf) - 1, "  Connection time : %lf s.\n", snap.connectionTime_);
 
     ret += buf;
 
-    if (fieldsSet_ & NET_STAT_FIELD_UPLOAD_SPEED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_UPLOAD_SPEED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Upload speed : %lf KB/s.\n", uploadSpeedAvg_.getValue());
+      snprintf(buf, sizeof(buf) - 1, "  Upload speed : %lf KB/s.\n", getUploadSpeed());
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_DOWNLOAD_SPEED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_DOWNLOAD_SPEED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Download speed : %lf KB/s.\n", downloadSpeedAvg_.getValue());
+      snprintf(buf, sizeof(buf) - 1, "  Download speed : %lf KB/s.\n", getDownloadSpeed());
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_BYTES_UPLOADED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_BYTES_UPLOADED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Data uploaded : %lf MB.\n", bytesUploaded_ / 1024.0 / 1024.0);
+      snprintf(buf, sizeof(buf) - 1, "  Data uploaded : %lf MB.\n", snap.bytesUploaded_ / 1024.0 / 1024.0);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_BYTES_DOWNLOADED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_BYTES_DOWNLOADED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Data downloaded : %lf MB.\n", bytesDownloaded_ / 1024.0 / 1024.0);
+      snprintf(buf, sizeof(buf) - 1, "  Data downloaded : %lf MB.\n", snap.bytesDownloaded_ / 1024.0 / 1024.0);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_BYTES_SENT)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_BYTES_SENT)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Data sent : %lf MB.\n", bytesSent_ / 1024.0 / 1024.0);
+      snprintf(buf, sizeof(buf) - 1, "  Data sent : %lf MB.\n", snap.bytesSent_ / 1024.0 / 1024.0);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_BYTES_RECV)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_BYTES_RECV)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Data received : %lf MB.\n", bytesRecv_ / 1024.0 / 1024.0);
+      snprintf(buf, sizeof(buf) - 1, "  Data received : %lf MB.\n", snap.bytesRecv_ / 1024.0 / 1024.0);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_PACKET_SENT_COUNT)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_PACKET_SENT_COUNT)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Packets sent : %d.\n", packetSentCount_);
+      snprintf(buf, sizeof(buf) - 1, "  Packets sent : %lld.\n", (long long) snap.packetSentCount_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_PACKET_RECV_COUNT)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_PACKET_RECV_COUNT)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Packets received : %d.\n", packetRecvCount_);
+      snprintf(buf, sizeof(buf) - 1, "  Packets received : %lld.\n", (long long) snap.packetRecvCount_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_REQUEST_COUNT)
+    if (snap.fieldsSet_ & (NET_STAT_FIELD_PACKET_SENT_COUNT | NET_STAT_FIELD_PACKET_RECV_COUNT))
     {
-      snprintf(buf, sizeof(buf) - 1, "  Requests processed : %d.\n", requestCount_);
+      snprintf(buf, sizeof(buf) - 1, "  Packet size p50/p99/p999 : %.0lf / %.0lf / %.0lf B.\n",
+                   snap.packetSizeP50_, snap.packetSizeP99_, snap.packetSizeP999_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_REQUEST_SPEED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_REQUEST_COUNT)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Request speed : %lf KB/s.\n", requestSpeedAvg_.getValue());
+      snprintf(buf, sizeof(buf) - 1, "  Requests processed : %lld.\n", (long long) snap.requestCount_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_REQUEST_TIME_TOTAL)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_REQUEST_SPEED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Total requests time : %lf s.\n", requestTimeTotal_ / 1000.0);
+      snprintf(buf, sizeof(buf) - 1, "  Request speed : %lf KB/s.\n", getRequestSpeed());
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_REQUEST_TIME_TOTAL)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_REQUEST_TIME_TOTAL)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Max. request time : %lf ms.\n", requestTimeMax_);
+      snprintf(buf, sizeof(buf) - 1, "  Total requests time : %lf s.\n", snap.requestTimeTotal_ / 1000.0);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_REQUEST_TIME_AVG)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_REQUEST_TIME_MAX)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Avg. request time : %lf ms.\n", requestTimeAvg_.getValue());
+      snprintf(buf, sizeof(buf) - 1, "  Max. request time : %lf ms.\n", snap.requestTimeMax_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_PARTIAL_READ_TRIGGERED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_REQUEST_TIME_AVG)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Partial read triggered : %d.\n", partialReadTriggered_);
+      snprintf(buf, sizeof(buf) - 1, "  Avg. request time : %lf ms.\n", getRequestTime());
+
+      ret += buf;
+
+      snprintf(buf, sizeof(buf) - 1, "  Request time p50/p99/p999 : %.3lf / %.3lf / %.3lf ms.\n",
+                   snap.requestTimeP50_, snap.requestTimeP99_, snap.requestTimeP999_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_PARTIAL_WRITE_TRIGGERED)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_PARTIAL_READ_TRIGGERED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Partial write triggered : %d.\n", partialWriteTriggered_);
+      snprintf(buf, sizeof(buf) - 1, "  Partial read triggered : %d.\n", snap.partialReadTriggered_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_PING_MAX)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_PARTIAL_WRITE_TRIGGERED)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Max. ping : %lf ms.\n", pingMax_);
+      snprintf(buf, sizeof(buf) - 1, "  Partial write triggered : %d.\n", snap.partialWriteTriggered_);
 
       ret += buf;
     }
 
-    if (fieldsSet_ & NET_STAT_FIELD_PING_AVG)
+    if (snap.fieldsSet_ & NET_STAT_FIELD_PING_MAX)
     {
-      snprintf(buf, sizeof(buf) - 1, "  Avg. ping : %lf ms.\n", pingAvg_.getValue());
+      snprintf(buf, sizeof(buf) - 1, "  Max. ping : %lf ms.\n", snap.pingMax_);
+
+      ret += buf;
+    }
+
+    if (snap.fieldsSet_ & NET_STAT_FIELD_PING_AVG)
+    {
+      snprintf(buf, sizeof(buf) - 1, "  Avg. ping : %lf ms.\n", getPing());
+
+      ret += buf;
+
+      snprintf(buf, sizeof(buf) - 1, "  Ping p50/p99/p999 : %.3lf / %.3lf / %.3lf ms.\n",
+                   snap.pingP50_, snap.pingP99_, snap.pingP999_);
 
       ret += buf;
     }
@@ -197,12 +577,14 @@ namespace Tegenaria
 
   void NetStatistics::insertOutcomingPacket(int size)
   {
-    bytesSent_ += size;
+    NetStatShard *shard = getShard();
+
+    __atomic_fetch_add(&shard -> bytesSent_, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard -> packetSentCount_, 1, __ATOMIC_RELAXED);
 
-    packetSentCount_ ++;
+    shard -> packetSize_.insert(size);
 
-    fieldsSet_ |= NET_STAT_FIELD_BYTES_SENT;
-    fieldsSet_ |= NET_STAT_FIELD_PACKET_SENT_COUNT;
+    setFields(NET_STAT_FIELD_BYTES_SENT | NET_STAT_FIELD_PACKET_SENT_COUNT);
   }
 
   //
@@ -211,12 +593,14 @@ namespace Tegenaria
 
   void NetStatistics::insertIncomingPacket(int size)
   {
-    bytesRecv_ += size;
+    NetStatShard *shard = getShard();
 
-    packetRecvCount_ ++;
+    __atomic_fetch_add(&shard -> bytesRecv_, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard -> packetRecvCount_, 1, __ATOMIC_RELAXED);
 
-    fieldsSet_ |= NET_STAT_FIELD_BYTES_RECV;
-    fieldsSet_ |= NET_STAT_FIELD_PACKET_RECV_COUNT;
+    shard -> packetSize_.insert(size);
+
+    setFields(NET_STAT_FIELD_BYTES_RECV | NET_STAT_FIELD_PACKET_RECV_COUNT);
   }
 
   //
@@ -228,30 +612,35 @@ namespace Tegenaria
 
   void NetStatistics::insertRequest(int size, double elapsed)
   {
-    //
-    // Update maximum request time.
-    //
+    NetStatShard *shard = getShard();
 
-    if (elapsed > requestTimeMax_)
-    {
-      requestTimeMax_ = elapsed;
-    }
+    int64_t elapsedUs = int64_t(elapsed * 1000.0);
 
     //
-    // Update counter of all processed requests.
+    // Update counter of all processed requests, total and maximum
+    // request time.
     //
 
-    requestCount_ ++;
+    __atomic_fetch_add(&shard -> requestCount_, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard -> requestTimeTotal_, elapsedUs, __ATOMIC_RELAXED);
 
-    requestTimeTotal_ += elapsed;
+    NetStatAtomicMax(&shard -> requestTimeMax_, elapsedUs);
+
+    shard -> requestTime_.insert(elapsedUs);
 
     //
     // Update average request speed and time.
+    // Skip if another thread is updating averages right now.
     //
 
-    requestSpeedAvg_.insert((size / 1024.0) / (elapsed / 1000.0 + 0.1));
+    if (__sync_lock_test_and_set(&avgLock_, 1) == 0)
+    {
+      requestSpeedAvg_.insert((size / 1024.0) / (elapsed / 1000.0 + 0.1));
 
-    requestTimeAvg_.insert(elapsed);
+      requestTimeAvg_.insert(elapsed);
+
+      __sync_lock_release(&avgLock_);
+    }
 
     //
     // Interpretate small request as ping info.
@@ -266,11 +655,11 @@ namespace Tegenaria
     // Set that request related fields changed.
     //
 
-    fieldsSet_ |= NET_STAT_FIELD_REQUEST_SPEED;
-    fieldsSet_ |= NET_STAT_FIELD_REQUEST_COUNT;
-    fieldsSet_ |= NET_STAT_FIELD_REQUEST_TIME_TOTAL;
-    fieldsSet_ |= NET_STAT_FIELD_REQUEST_TIME_MAX;
-    fieldsSet_ |= NET_STAT_FIELD_REQUEST_TIME_AVG;
+    setFields(NET_STAT_FIELD_REQUEST_SPEED
+                  | NET_STAT_FIELD_REQUEST_COUNT
+                      | NET_STAT_FIELD_REQUEST_TIME_TOTAL
+                          | NET_STAT_FIELD_REQUEST_TIME_MAX
+                              | NET_STAT_FIELD_REQUEST_TIME_AVG);
   }
 
   //
@@ -281,7 +670,7 @@ namespace Tegenaria
   {
     partialReadTriggered_ = 1;
 
-    fieldsSet_ |= NET_STAT_FIELD_PARTIAL_READ_TRIGGERED;
+    setFields(NET_STAT_FIELD_PARTIAL_READ_TRIGGERED);
   }
 
   //
@@ -292,7 +681,7 @@ namespace Tegenaria
   {
     partialWriteTriggered_ = 1;
 
-    fieldsSet_ |= NET_STAT_FIELD_PARTIAL_WRITE_TRIGGERED;
+    setFields(NET_STAT_FIELD_PARTIAL_WRITE_TRIGGERED);
   }
 
   //
@@ -304,12 +693,16 @@ namespace Tegenaria
 
   void NetStatistics::insertUploadEvent(int size, double elapsed)
   {
-    bytesUploaded_ += size;
+    __atomic_fetch_add(&getShard() -> bytesUploaded_, size, __ATOMIC_RELAXED);
 
-    uploadSpeedAvg_.insert((size / 1024.0) / (elapsed / 1000.0 + 0.1));
+    if (__sync_lock_test_and_set(&avgLock_, 1) == 0)
+    {
+      uploadSpeedAvg_.insert((size / 1024.0) / (elapsed / 1000.0 + 0.1));
 
-    fieldsSet_ |= NET_STAT_FIELD_BYTES_UPLOADED;
-    fieldsSet_ |= NET_STAT_FIELD_UPLOAD_SPEED;
+      __sync_lock_release(&avgLock_);
+    }
+
+    setFields(NET_STAT_FIELD_BYTES_UPLOADED | NET_STAT_FIELD_UPLOAD_SPEED);
   }
 
   //
@@ -321,12 +714,16 @@ namespace Tegenaria
 
   void NetStatistics::insertDownloadEvent(int size, double elapsed)
   {
-    bytesDownloaded_ += size;
+    __atomic_fetch_add(&getShard() -> bytesDownloaded_, size, __ATOMIC_RELAXED);
 
-    downloadSpeedAvg_.insert((size / 1024.0) / (elapsed / 1000.0 + 0.1));
+    if (__sync_lock_test_and_set(&avgLock_, 1) == 0)
+    {
+      downloadSpeedAvg_.insert((size / 1024.0) / (elapsed / 1000.0 + 0.1));
+
+      __sync_lock_release(&avgLock_);
+    }
 
-    fieldsSet_ |= NET_STAT_FIELD_BYTES_DOWNLOADED;
-    fieldsSet_ |= NET_STAT_FIELD_DOWNLOAD_SPEED;
+    setFields(NET_STAT_FIELD_BYTES_DOWNLOADED | NET_STAT_FIELD_DOWNLOAD_SPEED);
   }
 
   //
@@ -337,53 +734,106 @@ namespace Tegenaria
 
   void NetStatistics::insertPing(double ping)
   {
-    if (ping > pingMax_)
+    NetStatShard *shard = getShard();
+
+    int64_t pingUs = int64_t(ping * 1000.0);
+
+    NetStatAtomicMax(&shard -> pingMax_, pingUs);
+
+    shard -> ping_.insert(pingUs);
+
+    if (__sync_lock_test_and_set(&avgLock_, 1) == 0)
     {
-      pingMax_ = ping;
-    }
+      pingAvg_.insert(ping);
 
-    pingAvg_.insert(ping);
+      __sync_lock_release(&avgLock_);
+    }
 
-    fieldsSet_ |= NET_STAT_FIELD_PING_MAX;
-    fieldsSet_ |= NET_STAT_FIELD_PING_AVG;
+    setFields(NET_STAT_FIELD_PING_MAX | NET_STAT_FIELD_PING_AVG);
   }
 
 
   //
   // Clear all fields.
   //
+  // WARNING: Values inserted by other threads during reset may be lost.
+  //
 
   void NetStatistics::reset()
   {
     resetTime_ = getTimeMs();
 
+    while (__sync_lock_test_and_set(&avgLock_, 1))
+    {
+    }
+
     uploadSpeedAvg_.clear();
     downloadSpeedAvg_.clear();
     requestTimeAvg_.clear();
     requestSpeedAvg_.clear();
     pingAvg_.clear();
 
-    packetSentCount_  = 0;
-    packetRecvCount_  = 0;
-    requestCount_     = 0;
-
-    bytesSent_ = 0.0;
-    bytesRecv_ = 0.0;
-
-    bytesDownloaded_ = 0.0;
-    bytesUploaded_   = 0.0;
+    __sync_lock_release(&avgLock_);
 
-    requestTimeTotal_ = 0.0;
-    requestTimeMax_   = 0.0;
+    if (shards_)
+    {
+      memset(shards_, 0, NET_STAT_SHARDS * sizeof(NetStatShard));
+    }
 
     partialReadTriggered_  = 0;
     partialWriteTriggered_ = 0;
 
-    pingMax_ = 0.0;
-
     fieldsSet_ = 0;
   }
 
+  //
+  // Merge all shards into one snapshot. Doesn't block writers.
+  //
+  // snapshot - buffer, where to store merged counters (OUT).
+  //
+
+  void NetStatistics::getSnapshot(NetStatSnapshot *snapshot)
+  {
+    NetHistogram hist;
+
+    snapshot -> connectionTime_ = getConnectionTime();
+
+    snapshot -> packetSentCount_ = sumShards(&NetStatShard::packetSentCount_);
+    snapshot -> packetRecvCount_ = sumShards(&NetStatShard::packetRecvCount_);
+    snapshot -> requestCount_    = sumShards(&NetStatShard::requestCount_);
+    snapshot -> bytesSent_       = sumShards(&NetStatShard::bytesSent_);
+    snapshot -> bytesRecv_       = sumShards(&NetStatShard::bytesRecv_);
+    snapshot -> bytesUploaded_   = sumShards(&NetStatShard::bytesUploaded_);
+    snapshot -> bytesDownloaded_ = sumShards(&NetStatShard::bytesDownloaded_);
+
+    snapshot -> requestTimeTotal_ = sumShards(&NetStatShard::requestTimeTotal_) / 1000.0;
+    snapshot -> requestTimeMax_   = maxShards(&NetStatShard::requestTimeMax_) / 1000.0;
+    snapshot -> pingMax_          = maxShards(&NetStatShard::pingMax_) / 1000.0;
+
+    mergeHistogram(&hist, &NetStatShard::requestTime_);
+
+    snapshot -> requestTimeP50_  = hist.getPercentile(50.0) / 1000.0;
+    snapshot -> requestTimeP99_  = hist.getPercentile(99.0) / 1000.0;
+    snapshot -> requestTimeP999_ = hist.getPercentile(99.9) / 1000.0;
+
+    mergeHistogram(&hist, &NetStatShard::ping_);
+
+    snapshot -> pingP50_  = hist.getPercentile(50.0) / 1000.0;
+    snapshot -> pingP99_  = hist.getPercentile(99.0) / 1000.0;
+    snapshot -> pingP999_ = hist.getPercentile(99.9) / 1000.0;
+
+    mergeHistogram(&hist, &NetStatShard::packetSize_);
+
+    snapshot -> packetSizeP50_  = double(hist.getPercentile(50.0));
+    snapshot -> packetSizeP99_  = double(hist.getPercentile(99.0));
+    snapshot -> packetSizeP999_ = double(hist.getPercentile(99.9));
+
+    snapshot -> partialReadTriggered_  = partialReadTriggered_;
+    snapshot -> partialWriteTriggered_ = partialWriteTriggered_;
+
+    snapshot -> fieldsSet_ = fieldsSet_;
+  }
+
   //
   // ----------------------------------------------------------------------------
   //
@@ -403,32 +853,32 @@ namespace Tegenaria
 
   double NetStatistics::getUploadSpeed()
   {
-    return uploadSpeedAvg_.getValue();
+    return getAvg(&uploadSpeedAvg_);
   }
 
   double NetStatistics::getDownloadSpeed()
   {
-    return downloadSpeedAvg_.getValue();
+    return getAvg(&downloadSpeedAvg_);
   }
 
   double NetStatistics::getRequestTime()
   {
-    return requestTimeAvg_.getValue();
+    return getAvg(&requestTimeAvg_);
   }
 
   double NetStatistics::getRequestSpeed()
   {
-    return requestSpeedAvg_.getValue();
+    return getAvg(&requestSpeedAvg_);
   }
 
   double NetStatistics::getPing()
   {
-    return pingAvg_.getValue();
+    return getAvg(&pingAvg_);
   }
 
   double NetStatistics::getPingMax()
   {
-    return pingMax_;
+    return maxShards(&NetStatShard::pingMax_) / 1000.0;
   }
 
   //
@@ -437,42 +887,42 @@ namespace Tegenaria
 
   double NetStatistics::getConnectionTime()
   {
-    return (resetTime_ - getTimeMs()) / 1000.0;
+    return (getTimeMs() - resetTime_) / 1000.0;
   }
 
   int NetStatistics::getPacketSentCount()
   {
-    return packetSentCount_;
+    return int(sumShards(&NetStatShard::packetSentCount_));
   }
 
   int NetStatistics::getPacketRecvCount()
   {
-    return packetSentCount_;
+    return int(sumShards(&NetStatShard::packetRecvCount_));
   }
 
   int NetStatistics::getRequestCount()
   {
-    return packetSentCount_;
+    return int(sumShards(&NetStatShard::requestCount_));
   }
 
   double NetStatistics::getBytesUploaded()
   {
-    return bytesUploaded_;
+    return double(sumShards(&NetStatShard::bytesUploaded_));
   }
 
   double NetStatistics::getBytesDownloaded()
   {
-    return bytesUploaded_;
+    return double(sumShards(&NetStatShard::bytesDownloaded_));
   }
 
   double NetStatistics::getBytesSent()
   {
-    return bytesSent_;
+    return double(sumShards(&NetStatShard::bytesSent_));
   }
 
   double NetStatistics::getBytesReceived()
   {
-    return bytesRecv_;
+    return double(sumShards(&NetStatShard::bytesRecv_));
   }
 
   //
@@ -481,7 +931,7 @@ namespace Tegenaria
 
   double NetStatistics::getRequestTimeTotal()
   {
-    return requestTimeTotal_ / 1000.0;
+    return sumShards(&NetStatShard::requestTimeTotal_) / 1000000.0;
   }
 
   //
@@ -490,7 +940,7 @@ namespace Tegenaria
 
   double NetStatistics::getRequestTimeMax()
   {
-    return requestTimeMax_;
+    return maxShards(&NetStatShard::requestTimeMax_) / 1000.0;
   }
 
   int NetStatistics::isPartialReadTriggered()
@@ -503,6 +953,51 @@ namespace Tegenaria
     return partialWriteTriggered_;
   }
 
+  //
+  // Get request time percentile in ms.
+  //
+  // percent - percent in <0;100> range e.g. 99.9 for p999 (IN).
+  //
+
+  double NetStatistics::getRequestTimePercentile(double percent)
+  {
+    NetHistogram hist;
+
+    mergeHistogram(&hist, &NetStatShard::requestTime_);
+
+    return hist.getPercentile(percent) / 1000.0;
+  }
+
+  //
+  // Get ping percentile in ms.
+  //
+  // percent - percent in <0;100> range e.g. 99.9 for p999 (IN).
+  //
+
+  double NetStatistics::getPingPercentile(double percent)
+  {
+    NetHistogram hist;
+
+    mergeHistogram(&hist, &NetStatShard::ping_);
+
+    return hist.getPercentile(percent) / 1000.0;
+  }
+
+  //
+  // Get packet size percentile in bytes.
+  //
+  // percent - percent in <0;100> range e.g. 99.9 for p999 (IN).
+  //
+
+  double NetStatistics::getPacketSizePercentile(double percent)
+  {
+    NetHistogram hist;
+
+    mergeHistogram(&hist, &NetStatShard::packetSize_);
+
+    return double(hist.getPercentile(percent));
+  }
+
   //
   // Limit input value to fit <0;1> range.
   // Used internally only.
@@ -27,6 +27,7 @@
 
 #include <Tegenaria/Math.h>
 #include <string>
+#include <stdint.h>
 
 namespace Tegenaria
 {
@@ -61,9 +62,122 @@ namespace Tegenaria
   #define NET_STAT_FIELD_PING_MAX                (1 << 15)
   #define NET_STAT_FIELD_PING_AVG                (1 << 16)
 
+  //
+  // NET_STAT_SHARDS        - number of per-thread counter sets. Threads
+  //                          are assigned to shards round robin.
+  //                          Every shard carries 3 histograms, so one
+  //                          NetStatistics object allocates about 29 KB
+  //                          (NET_STAT_SHARDS * sizeof(NetStatShard)).
+  //
+  // NET_STAT_HIST_SUB_BITS - log2 of sub-buckets in one power of two
+  //                          range (relative error 1 / 2^SUB_BITS).
+  //
+  // NET_STAT_HIST_MAX_BITS - values are clamped to 2^MAX_BITS - 1.
+  //
+
+  #define NET_STAT_SHARDS        8
+  #define NET_STAT_HIST_SUB_BITS 3
+  #define NET_STAT_HIST_MAX_BITS 40
+
+  #define NET_STAT_HIST_SUB_COUNT (1 << NET_STAT_HIST_SUB_BITS)
+
+  #define NET_STAT_HIST_BUCKETS \
+    ((NET_STAT_HIST_MAX_BITS - NET_STAT_HIST_SUB_BITS + 1) * NET_STAT_HIST_SUB_COUNT)
+
+  //
+  // Log-bucketed histogram (HDR like). Value v is counted in bucket
+  // selected by position of highest bit and next NET_STAT_HIST_SUB_BITS
+  // bits, so every bucket covers the same relative range.
+  //
+
+  struct NetHistogram
+  {
+    uint32_t buckets_[NET_STAT_HIST_BUCKETS];
+
+    void insert(uint64_t value);
+
+    void merge(const NetHistogram *src);
+
+    uint64_t getCount() const;
+
+    uint64_t getPercentile(double percent) const;
+
+    void clear();
+  };
+
+  //
+  // Counters merged from all shards at one moment.
+  // Returned by NetStatistics::getSnapshot().
+  //
+  // Times are in ms, packet sizes in bytes.
+  //
+
+  struct NetStatSnapshot
+  {
+    double connectionTime_;
+
+    int64_t packetSentCount_;
+    int64_t packetRecvCount_;
+    int64_t requestCount_;
+
+    int64_t bytesSent_;
+    int64_t bytesRecv_;
+    int64_t bytesUploaded_;
+    int64_t bytesDownloaded_;
+
+    double requestTimeTotal_;
+    double requestTimeMax_;
+    double requestTimeP50_;
+    double requestTimeP99_;
+    double requestTimeP999_;
+
+    double pingMax_;
+    double pingP50_;
+    double pingP99_;
+    double pingP999_;
+
+    double packetSizeP50_;
+    double packetSizeP99_;
+    double packetSizeP999_;
+
+    int partialReadTriggered_;
+    int partialWriteTriggered_;
+
+    unsigned int fieldsSet_;
+  };
+
+  //
+  // Counters written by threads assigned to one shard.
+  // Updated by atomic adds, so threads sharing shard don't lose data.
+  //
+
+  struct NetStatShard
+  {
+    int64_t packetSentCount_;
+    int64_t packetRecvCount_;
+    int64_t requestCount_;
+
+    int64_t bytesUploaded_;
+    int64_t bytesDownloaded_;
+    int64_t bytesSent_;
+    int64_t bytesRecv_;
+
+    int64_t requestTimeTotal_;   // in us
+    int64_t requestTimeMax_;     // in us
+    int64_t pingMax_;            // in us
+
+    NetHistogram requestTime_;   // in us
+    NetHistogram ping_;          // in us
+    NetHistogram packetSize_;    // in bytes
+  };
+
   //
   // Structure to store network statistics.
   //
+  // Thread safe. Counters and histograms are sharded per thread and merged
+  // on read. Moving averages are updated under try-lock only, so writers
+  // never wait for each other.
+  //
 
   class NetStatistics
   {
@@ -79,28 +193,28 @@ namespace Tegenaria
     MathWeightAvg requestSpeedAvg_;  // Average request time in ms
     MathWeightAvg pingAvg_;          // Average ping in ms
 
+    volatile int avgLock_;       // Guards moving averages above
+
     double resetTime_;           // Last reset time to compute connection time
 
-    int packetSentCount_;        // Number of all packets sent
-    int packetRecvCount_;        // Number of all packets received
-    int requestCount_;           // Number of all requests processed.
+    NetStatShard *shards_;       // Per-thread counters, see NET_STAT_SHARDS
 
-    double bytesUploaded_;       // Number of bytes uploaded
-    double bytesDownloaded_;     // Number of bytes downloaded
+    volatile int partialReadTriggered_;   // Read operation was cancelled due to timeout
+    volatile int partialWriteTriggered_;  // Write operation was cancelled due to timeout
 
-    double bytesSent_;           // Total number of bytes sent
-    double bytesRecv_;           // Total number of bytes received
+    volatile unsigned int fieldsSet_;     // Combination of NET_STAT_FIELD_XXX values
+                                          // telling which struct fields are set.
 
-    double requestTimeTotal_;    // Total ms spent in processing one request in ms
-    double requestTimeMax_;      // Max. time spent in processing one request in ms
+    NetStatShard *getShard();
 
-    int partialReadTriggered_;   // Read operation was cancelled due to timeout
-    int partialWriteTriggered_;  // Write operation was cancelled due to timeout
+    void setFields(unsigned int fields);
 
-    double pingMax_;             // Max. noted ping
+    int64_t sumShards(int64_t NetStatShard::*field);
+    int64_t maxShards(int64_t NetStatShard::*field);
 
-    unsigned int fieldsSet_;     // Combination of NET_STAT_FIELD_XXX values
-                                 // telling which struct fields are set.
+    double getAvg(MathWeightAvg *avg);
+
+    void mergeHistogram(NetHistogram *dst, NetHistogram NetStatShard::*field);
     //
     // Functions.
     //
@@ -108,6 +222,11 @@ namespace Tegenaria
     public:
 
     NetStatistics();
+    NetStatistics(const NetStatistics &src);
+
+    ~NetStatistics();
+
+    NetStatistics &operator=(const NetStatistics &src);
 
     string toString();
 
@@ -160,6 +279,12 @@ namespace Tegenaria
     int isPartialReadTriggered();
     int isPartialWriteTriggered();
 
+    double getRequestTimePercentile(double percent);
+    double getPingPercentile(double percent);
+    double getPacketSizePercentile(double percent);
+
+    void getSnapshot(NetStatSnapshot *snapshot);
+
     int getNetworkQuality();
   };
 
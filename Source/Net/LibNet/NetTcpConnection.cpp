@@ -26,6 +26,7 @@
 #pragma qcbuild_set_private(1)
 
 #include "NetTcpConnection.h"
+#include "NetInternal.h"
 
 namespace Tegenaria
 {
@@ -159,6 +160,8 @@ namespace Tegenaria
     int goOn         = 1;
     int totalWritten = 0;
 
+    int64_t deadline = _NetGetTimeMs() + timeout;
+
     DEBUG3("NetTcpConnection::write : Writing [%d]"
                " bytes inside PTR=[%p] CTX=[%p]...\n", count, this, ctx_);
 
@@ -191,38 +194,24 @@ namespace Tegenaria
 
         //
         // Piece not written, but would block error found.
-        // Wait until socket available for write.
+        // Wait until socket available for write, but no longer than
+        // time left to deadline computed at call begin.
         //
 
         #ifdef WIN32
         else if (GetLastError() == WSAEWOULDBLOCK)
         #else
-        else if (errno == EWOULDBLOCK)
+        else if (errno == EWOULDBLOCK || errno == EINTR)
         #endif
         {
-          fd_set fdset;
-
-          struct timeval tv;
-
-          int ret = -1;
-
-          tv.tv_sec  = timeout / 1000;
-          tv.tv_usec = timeout % 1000 * 1000;
-
-          FD_ZERO(&fdset);
-
-          FD_SET(socket_, &fdset);
+          int left = -1;
 
           if (timeout > 0)
           {
-            ret = select(socket_ + 1, NULL, &fdset, NULL, &tv);
-          }
-          else
-          {
-            ret = select(socket_ + 1, NULL, &fdset, NULL, NULL);
+            left = int(std::max(deadline - _NetGetTimeMs(), int64_t(0)));
           }
 
-          if (ret <= 0)
+          if (_NetWait(socket_, NET_WAIT_WRITE, left) <= 0)
           {
             Error("ERROR: Timeout while writing to TCP connection PTR#%p.\n", this);
 
@@ -310,38 +299,22 @@ namespace Tegenaria
         }
         #else
         {
-          struct timeval tv;
-
-          tv.tv_sec  = timeout / 1000;
-          tv.tv_usec = timeout * 1000;
-
-          fd_set rfd;
-
-          int fdmax = std::max(socket_, cancelPipe_[0]);
+          int fd[2]      = {socket_, cancelPipe_[0]};
+          int events[2]  = {NET_WAIT_READ, NET_WAIT_READ};
+          int revents[2] = {0, 0};
 
-          FD_ZERO(&rfd);
-
-          FD_SET(socket_, &rfd);
-          FD_SET(cancelPipe_[0], &rfd);
-
-          if (timeout == -1)
+          if (_NetPoll(fd, events, revents, 2, timeout) > 0)
           {
-            select(fdmax + 1, &rfd, NULL, NULL, NULL);
-          }
-          else
-          {
-            select(fdmax + 1, &rfd, NULL, NULL, &tv);
-          }
-
-          if (FD_ISSET(cancelPipe_[0], &rfd))
-          {
-            DBG_INFO("NetTcpConnection : Read canceled on socket #%d.\n", socket_);
+            if (revents[1])
+            {
+              DBG_INFO("NetTcpConnection : Read canceled on socket #%d.\n", socket_);
 
-            readed = 0;
-          }
-          else if (FD_ISSET(socket_, &rfd))
-          {
-            readed = recv(socket_, (char *) buf, count, 0);
+              readed = 0;
+            }
+            else if (revents[0])
+            {
+              readed = recv(socket_, (char *) buf, count, 0);
+            }
           }
         }
         #endif
@@ -385,19 +358,7 @@ namespace Tegenaria
 
           if (how == SD_SEND)
           {
-            fd_set rfd;
-
-            struct timeval tv;
-
-            FD_ZERO(&rfd);
-
-            FD_SET(socket_, &rfd);
-
-            tv.tv_sec  = 0;
-            tv.tv_usec = 100000;
-
-            if (select(socket_ + 1, &rfd, NULL, NULL, &tv) > 0
-                    && FD_ISSET(socket_, &rfd))
+            if (_NetWait(socket_, NET_WAIT_READ, 100) > 0)
             {
               char buf[64];
 
@@ -420,6 +381,131 @@ namespace Tegenaria
     return ret;
   }
 
+  //
+  // Send <len> bytes from file <fd> starting at <offset>.
+  // File data is copied by kernel directly to socket (sendfile) without
+  // passing it through user space.
+  //
+  // fd      - CRT FD of opened file (IN).
+  // offset  - file position, where to start from (IN).
+  // len     - number of bytes to send (IN).
+  // timeout - timeout in miliseconds for whole operation (IN).
+  //
+  // TIP #1: If sendfile() is not supported for given fd, generic
+  //         NetConnection::sendFile() is used.
+  //
+  // TIP #2: Zero-copy is used on Linux only. Other systems always use
+  //         generic pread() + write() code from NetConnection::sendFile().
+  //
+  // RETURNS: Number of bytes sent or
+  //          -1 if error.
+  //
+
+  int64_t NetTcpConnection::sendFile(int fd, int64_t offset, int64_t len, int timeout)
+  {
+    //
+    // Windows, MacOS. sendfile() is missing or has different signature.
+    //
+
+    #ifndef __linux__
+    {
+      return NetConnection::sendFile(fd, offset, len, timeout);
+    }
+
+    //
+    // Linux.
+    //
+
+    #else
+    {
+      int64_t totalSent = 0;
+
+      int64_t deadline = _NetGetTimeMs() + timeout;
+
+      off_t pos = off_t(offset);
+
+      ssize_t sent = 0;
+
+      int left = -1;
+
+      if (int(socket_) == -1)
+      {
+        return -1;
+      }
+
+      while (totalSent < len)
+      {
+        sent = ::sendfile(socket_, fd, &pos, size_t(len - totalSent));
+
+        //
+        // Piece sent. Kernel moved pos for us.
+        //
+
+        if (sent > 0)
+        {
+          totalSent += sent;
+        }
+
+        //
+        // File shorter than expected.
+        //
+
+        else if (sent == 0)
+        {
+          Error("ERROR: Unexpected end of file FD #%d at offset [%lld].\n",
+                    fd, (long long) pos);
+
+          return -1;
+        }
+
+        //
+        // sendfile() not supported for this FD. Go on with generic
+        // read/write code.
+        //
+
+        else if ((errno == EINVAL || errno == ENOSYS) && totalSent == 0)
+        {
+          DBG_MSG("NetTcpConnection::sendFile : sendfile() not supported for"
+                      " FD #%d, falling back to read/write.\n", fd);
+
+          return NetConnection::sendFile(fd, offset, len, timeout);
+        }
+
+        //
+        // Socket buffer full. Wait until socket available for write, but
+        // no longer than time left to deadline computed at call begin.
+        //
+
+        else if (errno == EWOULDBLOCK || errno == EINTR)
+        {
+          if (timeout > 0)
+          {
+            left = int(std::max(deadline - _NetGetTimeMs(), int64_t(0)));
+          }
+
+          if (_NetWait(socket_, NET_WAIT_WRITE, left, cancelPipe_[0]) <= 0)
+          {
+            Error("ERROR: Timeout while sending file to TCP connection PTR#%p.\n", this);
+
+            return -1;
+          }
+        }
+
+        //
+        // Unexpected error.
+        //
+
+        else
+        {
+          return -1;
+        }
+      }
+
+      return totalSent;
+    }
+    #endif
+  }
+
   //
   // Disable/enable nagle algorithm.
   //
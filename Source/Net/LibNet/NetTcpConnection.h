@@ -51,6 +51,9 @@ struct tcp_keepalive
 
 #else
 # include <unistd.h>
+# ifdef __linux__
+#  include <sys/sendfile.h>
+# endif
 #endif
 
 namespace Tegenaria
@@ -87,6 +90,8 @@ namespace Tegenaria
     virtual int read(void *buf, int count, int timeout = -1);
     virtual void cancel();
 
+    virtual int64_t sendFile(int fd, int64_t offset, int64_t len, int timeout = -1);
+
     virtual int shutdown(int how = SD_BOTH);
 
     virtual void setNoDelay(int value);
@@ -0,0 +1,463 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Hierarchical timer wheel used by epoll server workers to serve
+//          idle, write stall and user timeouts without extra threads.
+//
+
+#pragma qcbuild_set_file_title("Timer wheel");
+#pragma qcbuild_set_private(1)
+
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <Tegenaria/Debug.h>
+#include "NetTimerWheel.h"
+#include "NetInternal.h"
+
+namespace Tegenaria
+{
+  //
+  // Get current monotonic time in wheel ticks.
+  //
+
+  static uint64_t NetTimerGetTick(NetTimerWheel *wheel)
+  {
+    return uint64_t(_NetGetTimeMs()) / wheel -> tickMs_;
+  }
+
+  //
+  // Link timer into slot matching its expire tick.
+  // Used internally only.
+  //
+
+  static void NetTimerLink(NetTimerWheel *wheel, NetTimer *timer)
+  {
+    uint64_t delta = 0;
+
+    int level = 0;
+
+    int slot = 0;
+
+    //
+    // Already expired. Fire it on the next processed tick.
+    //
+
+    if (timer -> expire_ < wheel -> now_)
+    {
+      timer -> expire_ = wheel -> now_;
+    }
+
+    delta = timer -> expire_ - wheel -> now_;
+
+    //
+    // Find the lowest level, which covers given delta.
+    //
+
+    while (level < NET_TIMER_LEVELS - 1
+               && delta >= (uint64_t(1) << ((level + 1) * NET_TIMER_BITS)))
+    {
+      level++;
+    }
+
+    //
+    // Clamp timers over wheel range to the last slot.
+    //
+
+    if (delta >= (uint64_t(1) << (NET_TIMER_LEVELS * NET_TIMER_BITS)))
+    {
+      timer -> expire_ = wheel -> now_ + (uint64_t(1) << (NET_TIMER_LEVELS * NET_TIMER_BITS)) - 1;
+    }
+
+    slot = int((timer -> expire_ >> (level * NET_TIMER_BITS)) & NET_TIMER_MASK);
+
+    timer -> level_ = level;
+    timer -> slot_  = slot;
+    timer -> prev_  = NULL;
+    timer -> next_  = wheel -> slots_[level][slot];
+
+    if (timer -> next_)
+    {
+      timer -> next_ -> prev_ = timer;
+    }
+
+    wheel -> slots_[level][slot] = timer;
+  }
+
+  //
+  // Unlink timer from its slot.
+  // Used internally only.
+  //
+
+  static void NetTimerUnlink(NetTimerWheel *wheel, NetTimer *timer)
+  {
+    if (timer -> prev_)
+    {
+      timer -> prev_ -> next_ = timer -> next_;
+    }
+    else
+    {
+      wheel -> slots_[timer -> level_][timer -> slot_] = timer -> next_;
+    }
+
+    if (timer -> next_)
+    {
+      timer -> next_ -> prev_ = timer -> prev_;
+    }
+
+    timer -> prev_  = NULL;
+    timer -> next_  = NULL;
+    timer -> level_ = -1;
+    timer -> slot_  = -1;
+  }
+
+  //
+  // Move all timers from given slot to lower levels.
+  // Used internally only.
+  //
+  // RETURNS: Index of cascaded slot.
+  //
+
+  static int NetTimerCascade(NetTimerWheel *wheel, int level)
+  {
+    int slot = int((wheel -> now_ >> (level * NET_TIMER_BITS)) & NET_TIMER_MASK);
+
+    NetTimer *timer = wheel -> slots_[level][slot];
+
+    wheel -> slots_[level][slot] = NULL;
+
+    while (timer)
+    {
+      NetTimer *next = timer -> next_;
+
+      NetTimerLink(wheel, timer);
+
+      timer = next;
+    }
+
+    return slot;
+  }
+
+  //
+  // Find the nearest tick, which needs processing: level 0 slot with
+  // timers to fire or upper level slot with timers to cascade.
+  // Search stops at <limit> tick.
+  // Used internally only.
+  //
+  // TIP#1: Upper level slot is cascaded, when all lower bits of tick
+  //        wrap to zero, so it's enough to check one tick per slot.
+  //
+  // wheel - wheel to check (IN).
+  // limit - the last tick worth to check (IN).
+  //
+  // RETURNS: Nearest tick to process,
+  //          or limit + 1 if nothing to do up to <limit>.
+  //
+
+  static uint64_t NetTimerNextTick(NetTimerWheel *wheel, uint64_t limit)
+  {
+    uint64_t best = limit + 1;
+
+    if (wheel -> count_ == 0)
+    {
+      return best;
+    }
+
+    //
+    // Level 0. Timers are linked at slot matching expire tick.
+    //
+
+    for (uint64_t tick = wheel -> now_;
+             tick < best && tick < wheel -> now_ + NET_TIMER_SLOTS; tick++)
+    {
+      if (wheel -> slots_[0][tick & NET_TIMER_MASK])
+      {
+        best = tick;
+      }
+    }
+
+    //
+    // Upper levels. If now_ is at the wrap point, current slot is not
+    // cascaded yet. Otherwise current slot is cascaded one full round
+    // later.
+    //
+
+    for (int level = 1; level < NET_TIMER_LEVELS; level++)
+    {
+      int shift = level * NET_TIMER_BITS;
+
+      uint64_t base = (wheel -> now_ >> shift) << shift;
+
+      for (int i = (wheel -> now_ == base ? 0 : 1); i <= NET_TIMER_SLOTS; i++)
+      {
+        uint64_t tick = base + (uint64_t(i) << shift);
+
+        if (tick >= best)
+        {
+          break;
+        }
+
+        if (wheel -> slots_[level][((base >> shift) + i) & NET_TIMER_MASK])
+        {
+          best = tick;
+        }
+      }
+    }
+
+    return best;
+  }
+
+  //
+  // Initialize empty timer wheel.
+  //
+  // wheel  - wheel to initialize (OUT).
+  // tickMs - tick length in ms (IN/OPT).
+  //
+
+  void NetTimerWheelInit(NetTimerWheel *wheel, int tickMs)
+  {
+    memset(wheel, 0, sizeof(NetTimerWheel));
+
+    wheel -> tickMs_ = tickMs > 0 ? tickMs : NET_TIMER_TICK;
+
+    wheel -> now_ = NetTimerGetTick(wheel);
+  }
+
+  //
+  // Initialize not armed timer.
+  //
+  // timer    - timer to initialize (OUT).
+  // callback - function called when timer expires (IN).
+  // data     - custom data passed to callback (IN/OPT).
+  //
+
+  void NetTimerInit(NetTimer *timer, NetTimerProto callback, void *data)
+  {
+    memset(timer, 0, sizeof(NetTimer));
+
+    timer -> level_    = -1;
+    timer -> slot_     = -1;
+    timer -> callback_ = callback;
+    timer -> data_     = data;
+  }
+
+  //
+  // Arm timer to expire after given time. If timer is already armed, it's
+  // moved to new expire time.
+  //
+  // wheel     - wheel, where to add timer (IN/OUT).
+  // timer     - timer initialized by NetTimerInit() before (IN/OUT).
+  // timeoutMs - time to expire in ms, rounded up to full ticks (IN).
+  //
+  // TIP#1: Timer fires once. Call NetTimerAdd() again inside callback to
+  //        get periodic timer.
+  //
+
+  void NetTimerAdd(NetTimerWheel *wheel, NetTimer *timer, int timeoutMs)
+  {
+    uint64_t ticks = (uint64_t(timeoutMs > 0 ? timeoutMs : 0) + wheel -> tickMs_ - 1)
+                         / wheel -> tickMs_;
+
+    if (timer -> slot_ >= 0)
+    {
+      NetTimerUnlink(wheel, timer);
+
+      wheel -> count_--;
+    }
+
+    //
+    // Expire at least one tick from now, so timer re-added inside its own
+    // callback doesn't fire again in the same tick.
+    //
+
+    timer -> expire_ = NetTimerGetTick(wheel) + (ticks > 0 ? ticks : 1);
+
+    NetTimerLink(wheel, timer);
+
+    wheel -> count_++;
+  }
+
+  //
+  // Disarm timer. Does nothing if timer is not armed.
+  //
+  // wheel - wheel, where timer was added (IN/OUT).
+  // timer - timer to cancel (IN/OUT).
+  //
+
+  void NetTimerCancel(NetTimerWheel *wheel, NetTimer *timer)
+  {
+    if (timer -> slot_ >= 0)
+    {
+      NetTimerUnlink(wheel, timer);
+
+      wheel -> count_--;
+    }
+  }
+
+  //
+  // RETURNS: 1 if timer is armed,
+  //          0 otherwise.
+  //
+
+  int NetTimerIsArmed(NetTimer *timer)
+  {
+    return timer -> slot_ >= 0;
+  }
+
+  //
+  // Process all ticks passed since last call and call callbacks for
+  // expired timers.
+  //
+  // wheel - wheel to process (IN/OUT).
+  //
+  // TIP#1: Timer is disarmed before callback is called, so callback can
+  //        add or cancel any timer, including itself.
+  //
+  // RETURNS: Number of expired timers.
+  //
+
+  int NetTimerWheelRun(NetTimerWheel *wheel)
+  {
+    uint64_t target = NetTimerGetTick(wheel);
+
+    int expired = 0;
+
+    while (wheel -> now_ <= target)
+    {
+      int slot = 0;
+
+      //
+      // Jump over ticks with nothing to fire or cascade, so long idle
+      // period doesn't cost one iteration per tick.
+      //
+
+      wheel -> now_ = NetTimerNextTick(wheel, target);
+
+      if (wheel -> now_ > target)
+      {
+        break;
+      }
+
+      slot = int(wheel -> now_ & NET_TIMER_MASK);
+
+      //
+      // Lower wheel wrapped. Move timers from upper levels down.
+      //
+
+      for (int level = 1; slot == 0 && level < NET_TIMER_LEVELS; level++)
+      {
+        if (NetTimerCascade(wheel, level) != 0)
+        {
+          break;
+        }
+      }
+
+      //
+      // Fire timers in current slot.
+      //
+
+      while (wheel -> slots_[0][slot])
+      {
+        NetTimer *timer = wheel -> slots_[0][slot];
+
+        NetTimerUnlink(wheel, timer);
+
+        wheel -> count_--;
+
+        expired++;
+
+        timer -> callback_(timer, timer -> data_);
+      }
+
+      wheel -> now_++;
+    }
+
+    return expired;
+  }
+
+  //
+  // Get time to wait for events before wheel needs to be processed again,
+  // i.e. time to the nearest tick with timers to fire or cascade.
+  //
+  // wheel     - wheel to check (IN).
+  // timeoutMs - timeout, which caller wants to use, -1 means infinite (IN).
+  //
+  // RETURNS: Timeout in ms to pass to epoll_wait() or similar.
+  //
+
+  int NetTimerWheelGetTimeout(NetTimerWheel *wheel, int timeoutMs)
+  {
+    int64_t nowMs = _NetGetTimeMs();
+
+    int64_t waitMs = 0;
+
+    uint64_t limit = 0;
+    uint64_t next  = 0;
+
+    if (wheel -> count_ == 0)
+    {
+      return timeoutMs;
+    }
+
+    //
+    // Don't look farther than caller's timeout or whole wheel range.
+    //
+
+    if (timeoutMs >= 0)
+    {
+      limit = uint64_t(nowMs + timeoutMs) / wheel -> tickMs_;
+    }
+    else
+    {
+      limit = wheel -> now_ + (uint64_t(1) << (NET_TIMER_LEVELS * NET_TIMER_BITS));
+    }
+
+    next = NetTimerNextTick(wheel, limit);
+
+    if (next > limit)
+    {
+      return timeoutMs;
+    }
+
+    //
+    // Wake up at the beginning of found tick. Overdue ticks are
+    // processed at once.
+    //
+
+    waitMs = int64_t(next) * wheel -> tickMs_ - nowMs;
+
+    if (waitMs < 0)
+    {
+      waitMs = 0;
+    }
+
+    if (timeoutMs >= 0 && waitMs > timeoutMs)
+    {
+      waitMs = timeoutMs;
+    }
+
+    return int(std::min(waitMs, int64_t(INT_MAX)));
+  }
+} /* namespace Tegenaria */
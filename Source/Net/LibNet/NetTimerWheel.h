@@ -0,0 +1,138 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef Tegenaria_Core_NetTimerWheel_H
+#define Tegenaria_Core_NetTimerWheel_H
+
+#include <stdint.h>
+
+namespace Tegenaria
+{
+  //
+  // Defines.
+  //
+
+  //
+  // NET_TIMER_LEVELS - number of wheels in hierarchy.
+  // NET_TIMER_BITS   - log2 of slots number in one wheel.
+  // NET_TIMER_TICK   - default tick length in ms.
+  //
+  // 4 levels by 256 slots cover 2^32 ticks (about 16 months with 10 ms
+  // tick).
+  //
+
+  #define NET_TIMER_LEVELS 4
+  #define NET_TIMER_BITS   8
+  #define NET_TIMER_SLOTS  (1 << NET_TIMER_BITS)
+  #define NET_TIMER_MASK   (NET_TIMER_SLOTS - 1)
+  #define NET_TIMER_TICK   10
+
+  //
+  // Forward declarations.
+  //
+
+  struct NetTimer;
+
+  //
+  // Typedef.
+  //
+
+  typedef void (*NetTimerProto)(NetTimer *timer, void *data);
+
+  //
+  // Structs.
+  //
+
+  //
+  // One timer. Embedded by caller in its own structures, so adding and
+  // removing timers never allocates memory.
+  //
+
+  struct NetTimer
+  {
+    NetTimer *prev_;
+    NetTimer *next_;
+
+    //
+    // Tick, when timer expires.
+    //
+
+    uint64_t expire_;
+
+    //
+    // Wheel slot, where timer is linked or -1 if timer is not armed.
+    //
+
+    int level_;
+    int slot_;
+
+    NetTimerProto callback_;
+
+    void *data_;
+  };
+
+  //
+  // Hierarchical timer wheel. Owned by one thread, not thread safe.
+  //
+  // - Add and cancel are O(1).
+  // - Timers due in less than 256 ticks live in level 0. Farther ones are
+  //   moved one level down every time lower wheel wraps (cascade), so every
+  //   timer is touched at most NET_TIMER_LEVELS times.
+  //
+
+  struct NetTimerWheel
+  {
+    int tickMs_;
+    int count_;
+
+    //
+    // Next tick to process.
+    //
+
+    uint64_t now_;
+
+    NetTimer *slots_[NET_TIMER_LEVELS][NET_TIMER_SLOTS];
+  };
+
+  //
+  // Functions.
+  //
+
+  void NetTimerWheelInit(NetTimerWheel *wheel, int tickMs = NET_TIMER_TICK);
+
+  void NetTimerInit(NetTimer *timer, NetTimerProto callback, void *data);
+
+  void NetTimerAdd(NetTimerWheel *wheel, NetTimer *timer, int timeoutMs);
+
+  void NetTimerCancel(NetTimerWheel *wheel, NetTimer *timer);
+
+  int NetTimerIsArmed(NetTimer *timer);
+
+  int NetTimerWheelRun(NetTimerWheel *wheel);
+
+  int NetTimerWheelGetTimeout(NetTimerWheel *wheel, int timeoutMs);
+
+} /* namespace Tegenaria */
+
+#endif /* Tegenaria_Core_NetTimerWheel_H */
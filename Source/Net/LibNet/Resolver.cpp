@@ -0,0 +1,440 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Asynchronous hostname resolver with small cache.
+//
+// Blocking getaddrinfo() calls are moved to small pool of resolver threads,
+// so caller can give up after timeout even if system resolver hangs.
+// Resolved addresses are cached for NET_RESOLVER_CACHE_TTL ms.
+//
+// Usage:
+//
+//   vector<struct sockaddr_storage> addrs;
+//
+//   _NetResolve(addrs, "google.pl", 80, 5000);
+//
+
+#pragma qcbuild_set_file_title("Hostname resolver");
+#pragma qcbuild_set_private(1)
+
+#include "Net.h"
+#include "NetInternal.h"
+
+#include <list>
+#include <map>
+
+#include <Tegenaria/Mutex.h>
+#include <Tegenaria/Semaphore.h>
+
+#ifdef WIN32
+# include <ws2tcpip.h>
+#else
+# include <netdb.h>
+#endif
+
+//
+// Defines.
+//
+
+#define NET_RESOLVER_THREADS     4
+#define NET_RESOLVER_CACHE_TTL   60000
+#define NET_RESOLVER_CACHE_MAX   256
+
+namespace Tegenaria
+{
+  using std::list;
+  using std::map;
+
+  //
+  // Pending resolve request.
+  // Shared between caller and resolver thread, freed by the last one
+  // releasing it, because caller may give up on timeout before
+  // resolver finished.
+  //
+
+  struct NetResolveJob
+  {
+    string host_;
+
+    vector<struct sockaddr_storage> addrs_;
+
+    int result_;
+    int refCount_;
+
+    Semaphore done_;
+  };
+
+  struct NetResolveCacheEntry
+  {
+    vector<struct sockaddr_storage> addrs_;
+
+    int64_t expire_;
+  };
+
+  static Mutex NetResolverMutex;
+
+  //
+  // Counting semaphore, signaled once per queued job.
+  //
+
+  static Semaphore NetResolverPending;
+
+  static list<NetResolveJob *> NetResolverQueue;
+
+  static map<string, NetResolveCacheEntry> NetResolverCache;
+
+  static int NetResolverThreads = 0;
+  static int NetResolverIdle    = 0;
+
+  //
+  // Resolve hostname using blocking getaddrinfo().
+  // Used internally only.
+  //
+  // addrs - list of resolved IPv4 and IPv6 addresses in system order (OUT).
+  // host  - hostname or numeric address to resolve (IN).
+  // flags - extra AI_XXX flags passed to getaddrinfo() (IN).
+  //
+  // RETURNS: 0 if OK,
+  //          getaddrinfo() error code otherwise.
+  //
+
+  static int NetResolveBlocking(vector<struct sockaddr_storage> &addrs,
+                                    const char *host, int flags)
+  {
+    struct addrinfo hints;
+
+    struct addrinfo *res = NULL;
+
+    int ret = 0;
+
+    memset(&hints, 0, sizeof(hints));
+
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = flags;
+
+    addrs.clear();
+
+    ret = getaddrinfo(host, NULL, &hints, &res);
+
+    if (ret == 0)
+    {
+      for (struct addrinfo *it = res; it; it = it -> ai_next)
+      {
+        struct sockaddr_storage addr;
+
+        if (it -> ai_family != AF_INET && it -> ai_family != AF_INET6)
+        {
+          continue;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, it -> ai_addr, it -> ai_addrlen);
+
+        addrs.push_back(addr);
+      }
+
+      freeaddrinfo(res);
+    }
+
+    return ret;
+  }
+
+  //
+  // Decrease job refference counter and free it if not needed longer.
+  // Used internally only.
+  //
+
+  static void NetResolveJobRelease(NetResolveJob *job)
+  {
+    int deleteNeeded = 0;
+
+    NetResolverMutex.lock();
+
+    job -> refCount_--;
+
+    deleteNeeded = (job -> refCount_ == 0);
+
+    NetResolverMutex.unlock();
+
+    if (deleteNeeded)
+    {
+      delete job;
+    }
+  }
+
+  //
+  // Resolver thread. Pops pending jobs from queue, resolves them and
+  // put result into cache. Threads live until process exit.
+  // Used internally only.
+  //
+
+  static int NetResolverWorker(void *unused)
+  {
+    NetResolveJob *job = NULL;
+
+    while(1)
+    {
+      NetResolverPending.wait();
+
+      NetResolverMutex.lock();
+
+      if (NetResolverQueue.empty())
+      {
+        NetResolverMutex.unlock();
+
+        continue;
+      }
+
+      job = NetResolverQueue.front();
+
+      NetResolverQueue.pop_front();
+
+      NetResolverIdle--;
+
+      NetResolverMutex.unlock();
+
+      //
+      // Resolve outside lock.
+      //
+
+      job -> result_ = NetResolveBlocking(job -> addrs_, job -> host_.c_str(), 0);
+
+      if (job -> result_ == 0 && job -> addrs_.empty())
+      {
+        job -> result_ = -1;
+      }
+
+      //
+      // Put result into cache. Drop expired entries if cache grows
+      // too big.
+      //
+
+      NetResolverMutex.lock();
+
+      if (job -> result_ == 0)
+      {
+        int64_t now = _NetGetTimeMs();
+
+        if (NetResolverCache.size() >= NET_RESOLVER_CACHE_MAX)
+        {
+          map<string, NetResolveCacheEntry>::iterator it = NetResolverCache.begin();
+
+          while(it != NetResolverCache.end())
+          {
+            if (it -> second.expire_ <= now)
+            {
+              NetResolverCache.erase(it++);
+            }
+            else
+            {
+              it++;
+            }
+          }
+
+          if (NetResolverCache.size() >= NET_RESOLVER_CACHE_MAX)
+          {
+            NetResolverCache.clear();
+          }
+        }
+
+        NetResolveCacheEntry &entry = NetResolverCache[job -> host_];
+
+        entry.addrs_  = job -> addrs_;
+        entry.expire_ = now + NET_RESOLVER_CACHE_TTL;
+      }
+
+      NetResolverIdle++;
+
+      NetResolverMutex.unlock();
+
+      job -> done_.signal();
+
+      NetResolveJobRelease(job);
+    }
+
+    return 0;
+  }
+
+  //
+  // Resolve hostname to list of IPv4 and IPv6 addresses without blocking
+  // caller longer than timeout.
+  //
+  // TIP #1: Numeric addresses e.g. "127.0.0.1" or "::1" are converted
+  //         directly without touching resolver threads.
+  //
+  // TIP #2: Resolved names are cached for NET_RESOLVER_CACHE_TTL ms.
+  //
+  // addrs   - list of resolved addresses with port set in system
+  //           preference order (OUT).
+  // host    - hostname or numeric address to resolve (IN).
+  // port    - port to set in returned addresses (IN).
+  // timeout - timeout in ms or -1 for infinite (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int _NetResolve(vector<struct sockaddr_storage> &addrs,
+                      const char *host, int port, int timeout)
+  {
+    DBG_ENTER3("_NetResolve");
+
+    int exitCode = -1;
+
+    NetResolveJob *job = NULL;
+
+    map<string, NetResolveCacheEntry>::iterator it;
+
+    addrs.clear();
+
+    //
+    // Check args.
+    //
+
+    FAILEX(host == NULL, "ERROR: 'host' cannot be NULL in _NetResolve().\n");
+
+    //
+    // Initialize WinSock 2.2 on windows.
+    //
+
+    FAIL(_NetInit());
+
+    //
+    // Numeric address. Convert in place, it never blocks.
+    //
+
+    if (NetResolveBlocking(addrs, host, AI_NUMERICHOST) != 0 || addrs.empty())
+    {
+      NetResolverMutex.lock();
+
+      //
+      // Try cache first.
+      //
+
+      it = NetResolverCache.find(host);
+
+      if (it != NetResolverCache.end() && it -> second.expire_ > _NetGetTimeMs())
+      {
+        addrs = it -> second.addrs_;
+      }
+
+      //
+      // Not in cache. Pass job to resolver threads and start new
+      // thread if all busy.
+      //
+
+      else
+      {
+        if (NetResolverIdle <= int(NetResolverQueue.size())
+                && NetResolverThreads < NET_RESOLVER_THREADS)
+        {
+          if (ThreadCreate(NetResolverWorker, NULL))
+          {
+            NetResolverThreads++;
+            NetResolverIdle++;
+          }
+        }
+
+        if (NetResolverThreads > 0)
+        {
+          job = new NetResolveJob;
+
+          job -> host_     = host;
+          job -> result_   = -1;
+          job -> refCount_ = 2;
+
+          NetResolverQueue.push_back(job);
+        }
+      }
+
+      NetResolverMutex.unlock();
+
+      FAILEX(job == NULL && addrs.empty(), "ERROR: Cannot start resolver thread.\n");
+
+      //
+      // Wait for resolver.
+      //
+
+      if (job)
+      {
+        NetResolverPending.signal();
+
+        FAILEX(job -> done_.wait(timeout) != 0,
+                   "ERROR: Timeout while resolving '%s'.\n", host);
+
+        FAILEX(job -> result_ != 0,
+                   "ERROR: getaddrinfo() failed with code '%d'.\n", job -> result_);
+
+        addrs = job -> addrs_;
+      }
+    }
+
+    FAIL(addrs.empty());
+
+    //
+    // Set port.
+    //
+
+    for (size_t i = 0; i < addrs.size(); i++)
+    {
+      if (addrs[i].ss_family == AF_INET)
+      {
+        ((struct sockaddr_in *) &addrs[i]) -> sin_port = htons(port);
+      }
+      else
+      {
+        ((struct sockaddr_in6 *) &addrs[i]) -> sin6_port = htons(port);
+      }
+    }
+
+    DEBUG2("_NetResolve : Host '%s' resolved to %d address(es).\n",
+               host, int(addrs.size()));
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot resolve host '%s'.\n", host);
+
+      addrs.clear();
+    }
+
+    if (job)
+    {
+      NetResolveJobRelease(job);
+    }
+
+    DBG_LEAVE3("_NetResolve");
+
+    return exitCode;
+  }
+
+} /* namespace Tegenaria */
@@ -50,6 +50,19 @@
 //      nc -> release()
 //    }
 //
+// Usage III (serve connections by fixed pool of threads):
+// -------------------------------------------------------
+//
+//  NetServerConfig cfg = {0};
+//
+//  cfg.workers_ = 16;
+//
+//  NetConnection *nc = NetServerCreateEx(..., handler, ..., &cfg)
+//  nc -> join()
+//
+//  Handler is the same like above, but threads are reused between
+//  connections. Accepted connections wait in queue for free worker.
+//
 
 #pragma qcbuild_set_file_title("Server side API")
 
@@ -57,8 +70,302 @@
 #include "NetInternal.h"
 #include "NetTcpConnection.h"
 
+#include <map>
+#include <algorithm>
+#include <Tegenaria/Mutex.h>
+#include <Tegenaria/Semaphore.h>
+
 namespace Tegenaria
 {
+  using std::map;
+
+  //
+  // Worker pool and accept queue of one server created by
+  // NetServerCreateEx(). Queue is a ring buffer guarded by mutex_,
+  // pending_ counts connections waiting in queue.
+  //
+
+  struct NetServerPool
+  {
+    Mutex mutex_;
+
+    Semaphore pending_;
+
+    NetHandleConnProto handler_;
+
+    NetTcpConnection **queue_;
+
+    int queueSize_;
+    int queueHead_;
+    int queueDepth_;
+    int maxQueueDepth_;
+
+    int workersCount_;
+    int busyWorkers_;
+    int stop_;
+
+    int64_t accepted_;
+    int64_t rejected_;
+    int64_t served_;
+
+    ThreadHandle_t **workers_;
+  };
+
+  //
+  // Pools of running servers indexed by listening connection.
+  //
+
+  static map<NetConnection *, NetServerPool *> NetServerPools;
+
+  static Mutex NetServerPoolsMutex;
+
+  //
+  // Pooled worker thread. Pops accepted connection from queue and pass it
+  // to user handler. Thread is reused for next connection after handler
+  // returned.
+  // Used internally only.
+  //
+  // pool - pool created by NetServerPoolCreate() (IN/OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  static int NetServerPoolWorker(NetServerPool *pool)
+  {
+    DBG_ENTER("NetServerPoolWorker");
+
+    NetTcpConnection *clientConn = NULL;
+
+    while(1)
+    {
+      pool -> pending_.wait();
+
+      pool -> mutex_.lock();
+
+      if (pool -> queueDepth_ == 0)
+      {
+        int stop = pool -> stop_;
+
+        pool -> mutex_.unlock();
+
+        if (stop)
+        {
+          break;
+        }
+
+        continue;
+      }
+
+      clientConn = pool -> queue_[pool -> queueHead_];
+
+      pool -> queueHead_ = (pool -> queueHead_ + 1) % pool -> queueSize_;
+
+      pool -> queueDepth_--;
+      pool -> busyWorkers_++;
+
+      pool -> mutex_.unlock();
+
+      //
+      // Serve connection. Handler is responsible to release it like in
+      // thread per connection mode.
+      //
+
+      pool -> handler_(clientConn);
+
+      pool -> mutex_.lock();
+
+      pool -> busyWorkers_--;
+      pool -> served_++;
+
+      pool -> mutex_.unlock();
+    }
+
+    DBG_LEAVE("NetServerPoolWorker");
+
+    return 0;
+  }
+
+  //
+  // Stop pool workers and free pool related with given listening
+  // connection if any. Connections still waiting in queue are closed.
+  // Used internally only.
+  //
+  // WARNING: Function waits until running handlers finished.
+  //
+  // serverConn - listening connection passed to NetServerPoolCreate() (IN).
+  //
+
+  static void NetServerPoolDestroy(NetConnection *serverConn)
+  {
+    DBG_ENTER("NetServerPoolDestroy");
+
+    NetServerPool *pool = NULL;
+
+    NetTcpConnection *clientConn = NULL;
+
+    NetServerPoolsMutex.lock();
+
+    if (NetServerPools.count(serverConn))
+    {
+      pool = NetServerPools[serverConn];
+
+      NetServerPools.erase(serverConn);
+    }
+
+    NetServerPoolsMutex.unlock();
+
+    if (pool)
+    {
+      //
+      // Close connections never served.
+      //
+
+      pool -> mutex_.lock();
+
+      pool -> stop_ = 1;
+
+      while (pool -> queueDepth_ > 0)
+      {
+        clientConn = pool -> queue_[pool -> queueHead_];
+
+        pool -> queueHead_ = (pool -> queueHead_ + 1) % pool -> queueSize_;
+
+        pool -> queueDepth_--;
+
+        clientConn -> release();
+      }
+
+      pool -> mutex_.unlock();
+
+      //
+      // Wake up and join all workers.
+      //
+
+      for (int i = 0; i < pool -> workersCount_; i++)
+      {
+        pool -> pending_.signal();
+      }
+
+      for (int i = 0; i < pool -> workersCount_; i++)
+      {
+        if (pool -> workers_[i])
+        {
+          ThreadWait(pool -> workers_[i]);
+          ThreadClose(pool -> workers_[i]);
+        }
+      }
+
+      free(pool -> queue_);
+      free(pool -> workers_);
+
+      delete pool;
+    }
+
+    DBG_LEAVE("NetServerPoolDestroy");
+  }
+
+  //
+  // Create worker pool for server and register it for given listening
+  // connection.
+  // Used internally only.
+  //
+  // serverConn - listening connection served by pool (IN).
+  // handler    - user handler called for every connection (IN).
+  // config     - pool configuration (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  static int NetServerPoolCreate(NetConnection *serverConn,
+                                     NetHandleConnProto handler,
+                                         NetServerConfig *config)
+  {
+    DBG_ENTER("NetServerPoolCreate");
+
+    int exitCode   = -1;
+    int registered = 0;
+
+    NetServerPool *pool = new NetServerPool;
+
+    FAILEX(pool == NULL, "ERROR: Out of memory.\n");
+
+    pool -> handler_       = handler;
+    pool -> workersCount_  = config -> workers_;
+    pool -> queueSize_     = config -> queueSize_;
+    pool -> queueHead_     = 0;
+    pool -> queueDepth_    = 0;
+    pool -> maxQueueDepth_ = 0;
+    pool -> busyWorkers_   = 0;
+    pool -> stop_          = 0;
+    pool -> accepted_      = 0;
+    pool -> rejected_      = 0;
+    pool -> served_        = 0;
+
+    if (pool -> queueSize_ <= 0)
+    {
+      pool -> queueSize_ = NET_SERVER_QUEUE_PER_WORKER * pool -> workersCount_;
+    }
+
+    pool -> queue_   = (NetTcpConnection **) calloc(pool -> queueSize_, sizeof(NetTcpConnection *));
+    pool -> workers_ = (ThreadHandle_t **) calloc(pool -> workersCount_, sizeof(ThreadHandle_t *));
+
+    FAILEX(pool -> queue_ == NULL || pool -> workers_ == NULL, "ERROR: Out of memory.\n");
+
+    //
+    // Register pool before workers started. It's unregistered and freed
+    // by NetServerPoolDestroy() at the end of NetServerLoop().
+    //
+
+    NetServerPoolsMutex.lock();
+
+    NetServerPools[serverConn] = pool;
+
+    registered = 1;
+
+    NetServerPoolsMutex.unlock();
+
+    for (int i = 0; i < pool -> workersCount_; i++)
+    {
+      pool -> workers_[i] = ThreadCreate(NetServerPoolWorker, pool);
+
+      DBG_SET_RENAME("thread", pool -> workers_[i], "NET/IN/PoolWorker");
+
+      FAILEX(pool -> workers_[i] == NULL,
+                 "ERROR: Cannot create pool worker #%d.\n", i);
+    }
+
+    DBG_MSG("Created [%d] pool workers with queue size [%d] for server PTR [%p].\n",
+                pool -> workersCount_, pool -> queueSize_, serverConn);
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode && pool)
+    {
+      //
+      // Pool already registered. Stop workers started so far.
+      //
+
+      if (registered)
+      {
+        NetServerPoolDestroy(serverConn);
+      }
+      else
+      {
+        free(pool -> queue_);
+        free(pool -> workers_);
+
+        delete pool;
+      }
+    }
+
+    DBG_LEAVE("NetServerPoolCreate");
+
+    return exitCode;
+  }
+
   //
   // Main server loop, which does:
   //
@@ -103,6 +410,10 @@ namespace Tegenaria
 
     NetTcpConnection *serv = (NetTcpConnection *) nc;
 
+    NetServerPool *pool = NULL;
+
+    int rejected = 0;
+
     DBG_SET_ADD("NetServerLoop", nc);
 
     //
@@ -132,6 +443,19 @@ namespace Tegenaria
 
     port = htons(serv -> getAddr().sin_port);
 
+    //
+    // Check is server served by worker pool.
+    //
+
+    NetServerPoolsMutex.lock();
+
+    if (NetServerPools.count(nc))
+    {
+      pool = NetServerPools[nc];
+    }
+
+    NetServerPoolsMutex.unlock();
+
     DBG_SET_RENAME("NetTcpConnection", nc, "Listen/%d", port);
 
     //
@@ -147,7 +471,7 @@ namespace Tegenaria
       DBG_MSG("NetServerLoop : Listening on port [%d] inside context [%p]...\n",
                   port, serv -> getContext());
 
-      FAILEX(listen(serv -> getSocket(), 5),
+      FAILEX(listen(serv -> getSocket(), pool ? SOMAXCONN : 5),
                  "ERROR: Cannot listen on socket.\n", serv -> getSocket());
 
       //
@@ -179,6 +503,39 @@ namespace Tegenaria
 
       DBG_SET_ADD("socket", client, "IN");
 
+      //
+      // Pooled mode. Reject connection if accept queue is full.
+      //
+
+      if (pool)
+      {
+        pool -> mutex_.lock();
+
+        rejected = (pool -> queueDepth_ >= pool -> queueSize_);
+
+        if (rejected)
+        {
+          pool -> rejected_++;
+        }
+        else
+        {
+          pool -> accepted_++;
+        }
+
+        pool -> mutex_.unlock();
+
+        if (rejected)
+        {
+          DBG_MSG("NetServerLoop : Accept queue full, rejecting SOCKET #%d.\n", client);
+
+          closesocket(client);
+
+          DBG_SET_DEL("socket", client);
+
+          continue;
+        }
+      }
+
       //
       // Pass connection to handler.
       //
@@ -190,15 +547,38 @@ namespace Tegenaria
 
       DBG_SET_RENAME("NetTcpConnection", clientConn, "IN");
 
+      //
+      // Pooled mode. Push connection to accept queue and wake up one
+      // free worker.
+      //
+
+      if (pool)
+      {
+        pool -> mutex_.lock();
+
+        pool -> queue_[(pool -> queueHead_ + pool -> queueDepth_) % pool -> queueSize_] = clientConn;
+
+        pool -> queueDepth_++;
+
+        pool -> maxQueueDepth_ = std::max(pool -> maxQueueDepth_, pool -> queueDepth_);
+
+        pool -> mutex_.unlock();
+
+        pool -> pending_.signal();
+      }
+
       //
       // Start up connection handler in another thread.
       //
 
-      thread = ThreadCreate((ThreadEntryProto) serv -> getHandler(), clientConn);
+      else
+      {
+        thread = ThreadCreate((ThreadEntryProto) serv -> getHandler(), clientConn);
 
-      DBG_SET_RENAME("thread", thread, "NET/IN/Handler");
+        DBG_SET_RENAME("thread", thread, "NET/IN/Handler");
 
-      clientConn -> setThread(thread);
+        clientConn -> setThread(thread);
+      }
     }
 
     //
@@ -211,6 +591,8 @@ namespace Tegenaria
 
     DBG_MSG("NetServerLoop : listening loop for connection [%p] finished.\n", nc);
 
+    NetServerPoolDestroy(nc);
+
     if (nc)
     {
       nc -> release();
@@ -225,6 +607,7 @@ namespace Tegenaria
 
   //
   // Start up TCP server in background thread.
+  // Every connection is served in new thread.
   //
   // handler - callback routine to handle incoming connections (IN).
   //
@@ -239,7 +622,34 @@ namespace Tegenaria
 
   NetConnection *NetServerCreate(int port, NetHandleConnProto handler, void *custom)
   {
-    DBG_ENTER("NetServerCreate");
+    return NetServerCreateEx(port, handler, custom, NULL);
+  }
+
+  //
+  // Start up TCP server in background thread.
+  //
+  // handler - callback routine to handle incoming connections (IN).
+  //
+  // custom  - custom, caller specified data passed to handler directly
+  //           inside NetConnection struct as 'ctx' (IN/OPT).
+  //
+  // port    - listening port (IN).
+  //
+  // config  - server configuration. If config -> workers_ > 0, connections
+  //           are served by fixed pool of threads instead of creating new
+  //           thread for every connection (IN/OPT).
+  //
+  // TIP #1: Use NetServerGetStats() to get accept queue depth and number
+  //         of rejected connections in pooled mode.
+  //
+  // RETURNS: Pointer to server side connection,
+  //          or NULL if error.
+  //
+
+  NetConnection *NetServerCreateEx(int port, NetHandleConnProto handler,
+                                       void *custom, NetServerConfig *config)
+  {
+    DBG_ENTER("NetServerCreateEx");
 
     int exitCode = -1;
 
@@ -301,6 +711,15 @@ namespace Tegenaria
 
     FAILEX(serverConn == NULL, "ERROR: Out of memory.\n");
 
+    //
+    // Start worker pool if needed.
+    //
+
+    if (config && config -> workers_ > 0)
+    {
+      FAIL(NetServerPoolCreate(serverConn, handler, config));
+    }
+
     //
     // Create server loop thread.
     //
@@ -350,17 +769,73 @@ namespace Tegenaria
       {
         serverConn -> setState(NET_STATE_DEAD);
 
+        //
+        // Server loop not started, stop worker pool here.
+        //
+
+        if (serverLoopThread == NULL)
+        {
+          NetServerPoolDestroy(serverConn);
+        }
+
         serverConn -> release();
 
         serverConn = NULL;
       }
     }
 
-    DBG_LEAVE("NetServerCreate");
+    DBG_LEAVE("NetServerCreateEx");
 
     return serverConn;
   }
 
+  //
+  // Get counters of server created by NetServerCreateEx() in pooled mode.
+  //
+  // serverConn - server connection returned by NetServerCreateEx() (IN).
+  // stats      - buffer, where to store counters (OUT).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error or server is not in pooled mode.
+  //
+
+  int NetServerGetStats(NetConnection *serverConn, NetServerStats *stats)
+  {
+    int exitCode = -1;
+
+    NetServerPool *pool = NULL;
+
+    FAILEX(stats == NULL, "ERROR: 'stats' cannot be NULL.\n");
+
+    NetServerPoolsMutex.lock();
+
+    if (NetServerPools.count(serverConn))
+    {
+      pool = NetServerPools[serverConn];
+
+      pool -> mutex_.lock();
+
+      stats -> workers_       = pool -> workersCount_;
+      stats -> busyWorkers_   = pool -> busyWorkers_;
+      stats -> queueSize_     = pool -> queueSize_;
+      stats -> queueDepth_    = pool -> queueDepth_;
+      stats -> maxQueueDepth_ = pool -> maxQueueDepth_;
+      stats -> accepted_      = pool -> accepted_;
+      stats -> rejected_      = pool -> rejected_;
+      stats -> served_        = pool -> served_;
+
+      pool -> mutex_.unlock();
+
+      exitCode = 0;
+    }
+
+    NetServerPoolsMutex.unlock();
+
+    fail:
+
+    return exitCode;
+  }
+
   //
   // Create listening TCP/IP4 socket and wait for one client.
   // After connection negociated, listening socket is shutted down.
@@ -34,6 +34,8 @@
 # include <netinet/in.h>
 # include <arpa/inet.h>
 # include <unistd.h>
+# include <poll.h>
+# include <errno.h>
 #endif
 
 #include <ctime>
@@ -766,9 +768,288 @@ namespace Tegenaria
     return exitCode;
   }
 
+  //
+  // Get monotonic time in ms. Used to compute deadlines, which are not
+  // affected by system clock changes.
+  // Called internally.
+  //
+
+  int64_t _NetGetTimeMs()
+  {
+    #pragma qcbuild_set_private(1)
+
+    #ifdef WIN32
+    {
+      return int64_t(GetTickCount());
+    }
+    #else
+    {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+
+      return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+    #endif
+  }
+
+  //
+  // Wait until one of given sockets is ready for read or write.
+  // Wait is restarted on EINTR with time left to monotonic deadline.
+  // Called internally.
+  //
+  // TIP#1: On Linux poll() is used, so there is no FD_SETSIZE limit
+  //        for socket numbers.
+  //
+  // fd      - table of sockets to wait for (IN).
+  // events  - NET_WAIT_READ and/or NET_WAIT_WRITE for every socket (IN).
+  // revents - ready NET_WAIT_XXX events for every socket (OUT).
+  // count   - number of elements in fd[], events[] and revents[] (IN).
+  // timeout - timeout in ms or -1 for infinite (IN).
+  //
+  // RETURNS: Number of ready sockets,
+  //          0 if timeout,
+  //          -1 if error.
+  //
+
+  int _NetPoll(int *fd, int *events, int *revents, int count, int timeout)
+  {
+    #pragma qcbuild_set_private(1)
+
+    int ret = -1;
+
+    int64_t deadline = _NetGetTimeMs() + timeout;
+
+    #ifdef WIN32
+    {
+      fd_set rfd;
+      fd_set wfd;
+      fd_set efd;
+
+      struct timeval tv;
+
+      if (count > FD_SETSIZE)
+      {
+        Error("ERROR: Too many sockets [%d] passed to _NetPoll().\n", count);
+
+        return -1;
+      }
+
+      FD_ZERO(&rfd);
+      FD_ZERO(&wfd);
+      FD_ZERO(&efd);
+
+      for (int i = 0; i < count; i++)
+      {
+        if (events[i] & NET_WAIT_READ)
+        {
+          FD_SET(fd[i], &rfd);
+        }
+
+        if (events[i] & NET_WAIT_WRITE)
+        {
+          FD_SET(fd[i], &wfd);
+        }
+
+        FD_SET(fd[i], &efd);
+      }
+
+      tv.tv_sec  = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+
+      ret = select(0, &rfd, &wfd, &efd, (timeout < 0) ? NULL : &tv);
+
+      for (int i = 0; i < count; i++)
+      {
+        revents[i] = 0;
+
+        if (ret > 0)
+        {
+          if (FD_ISSET(fd[i], &rfd))
+          {
+            revents[i] |= NET_WAIT_READ;
+          }
+
+          if (FD_ISSET(fd[i], &wfd))
+          {
+            revents[i] |= NET_WAIT_WRITE;
+          }
+
+          if (FD_ISSET(fd[i], &efd))
+          {
+            revents[i] |= NET_WAIT_ERROR;
+          }
+        }
+      }
+    }
+    #else
+    {
+      struct pollfd pfdStatic[16];
+
+      vector<struct pollfd> pfdDynamic;
+
+      struct pollfd *pfd = pfdStatic;
+
+      if (count > 16)
+      {
+        pfdDynamic.resize(count);
+
+        pfd = &pfdDynamic[0];
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        pfd[i].fd      = fd[i];
+        pfd[i].events  = 0;
+        pfd[i].revents = 0;
+
+        if (events[i] & NET_WAIT_READ)
+        {
+          pfd[i].events |= POLLIN;
+        }
+
+        if (events[i] & NET_WAIT_WRITE)
+        {
+          pfd[i].events |= POLLOUT;
+        }
+      }
+
+      for (;;)
+      {
+        ret = poll(pfd, count, timeout);
+
+        if (ret >= 0 || errno != EINTR)
+        {
+          break;
+        }
+
+        if (timeout > 0)
+        {
+          int64_t now = _NetGetTimeMs();
+
+          timeout = (deadline > now) ? int(deadline - now) : 0;
+        }
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        revents[i] = 0;
+
+        if (pfd[i].revents & (POLLIN | POLLHUP))
+        {
+          revents[i] |= NET_WAIT_READ;
+        }
+
+        if (pfd[i].revents & POLLOUT)
+        {
+          revents[i] |= NET_WAIT_WRITE;
+        }
+
+        if (pfd[i].revents & (POLLERR | POLLNVAL))
+        {
+          revents[i] |= NET_WAIT_ERROR;
+        }
+      }
+    }
+    #endif
+
+    return ret;
+  }
+
+  //
+  // Wait until socket is ready for read or write.
+  // Called internally.
+  //
+  // sock     - socket to wait for (IN).
+  // events   - NET_WAIT_READ and/or NET_WAIT_WRITE (IN).
+  // timeout  - timeout in ms or -1 for infinite (IN).
+  // cancelFd - optional FD, which breaks wait when become readable (IN/OPT).
+  //
+  // RETURNS: Ready NET_WAIT_XXX events on socket,
+  //          0 if timeout or canceled,
+  //          -1 if error.
+  //
+
+  int _NetWait(int sock, int events, int timeout, int cancelFd)
+  {
+    #pragma qcbuild_set_private(1)
+
+    int fd[2]      = {sock, cancelFd};
+    int ev[2]      = {events, NET_WAIT_READ};
+    int revents[2] = {0, 0};
+
+    int ret = _NetPoll(fd, ev, revents, (cancelFd == -1) ? 1 : 2, timeout);
+
+    if (ret <= 0)
+    {
+      return ret;
+    }
+
+    if (cancelFd != -1 && revents[1])
+    {
+      return 0;
+    }
+
+    return revents[0];
+  }
+
+  //
+  // Wait for many connections at once with one system call.
+  //
+  // items   - table of connections to wait for. Set events_ to
+  //           NET_WAIT_READ and/or NET_WAIT_WRITE for every item.
+  //           Ready events are returned in revents_ (IN/OUT).
+  //
+  // count   - number of elements in items[] table (IN).
+  //
+  // timeout - timeout in ms or -1 for infinite (IN/OPT).
+  //
+  // RETURNS: Number of ready connections,
+  //          0 if timeout,
+  //          -1 if error.
+  //
+
+  int NetWaitMany(NetWaitItem *items, int count, int timeout)
+  {
+    DBG_ENTER3("NetWaitMany");
+
+    int ret = -1;
+
+    vector<int> fd(count + 1);
+    vector<int> events(count + 1);
+    vector<int> revents(count + 1);
+
+    for (int i = 0; i < count; i++)
+    {
+      fd[i]     = items[i].conn_ ? items[i].conn_ -> getSocket() : -1;
+      events[i] = items[i].events_;
+    }
+
+    ret = _NetPoll(&fd[0], &events[0], &revents[0], count, timeout);
+
+    for (int i = 0; i < count; i++)
+    {
+      items[i].revents_ = (ret > 0) ? revents[i] : 0;
+    }
+
+    if (ret < 0)
+    {
+      Error("ERROR: Cannot wait for [%d] connections.\n", count);
+    }
+
+    DBG_LEAVE3("NetWaitMany");
+
+    return ret;
+  }
+
   //
   // Resolve ip adresses for given host name.
   //
+  // TIP #1: Only IPv4 addresses are returned. Use NetConnect() to reach
+  //         IPv6 hosts.
+  //
+  // TIP #2: Results are cached, see _NetResolve().
+  //
   // ips  - list of found IP addresses (OUT).
   // host - host name to resolve e.g. "google.pl" (IN).
   //
@@ -780,9 +1061,7 @@ namespace Tegenaria
   {
     int exitCode = -1;
 
-    hostent *remoteHost = NULL;
-
-    in_addr addr;
+    vector<struct sockaddr_storage> addrs;
 
     //
     // Check args.
@@ -793,30 +1072,21 @@ namespace Tegenaria
     FAILEX(host == NULL, "ERROR: 'host' cannot be NULL in NetResolveIp().\n");
 
     //
-    // Initialize WinSock 2.2 on windows.
-    //
-
-    FAIL(_NetInit());
-
-    //
-    // Get host info.
+    // Resolve host.
     //
 
-    remoteHost = gethostbyname(host);
-
-    FAIL(remoteHost == NULL);
+    FAIL(_NetResolve(addrs, host, 0, -1));
 
     //
     // Retrieve IP addresses.
     //
 
-    FAIL(remoteHost -> h_addrtype != AF_INET);
-
-    for (int i = 0; remoteHost -> h_addr_list[i]; i++)
+    for (size_t i = 0; i < addrs.size(); i++)
     {
-      addr.s_addr = *(u_long *) remoteHost -> h_addr_list[i];
-
-      ips.push_back(inet_ntoa(addr));
+      if (addrs[i].ss_family == AF_INET)
+      {
+        ips.push_back(inet_ntoa(((struct sockaddr_in *) &addrs[i]) -> sin_addr));
+      }
     }
 
     FAIL(ips.empty());
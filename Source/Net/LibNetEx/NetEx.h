@@ -26,6 +26,7 @@
 #define Tegenaria_Core_LibNetEx_H
 
 #include <string>
+#include <stdint.h>
 
 using std::string;
 
@@ -46,6 +47,40 @@ using std::string;
 
 #undef  NET_EX_CHECK_CTX
 
+//
+// How workers get new connections (see NetExHpConfig.listenMode_):
+//
+// NET_EX_LISTEN_SHARED    - one listening socket watched by every worker's
+//                           event base. Every worker wakes up on new
+//                           connection.
+//
+// NET_EX_LISTEN_REUSEPORT - every worker owns its own SO_REUSEPORT
+//                           listener, kernel balances connections between
+//                           them. Falls back to NET_EX_LISTEN_SHARED if
+//                           SO_REUSEPORT is not supported.
+//
+
+#define NET_EX_LISTEN_SHARED    0
+#define NET_EX_LISTEN_REUSEPORT 1
+
+//
+// TLS handshake limits (see NetExHpConfig):
+//
+// NET_EX_MAX_HANDSHAKES     - max. number of handshakes pending on one
+//                             worker. Worker stops accepting new
+//                             connections above it.
+//
+// NET_EX_HANDSHAKE_TIMEOUT  - time in ms given to client to finish
+//                             handshake.
+//
+// NET_EX_MAX_CRYPTO_THREADS - max. number of threads doing handshake
+//                             crypto outside event loop.
+//
+
+#define NET_EX_MAX_HANDSHAKES     256
+#define NET_EX_HANDSHAKE_TIMEOUT  10000
+#define NET_EX_MAX_CRYPTO_THREADS 16
+
 //
 // Include LibSecure to handle secure TLS connection.
 //
@@ -89,14 +124,99 @@ namespace Tegenaria
     #ifdef NET_EX_USE_LIBSECURE
     SecureConnection *sc_;
 
-    char *secureCert_;
-    char *securePrivKey_;
-    char *securePrivKeyPass_;
+    SecureContext *secureCtx_;
+
+    //
+    // Handshake state. Internal use only.
+    //
+    // handshakeStart_  - time in us, when handshake started, 0 if no
+    //                    handshake pending.
+    // handshakeBusy_   - set to 1 while handshake is processed by crypto
+    //                    thread.
+    // handshakeResult_ - result of handshake step done by crypto thread.
+    // closePending_    - connection closed while handshakeBusy_ was set.
+    //
+
+    int64_t handshakeStart_;
+
+    int handshakeBusy_;
+    int handshakeResult_;
+    int closePending_;
     #endif
 
     char clientIp_[16];
   };
 
+  //
+  // Run time server configuration passed to NetExHpServerLoopEx().
+  // Zero in any field means default value.
+  //
+
+  struct NetExHpConfig
+  {
+    //
+    // Number of worker threads. Default is number of CPU cores.
+    //
+
+    int workers_;
+
+    //
+    // One of NET_EX_LISTEN_XXX values. Default is NET_EX_LISTEN_SHARED.
+    //
+
+    int listenMode_;
+
+    //
+    // TLS only. Max. number of handshakes pending on one worker.
+    // Default is NET_EX_MAX_HANDSHAKES.
+    //
+
+    int maxHandshakes_;
+
+    //
+    // TLS only. Time in ms to finish handshake.
+    // Default is NET_EX_HANDSHAKE_TIMEOUT.
+    //
+
+    int handshakeTimeout_;
+
+    //
+    // TLS only. Number of threads doing handshake crypto (e.g. RSA private
+    // key operations) outside event loop. Default is 0, what means
+    // handshake is done inside event loop.
+    //
+
+    int cryptoThreads_;
+  };
+
+  //
+  // Per worker counters returned by NetExHpServerGetStats().
+  //
+
+  struct NetExHpStats
+  {
+    int activeConns_;
+
+    int64_t accepted_;
+
+    //
+    // TLS handshake counters.
+    //
+    // handshakesActive_     - handshakes pending now.
+    // handshakes_           - finished handshakes.
+    // handshakesFailed_     - failed, timed out or closed handshakes.
+    // handshakeTimeTotalUs_ - sum of finished handshakes time in us.
+    // handshakeTimeMaxUs_   - the longest finished handshake in us.
+    //
+
+    int handshakesActive_;
+
+    int64_t handshakes_;
+    int64_t handshakesFailed_;
+    int64_t handshakeTimeTotalUs_;
+    int64_t handshakeTimeMaxUs_;
+  };
+
   //
   // Exported functions.
   //
@@ -112,8 +232,29 @@ namespace Tegenaria
                                               const char *privKey,
                                                   const char *privKeyPass);
 
+  int NetExHpServerLoopEx(int port, NetExHpOpenProto openHandler,
+                              NetExHpCloseProto closeHandler,
+                                  NetExHpDataProto dataHandler,
+                                      NetExHpConfig *config);
+
+  int NetExHpSecureServerLoopEx(int port, NetExHpOpenProto openHandler,
+                                    NetExHpCloseProto closeHandler,
+                                        NetExHpDataProto dataHandler,
+                                            const char *cert,
+                                                const char *privKey,
+                                                    const char *privKeyPass,
+                                                        NetExHpConfig *config);
+
+  int NetExHpServerGetStats(NetExHpStats *stats, int maxWorkers);
+
+  #ifdef NET_EX_USE_LIBSECURE
+  int NetExHpServerGetSecureStats(SecureContextStats *stats);
+  #endif
+
   int NetExHpWrite(NetExHpContext *ctx, void *buf, int len);
 
+  int NetExHpSendFile(NetExHpContext *ctx, int fileFd, int64_t offset, int64_t len);
+
 } /* namespace Tegenaria */
 
 #endif /* Tegenaria_Core_LibNetEx_H */
@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <signal.h>
 #include <set>
+#include <list>
 #include <algorithm>
 
 using std::max;
@@ -57,12 +58,14 @@ using std::max;
 #include <Tegenaria/Debug.h>
 #include <Tegenaria/Thread.h>
 #include <Tegenaria/Mutex.h>
+#include <Tegenaria/Semaphore.h>
 #include "NetEx.h"
 #include "Utils.h"
 
 namespace Tegenaria
 {
   using std::set;
+  using std::list;
 
   const int NET_EX_MAX_THREADS = 64;
 
@@ -78,6 +81,12 @@ namespace Tegenaria
 
   static void NetExHpReadCallback(struct bufferevent *, void *);
 
+  #ifdef NET_EX_USE_LIBSECURE
+  static void NetExHpHandshakeDoneCallback(evutil_socket_t, short, void *);
+
+  static void NetExHpHandshakeBegin(NetExHpContext *);
+  #endif
+
   //
   // Global variables.
   //
@@ -88,6 +97,66 @@ namespace Tegenaria
 
   static int ServerRunning = 0;
 
+  static int WorkersCount = 0;
+
+  //
+  // Per worker counters. Written by owning worker thread only.
+  //
+
+  static NetExHpStats WorkerStats[NET_EX_MAX_THREADS] = {0};
+
+  //
+  // Accept event of every worker. Removed from event base while worker
+  // has too many pending handshakes.
+  //
+
+  static struct event *AcceptEvent[NET_EX_MAX_THREADS] = {0};
+
+  static int AcceptPaused[NET_EX_MAX_THREADS] = {0};
+
+  //
+  // TLS context shared by all workers. Certificate and key are loaded
+  // once at server start.
+  //
+
+  #ifdef NET_EX_USE_LIBSECURE
+
+  static SecureContext *ServerSecureCtx = NULL;
+
+  //
+  // Per worker buffers for decrypted data. Grown when needed and reused
+  // by all connections served by worker.
+  //
+
+  static char *WorkerDecryptBuffer[NET_EX_MAX_THREADS] = {0};
+
+  static int WorkerDecryptBufferSize[NET_EX_MAX_THREADS] = {0};
+
+  //
+  // Handshake limits taken from NetExHpConfig.
+  //
+
+  static int MaxHandshakes    = NET_EX_MAX_HANDSHAKES;
+  static int HandshakeTimeout = NET_EX_HANDSHAKE_TIMEOUT;
+
+  //
+  // Crypto threads doing handshake outside event loop.
+  // Worker queues connection, crypto thread moves handshake forward and
+  // posts connection back to worker's event base.
+  //
+
+  static int CryptoThreadsCount = 0;
+
+  static ThreadHandle_t *CryptoThread[NET_EX_MAX_CRYPTO_THREADS] = {0};
+
+  static list<NetExHpContext *> CryptoQueue;
+
+  static Mutex CryptoQueueMutex("NetExHpServer::CryptoQueueMutex");
+
+  static Semaphore CryptoQueueSem(0, "NetExHpServer::CryptoQueueSem");
+
+  #endif
+
   //
   // Map to check is given context correct.
   // Debug purpose only.
@@ -119,122 +188,93 @@ namespace Tegenaria
     event_base_dispatch(eventBase);
 
     DBG_INFO("HP worker #%d finished.\n", workerNo);
+
+    return 0;
   }
 
   //
-  // Create TCP server based on libevent library. Traffic is encrypted
-  // basing on TLS protocol.
-  //
-  // port              - listening port (IN).
-  // openHandler       - handler called when new connection arrived (IN/OPT).
-  // closeHandler      - handler called when existing connection closed (IN/OPT).
-  //
-  // dataHandler       - handler called when something to read on one of existing
-  //                     connection (IN).
-  //
-  // secureCert        - filename, where server certificate is stored (IN).
-  //
-  // securePrivKey     - filename, where server private key is stored (server side
-  //                     only) (IN/OPT).
-  //
-  // securePrivKeyPass - passphrase to decode private key. Readed from keyboard
-  //                     if skipped (IN/OPT).
-  //
-  //
-  // TIP #1: Use NetExHpWrite() to write data inside data handler. Don't
-  //         use write() or send() directly.
-  //
-  // RETURNS: never reached in correct work,
-  //         -1 if error.
+  // Get current time in us.
   //
 
-  int NetExHpSecureServerLoop(int port, NetExHpOpenProto openHandler,
-                                  NetExHpCloseProto closeHandler,
-                                      NetExHpDataProto dataHandler,
-                                          const char *secureCert,
-                                              const char *securePrivKey,
-                                                  const char *securePrivKeyPass)
+  static int64_t NetExHpGetTimeUs()
   {
-    DBG_ENTER("NetExHpServerLoop");
-
-    int exitCode = -1;
-
-    struct event *exitEvent = NULL;
+    struct timeval tv;
 
-    struct event *acceptEvent[NET_EX_MAX_THREADS] = {0};
+    evutil_gettimeofday(&tv, NULL);
 
-    ThreadHandle_t *workerThread[NET_EX_MAX_THREADS] = {0};
+    return int64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+  }
 
-    struct sockaddr_in sin = {0};
+  //
+  // Internal use only. Crypto thread loop. Takes connections queued by
+  // workers, moves their handshakes forward and posts them back to owning
+  // worker. NULL in queue means exit.
+  //
 
-    int listenfd = -1;
+  #ifdef NET_EX_USE_LIBSECURE
 
-    int eventFlags = 0;
+  static int NetExHpCryptoThreadLoop(void *unused)
+  {
+    struct timeval now = {0, 0};
 
-    int reuseaddr_on = 1;
+    NetExHpContext *ctx = NULL;
 
-    struct linger so_linger;
+    while (1)
+    {
+      CryptoQueueSem.wait();
 
-    NetExHpContext *ctx[NET_EX_MAX_THREADS] = {0};
+      CryptoQueueMutex.lock();
 
-    //
-    // Set up pthread locking for multithreading on Linux
-    //
+      ctx = CryptoQueue.front();
 
-    #ifdef __linux__
-    {
-      struct sigaction act = {0};
+      CryptoQueue.pop_front();
 
-      //
-      // Enable multithread support in livevent.
-      //
+      CryptoQueueMutex.unlock();
 
-      evthread_use_pthreads();
+      if (ctx == NULL)
+      {
+        break;
+      }
 
       //
-      // Ignore SIGPIPE on Linux.
+      // Expensive part e.g. RSA private key operation goes here.
       //
 
-      act.sa_handler = SIG_IGN;
-      act.sa_flags   = SA_RESTART;
+      ctx -> handshakeResult_ = ctx -> sc_ -> handshakeContinue();
 
-      sigaction(SIGPIPE, &act, NULL);
+      event_base_once(EventBase[ctx -> workerNo_], -1, EV_TIMEOUT,
+                          NetExHpHandshakeDoneCallback, ctx, &now);
     }
-    #endif
 
-    //
-    // Fail if TLS requested without NET_EX_USE_LIBSECURE.
-    //
+    return 0;
+  }
 
-    #ifndef NET_EX_USE_LIBSECURE
-    {
-      if (secureCert || securePrivKey)
-      {
-        Error("ERROR: NetExHp server is compiled without LibSecure.\n"
-              "TLS server is not available.\n");
+  #endif
 
-        goto fail;
-      }
-    }
-    #endif
+  //
+  // Internal use only. Create non-blocking listening socket.
+  //
+  // port      - listening port (IN).
+  // reusePort - set SO_REUSEPORT flag to allow one listening socket per
+  //             worker on the same port (IN).
+  //
+  // RETURNS: Listening socket,
+  //          -1 if error.
+  //
 
-    //
-    // HP Server is not thread safe. It means one process can have only one
-    // (multithreaded) HP server running.
-    //
+  static int NetExHpListen(int port, int reusePort)
+  {
+    DBG_ENTER("NetExHpListen");
 
-    FAILEX(ServerRunning, "ERROR: Only one HP server per process allowed.\n");
+    int exitCode = -1;
 
-    ServerRunning = 1;
+    int listenfd = -1;
 
-    //
-    // Init WINSOCK2 on windows.
-    //
+    int reuseaddr_on = 1;
 
-    #ifdef WIN32
-    WSADATA wsadata;
-    WSAStartup(0x0201, &wsadata);
-    #endif
+    struct sockaddr_in sin = {0};
+
+    struct linger so_linger;
 
     //
     // Create listening socket.
@@ -263,6 +303,21 @@ namespace Tegenaria
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
                    (const char *) &reuseaddr_on, sizeof(reuseaddr_on));
 
+    //
+    // Set port reuse to allow one listening socket per worker.
+    //
+
+    if (reusePort)
+    {
+      #ifdef SO_REUSEPORT
+      FAILEX(setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                            (const char *) &reusePort, sizeof(reusePort)) < 0,
+                                "ERROR: Cannot set SO_REUSEPORT on listening socket.\n");
+      #else
+      FAILEX(1, "ERROR: SO_REUSEPORT is not supported.\n");
+      #endif
+    }
+
     //
     // Bind socket to given port.
     //
@@ -279,8 +334,6 @@ namespace Tegenaria
 
     FAILEX(listen(listenfd, SOMAXCONN) < 0, "ERROR: Listen() failed.\n");
 
-    DBG_INFO("NetExHpLoop : Listening on TCP port %d...\n", port);
-
     //
     // Set nonblock mode on listening socket.
     //
@@ -289,67 +342,381 @@ namespace Tegenaria
                "ERROR: Cannot set non-blocking mode on listening socket.\n");
 
     //
-    // Initialize event worker per every CPU core.
+    // Error handler.
     //
 
-    for (int i = 0; i < CpuCount; i++)
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode && listenfd >= 0)
     {
-      //
-      // Create new event base object for worker.
-      //
+      evutil_closesocket(listenfd);
 
-      EventBase[i] = event_base_new();
+      listenfd = -1;
+    }
 
-      FAILEX(EventBase[i] == NULL, "ERROR: Cannot initialize libevent.\n");
+    DBG_LEAVE("NetExHpListen");
 
-      //
-      // Allocate new NetExHp context.
-      //
+    return listenfd;
+  }
 
-      ctx[i] = (NetExHpContext *) calloc(1, sizeof(NetExHpContext));
+  //
+  // Create TCP server based on libevent library. Traffic is encrypted
+  // basing on TLS protocol.
+  //
+  // port              - listening port (IN).
+  // openHandler       - handler called when new connection arrived (IN/OPT).
+  // closeHandler      - handler called when existing connection closed (IN/OPT).
+  //
+  // dataHandler       - handler called when something to read on one of existing
+  //                     connection (IN).
+  //
+  // secureCert        - filename, where server certificate is stored (IN).
+  //
+  // securePrivKey     - filename, where server private key is stored (server side
+  //                     only) (IN/OPT).
+  //
+  // securePrivKeyPass - passphrase to decode private key. Readed from keyboard
+  //                     if skipped (IN/OPT).
+  //
+  //
+  // TIP #1: Use NetExHpWrite() to write data inside data handler. Don't
+  //         use write() or send() directly.
+  //
+  // RETURNS: never reached in correct work,
+  //         -1 if error.
+  //
 
-      FAILEX(ctx[i] == NULL, "ERROR: Out of memory.\n");
+  int NetExHpSecureServerLoop(int port, NetExHpOpenProto openHandler,
+                                  NetExHpCloseProto closeHandler,
+                                      NetExHpDataProto dataHandler,
+                                          const char *secureCert,
+                                              const char *securePrivKey,
+                                                  const char *securePrivKeyPass)
+  {
+    return NetExHpSecureServerLoopEx(port, openHandler, closeHandler,
+                                         dataHandler, secureCert, securePrivKey,
+                                             securePrivKeyPass, NULL);
+  }
 
-      ctx[i] -> eventBase_    = EventBase[i];
-      ctx[i] -> openHandler_  = openHandler;
-      ctx[i] -> closeHandler_ = closeHandler;
-      ctx[i] -> dataHandler_  = dataHandler;
-      ctx[i] -> workerNo_     = i;
+  //
+  // Create TCP server based on libevent library with run time configuration.
+  // Traffic is encrypted basing on TLS protocol if secureCert and
+  // securePrivKey are specified.
+  //
+  // port              - listening port (IN).
+  // openHandler       - handler called when new connection arrived (IN/OPT).
+  // closeHandler      - handler called when existing connection closed (IN/OPT).
+  //
+  // dataHandler       - handler called when something to read on one of existing
+  //                     connection (IN).
+  //
+  // secureCert        - filename, where server certificate is stored (IN/OPT).
+  //
+  // securePrivKey     - filename, where server private key is stored (server side
+  //                     only) (IN/OPT).
+  //
+  // securePrivKeyPass - passphrase to decode private key. Readed from keyboard
+  //                     if skipped (IN/OPT).
+  //
+  // config            - number of workers and listen mode, default values
+  //                     used if NULL (IN/OPT).
+  //
+  // TIP #1: Use NetExHpWrite() to write data inside data handler. Don't
+  //         use write() or send() directly.
+  //
+  // TIP #2: Use NetExHpServerGetStats() to get per-worker counters while
+  //         server is running.
+  //
+  // RETURNS: never reached in correct work,
+  //         -1 if error.
+  //
 
-      //
-      // Save data to establish secure session on incoming connection.
-      //
+  int NetExHpSecureServerLoopEx(int port, NetExHpOpenProto openHandler,
+                                    NetExHpCloseProto closeHandler,
+                                        NetExHpDataProto dataHandler,
+                                            const char *secureCert,
+                                                const char *securePrivKey,
+                                                    const char *securePrivKeyPass,
+                                                        NetExHpConfig *config)
+  {
+    DBG_ENTER("NetExHpServerLoop");
 
-      #ifdef NET_EX_USE_LIBSECURE
-      {
-        if (secureCert)
-        {
-          ctx[i] -> secureCert_ = strdup(secureCert);
-        }
+    int exitCode = -1;
 
-        if (securePrivKey)
-        {
-          ctx[i] -> securePrivKey_ = strdup(securePrivKey);
-        }
+    struct event *exitEvent = NULL;
 
-        if (securePrivKeyPass)
-        {
-          ctx[i] -> securePrivKeyPass_ = strdup(securePrivKeyPass);
-        }
-      }
-      #endif
+    ThreadHandle_t *workerThread[NET_EX_MAX_THREADS] = {0};
 
-      //
-      // Create accept event for given event base.
-      //
+    int listenfd[NET_EX_MAX_THREADS];
 
-      acceptEvent[i] = event_new(EventBase[i], listenfd, EV_READ | EV_PERSIST,
-                                    NetExHpOpenCallback, (void *) ctx[i]);
+    int listenMode = NET_EX_LISTEN_SHARED;
 
-      FAILEX(acceptEvent[i] == NULL, "ERROR: Cannot initialize accept event.\n");
+    int eventFlags = 0;
 
-      FAILEX(event_add(acceptEvent[i], NULL) < 0,
-                 "ERROR: Cannot register accept event.\n");
+    int evthreadReady = 0;
+
+    NetExHpContext *ctx[NET_EX_MAX_THREADS] = {0};
+
+    for (int i = 0; i < NET_EX_MAX_THREADS; i++)
+    {
+      listenfd[i] = -1;
+    }
+
+    //
+    // Enable multithread support in libevent.
+    // Crypto threads post handshake results to workers' event bases by
+    // event_base_once(), which is safe only with locking enabled.
+    // Must be done before any event base is created.
+    //
+    // On Windows locking is part of core libevent. On Linux we need
+    // event_pthreads library linked in (see qcbuild.src). On other
+    // platforms locking is not available and crypto threads are disabled
+    // below.
+    //
+
+    #if defined(WIN32)
+    evthreadReady = (evthread_use_windows_threads() == 0);
+    #elif defined(__linux__)
+    evthreadReady = (evthread_use_pthreads() == 0);
+    #endif
+
+    //
+    // Ignore SIGPIPE on Linux.
+    //
+
+    #ifdef __linux__
+    {
+      struct sigaction act = {0};
+
+      act.sa_handler = SIG_IGN;
+      act.sa_flags   = SA_RESTART;
+
+      sigaction(SIGPIPE, &act, NULL);
+    }
+    #endif
+
+    //
+    // Fail if TLS requested without NET_EX_USE_LIBSECURE.
+    //
+
+    #ifndef NET_EX_USE_LIBSECURE
+    {
+      if (secureCert || securePrivKey)
+      {
+        Error("ERROR: NetExHp server is compiled without LibSecure.\n"
+              "TLS server is not available.\n");
+
+        goto fail;
+      }
+    }
+    #endif
+
+    //
+    // HP Server is not thread safe. It means one process can have only one
+    // (multithreaded) HP server running.
+    //
+
+    FAILEX(ServerRunning, "ERROR: Only one HP server per process allowed.\n");
+
+    ServerRunning = 1;
+
+    //
+    // Apply config.
+    //
+
+    WorkersCount = CpuCount;
+
+    if (config)
+    {
+      if (config -> workers_ > 0)
+      {
+        WorkersCount = config -> workers_;
+      }
+
+      listenMode = config -> listenMode_;
+    }
+
+    if (WorkersCount > NET_EX_MAX_THREADS)
+    {
+      WorkersCount = NET_EX_MAX_THREADS;
+    }
+
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      MaxHandshakes      = NET_EX_MAX_HANDSHAKES;
+      HandshakeTimeout   = NET_EX_HANDSHAKE_TIMEOUT;
+      CryptoThreadsCount = 0;
+
+      if (config)
+      {
+        if (config -> maxHandshakes_ > 0)
+        {
+          MaxHandshakes = config -> maxHandshakes_;
+        }
+
+        if (config -> handshakeTimeout_ > 0)
+        {
+          HandshakeTimeout = config -> handshakeTimeout_;
+        }
+
+        if (config -> cryptoThreads_ > 0)
+        {
+          CryptoThreadsCount = std::min(config -> cryptoThreads_,
+                                            NET_EX_MAX_CRYPTO_THREADS);
+        }
+      }
+
+      //
+      // Crypto threads touch workers' event bases from other thread.
+      // Do handshakes inside event loop if libevent has no locking.
+      //
+
+      if (CryptoThreadsCount > 0 && evthreadReady == 0)
+      {
+        Error("WARNING: libevent thread support not available,"
+                  " crypto threads disabled.\n");
+
+        CryptoThreadsCount = 0;
+      }
+    }
+    #endif
+
+    memset(WorkerStats, 0, sizeof(WorkerStats));
+
+    //
+    // Load certificate and private key once for all workers.
+    //
+
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      if (secureCert && securePrivKey)
+      {
+        ServerSecureCtx = SecureContextCreate(SECURE_INTENT_SERVER, secureCert,
+                                                  securePrivKey, securePrivKeyPass);
+
+        FAILEX(ServerSecureCtx == NULL, "ERROR: Cannot init TLS context.\n");
+
+        //
+        // Start crypto threads if handshakes should be done outside
+        // event loop.
+        //
+
+        for (int i = 0; i < CryptoThreadsCount; i++)
+        {
+          CryptoThread[i] = ThreadCreate(NetExHpCryptoThreadLoop, NULL);
+
+          FAILEX(CryptoThread[i] == NULL, "ERROR: Cannot create crypto thread.\n");
+        }
+      }
+    }
+    #endif
+
+    //
+    // Init WINSOCK2 on windows.
+    //
+
+    #ifdef WIN32
+    WSADATA wsadata;
+    WSAStartup(0x0201, &wsadata);
+    #endif
+
+    //
+    // Create listening socket. In SO_REUSEPORT mode every worker gets
+    // own listener, kernel balances new connections between them.
+    // Go back to one shared listener if SO_REUSEPORT is not supported.
+    //
+
+    if (listenMode == NET_EX_LISTEN_REUSEPORT)
+    {
+      listenfd[0] = NetExHpListen(port, 1);
+
+      if (listenfd[0] < 0)
+      {
+        Error("WARNING: SO_REUSEPORT not available, using shared listener.\n");
+
+        listenMode = NET_EX_LISTEN_SHARED;
+      }
+    }
+
+    if (listenMode != NET_EX_LISTEN_REUSEPORT)
+    {
+      listenfd[0] = NetExHpListen(port, 0);
+    }
+
+    FAIL(listenfd[0] < 0);
+
+    DBG_INFO("NetExHpLoop : Listening on TCP port %d...\n", port);
+
+    //
+    // Initialize event worker per every CPU core.
+    //
+
+    for (int i = 0; i < WorkersCount; i++)
+    {
+      //
+      // Get listener for worker.
+      //
+
+      if (i > 0)
+      {
+        if (listenMode == NET_EX_LISTEN_REUSEPORT)
+        {
+          listenfd[i] = NetExHpListen(port, 1);
+
+          FAIL(listenfd[i] < 0);
+        }
+        else
+        {
+          listenfd[i] = listenfd[0];
+        }
+      }
+
+      //
+      // Create new event base object for worker.
+      //
+
+      EventBase[i] = event_base_new();
+
+      FAILEX(EventBase[i] == NULL, "ERROR: Cannot initialize libevent.\n");
+
+      //
+      // Allocate new NetExHp context.
+      //
+
+      ctx[i] = (NetExHpContext *) calloc(1, sizeof(NetExHpContext));
+
+      FAILEX(ctx[i] == NULL, "ERROR: Out of memory.\n");
+
+      ctx[i] -> eventBase_    = EventBase[i];
+      ctx[i] -> openHandler_  = openHandler;
+      ctx[i] -> closeHandler_ = closeHandler;
+      ctx[i] -> dataHandler_  = dataHandler;
+      ctx[i] -> workerNo_     = i;
+
+      //
+      // Pass shared TLS context to establish secure session on incoming
+      // connection.
+      //
+
+      #ifdef NET_EX_USE_LIBSECURE
+      {
+        ctx[i] -> secureCtx_ = ServerSecureCtx;
+      }
+      #endif
+
+      //
+      // Create accept event for given event base.
+      //
+
+      AcceptEvent[i] = event_new(EventBase[i], listenfd[i], EV_READ | EV_PERSIST,
+                                    NetExHpOpenCallback, (void *) ctx[i]);
+
+      FAILEX(AcceptEvent[i] == NULL, "ERROR: Cannot initialize accept event.\n");
+
+      FAILEX(event_add(AcceptEvent[i], NULL) < 0,
+                 "ERROR: Cannot register accept event.\n");
     }
 
     //
@@ -377,7 +744,7 @@ namespace Tegenaria
     // Create libevent loop in another thread for every CPU core.
     //
 
-    for (int i = 0; i < CpuCount; i++)
+    for (int i = 0; i < WorkersCount; i++)
     {
       workerThread[i] = ThreadCreate(NetExHpServerWorkerLoop, ctx[i]);
     }
@@ -386,7 +753,7 @@ namespace Tegenaria
     // Wait until every workers finished.
     //
 
-    for (int i = 0; i < CpuCount; i++)
+    for (int i = 0; i < WorkersCount; i++)
     {
       ThreadWait(workerThread[i]);
       ThreadClose(workerThread[i]);
@@ -407,47 +774,96 @@ namespace Tegenaria
                 "Error code is : %d.\n", port, GetLastError());
     }
 
+    //
+    // Stop crypto threads before event bases are freed.
+    //
+
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      for (int i = 0; i < NET_EX_MAX_CRYPTO_THREADS; i++)
+      {
+        if (CryptoThread[i])
+        {
+          CryptoQueueMutex.lock();
+
+          CryptoQueue.push_back(NULL);
+
+          CryptoQueueMutex.unlock();
+
+          CryptoQueueSem.signal();
+        }
+      }
+
+      for (int i = 0; i < NET_EX_MAX_CRYPTO_THREADS; i++)
+      {
+        if (CryptoThread[i])
+        {
+          ThreadWait(CryptoThread[i]);
+          ThreadClose(CryptoThread[i]);
+
+          CryptoThread[i] = NULL;
+        }
+      }
+    }
+    #endif
+
     if (exitEvent)
     {
       event_free(exitEvent);
     }
 
-    for (int i = 0; i < CpuCount; i++)
+    for (int i = 0; i < WorkersCount; i++)
     {
-      if (acceptEvent[i])
+      if (AcceptEvent[i])
       {
-        event_free(acceptEvent[i]);
+        event_free(AcceptEvent[i]);
+
+        AcceptEvent[i] = NULL;
       }
 
+      AcceptPaused[i] = 0;
+
       if (EventBase[i])
       {
         event_base_free(EventBase[i]);
+
+        EventBase[i] = NULL;
+      }
+
+      //
+      // Shared listener is closed once, own listeners in SO_REUSEPORT
+      // mode are closed by every worker.
+      //
+
+      if (listenfd[i] >= 0 && (i == 0 || listenfd[i] != listenfd[0]))
+      {
+        evutil_closesocket(listenfd[i]);
       }
 
       if (ctx[i])
       {
-        #ifdef NET_EX_USE_LIBSECURE
-        {
-          if (ctx[i] -> secureCert_)
-          {
-            free(ctx[i] -> secureCert_);
-          }
+        free(ctx[i]);
+      }
+    }
 
-          if (ctx[i] -> securePrivKey_)
-          {
-            free(ctx[i] -> securePrivKey_);
-          }
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      if (ServerSecureCtx)
+      {
+        ServerSecureCtx -> release();
 
-          if (ctx[i] -> securePrivKeyPass_)
-          {
-            free(ctx[i] -> securePrivKeyPass_);
-          }
-        }
-        #endif
+        ServerSecureCtx = NULL;
+      }
 
-        free(ctx[i]);
+      for (int i = 0; i < NET_EX_MAX_THREADS; i++)
+      {
+        free(WorkerDecryptBuffer[i]);
+
+        WorkerDecryptBuffer[i]     = NULL;
+        WorkerDecryptBufferSize[i] = 0;
       }
     }
+    #endif
 
     ServerRunning = 0;
 
@@ -484,25 +900,172 @@ namespace Tegenaria
   }
 
   //
-  // Write <len> bytes remote client related with given NetExHpContext.
+  // Create TCP server based on libevent library with run time configuration.
   //
-  // TIP #1: Caller should use this function to write data
-  //         to remote client inside data handler specified to
-  //         NetExServerLoop(). Don't use write() or send() directly.
+  // port         - listening port (IN).
+  // openHandler  - handler called when new connection arrived (IN/OPT).
+  // closeHandler - handler called when existing connection closed (IN/OPT).
   //
-  // ctx - context received in data handler parameters (IN).
-  // buf - buffer with data to write (IN).
-  // len - how many bytes to write (IN).
+  // dataHandler  - handler called when something to read on one of existing
+  //                connection (IN).
   //
-  // RETURNS: Number of bytes written or
-  //          -1 if error.
+  // config       - number of workers and listen mode, default values
+  //                used if NULL (IN/OPT).
+  //
+  // TIP #1: Set config.listenMode_ to NET_EX_LISTEN_REUSEPORT to give every
+  //         worker own listening socket and avoid waking up all workers on
+  //         every new connection.
+  //
+  // RETURNS: never reached in correct work,
+  //         -1 if error.
   //
 
-  int NetExHpWrite(NetExHpContext *ctx, void *buf, int len)
+  int NetExHpServerLoopEx(int port, NetExHpOpenProto openHandler,
+                              NetExHpCloseProto closeHandler,
+                                  NetExHpDataProto dataHandler,
+                                      NetExHpConfig *config)
   {
-    DBG_ENTER3("NetExHpWrite");
-
-    int ret = -1;
+    return NetExHpSecureServerLoopEx(port, openHandler, closeHandler,
+                                         dataHandler, NULL, NULL, NULL, config);
+  }
+
+  //
+  // Get per-worker counters of running HP server.
+  //
+  // stats      - table, where to store counters for every worker (OUT).
+  // maxWorkers - number of elements in stats[] table (IN).
+  //
+  // RETURNS: Number of workers stored in stats[],
+  //          -1 if server is not running.
+  //
+
+  int NetExHpServerGetStats(NetExHpStats *stats, int maxWorkers)
+  {
+    int count = -1;
+
+    if (ServerRunning)
+    {
+      count = WorkersCount;
+
+      if (count > maxWorkers)
+      {
+        count = maxWorkers;
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        stats[i].activeConns_ = ((volatile NetExHpStats *) &WorkerStats[i]) -> activeConns_;
+        stats[i].accepted_    = ((volatile NetExHpStats *) &WorkerStats[i]) -> accepted_;
+
+        stats[i].handshakesActive_     = ((volatile NetExHpStats *) &WorkerStats[i]) -> handshakesActive_;
+        stats[i].handshakes_           = ((volatile NetExHpStats *) &WorkerStats[i]) -> handshakes_;
+        stats[i].handshakesFailed_     = ((volatile NetExHpStats *) &WorkerStats[i]) -> handshakesFailed_;
+        stats[i].handshakeTimeTotalUs_ = ((volatile NetExHpStats *) &WorkerStats[i]) -> handshakeTimeTotalUs_;
+        stats[i].handshakeTimeMaxUs_   = ((volatile NetExHpStats *) &WorkerStats[i]) -> handshakeTimeMaxUs_;
+      }
+    }
+
+    return count;
+  }
+
+  //
+  // Get TLS session counters of running HP server e.g. session resumption
+  // hit rate.
+  //
+  // stats - buffer, where to store counters (OUT).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if server is not running or TLS is not enabled.
+  //
+
+  #ifdef NET_EX_USE_LIBSECURE
+  int NetExHpServerGetSecureStats(SecureContextStats *stats)
+  {
+    if (ServerRunning == 0 || ServerSecureCtx == NULL)
+    {
+      return -1;
+    }
+
+    return ServerSecureCtx -> getStats(stats);
+  }
+  #endif
+
+  //
+  // Move encrypted data waiting in SSL object directly into free space
+  // reserved in connection's output buffer.
+  //
+  // ctx - connection context with TLS session (IN).
+  //
+  // RETURNS: 0 if OK,
+  //          -1 if error.
+  //
+
+  #ifdef NET_EX_USE_LIBSECURE
+
+  static int NetExHpFlushSecure(NetExHpContext *ctx)
+  {
+    int exitCode = -1;
+
+    bufferevent *bev = (bufferevent *) ctx -> eventBuffer_;
+
+    struct evbuffer *output = bufferevent_get_output(bev);
+
+    struct evbuffer_iovec vec[2];
+
+    int pending  = ctx -> sc_ -> encryptPending();
+    int vecCount = 0;
+    int vecUsed  = 0;
+
+    if (pending > 0)
+    {
+      vecCount = evbuffer_reserve_space(output, pending, vec, 2);
+
+      FAILEX(vecCount <= 0, "ERROR: Cannot reserve [%d] bytes in output buffer.\n",
+                 pending);
+
+      while (vecUsed < vecCount && pending > 0)
+      {
+        int chunk = int(std::min(size_t(pending), vec[vecUsed].iov_len));
+
+        vec[vecUsed].iov_len = ctx -> sc_ -> encryptPop(vec[vecUsed].iov_base, chunk);
+
+        pending -= int(vec[vecUsed].iov_len);
+
+        vecUsed++;
+      }
+
+      FAIL(evbuffer_commit_space(output, vec, vecUsed));
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
+  #endif
+
+  //
+  // Write <len> bytes remote client related with given NetExHpContext.
+  //
+  // TIP #1: Caller should use this function to write data
+  //         to remote client inside data handler specified to
+  //         NetExServerLoop(). Don't use write() or send() directly.
+  //
+  // ctx - context received in data handler parameters (IN).
+  // buf - buffer with data to write (IN).
+  // len - how many bytes to write (IN).
+  //
+  // RETURNS: Number of bytes written or
+  //          -1 if error.
+  //
+
+  int NetExHpWrite(NetExHpContext *ctx, void *buf, int len)
+  {
+    DBG_ENTER3("NetExHpWrite");
+
+    int ret = -1;
 
     //
     // Debug purpose only.
@@ -536,243 +1099,707 @@ namespace Tegenaria
         // TLS encrypted session.
         //
 
-        if (ctx -> sc_)
-        {
-          int encryptBufferSize = max(8096, len * 2);
+        if (ctx -> sc_)
+        {
+          //
+          // Encrypt outcoming data before send.
+          //
+
+          FAILEX(ctx -> sc_ -> encryptPush(buf, len) <= 0,
+                     "ERROR: Cannot encrypt data for client [%s].\n", ctx -> clientIp_);
+
+          //
+          // Send encrypted data to client.
+          //
+
+          if (NetExHpFlushSecure(ctx) == 0)
+          {
+            ret = len;
+          }
+        }
+
+        //
+        // Non-TLS unecrypted session.
+        //
+
+        else
+        {
+          if (bufferevent_write(bev, buf, len) == 0)
+          {
+            ret = len;
+          }
+        }
+      }
+    }
+
+    //
+    // LibSecure disabled.
+    //
+
+    #else
+    {
+      //
+      // Write data into libevent buffer.
+      //
+
+      if (ctx)
+      {
+        bufferevent *bev = (bufferevent *) ctx -> eventBuffer_;
+
+        if (bufferevent_write(bev, buf, len) == 0)
+        {
+          ret = len;
+        }
+      }
+    }
+    #endif
+
+    fail:
+
+    DBG_LEAVE3("NetExHpWrite");
+
+    return ret;
+  }
+
+  //
+  // Send <len> bytes from file <fileFd> starting at <offset> to remote
+  // client related with given NetExHpContext.
+  //
+  // Plain connection: file range is added to libevent output buffer and
+  // sent by sendfile() without copying it into user space.
+  //
+  // TLS connection: file must be encrypted, so it's read into user space
+  // and passed to NetExHpWrite() piece by piece.
+  //
+  // ctx    - context received in data handler parameters (IN).
+  // fileFd - CRT FD of opened file. Caller can close it after call (IN).
+  // offset - file position, where to start from (IN).
+  // len    - number of bytes to send (IN).
+  //
+  // RETURNS: 0 if OK,
+  //         -1 if error.
+  //
+
+  int NetExHpSendFile(NetExHpContext *ctx, int fileFd, int64_t offset, int64_t len)
+  {
+    DBG_ENTER3("NetExHpSendFile");
+
+    int exitCode = -1;
+
+    int dupFd = -1;
+
+    FAILEX(ctx == NULL, "ERROR: 'ctx' cannot be NULL.\n");
+
+    //
+    // TLS fallback. Read, encrypt and write.
+    //
+
+    #ifdef NET_EX_USE_LIBSECURE
+    if (ctx -> sc_)
+    {
+      char buf[16384];
+
+      int readed = 0;
+
+      while (len > 0)
+      {
+        #ifdef WIN32
+        {
+          readed = -1;
+
+          if (_lseeki64(fileFd, offset, SEEK_SET) != -1)
+          {
+            readed = _read(fileFd, buf, int(std::min(len, int64_t(sizeof(buf)))));
+          }
+        }
+        #else
+        {
+          readed = pread(fileFd, buf, size_t(std::min(len, int64_t(sizeof(buf)))), off_t(offset));
+        }
+        #endif
+
+        FAILEX(readed <= 0, "ERROR: Cannot read file FD #%d at offset [%lld].\n",
+                   fileFd, (long long) offset);
+
+        FAIL(NetExHpWrite(ctx, buf, readed) != readed);
+
+        offset += readed;
+        len    -= readed;
+      }
+
+      exitCode = 0;
+
+      goto fail;
+    }
+    #endif
+
+    //
+    // Plain connection. Let libevent send file by sendfile().
+    // libevent takes ownership of FD, so pass a duplicate.
+    //
+
+    #ifdef WIN32
+    dupFd = _dup(fileFd);
+    #else
+    dupFd = dup(fileFd);
+    #endif
+
+    FAILEX(dupFd == -1, "ERROR: Cannot duplicate file FD #%d.\n", fileFd);
+
+    if (evbuffer_add_file(bufferevent_get_output((bufferevent *) ctx -> eventBuffer_),
+                              dupFd, ev_off_t(offset), ev_off_t(len)) != 0)
+    {
+      Error("ERROR: Cannot add file FD #%d to output buffer.\n", fileFd);
+
+      //
+      // libevent took no ownership, close duplicate by own.
+      //
+
+      #ifdef WIN32
+      _close(dupFd);
+      #else
+      close(dupFd);
+      #endif
+
+      goto fail;
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE3("NetExHpSendFile");
+
+    return exitCode;
+  }
+
+  //
+  // Callback called when new connection arrived.
+  //
+
+  static void NetExHpOpenCallback(evutil_socket_t fd, short ev, void *data)
+  {
+    DBG_ENTER3("NetExHpOpenCallback");
+
+    int exitCode = -1;
+
+    struct event_base *eventBase = NULL;
+
+    struct bufferevent *eventBuffer = NULL;
+
+    NetExHpContext *serverCtx = NULL;
+
+    NetExHpContext *ctx = NULL;
+
+    int clientfd = -1;
+
+    struct sockaddr_in client_addr = {0};
+
+    socklen_t client_len = sizeof(client_addr);
+
+    //
+    // Get back main HP server loop context from data pointer.
+    //
+
+    serverCtx = (NetExHpContext *) data;
+
+    //
+    // Allocate HP context for new connection.
+    //
+
+    ctx = (NetExHpContext *) calloc(1, sizeof(NetExHpContext));
+
+    FAILEX(ctx == NULL, "ERROR: Out of memory.\n");
+
+    //
+    // Accept conncetion.
+    //
+
+    clientfd = accept(fd, (struct sockaddr *) &client_addr, &client_len);
+
+    FAIL(clientfd < 0);
+
+    //
+    // Save client IP in connection context.
+    //
+
+    strncpy(ctx -> clientIp_,
+                inet_ntoa(client_addr.sin_addr),
+                    sizeof(ctx -> clientIp_) - 1);
+
+    //
+    // Initialize new event buffer for new connection.
+    //
+
+    eventBase = (event_base *) serverCtx -> eventBase_;
+
+    eventBuffer = bufferevent_socket_new(eventBase, clientfd, BEV_OPT_CLOSE_ON_FREE);
+
+    FAILEX(eventBuffer == NULL, "ERROR: Cannot create event buffer.\n");
+
+    //
+    // Debug purpose only.
+    // Track created contexts.
+    //
+
+    #ifdef NET_EX_CHECK_CTX
+    {
+      CtxSetMutex.lock();
+      CtxSet.insert(ctx);
+      CtxSetMutex.unlock();
+    }
+    #endif
+
+    //
+    // Init secure context for secure connection.
+    //
+
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      //
+      // TLS encrypted session. Init secure context.
+      //
+
+      if (serverCtx -> secureCtx_)
+      {
+        ctx -> sc_ = SecureConnectionCreate(serverCtx -> secureCtx_);
+
+        FAILEX(ctx -> sc_ == NULL,
+                   "ERROR: Cannot init secure context for new connection.\n");
+      }
+    }
+    #endif
+
+    //
+    // Call underlying open handler if specified.
+    //
+
+    ctx -> openHandler_  = serverCtx -> openHandler_;
+    ctx -> closeHandler_ = serverCtx -> closeHandler_;
+    ctx -> dataHandler_  = serverCtx -> dataHandler_;
+    ctx -> workerNo_     = serverCtx -> workerNo_;
+    ctx -> eventBuffer_  = eventBuffer;
+
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      if (ctx -> sc_)
+      {
+        NetExHpHandshakeBegin(ctx);
+      }
+    }
+    #endif
+
+    if (ctx -> openHandler_)
+    {
+      ctx -> openHandler_(ctx);
+    }
+
+    //
+    // Set event and read callbacks.
+    //
+
+    bufferevent_setcb(eventBuffer, NetExHpReadCallback,
+                          NULL, NetExHpEventCallback, ctx);
+
+    bufferevent_enable(eventBuffer, EV_READ);
+
+    //
+    // Update worker's counters.
+    //
+
+    WorkerStats[ctx -> workerNo_].accepted_++;
+    WorkerStats[ctx -> workerNo_].activeConns_++;
+
+    //
+    // Error handler.
+    // Accept failed or already accepted from another libevent loop.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      //
+      // Clean up on error.
+      //
+
+      if (clientfd > 0)
+      {
+        #ifdef WIN32
+        closesocket(clientfd);
+        #else
+        close(clientfd);
+        #endif
+      }
+
+      if (ctx)
+      {
+        #ifdef NET_EX_USE_LIBSECURE
+        {
+          if (ctx -> sc_)
+          {
+            ctx -> sc_ -> release();
+
+            ctx -> sc_ = NULL;
+          }
+        }
+        #endif
+
+        free(ctx);
+      }
+    }
+
+    DBG_LEAVE3("NetExHpOpenCallback");
+  }
+
+  //
+  // Pass all encrypted data waiting in input buffer to SSL object segment
+  // by segment, without joining input buffer.
+  //
+  // ctx   - connection context with TLS session (IN).
+  // input - event input buffer with encrypted data. Drained on exit (IN).
+  //
+  // RETURNS: 0 if OK,
+  //          -1 if error.
+  //
+
+  #ifdef NET_EX_USE_LIBSECURE
+
+  static int NetExHpPushInput(NetExHpContext *ctx, struct evbuffer *input)
+  {
+    int exitCode = -1;
+
+    struct evbuffer_iovec vec[16];
+
+    while (evbuffer_get_length(input) > 0)
+    {
+      int vecCount = std::min(evbuffer_peek(input, -1, NULL, vec, 16), 16);
+
+      size_t consumed = 0;
+
+      for (int i = 0; i < vecCount; i++)
+      {
+        FAIL(ctx -> sc_ -> decryptPush(vec[i].iov_base, int(vec[i].iov_len)));
+
+        consumed += vec[i].iov_len;
+      }
+
+      evbuffer_drain(input, consumed);
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
+  #endif
+
+  //
+  // Decrypt all data waiting in input buffer of TLS connection and pass it
+  // to data handler.
+  //
+  // Encrypted data is passed to SSL segment by segment without joining
+  // input buffer. Decrypted data goes to per worker buffer reused by all
+  // connections, so steady state traffic needs no memory allocation.
+  //
+  // If decrypted data doesn't fit into buffer, data handler is called once
+  // per every full buffer. SSL is drained completely, because no new read
+  // event comes for data already buffered inside SSL.
+  //
+  // ctx   - connection context with established TLS session (IN).
+  // input - event input buffer with encrypted data. Drained on exit (IN).
+  //
+  // RETURNS: 0 if OK,
+  //          -1 if error.
+  //
+
+  #ifdef NET_EX_USE_LIBSECURE
+
+  static int NetExHpDecryptInput(NetExHpContext *ctx, struct evbuffer *input)
+  {
+    DBG_ENTER3("NetExHpDecryptInput");
 
-          char *encryptBuffer = (char *) malloc(encryptBufferSize);
+    int exitCode = -1;
 
-          FAILEX(encryptBuffer == NULL, "ERROR: Out of memory.\n");
+    int workerNo = ctx -> workerNo_;
 
-          //
-          // Encrypt outcoming data before send.
-          //
+    int decrypted = 0;
+    int readed    = 0;
 
-          encryptBufferSize = ctx -> sc_ -> encrypt(encryptBuffer,
-                                                        encryptBufferSize, buf, len);
+    size_t len = evbuffer_get_length(input);
 
-          //
-          // Send encrypted data to client.
-          //
+    //
+    // Grow worker buffer to input size to pass usual input to data handler
+    // in one call.
+    //
 
-          if (bufferevent_write(bev, encryptBuffer, encryptBufferSize) == 0)
-          {
-            ret = len;
-          }
+    if (WorkerDecryptBufferSize[workerNo] < int(len)
+            || WorkerDecryptBufferSize[workerNo] == 0)
+    {
+      int newSize = std::max(int(len), 16384);
 
-          free(encryptBuffer);
-        }
+      char *newBuffer = (char *) realloc(WorkerDecryptBuffer[workerNo], newSize);
 
-        //
-        // Non-TLS unecrypted session.
-        //
+      FAILEX(newBuffer == NULL, "ERROR: Out of memory.\n");
 
-        else
-        {
-          if (bufferevent_write(bev, buf, len) == 0)
-          {
-            ret = len;
-          }
-        }
-      }
+      WorkerDecryptBuffer[workerNo]     = newBuffer;
+      WorkerDecryptBufferSize[workerNo] = newSize;
     }
 
     //
-    // LibSecure disabled.
+    // Pass encrypted segments to SSL.
     //
 
-    #else
+    FAIL(NetExHpPushInput(ctx, input));
+
+    //
+    // Take back all complete records until SSL has nothing more.
+    //
+
+    do
     {
+      readed = ctx -> sc_ -> decryptPop(WorkerDecryptBuffer[workerNo] + decrypted,
+                                            WorkerDecryptBufferSize[workerNo] - decrypted);
+
+      FAILEX(readed < 0, "ERROR: Cannot decrypt data from client [%s].\n",
+                 ctx -> clientIp_);
+
+      decrypted += readed;
+
       //
-      // Write data into libevent buffer.
+      // Buffer full or SSL drained. Call underlying data handler with
+      // decrypted data and start filling buffer from the beginning.
       //
 
-      if (ctx)
+      if (decrypted > 0 && (readed == 0 || decrypted == WorkerDecryptBufferSize[workerNo]))
       {
-        bufferevent *bev = (bufferevent *) ctx -> eventBuffer_;
-
-        if (bufferevent_write(bev, buf, len) == 0)
+        if (ctx -> dataHandler_)
         {
-          ret = len;
+          ctx -> dataHandler_(ctx, WorkerDecryptBuffer[workerNo], decrypted);
         }
+
+        decrypted = 0;
       }
     }
-    #endif
+    while (readed > 0);
+
+    exitCode = 0;
 
     fail:
 
-    DBG_ENTER3("NetExHpWrite");
+    DBG_LEAVE3("NetExHpDecryptInput");
 
-    return ret;
+    return exitCode;
   }
 
+  #endif
+
   //
-  // Callback called when new connection arrived.
+  // Handshake bookkeeping. All functions below are called on worker
+  // thread owning connection.
   //
 
-  static void NetExHpOpenCallback(evutil_socket_t fd, short ev, void *data)
-  {
-    DBG_ENTER3("NetExHpOpenCallback");
+  #ifdef NET_EX_USE_LIBSECURE
 
-    int exitCode = -1;
+  //
+  // Note new pending handshake. Arm handshake timeout and stop accepting
+  // new connections if worker has too many handshakes pending.
+  //
+  // ctx - connection context with TLS session (IN).
+  //
 
-    struct event_base *eventBase = NULL;
+  static void NetExHpHandshakeBegin(NetExHpContext *ctx)
+  {
+    int workerNo = ctx -> workerNo_;
 
-    struct bufferevent *eventBuffer = NULL;
+    struct timeval timeout;
 
-    NetExHpContext *serverCtx = NULL;
+    timeout.tv_sec  = HandshakeTimeout / 1000;
+    timeout.tv_usec = (HandshakeTimeout % 1000) * 1000;
 
-    NetExHpContext *ctx = NULL;
+    ctx -> handshakeStart_ = NetExHpGetTimeUs();
 
-    int clientfd = -1;
+    bufferevent_set_timeouts((bufferevent *) ctx -> eventBuffer_, &timeout, NULL);
 
-    struct sockaddr_in client_addr = {0};
+    WorkerStats[workerNo].handshakesActive_++;
 
-    socklen_t client_len = sizeof(client_addr);
+    if (WorkerStats[workerNo].handshakesActive_ >= MaxHandshakes
+            && AcceptPaused[workerNo] == 0)
+    {
+      DEBUG1("HP worker #%d : Too many pending handshakes, accept paused.\n",
+                 workerNo);
 
-    //
-    // Get back main HP server loop context from data pointer.
-    //
+      event_del(AcceptEvent[workerNo]);
 
-    serverCtx = (NetExHpContext *) data;
+      AcceptPaused[workerNo] = 1;
+    }
+  }
 
-    //
-    // Allocate HP context for new connection.
-    //
+  //
+  // Note finished or failed handshake. Update counters and resume
+  // accepting if it was paused. Does nothing if no handshake pending.
+  //
+  // ctx     - connection context with TLS session (IN).
+  // success - 1 if handshake finished, 0 if failed or closed (IN).
+  //
 
-    ctx = (NetExHpContext *) calloc(1, sizeof(NetExHpContext));
+  static void NetExHpHandshakeEnd(NetExHpContext *ctx, int success)
+  {
+    int workerNo = ctx -> workerNo_;
 
-    FAILEX(ctx == NULL, "ERROR: Out of memory.\n");
+    NetExHpStats *stats = &WorkerStats[workerNo];
 
-    //
-    // Accept conncetion.
-    //
+    if (ctx -> handshakeStart_ == 0)
+    {
+      return;
+    }
 
-    clientfd = accept(fd, (struct sockaddr *) &client_addr, &client_len);
+    if (success)
+    {
+      int64_t elapsed = NetExHpGetTimeUs() - ctx -> handshakeStart_;
 
-    FAIL(clientfd < 0);
+      stats -> handshakes_++;
 
-    //
-    // Save client IP in connection context.
-    //
+      stats -> handshakeTimeTotalUs_ += elapsed;
 
-    strncpy(ctx -> clientIp_,
-                inet_ntoa(client_addr.sin_addr),
-                    sizeof(ctx -> clientIp_) - 1);
+      if (elapsed > stats -> handshakeTimeMaxUs_)
+      {
+        stats -> handshakeTimeMaxUs_ = elapsed;
+      }
+    }
+    else
+    {
+      stats -> handshakesFailed_++;
+    }
 
-    //
-    // Initialize new event buffer for new connection.
-    //
+    ctx -> handshakeStart_ = 0;
 
-    eventBase = (event_base *) serverCtx -> eventBase_;
+    stats -> handshakesActive_--;
 
-    eventBuffer = bufferevent_socket_new(eventBase, clientfd, BEV_OPT_CLOSE_ON_FREE);
+    if (AcceptPaused[workerNo] && stats -> handshakesActive_ < MaxHandshakes)
+    {
+      event_add(AcceptEvent[workerNo], NULL);
 
-    FAILEX(eventBuffer == NULL, "ERROR: Cannot create event buffer.\n");
+      AcceptPaused[workerNo] = 0;
+    }
+  }
 
-    //
-    // Debug purpose only.
-    // Track created contexts.
-    //
+  //
+  // Send data produced by handshake step to client and go on basing on
+  // step result.
+  //
+  // ctx    - connection context with TLS session (IN).
+  // result - value returned by handshakeContinue() (IN).
+  //
+  // RETURNS: 0 if connection still alive,
+  //          -1 if connection closed.
+  //
 
-    #ifdef NET_EX_CHECK_CTX
+  static int NetExHpHandshakeStepDone(NetExHpContext *ctx, int result)
+  {
+    bufferevent *bev = (bufferevent *) ctx -> eventBuffer_;
+
+    if (result >= 0 && NetExHpFlushSecure(ctx))
     {
-      CtxSetMutex.lock();
-      CtxSet.insert(ctx);
-      CtxSetMutex.unlock();
+      result = -1;
     }
-    #endif
 
     //
-    // Init secure context for secure connection.
+    // Handshake finished. Disarm handshake timeout and handle application
+    // data sent by client together with last handshake flight.
     //
 
-    #ifdef NET_EX_USE_LIBSECURE
+    if (result == 1)
     {
-      //
-      // TLS encrypted session. Init secure context.
-      //
+      NetExHpHandshakeEnd(ctx, 1);
 
-      if (serverCtx -> secureCert_ && serverCtx -> securePrivKey_)
+      bufferevent_set_timeouts(bev, NULL, NULL);
+
+      if (NetExHpDecryptInput(ctx, bufferevent_get_input(bev)))
       {
-        ctx -> sc_ = SecureConnectionCreate(SECURE_INTENT_SERVER,
-                                                serverCtx -> secureCert_,
-                                                    serverCtx -> securePrivKey_,
-                                                        serverCtx -> securePrivKeyPass_);
-        FAILEX(ctx -> sc_ == NULL,
-                   "ERROR: Cannot init secure context for new connection.\n");
+        result = -1;
       }
     }
-    #endif
 
     //
-    // Call underlying open handler if specified.
+    // Handshake failed. Close connection.
     //
 
-    ctx -> openHandler_  = serverCtx -> openHandler_;
-    ctx -> closeHandler_ = serverCtx -> closeHandler_;
-    ctx -> dataHandler_  = serverCtx -> dataHandler_;
-    ctx -> workerNo_     = serverCtx -> workerNo_;
-    ctx -> eventBuffer_  = eventBuffer;
-
-    if (ctx -> openHandler_)
+    if (result < 0)
     {
-      ctx -> openHandler_(ctx);
+      Error("ERROR: TLS handshake with client [%s] failed.\n", ctx -> clientIp_);
+
+      NetExHpEventCallback(bev, 0, ctx);
+
+      return -1;
     }
 
-    //
-    // Set event and read callbacks.
-    //
+    return 0;
+  }
 
-    bufferevent_setcb(eventBuffer, NetExHpReadCallback,
-                          NULL, NetExHpEventCallback, ctx);
+  //
+  // Pass handshake step to crypto thread. Reading is disabled until step
+  // is posted back by NetExHpHandshakeDoneCallback().
+  //
+  // ctx - connection context with TLS session (IN).
+  //
 
-    bufferevent_enable(eventBuffer, EV_READ);
+  static void NetExHpHandshakeQueue(NetExHpContext *ctx)
+  {
+    bufferevent_disable((bufferevent *) ctx -> eventBuffer_, EV_READ);
 
-    //
-    // Error handler.
-    // Accept failed or already accepted from another libevent loop.
-    //
+    ctx -> handshakeBusy_ = 1;
 
-    exitCode = 0;
+    CryptoQueueMutex.lock();
 
-    fail:
+    CryptoQueue.push_back(ctx);
 
-    if (exitCode)
-    {
-      //
-      // Clean up on error.
-      //
+    CryptoQueueMutex.unlock();
 
-      if (clientfd > 0)
-      {
-        #ifdef WIN32
-        closesocket(clientfd);
-        #else
-        close(clientfd);
-        #endif
-      }
+    CryptoQueueSem.signal();
+  }
 
-      if (ctx)
-      {
-        #ifdef NET_EX_USE_LIBSECURE
-        {
-          if (ctx -> sc_)
-          {
-            ctx -> sc_ -> release();
+  //
+  // Callback called when crypto thread finished handshake step.
+  //
 
-            ctx -> sc_ = NULL;
-          }
-        }
-        #endif
+  static void NetExHpHandshakeDoneCallback(evutil_socket_t fd, short ev, void *data)
+  {
+    DBG_ENTER3("NetExHpHandshakeDoneCallback");
 
-        free(ctx);
-      }
+    NetExHpContext *ctx = (NetExHpContext *) data;
+
+    bufferevent *bev = (bufferevent *) ctx -> eventBuffer_;
+
+    ctx -> handshakeBusy_ = 0;
+
+    //
+    // Connection closed in the meantime.
+    //
+
+    if (ctx -> closePending_)
+    {
+      NetExHpEventCallback(bev, 0, ctx);
     }
 
-    DBG_LEAVE3("NetExHpOpenCallback");
+    //
+    // Send handshake data and go on reading.
+    //
+
+    else if (NetExHpHandshakeStepDone(ctx, ctx -> handshakeResult_) == 0)
+    {
+      bufferevent_enable(bev, EV_READ);
+    }
+
+    DBG_LEAVE3("NetExHpHandshakeDoneCallback");
   }
 
+  #endif
+
   //
   // Callback called when new data arrived.
   //
@@ -791,7 +1818,7 @@ namespace Tegenaria
 
     size_t len = evbuffer_get_length(input);
 
-    unsigned char *buf = evbuffer_pullup(input, len);
+    unsigned char *buf = NULL;
 
     //
     // Use TLS secure connection.
@@ -809,67 +1836,58 @@ namespace Tegenaria
         {
           case SECURE_STATE_ESTABLISHED:
           {
-            char *decryptBuffer = (char *) malloc(len);
-
-            int decryptBufferSize = len;
-
-            FAILEX(decryptBuffer == NULL, "ERROR: Out of memory.\n");
-
             //
-            // Decrypt incoming data into buffer[].
+            // Decrypt incoming data and pass it to data handler.
+            // Input is drained inside.
             //
 
-            decryptBufferSize = ctx -> sc_ -> decrypt(decryptBuffer,
-                                                          decryptBufferSize,
-                                                              buf, len);
-
-            //
-            // Call underlying data handler with decrypted buffer.
-            //
+            len = 0;
 
-            if (ctx -> dataHandler_)
+            if (NetExHpDecryptInput(ctx, input))
             {
-              ctx -> dataHandler_(ctx, decryptBuffer, decryptBufferSize);
-            }
+              NetExHpEventCallback(bev, 0, ctx);
 
-            free(decryptBuffer);
+              bev = NULL;
+            }
 
             break;
           }
 
           //
           // SSL Handshake is pending.
-          // We must handle it by own.
+          // We must handle it by own without blocking event loop.
+          // Input is drained inside.
+          //
 
           case SECURE_STATE_HANDSHAKE_READ:
           case SECURE_STATE_HANDSHAKE_WRITE:
           {
-            char toWrite[1024];
+            len = 0;
 
-            int toWriteSize = 1024;
-
-            if (ctx -> sc_ -> handshakeStep(toWrite, &toWriteSize, buf, len) == 0)
+            if (NetExHpPushInput(ctx, input))
             {
-              //
-              // Write handshake data to client.
-              //
+              Error("ERROR: TLS handshake with client [%s] failed.\n", ctx -> clientIp_);
 
-              if (toWriteSize > 0)
-              {
-                bufferevent *bev = (bufferevent *) ctx -> eventBuffer_;
+              NetExHpEventCallback(bev, 0, ctx);
 
-                bufferevent_write(bev, toWrite, toWriteSize);
-              }
+              bev = NULL;
             }
 
             //
-            // Handshake error. Close connection.
+            // Pass handshake step to crypto thread if enabled.
             //
 
-            else
+            else if (CryptoThreadsCount > 0)
             {
-              NetExHpEventCallback(bev, 0, ctx);
+              NetExHpHandshakeQueue(ctx);
+            }
+
+            //
+            // Do handshake step in event loop.
+            //
 
+            else if (NetExHpHandshakeStepDone(ctx, ctx -> sc_ -> handshakeContinue()))
+            {
               bev = NULL;
             }
 
@@ -890,6 +1908,8 @@ namespace Tegenaria
 
         if (ctx && ctx -> dataHandler_)
         {
+          buf = evbuffer_pullup(input, len);
+
           ctx -> dataHandler_(ctx, buf, len);
         }
       }
@@ -907,6 +1927,8 @@ namespace Tegenaria
 
       if (ctx && ctx -> dataHandler_)
       {
+        buf = evbuffer_pullup(input, len);
+
         ctx -> dataHandler_(ctx, buf, len);
       }
     }
@@ -914,11 +1936,6 @@ namespace Tegenaria
 
     //
     // Clean up.
-    //
-
-    fail:
-
-    //
     // Pop processed data from event buffer.
     //
 
@@ -941,6 +1958,24 @@ namespace Tegenaria
 
     NetExHpContext *ctx = (NetExHpContext *) data;
 
+    //
+    // Crypto thread still works on connection. Close it when step is
+    // posted back.
+    //
+
+    #ifdef NET_EX_USE_LIBSECURE
+    {
+      if (ctx && ctx -> handshakeBusy_)
+      {
+        ctx -> closePending_ = 1;
+
+        DBG_LEAVE3("NetExHpEventCallback");
+
+        return;
+      }
+    }
+    #endif
+
     if (ctx)
     {
       if (ctx -> closeHandler_)
@@ -948,6 +1983,8 @@ namespace Tegenaria
         ctx -> closeHandler_(ctx);
       }
 
+      WorkerStats[ctx -> workerNo_].activeConns_--;
+
       //
       // Debug purpose only.
       // Track created contexts.
@@ -974,6 +2011,8 @@ namespace Tegenaria
 
       #ifdef NET_EX_USE_LIBSECURE
       {
+        NetExHpHandshakeEnd(ctx, 0);
+
         if (ctx -> sc_)
         {
           ctx -> sc_ -> release();
@@ -1003,7 +2042,7 @@ namespace Tegenaria
   {
     DBG_INFO("NetExHpExitCallback : CTRL_BREAK received. Going to shutdown...\n");
 
-    for (int i = CpuCount - 1; i >= 0; i--)
+    for (int i = WorkersCount - 1; i >= 0; i--)
     {
       event_base_loopbreak(EventBase[i]);
     }
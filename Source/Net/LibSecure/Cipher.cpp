@@ -29,105 +29,754 @@
 #include "Secure.h"
 #include "Internal.h"
 
+#include <Tegenaria/IOCodec.h>
+
 #ifdef WIN64
-  static int Win64NotImportedError()
+  #define BF_cfb64_encrypt(a, b, c, d, e, f, g) Win64NotImportedError()
+  #define BF_set_key(a, b, c)                   Win64NotImportedError()
+  #define BF_ecb_encrypt(a, b, c, d)            Win64NotImportedError()
+  #define HMAC(a, b, c, d, e, f, g)             (unsigned char *) Win64NotImportedError()
+  #define EVP_sha256()                          (const EVP_MD *) Win64NotImportedError()
+  #define EVP_MD_CTX_create()                   (EVP_MD_CTX *) Win64NotImportedError()
+  #define EVP_MD_CTX_destroy(x)                 Win64NotImportedError()
+  #define EVP_MD_CTX_copy_ex(x, y)              Win64NotImportedError()
+  #define EVP_DigestInit_ex(x, y, z)            Win64NotImportedError()
+  #define EVP_DigestUpdate(x, y, z)             Win64NotImportedError()
+  #define EVP_DigestFinal_ex(x, y, z)           Win64NotImportedError()
+  #define EVP_CIPHER_CTX_new()                  (EVP_CIPHER_CTX *) Win64NotImportedError()
+  #define EVP_CIPHER_CTX_free(x)                Win64NotImportedError()
+  #define EVP_CIPHER_CTX_ctrl(x, y, z, w)       Win64NotImportedError()
+  #define EVP_CipherInit_ex(a, b, c, d, e, f)   Win64NotImportedError()
+  #define EVP_CipherUpdate(a, b, c, d, e)       Win64NotImportedError()
+  #define EVP_CipherFinal_ex(a, b, c)           Win64NotImportedError()
+  #define EVP_aes_128_ctr()                     (const EVP_CIPHER *) Win64NotImportedError()
+  #define EVP_aes_192_ctr()                     (const EVP_CIPHER *) Win64NotImportedError()
+  #define EVP_aes_256_ctr()                     (const EVP_CIPHER *) Win64NotImportedError()
+  #define EVP_aes_128_gcm()                     (const EVP_CIPHER *) Win64NotImportedError()
+  #define EVP_aes_192_gcm()                     (const EVP_CIPHER *) Win64NotImportedError()
+  #define EVP_aes_256_gcm()                     (const EVP_CIPHER *) Win64NotImportedError()
+#endif
+
+namespace Tegenaria
+{
+  //
+  // Derive key material for one packet direction (HKDF-SHA256,
+  // RFC 5869). Built on one-shot HMAC(), so it works with every
+  // supported OpenSSL version.
+  //
+  // out     - buffer, where to store derived bytes (OUT).
+  // outSize - number of bytes to derive, up to 255 * 32 (IN).
+  // key     - shared secret (IN).
+  // keySize - size of key[] buffer in bytes (IN).
+  // salt    - salt, e.g. shared iv (IN).
+  // saltSize - size of salt[] buffer in bytes (IN).
+  // label   - direction label, e.g. "c2s" (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  static int SecureHkdf(unsigned char *out, int outSize,
+                            const void *key, int keySize,
+                                const void *salt, int saltSize,
+                                    const char *label)
+  {
+    int exitCode = -1;
+
+    unsigned char prk[SHA256_DIGEST_LENGTH];
+
+    unsigned char block[SHA256_DIGEST_LENGTH + 64 + 1];
+
+    unsigned char t[SHA256_DIGEST_LENGTH];
+
+    unsigned int tSize = 0;
+
+    int labelSize = strlen(label);
+
+    int blockSize = 0;
+
+    FAIL(labelSize > 64);
+
+    //
+    // Extract: prk = HMAC(salt, key).
+    //
+
+    FAIL(HMAC(EVP_sha256(), salt, saltSize,
+                  (const unsigned char *) key, keySize, prk, &tSize) == NULL);
+
+    //
+    // Expand: T(i) = HMAC(prk, T(i-1) | label | i).
+    //
+
+    for (int i = 1; outSize > 0; i++)
+    {
+      blockSize = 0;
+
+      if (i > 1)
+      {
+        memcpy(block, t, sizeof(t));
+
+        blockSize = sizeof(t);
+      }
+
+      memcpy(block + blockSize, label, labelSize);
+
+      blockSize += labelSize;
+
+      block[blockSize++] = (unsigned char) i;
+
+      FAIL(HMAC(EVP_sha256(), prk, sizeof(prk), block, blockSize, t, &tSize) == NULL);
+
+      memcpy(out, t, outSize < int(sizeof(t)) ? outSize : sizeof(t));
+
+      out     += sizeof(t);
+      outSize -= sizeof(t);
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    memset(prk, 0, sizeof(prk));
+    memset(block, 0, sizeof(block));
+    memset(t, 0, sizeof(t));
+
+    return exitCode;
+  }
+
+  //
+  // Prepare HMAC-SHA256 states used to authenticate packets in one
+  // direction.
+  //
+  // pk     - direction keys to init (IN/OUT).
+  // macKey - SHA256_DIGEST_LENGTH bytes of MAC key (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  static int SecurePacketInitMac(SecurePacketKeys *pk, const unsigned char *macKey)
+  {
+    int exitCode = -1;
+
+    unsigned char pad[64];
+
+    pk -> macInner_ = EVP_MD_CTX_create();
+    pk -> macOuter_ = EVP_MD_CTX_create();
+    pk -> macWork_  = EVP_MD_CTX_create();
+
+    FAIL(pk -> macInner_ == NULL);
+    FAIL(pk -> macOuter_ == NULL);
+    FAIL(pk -> macWork_ == NULL);
+
+    //
+    // Absorb (macKey ^ ipad) and (macKey ^ opad) once. Every packet
+    // starts from copy of these states.
+    //
+
+    memset(pad, 0x36, sizeof(pad));
+
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+      pad[i] ^= macKey[i];
+    }
+
+    FAIL(EVP_DigestInit_ex(pk -> macInner_, EVP_sha256(), NULL) != 1);
+    FAIL(EVP_DigestUpdate(pk -> macInner_, pad, sizeof(pad)) != 1);
+
+    memset(pad, 0x5c, sizeof(pad));
+
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+      pad[i] ^= macKey[i];
+    }
+
+    FAIL(EVP_DigestInit_ex(pk -> macOuter_, EVP_sha256(), NULL) != 1);
+    FAIL(EVP_DigestUpdate(pk -> macOuter_, pad, sizeof(pad)) != 1);
+
+    exitCode = 0;
+
+    fail:
+
+    memset(pad, 0, sizeof(pad));
+
+    return exitCode;
+  }
+
+  //
+  // Compute HMAC-SHA256(seq | size | data) for one packet.
+  //
+  // pk     - direction keys with MAC states (IN/OUT).
+  // seq    - packet sequence number (IN).
+  // buffer - packet data (IN).
+  // size   - size of buffer[] in bytes (IN).
+  // mac    - buffer, where to store SHA256_DIGEST_LENGTH bytes of MAC (OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  static int SecurePacketMac(SecurePacketKeys *pk, uint64_t seq,
+                                 const void *buffer, int size, unsigned char *mac)
+  {
+    EVP_MD_CTX *sha = pk -> macWork_;
+
+    unsigned char head[12];
+
+    unsigned int macSize = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+      head[i] = (unsigned char) (seq >> (i * 8));
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+      head[8 + i] = (unsigned char) (uint32_t(size) >> (i * 8));
+    }
+
+    if (EVP_MD_CTX_copy_ex(sha, pk -> macInner_) != 1
+            || EVP_DigestUpdate(sha, head, sizeof(head)) != 1
+                || EVP_DigestUpdate(sha, buffer, size) != 1
+                    || EVP_DigestFinal_ex(sha, mac, &macSize) != 1
+                        || EVP_MD_CTX_copy_ex(sha, pk -> macOuter_) != 1
+                            || EVP_DigestUpdate(sha, mac, SHA256_DIGEST_LENGTH) != 1
+                                || EVP_DigestFinal_ex(sha, mac, &macSize) != 1)
+    {
+      return -1;
+    }
+
+    return 0;
+  }
+
+  //
+  // Generate unpredictable iv for one Blowfish packet by encrypting
+  // (iv ^ seq) block with direction key.
+  //
+  // pk  - direction keys (IN).
+  // seq - packet sequence number (IN).
+  // iv  - buffer, where to store 8 bytes of iv (OUT).
+  //
+
+  static void SecurePacketIv(SecurePacketKeys *pk, uint64_t seq, unsigned char *iv)
+  {
+    unsigned char block[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+      block[i] = pk -> iv_[i] ^ (unsigned char) (seq >> (i * 8));
+    }
+
+    BF_ecb_encrypt(block, iv, &(pk -> bfKey_), BF_ENCRYPT);
+  }
+
+  //
+  // Build AES counter block (CTR) or nonce (GCM) for one packet.
+  // Bytes 4-11 carry (iv ^ seq), so every packet gets unique nonce
+  // within direction key.
+  // Last 4 bytes are zeroed, CTR uses them as block counter inside
+  // packet, GCM does not use them at all.
+  //
+  // pk  - direction keys (IN).
+  // seq - packet sequence number (IN).
+  // iv  - buffer, where to store 16 bytes of iv (OUT).
+  //
+
+  static void SecureAesPacketIv(SecurePacketKeys *pk, uint64_t seq, unsigned char *iv)
+  {
+    memcpy(iv, pk -> iv_, 12);
+
+    for (int i = 0; i < 8; i++)
+    {
+      iv[4 + i] ^= (unsigned char) (seq >> (i * 8));
+    }
+
+    memset(iv + 12, 0, 4);
+  }
+
+  //
+  // Select OpenSSL AES implementation matching cipher and key size.
+  // EVP picks AES-NI/VAES code path at runtime if CPU supports it.
+  //
+  // cipher  - SECURE_CIPHER_AES_XXX (IN).
+  // keySize - size of key in bytes, 16, 24 or 32 (IN).
+  //
+  // RETURNS: EVP cipher or NULL if not supported.
+  //
+
+  static const EVP_CIPHER *SecureAesGetEvp(int cipher, int keySize)
+  {
+    if (cipher == SECURE_CIPHER_AES_CTR)
+    {
+      switch(keySize)
+      {
+        case 16: return EVP_aes_128_ctr();
+        case 24: return EVP_aes_192_ctr();
+        case 32: return EVP_aes_256_ctr();
+      }
+    }
+    else if (cipher == SECURE_CIPHER_AES_GCM)
+    {
+      switch(keySize)
+      {
+        case 16: return EVP_aes_128_gcm();
+        case 24: return EVP_aes_192_gcm();
+        case 32: return EVP_aes_256_gcm();
+      }
+    }
+
+    return NULL;
+  }
+
+  //
+  // Encrypt or decrypt list of buffers as one continuous stream.
+  // Common code for SecureEncrypt/Decrypt[Multi]().
+  //
+  // ctx     - secure context containing cipher state created by
+  //           SecureCipherCreate before (IN/OUT).
+  //
+  // buffers - list of buffers to process in place (IN/OUT).
+  // sizes   - sizes of buffers[] in bytes (IN).
+  // count   - number of entries in buffers[] and sizes[] (IN).
+  // enc     - 1 to encrypt, 0 to decrypt (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  static int SecureCipherRun(SecureCipher *ctx, void **buffers,
+                                 int *sizes, int count, int enc)
+  {
+    int exitCode = -1;
+
+    unsigned char iv[16];
+
+    int num = 0;
+
+    int *piv = (int *) iv;
+
+    uint64_t *counter = enc ? &(ctx -> counterEncrypt_) : &(ctx -> counterDecrypt_);
+
+    memcpy(iv, ctx -> iv_, 16);
+
+    //
+    // Blowfish. Apply counter number for CTR mode, then keep iv and
+    // num between buffers, so CFB stream is continued over whole list.
+    //
+
+    if (ctx -> cipher_ == SECURE_CIPHER_BLOWFISH)
+    {
+      if (ctx -> cipherMode_ == SECURE_CIPHER_MODE_CTR)
+      {
+        (*piv) ^= int(*counter);
+
+        (*counter) ++;
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        BF_cfb64_encrypt((unsigned char *) buffers[i], (unsigned char *) buffers[i],
+                             sizes[i], &(ctx -> key_), iv, &num,
+                                 enc ? BF_ENCRYPT : BF_DECRYPT);
+      }
+    }
+
+    //
+    // AES. Always CTR mode (checked in SecureCipherCreate()), so every
+    // call starts from unique counter block (iv ^ 64-bit call number).
+    // Key is already expanded, set iv only and let EVP continue
+    // keystream over whole list.
+    //
+
+    else
+    {
+      EVP_CIPHER_CTX *evp = enc ? ctx -> evpEncrypt_ : ctx -> evpDecrypt_;
+
+      int outSize = 0;
+
+      for (int i = 0; i < 8; i++)
+      {
+        iv[i] ^= (unsigned char) ((*counter) >> (i * 8));
+      }
+
+      (*counter) ++;
+
+      FAIL(EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, enc) != 1);
+
+      for (int i = 0; i < count; i++)
+      {
+        FAIL(EVP_CipherUpdate(evp, (unsigned char *) buffers[i], &outSize,
+                                  (unsigned char *) buffers[i], sizes[i]) != 1);
+      }
+    }
+
+    exitCode = 0;
+
+    //
+    // Error handler.
+    //
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot %s data with cipher '%d'.\n",
+                enc ? "encrypt" : "decrypt", ctx -> cipher_);
+    }
+
+    return exitCode;
+  }
+
+  //
+  // Encrypt data.
+  //
+  // ctx    - secure context containing cipher state created by
+  //          SecureCipherCreate before (IN/OUT).
+  //
+  // buffer - buffer to encrypt (IN/OUT).
+  //
+  // size   - size of buffer[] in bytes (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int SecureEncrypt(SecureCipher *ctx, void *buffer, int size)
   {
-    fprintf(stderr, "OpenSSL is not imported on Win64");
-    exit(-1);
+    DBG_ENTER3("SecureEncrypt");
+
+    int exitCode = SecureCipherRun(ctx, &buffer, &size, 1, 1);
+
+    DBG_LEAVE3("SecureEncrypt");
+
+    return exitCode;
   }
 
-  #define BF_cfb64_encrypt(a, b, c, d, e, f, g) Win64NotImportedError()
-  #define BF_set_key(a, b, c)                   Win64NotImportedError()
-#endif
+  //
+  // Decrypt data.
+  //
+  // ctx    - secure context containing cipher state created by
+  //          SecureCipherCreate before (IN/OUT).
+  //
+  // buffer - buffer to decrypt (IN/OUT).
+  //
+  // size   - size of buffer[] in bytes (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int SecureDecrypt(SecureCipher *ctx, void *buffer, int size)
+  {
+    DBG_ENTER3("SecureDecrypt");
+
+    int exitCode = SecureCipherRun(ctx, &buffer, &size, 1, 0);
+
+    DBG_LEAVE3("SecureDecrypt");
+
+    return exitCode;
+  }
+
+  //
+  // Encrypt many buffers at once. Result is the same as encrypting
+  // concatenation of all buffers by one SecureEncrypt() call, but
+  // large payload does not need to be copied into one block first.
+  // Cipher is set up once per list, so it's also cheaper than calling
+  // SecureEncrypt() for every buffer.
+  //
+  // TIP#1: Remote side can decrypt data using any other split, e.g.
+  //        one SecureDecrypt() call on concatenated data.
+  //
+  // ctx     - secure context containing cipher state created by
+  //           SecureCipherCreate before (IN/OUT).
+  //
+  // buffers - list of buffers to encrypt in place (IN/OUT).
+  // sizes   - sizes of buffers[] in bytes (IN).
+  // count   - number of entries in buffers[] and sizes[] (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int SecureEncryptMulti(SecureCipher *ctx, void **buffers, int *sizes, int count)
+  {
+    DBG_ENTER3("SecureEncryptMulti");
+
+    int exitCode = SecureCipherRun(ctx, buffers, sizes, count, 1);
+
+    DBG_LEAVE3("SecureEncryptMulti");
+
+    return exitCode;
+  }
+
+  //
+  // Decrypt many buffers at once. See SecureEncryptMulti().
+  //
+  // ctx     - secure context containing cipher state created by
+  //           SecureCipherCreate before (IN/OUT).
+  //
+  // buffers - list of buffers to decrypt in place (IN/OUT).
+  // sizes   - sizes of buffers[] in bytes (IN).
+  // count   - number of entries in buffers[] and sizes[] (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int SecureDecryptMulti(SecureCipher *ctx, void **buffers, int *sizes, int count)
+  {
+    DBG_ENTER3("SecureDecryptMulti");
+
+    int exitCode = SecureCipherRun(ctx, buffers, sizes, count, 0);
+
+    DBG_LEAVE3("SecureDecryptMulti");
+
+    return exitCode;
+  }
+
+  //
+  // Encrypt one packet and compute its authentication tag.
+  //
+  // Packets are numbered implicitly, so remote MUST decrypt them in the
+  // same order using SecureDecryptPacket(). Every packet is encrypted
+  // with its own iv using keys of sending direction.
+  //
+  // ctx    - secure context containing cipher state created by
+  //          SecurePacketCipherCreate before (IN/OUT).
+  //
+  // buffer - buffer to encrypt in place (IN/OUT).
+  //
+  // size   - size of buffer[] in bytes (IN).
+  //
+  // tag    - buffer, where to store SECURE_PACKET_TAG_SIZE bytes of
+  //          authentication tag (OUT).
+  //
+  // RETURNS: 0 if OK,
+  //          -1 if cipher failed.
+  //
+
+  int SecureEncryptPacket(SecureCipher *ctx, void *buffer, int size, void *tag)
+  {
+    DBG_ENTER3("SecureEncryptPacket");
+
+    int exitCode = -1;
+
+    unsigned char iv[16];
+
+    unsigned char mac[SHA256_DIGEST_LENGTH];
+
+    int num = 0;
+
+    int outSize = 0;
+
+    SecurePacketKeys *pk = &(ctx -> packetSend_);
+
+    uint64_t seq = pk -> seq_;
+
+    EVP_CIPHER_CTX *evp = pk -> evp_;
+
+    FAILEX(ctx -> packetReady_ == 0,
+               "ERROR: Cipher was not created by SecurePacketCipherCreate().\n");
+
+    switch(ctx -> cipher_)
+    {
+      //
+      // Blowfish-CFB, encrypt-then-MAC.
+      //
+
+      case SECURE_CIPHER_BLOWFISH:
+      {
+        SecurePacketIv(pk, seq, iv);
+
+        BF_cfb64_encrypt((unsigned char *) buffer, (unsigned char *) buffer,
+                             size, &(pk -> bfKey_), iv, &num, BF_ENCRYPT);
+
+        FAIL(SecurePacketMac(pk, seq, buffer, size, mac));
+
+        memcpy(tag, mac, SECURE_PACKET_TAG_SIZE);
+
+        break;
+      }
+
+      //
+      // AES-CTR, encrypt-then-MAC.
+      //
+
+      case SECURE_CIPHER_AES_CTR:
+      {
+        SecureAesPacketIv(pk, seq, iv);
+
+        FAIL(EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, 1) != 1);
 
-namespace Tegenaria
-{
-  //
-  // Encrypt data.
-  //
-  // ctx    - secure context containing cipher state created by
-  //          SecureCipherCreate before (IN/OUT).
-  //
-  // buffer - buffer to encrypt (IN/OUT).
-  //
-  // size   - size of buffer[] in bytes (IN).
-  //
+        FAIL(EVP_CipherUpdate(evp, (unsigned char *) buffer, &outSize,
+                                  (unsigned char *) buffer, size) != 1);
 
-  void SecureEncrypt(SecureCipher *ctx, void *buffer, int size)
-  {
-    DBG_ENTER3("SecureEncrypt");
+        FAIL(SecurePacketMac(pk, seq, buffer, size, mac));
 
-    unsigned char iv[16];
+        memcpy(tag, mac, SECURE_PACKET_TAG_SIZE);
 
-    int num = 0;
+        break;
+      }
 
-    int *piv = (int *) iv;
+      //
+      // AES-GCM. Tag computed by cipher itself.
+      //
 
-    memcpy(iv, ctx -> iv_, 16);
+      case SECURE_CIPHER_AES_GCM:
+      {
+        SecureAesPacketIv(pk, seq, iv);
 
-    //
-    // Apply counter number for CTR mode.
-    //
+        FAIL(EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, 1) != 1);
 
-    if (ctx -> cipherMode_ == SECURE_CIPHER_MODE_CTR)
-    {
-      (*piv) ^= ctx -> counterEncrypt_;
+        FAIL(EVP_CipherUpdate(evp, (unsigned char *) buffer, &outSize,
+                                  (unsigned char *) buffer, size) != 1);
+
+        FAIL(EVP_CipherFinal_ex(evp, mac, &outSize) != 1);
+
+        FAIL(EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_GCM_GET_TAG,
+                                     SECURE_PACKET_TAG_SIZE, tag) != 1);
 
-      ctx -> counterEncrypt_ ++;
+        break;
+      }
     }
 
+    pk -> seq_ ++;
+
+    exitCode = 0;
+
     //
-    // Encrypt data.
+    // Error handler.
     //
 
-    BF_cfb64_encrypt((unsigned char *) buffer, (unsigned char *) buffer,
-                         size, &(ctx -> key_), (unsigned char *) iv, &num, BF_ENCRYPT);
+    fail:
 
-    DBG_LEAVE3("SecureEncrypt");
+    if (exitCode)
+    {
+      Error("ERROR: Cannot encrypt packet #%llu.\n", (unsigned long long) seq);
+    }
+
+    DBG_LEAVE3("SecureEncryptPacket");
+
+    return exitCode;
   }
 
   //
-  // Decrypt data.
+  // Verify authentication tag and decrypt one packet encrypted by
+  // SecureEncryptPacket() on remote side.
   //
   // ctx    - secure context containing cipher state created by
-  //          SecureCipherCreate before (IN/OUT).
+  //          SecurePacketCipherCreate before (IN/OUT).
   //
-  // buffer - buffer to decrypt (IN/OUT).
+  // buffer - buffer to decrypt in place (IN/OUT).
   //
   // size   - size of buffer[] in bytes (IN).
   //
+  // tag    - SECURE_PACKET_TAG_SIZE bytes of authentication tag
+  //          received with packet (IN).
+  //
+  // RETURNS: 0 if OK,
+  //          -1 if packet was modified, replayed, reordered or
+  //          reflected back from our own sending direction.
+  //
 
-  void SecureDecrypt(SecureCipher *ctx, void *buffer, int size)
+  int SecureDecryptPacket(SecureCipher *ctx, void *buffer, int size, const void *tag)
   {
-    DBG_ENTER("SecureDecrypt");
+    DBG_ENTER3("SecureDecryptPacket");
+
+    int exitCode = -1;
 
     unsigned char iv[16];
 
+    unsigned char mac[SHA256_DIGEST_LENGTH];
+
+    unsigned char diff = 0;
+
     int num = 0;
 
-    int *piv = (int *) iv;
+    int outSize = 0;
 
-    memcpy(iv, ctx -> iv_, 16);
+    SecurePacketKeys *pk = &(ctx -> packetRecv_);
+
+    uint64_t seq = pk -> seq_;
+
+    EVP_CIPHER_CTX *evp = pk -> evp_;
+
+    FAILEX(ctx -> packetReady_ == 0,
+               "ERROR: Cipher was not created by SecurePacketCipherCreate().\n");
+
+    //
+    // AES-GCM. Decrypt and verify tag in one pass.
+    // Don't leave unauthenticated plain text in caller buffer.
+    //
+
+    if (ctx -> cipher_ == SECURE_CIPHER_AES_GCM)
+    {
+      SecureAesPacketIv(pk, seq, iv);
+
+      FAIL(EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, 0) != 1);
+
+      FAIL(EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_GCM_SET_TAG,
+                                   SECURE_PACKET_TAG_SIZE, (void *) tag) != 1);
+
+      FAIL(EVP_CipherUpdate(evp, (unsigned char *) buffer, &outSize,
+                                (unsigned char *) buffer, size) != 1);
+
+      if (EVP_CipherFinal_ex(evp, mac, &outSize) != 1)
+      {
+        memset(buffer, 0, size);
+
+        FAILEX(1, "ERROR: Packet #%llu authentication failed.\n",
+                   (unsigned long long) seq);
+      }
+    }
 
     //
-    // Apply counter number for CTR mode.
+    // Blowfish-CFB or AES-CTR with HMAC.
     //
 
-    if (ctx -> cipherMode_ == SECURE_CIPHER_MODE_CTR)
+    else
     {
-      (*piv) ^= ctx -> counterDecrypt_;
+      //
+      // Verify tag first. Compare in constant time.
+      //
+
+      FAIL(SecurePacketMac(pk, seq, buffer, size, mac));
+
+      for (int i = 0; i < SECURE_PACKET_TAG_SIZE; i++)
+      {
+        diff |= mac[i] ^ ((const unsigned char *) tag)[i];
+      }
+
+      FAILEX(diff != 0, "ERROR: Packet #%llu authentication failed.\n",
+                 (unsigned long long) seq);
+
+      //
+      // Decrypt.
+      //
+
+      if (ctx -> cipher_ == SECURE_CIPHER_BLOWFISH)
+      {
+        SecurePacketIv(pk, seq, iv);
+
+        BF_cfb64_encrypt((unsigned char *) buffer, (unsigned char *) buffer,
+                             size, &(pk -> bfKey_), iv, &num, BF_DECRYPT);
+      }
+      else
+      {
+        SecureAesPacketIv(pk, seq, iv);
+
+        FAIL(EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, 0) != 1);
 
-      ctx -> counterDecrypt_ ++;
+        FAIL(EVP_CipherUpdate(evp, (unsigned char *) buffer, &outSize,
+                                  (unsigned char *) buffer, size) != 1);
+      }
     }
 
+    pk -> seq_ ++;
+
+    exitCode = 0;
+
     //
-    // Decrypt data.
+    // Error handler.
     //
 
-    BF_cfb64_encrypt((unsigned char *) buffer, (unsigned char *) buffer,
-                         size, &(ctx -> key_), (unsigned char *) iv, &num, BF_DECRYPT);
+    fail:
+
+    DBG_LEAVE3("SecureDecryptPacket");
 
-    DBG_LEAVE3("SecureDecrypt");
+    return exitCode;
   }
 
   //
@@ -209,6 +858,49 @@ namespace Tegenaria
         break;
       }
 
+      //
+      // AES-CTR and AES-GCM.
+      //
+      // Expand key once for each direction, iv is set per call.
+      //
+
+      case SECURE_CIPHER_AES_CTR:
+      case SECURE_CIPHER_AES_GCM:
+      {
+        const EVP_CIPHER *evp = SecureAesGetEvp(cipher, keySize);
+
+        FAILEX(ivSize != SECURE_AES_IV_SIZE,
+                   "ERROR: iv[] musts have %d bytes long for AES cipher.\n",
+                       SECURE_AES_IV_SIZE);
+
+        FAILEX(evp == NULL,
+                   "ERROR: key[] musts have 16, 24 or 32 bytes long for AES cipher.\n");
+
+        //
+        // AES is used as stream cipher. Fixed iv would repeat the same
+        // keystream for every call.
+        //
+
+        FAILEX(cipherMode != SECURE_CIPHER_MODE_CTR,
+                   "ERROR: AES cipher requires SECURE_CIPHER_MODE_CTR.\n");
+
+        memcpy(ctx -> iv_, iv, ivSize);
+
+        ctx -> evpEncrypt_ = EVP_CIPHER_CTX_new();
+        ctx -> evpDecrypt_ = EVP_CIPHER_CTX_new();
+
+        FAIL(ctx -> evpEncrypt_ == NULL);
+        FAIL(ctx -> evpDecrypt_ == NULL);
+
+        FAIL(EVP_CipherInit_ex(ctx -> evpEncrypt_, evp, NULL,
+                                   (unsigned char *) key, NULL, 1) != 1);
+
+        FAIL(EVP_CipherInit_ex(ctx -> evpDecrypt_, evp, NULL,
+                                   (unsigned char *) key, NULL, 0) != 1);
+
+        break;
+      }
+
       //
       // Unknown cipher.
       //
@@ -227,6 +919,8 @@ namespace Tegenaria
 
     exitCode = 0;
 
+    fail:
+
     if (exitCode)
     {
       Error("Cannot init cipher context '%d' mode '%d'.\n", cipher, cipherMode);
@@ -236,9 +930,186 @@ namespace Tegenaria
       ctx = NULL;
     }
 
+    DBG_LEAVE("SecureCipherCreate");
+
+    return ctx;
+  }
+
+  //
+  // Derive keys of one packet direction from shared secret.
+  //
+  // ctx     - cipher context created by SecureCipherCreate() (IN).
+  // pk      - direction keys to init (OUT).
+  // label   - direction label, "c2s" or "s2c" (IN).
+  // enc     - 1 for sending direction, 0 for receiving one (IN).
+  // key     - shared secret key (IN).
+  // keySize - size of key[] buffer in bytes (IN).
+  // iv      - shared init vector (IN).
+  // ivSize  - size of iv[] buffer in bytes (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  static int SecurePacketKeysInit(SecureCipher *ctx, SecurePacketKeys *pk,
+                                      const char *label, int enc,
+                                          const char *key, int keySize,
+                                              const char *iv, int ivSize)
+  {
+    int exitCode = -1;
+
+    //
+    // Direction key | iv | MAC key.
+    //
+
+    unsigned char okm[32 + 16 + SHA256_DIGEST_LENGTH];
+
+    unsigned char *dirKey = okm;
+    unsigned char *dirIv  = okm + keySize;
+    unsigned char *macKey = okm + keySize + 16;
+
+    FAIL(keySize > 32);
+
+    FAIL(SecureHkdf(okm, keySize + 16 + SHA256_DIGEST_LENGTH,
+                        key, keySize, iv, ivSize, label));
+
+    memcpy(pk -> iv_, dirIv, 16);
+
+    if (ctx -> cipher_ == SECURE_CIPHER_BLOWFISH)
+    {
+      BF_set_key(&(pk -> bfKey_), keySize, dirKey);
+    }
+    else
+    {
+      pk -> evp_ = EVP_CIPHER_CTX_new();
+
+      FAIL(pk -> evp_ == NULL);
+
+      FAIL(EVP_CipherInit_ex(pk -> evp_, SecureAesGetEvp(ctx -> cipher_, keySize),
+                                 NULL, dirKey, NULL, enc) != 1);
+    }
+
+    //
+    // GCM has own tag, other ciphers use HMAC.
+    //
+
+    if (ctx -> cipher_ != SECURE_CIPHER_AES_GCM)
+    {
+      FAIL(SecurePacketInitMac(pk, macKey));
+    }
+
+    exitCode = 0;
+
     fail:
 
-    DBG_LEAVE("SecureCipherCreate");
+    memset(okm, 0, sizeof(okm));
+
+    return exitCode;
+  }
+
+  //
+  // Free keys of one packet direction.
+  //
+
+  static void SecurePacketKeysFree(SecurePacketKeys *pk)
+  {
+    if (pk -> evp_)
+    {
+      EVP_CIPHER_CTX_free(pk -> evp_);
+    }
+
+    if (pk -> macInner_)
+    {
+      EVP_MD_CTX_destroy(pk -> macInner_);
+    }
+
+    if (pk -> macOuter_)
+    {
+      EVP_MD_CTX_destroy(pk -> macOuter_);
+    }
+
+    if (pk -> macWork_)
+    {
+      EVP_MD_CTX_destroy(pk -> macWork_);
+    }
+  }
+
+  //
+  // Create cipher context for authenticated packets, see
+  // SecureEncryptPacket() and SecureDecryptPacket().
+  //
+  // Both sides share one key and iv. Separate keys for client to server
+  // and server to client directions are derived from them, so packets
+  // sent in one direction can't be decrypted with keystream of the
+  // other one and packet reflected back to its sender fails MAC check.
+  //
+  // cipher  - cipher to use, see SECURE_CIPHER_XXX defines in Secure.h (IN).
+  // intent  - SECURE_INTENT_CLIENT or SECURE_INTENT_SERVER. Both sides
+  //           MUST use different intents (IN).
+  // key     - shared symmetric key (IN).
+  // keySize - size of key[] buffer in bytes (IN).
+  // iv      - shared init vector (IN).
+  // ivSize  - size of iv[] buffer in bytes (IN).
+  //
+  // RETURNS: Pointer to new allocated cipher context,
+  //          or NULL if error.
+  //
+
+  SecureCipher *SecurePacketCipherCreate(int cipher, int intent,
+                                             const char *key, int keySize,
+                                                 const char *iv, int ivSize)
+  {
+    DBG_ENTER("SecurePacketCipherCreate");
+
+    int exitCode = -1;
+
+    const char *sendLabel = "c2s";
+    const char *recvLabel = "s2c";
+
+    SecureCipher *ctx = NULL;
+
+    FAILEX(intent != SECURE_INTENT_CLIENT && intent != SECURE_INTENT_SERVER,
+               "ERROR: Unknown intent '%d'.\n", intent);
+
+    if (intent == SECURE_INTENT_SERVER)
+    {
+      sendLabel = "s2c";
+      recvLabel = "c2s";
+    }
+
+    //
+    // Check key/iv and init common state.
+    //
+
+    ctx = SecureCipherCreate(cipher, SECURE_CIPHER_MODE_CTR, key, keySize, iv, ivSize);
+
+    FAIL(ctx == NULL);
+
+    //
+    // Derive direction keys.
+    //
+
+    FAIL(SecurePacketKeysInit(ctx, &(ctx -> packetSend_), sendLabel, 1,
+                                  key, keySize, iv, ivSize));
+
+    FAIL(SecurePacketKeysInit(ctx, &(ctx -> packetRecv_), recvLabel, 0,
+                                  key, keySize, iv, ivSize));
+
+    ctx -> packetReady_ = 1;
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create packet cipher '%d'.\n", cipher);
+
+      SecureCipherDestroy(ctx);
+
+      ctx = NULL;
+    }
+
+    DBG_LEAVE("SecurePacketCipherCreate");
 
     return ctx;
   }
@@ -253,9 +1124,94 @@ namespace Tegenaria
 
     if (ctx)
     {
+      if (ctx -> evpEncrypt_)
+      {
+        EVP_CIPHER_CTX_free(ctx -> evpEncrypt_);
+      }
+
+      if (ctx -> evpDecrypt_)
+      {
+        EVP_CIPHER_CTX_free(ctx -> evpDecrypt_);
+      }
+
+      SecurePacketKeysFree(&(ctx -> packetSend_));
+      SecurePacketKeysFree(&(ctx -> packetRecv_));
+
+      memset(ctx, 0, sizeof(SecureCipher));
+
       free(ctx);
     }
 
     DBG_LEAVE("SecureCipherDestroy");
   }
+
+  //
+  // IOCipher implementation to encrypt IOMixer channels.
+  // One SecureCipher serves both directions, because packet encrypt
+  // and decrypt counters are separated.
+  //
+
+  class SecureMixerCipher : public IOCipher
+  {
+    SecureCipher *ctx_;
+
+    public:
+
+    SecureMixerCipher(SecureCipher *ctx)
+    {
+      ctx_ = ctx;
+    }
+
+    ~SecureMixerCipher()
+    {
+      SecureCipherDestroy(ctx_);
+    }
+
+    int encrypt(void *buf, int size, void *tag)
+    {
+      return SecureEncryptPacket(ctx_, buf, size, tag);
+    }
+
+    int decrypt(void *buf, int size, const void *tag)
+    {
+      return SecureDecryptPacket(ctx_, buf, size, tag);
+    }
+
+    int tagSize()
+    {
+      return SECURE_PACKET_TAG_SIZE;
+    }
+  };
+
+  //
+  // Create authenticated cipher to encrypt one IOMixer channel.
+  // Pass returned object to IOMixer::setSlaveEncryption() on both sides
+  // using the same key and iv, but different intents.
+  //
+  // cipher  - cipher to use, see SECURE_CIPHER_XXX defines in Secure.h (IN).
+  // intent  - SECURE_INTENT_CLIENT on one side, SECURE_INTENT_SERVER
+  //           on the other one (IN).
+  // key     - symmetric key to use (IN).
+  // keySize - size of key[] buffer in bytes (IN).
+  // iv      - init vector, can be treated as second part of key (IN).
+  // ivSize  - size of iv[] buffer in bytes (IN).
+  //
+  // RETURNS: Cipher object owned by IOMixer after setSlaveEncryption(),
+  //          or NULL if error.
+  //
+
+  IOCipher *SecureMixerCipherCreate(int cipher, int intent,
+                                        const char *key, int keySize,
+                                            const char *iv, int ivSize)
+  {
+    SecureCipher *ctx = SecurePacketCipherCreate(cipher, intent,
+                                                     key, keySize, iv, ivSize);
+
+    if (ctx == NULL)
+    {
+      return NULL;
+    }
+
+    return new SecureMixerCipher(ctx);
+  }
 } /* namespace Tegenaria */
@@ -51,44 +51,161 @@
 //
 
 #include "Secure.h"
+#include "Internal.h"
 
-#ifdef WIN64
-  static int Win64NotImportedError()
-  {
-    fprintf(stderr, "OpenSSL is not imported on Win64");
-    exit(-1);
-  }
-
-  #define SSL_write(x, y, z)                           Win64NotImportedError()
-  #define SSL_read(x, y, z)                            Win64NotImportedError()
-  #define SSL_free(x)                                  Win64NotImportedError()
-  #define SSL_CTX_free(x)                              Win64NotImportedError()
-  #define SSL_is_init_finished(x)                      Win64NotImportedError()
-  #define SSL_do_handshake(x)                          Win64NotImportedError()
-  #define BIO_read(x, y, z)                            Win64NotImportedError()
-  #define BIO_write(x, y, z)                           Win64NotImportedError()
-  #define SSL_library_init()                           Win64NotImportedError()
-  #define SSL_CTX_new(x)                               (SSL_CTX *) Win64NotImportedError()
-  #define SSL_CTX_use_certificate_chain_file(x, y)     Win64NotImportedError()
-  #define SSL_CTX_set_default_passwd_cb(x, y)          Win64NotImportedError()
-  #define SSL_CTX_set_default_passwd_cb_userdata(x, y) Win64NotImportedError()
-  #define SSL_CTX_use_PrivateKey_file(x, y, z)         Win64NotImportedError()
-  #define SSL_CTX_use_certificate_file(x, y, z)        Win64NotImportedError()
-  #define SSL_CTX_set_options(x, y)                    Win64NotImportedError()
-  #define SSL_CTX_set_session_id_context(x, y, z)      Win64NotImportedError()
-  #define SSL_new(x)                                   (SSL *) Win64NotImportedError()
-  #define SSL_set_accept_state(x)                      Win64NotImportedError()
-  #define SSL_set_verify(x, y, z)                      Win64NotImportedError()
-  #define SSL_set_session_id_context(x, y, z)          Win64NotImportedError()
-  #define BIO_s_mem()                                  Win64NotImportedError()
-  #define SSL_set_connect_state(x)                     Win64NotImportedError()
-  #define BIO_new(x)                                   (BIO *) Win64NotImportedError()
-  #define BIO_set_nbio(x, y)                           Win64NotImportedError()
-  #define SSL_set_bio(x, y, z)                         Win64NotImportedError()
+#ifndef WIN32
+# include <poll.h>
+# include <time.h>
 #endif
 
 namespace Tegenaria
 {
+  //
+  // Get monotonic time in ms. Used to count down timeouts in TLS stream
+  // mode.
+  //
+  // Used internally only.
+  //
+
+  static int64_t SecureGetTimeMs()
+  {
+    #ifdef WIN32
+    {
+      return int64_t(GetTickCount());
+    }
+    #else
+    {
+      struct timespec ts = {0};
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+
+      return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+    #endif
+  }
+
+  //
+  // Convert timeout in ms into deadline for streamWait().
+  //
+  // Used internally only.
+  //
+  // timeout - timeout in ms, set to -1 for infinite (IN).
+  //
+  // RETURNS: Deadline in SecureGetTimeMs() units or -1 if infinite.
+  //
+
+  static int64_t SecureGetDeadline(int timeout)
+  {
+    return (timeout < 0) ? -1 : SecureGetTimeMs() + timeout;
+  }
+
+  //
+  // Wait until underlying non-blocking IO is ready for the operation,
+  // which SSL call in TLS stream mode failed on.
+  //
+  // Used internally only.
+  //
+  // TIP#1: Use it in a loop around SSL call:
+  //
+  //        do
+  //        {
+  //          ret = SSL_read(ssl_, buf, len);
+  //        }
+  //        while(ret <= 0 && streamWait(ret, deadline) == 1);
+  //
+  // ret      - value returned by failed SSL_read(), SSL_write() or
+  //            SSL_do_handshake() call (IN).
+  //
+  // deadline - deadline computed by SecureGetDeadline() (IN).
+  //
+  // RETURNS: 1 if IO is ready and SSL call should be repeated,
+  //          0 if timeout,
+  //          -1 if SSL call failed for other reason than not ready IO.
+  //
+
+  int SecureConnection::streamWait(int ret, int64_t deadline)
+  {
+    int err = SSL_get_error(ssl_, ret);
+
+    int forWrite = 0;
+
+    int fd = -1;
+
+    int timeout = -1;
+
+    switch(err)
+    {
+      case SSL_ERROR_WANT_READ:  forWrite = 0; break;
+      case SSL_ERROR_WANT_WRITE: forWrite = 1; break;
+
+      default:
+      {
+        return -1;
+      }
+    }
+
+    if (ioMode_ == SECURE_IOMODE_SOCKET)
+    {
+      fd = sock_;
+    }
+    else
+    {
+      fd = forWrite ? fdOut_ : fdIn_;
+    }
+
+    for (;;)
+    {
+      if (deadline >= 0)
+      {
+        int64_t now = SecureGetTimeMs();
+
+        timeout = (deadline > now) ? int(deadline - now) : 0;
+      }
+
+      #ifdef WIN32
+      {
+        fd_set fds;
+
+        struct timeval tv;
+
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+
+        tv.tv_sec  = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+
+        ret = select(0, forWrite ? NULL : &fds, forWrite ? &fds : NULL,
+                         NULL, (timeout < 0) ? NULL : &tv);
+      }
+      #else
+      {
+        struct pollfd pfd;
+
+        pfd.fd      = fd;
+        pfd.events  = forWrite ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+
+        ret = poll(&pfd, 1, timeout);
+
+        if (ret < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      }
+      #endif
+
+      break;
+    }
+
+    if (ret == 0)
+    {
+      Error("ERROR: Timeout while waiting for %s on TLS connection.\n",
+                forWrite ? "write" : "read");
+    }
+
+    return (ret > 0) ? 1 : ret;
+  }
+
   //
   // Write <len> bytes directly to underlying IO skipping SSL object beetwen.
   //
@@ -258,6 +375,19 @@ namespace Tegenaria
 
     int readed = 0;
 
+    //
+    // No memory BIOs in TLS stream mode.
+    //
+
+    if (stream_)
+    {
+      Error("ERROR: encrypt() is not available in TLS stream mode.\n");
+
+      DBG_LEAVE3("SecureConnection::encrypt");
+
+      return -1;
+    }
+
     //
     // Pass unecrypted message to SSL BIO.
     //
@@ -294,6 +424,19 @@ namespace Tegenaria
 
     int readed = 0;
 
+    //
+    // No memory BIOs in TLS stream mode.
+    //
+
+    if (stream_)
+    {
+      Error("ERROR: decrypt() is not available in TLS stream mode.\n");
+
+      DBG_LEAVE3("SecureConnection::decrypt");
+
+      return -1;
+    }
+
     //
     // Pass readed enrypted data to SSL BIO.
     //
@@ -311,6 +454,148 @@ namespace Tegenaria
     return readed;
   }
 
+  //
+  // Pass plain data to SSL object to encrypt it. Encrypted data is kept
+  // inside SSL until taken by encryptPop().
+  //
+  // buffer     - source buffer with data to encrypt (IN).
+  // bufferSize - number of bytes to be encrypted (IN).
+  //
+  // RETURNS: Number of encrypted bytes waiting for encryptPop() or
+  //          -1 if error.
+  //
+
+  int SecureConnection::encryptPush(const void *buffer, int bufferSize)
+  {
+    DBG_ENTER3("SecureConnection::encryptPush");
+
+    int exitCode = -1;
+
+    int pending = -1;
+
+    FAILEX(stream_, "ERROR: encryptPush() is not available in TLS stream mode.\n");
+
+    FAIL(SSL_write(ssl_, buffer, bufferSize) != bufferSize);
+
+    pending = int(BIO_ctrl_pending(writeBio_));
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE3("SecureConnection::encryptPush");
+
+    return exitCode ? -1 : pending;
+  }
+
+  //
+  // Take back data encrypted by encryptPush() before.
+  // Can be called many times to split data into many buffers.
+  //
+  // encrypted     - buffer, where to store encrypted data (OUT).
+  // encryptedSize - size of encrypted[] buffer in bytes (IN).
+  //
+  // RETURNS: Number of bytes written to encrypted[],
+  //          0 if no more encrypted data pending.
+  //
+
+  int SecureConnection::encryptPop(void *encrypted, int encryptedSize)
+  {
+    DBG_ENTER3("SecureConnection::encryptPop");
+
+    int readed = 0;
+
+    if (stream_ == 0)
+    {
+      readed = BIO_read(writeBio_, encrypted, encryptedSize);
+    }
+
+    DBG_LEAVE3("SecureConnection::encryptPop");
+
+    return readed > 0 ? readed : 0;
+  }
+
+  //
+  // RETURNS: Number of encrypted bytes waiting for encryptPop().
+  //
+
+  int SecureConnection::encryptPending()
+  {
+    if (stream_ || writeBio_ == NULL)
+    {
+      return 0;
+    }
+
+    return int(BIO_ctrl_pending(writeBio_));
+  }
+
+  //
+  // Pass encrypted data readed from underlying IO to SSL object.
+  // Use decryptPop() to get back decrypted data.
+  //
+  // TIP#1: Encrypted stream can be passed in any pieces, e.g. directly
+  //        from segments of network buffer.
+  //
+  // encrypted     - encrypted data readed from underlying IO (IN).
+  // encryptedSize - number of bytes in encrypted[] buffer (IN).
+  //
+  // RETURNS: 0 if OK,
+  //          -1 if error.
+  //
+
+  int SecureConnection::decryptPush(const void *encrypted, int encryptedSize)
+  {
+    DBG_ENTER3("SecureConnection::decryptPush");
+
+    int exitCode = -1;
+
+    FAILEX(stream_, "ERROR: decryptPush() is not available in TLS stream mode.\n");
+
+    FAIL(BIO_write(readBio_, encrypted, encryptedSize) != encryptedSize);
+
+    exitCode = 0;
+
+    fail:
+
+    DBG_LEAVE3("SecureConnection::decryptPush");
+
+    return exitCode;
+  }
+
+  //
+  // Take back data decrypted from encrypted stream passed by
+  // decryptPush() before. One call returns at most one record, call it
+  // in loop until 0 returned.
+  //
+  // decrypted     - buffer, where to store decrypted data (OUT).
+  // decryptedSize - size of decrypted[] buffer in bytes (IN).
+  //
+  // RETURNS: Number of bytes written to decrypted[],
+  //          0 if no more complete records pending,
+  //          -1 if error.
+  //
+
+  int SecureConnection::decryptPop(void *decrypted, int decryptedSize)
+  {
+    DBG_ENTER3("SecureConnection::decryptPop");
+
+    int readed = -1;
+
+    if (stream_ == 0)
+    {
+      readed = SSL_read(ssl_, decrypted, decryptedSize);
+
+      if (readed <= 0)
+      {
+        readed = (SSL_get_error(ssl_, readed) == SSL_ERROR_WANT_READ) ? 0 : -1;
+      }
+    }
+
+    DBG_LEAVE3("SecureConnection::decryptPop");
+
+    return readed;
+  }
+
   //
   // Write <len> bytes throught secure connection.
   //
@@ -333,6 +618,26 @@ namespace Tegenaria
 
     int encryptedSize = 0;
 
+    //
+    // TLS stream mode.
+    // SSL writes encrypted records to underlying IO itself.
+    //
+
+    if (stream_)
+    {
+      int64_t deadline = SecureGetDeadline(timeout);
+
+      do
+      {
+        written = SSL_write(ssl_, buf, len);
+      }
+      while(written <= 0 && streamWait(written, deadline) == 1);
+
+      DBG_LEAVE3("SecureConnection::write");
+
+      return written;
+    }
+
     //
     // Encrypt message.
     //
@@ -375,6 +680,26 @@ namespace Tegenaria
 
     int encryptedSize = 0;
 
+    //
+    // TLS stream mode.
+    // SSL reads encrypted records from underlying IO itself.
+    //
+
+    if (stream_)
+    {
+      int64_t deadline = SecureGetDeadline(timeout);
+
+      do
+      {
+        readed = SSL_read(ssl_, buf, len);
+      }
+      while(readed <= 0 && streamWait(readed, deadline) == 1);
+
+      DBG_LEAVE3("SecureConnection::read");
+
+      return readed;
+    }
+
     //
     // Read encrypted data from underlying IO.
     //
@@ -574,12 +899,22 @@ namespace Tegenaria
 
     if (ssl_)
     {
+      //
+      // Mark established session as closed cleanly. Otherwise OpenSSL
+      // treats it as broken and drops it from resumption.
+      //
+
+      if (state_ == SECURE_STATE_ESTABLISHED)
+      {
+        SSL_set_shutdown(ssl_, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+      }
+
       SSL_free(ssl_);
     }
 
-    if (sslCtx_)
+    if (ctx_)
     {
-      SSL_CTX_free(sslCtx_);
+      ctx_ -> release();
     }
 
     DBG_LEAVE("SecureConnection::~SecureConnection");
@@ -624,25 +959,41 @@ namespace Tegenaria
     int readed  = 0;
     int written = 0;
 
+    int entryState     = state_;
+    int customCapacity = customSize ? *customSize : 0;
+    int customUsed     = 0;
+
     //
     // Handshake finished.
+    // Last flight still waiting in SSL BIO is flushed in write turn below.
+    // Client waiting for server's "OK" is handled in read turn below.
     //
 
-    if (SSL_is_init_finished(ssl_))
+    if (SSL_is_init_finished(ssl_)
+            && state_ != SECURE_STATE_HANDSHAKE_READ
+                && BIO_ctrl_pending(writeBio_) == 0)
     {
       state_ = SECURE_STATE_ESTABLISHED;
 
       //
       // Server should sent "OK" message at the end of handshake.
+      // If not arrived yet, go on to read turn.
       //
 
       if (intent_ == SECURE_INTENT_CLIENT)
       {
         readed = SSL_read(ssl_, buffer, 2);
 
-        FAIL(readed != 2);
-        FAIL(buffer[0] != 'O');
-        FAIL(buffer[1] != 'K');
+        if (readed <= 0 && SSL_get_error(ssl_, readed) == SSL_ERROR_WANT_READ)
+        {
+          state_ = SECURE_STATE_HANDSHAKE_READ;
+        }
+        else
+        {
+          FAIL(readed != 2);
+          FAIL(buffer[0] != 'O');
+          FAIL(buffer[1] != 'K');
+        }
       }
     }
 
@@ -689,6 +1040,8 @@ namespace Tegenaria
 
             *customSize = readed;
 
+            customUsed = readed;
+
             written = readed;
           }
 
@@ -707,11 +1060,20 @@ namespace Tegenaria
 
           //
           // Handshake finished.
+          // Client ends here when session was resumed. Go on to read
+          // turn to receive "OK" message from server.
           //
 
           if (SSL_is_init_finished(ssl_))
           {
-            state_ = SECURE_STATE_ESTABLISHED;
+            if (intent_ == SECURE_INTENT_CLIENT)
+            {
+              state_ = SECURE_STATE_HANDSHAKE_READ;
+            }
+            else
+            {
+              state_ = SECURE_STATE_ESTABLISHED;
+            }
           }
 
           //
@@ -809,13 +1171,26 @@ namespace Tegenaria
 
     //
     // Server send ecrypted "OK" message if handshake finished.
+    // Custom IO: append it after last flight returned in write turn.
+    // If handshake finished in read turn, customBuffer[] holds input data
+    // and caller (5-parameter handshakeStep) puts "OK" to output buffer.
     //
 
-    if (state_ == SECURE_STATE_ESTABLISHED && intent_ == SECURE_INTENT_SERVER)
+    if (state_ == SECURE_STATE_ESTABLISHED
+            && intent_ == SECURE_INTENT_SERVER
+                && handshakeDone_ == 0)
     {
       if (ioMode_ == SECURE_IOMODE_NONE)
       {
-        *customSize = this -> encrypt(customBuffer, *customSize, "OK", 2);
+        if (entryState != SECURE_STATE_HANDSHAKE_READ)
+        {
+          written = this -> encrypt((char *) customBuffer + customUsed,
+                                        customCapacity - customUsed, "OK", 2);
+
+          FAIL(written <= 0);
+
+          *customSize = customUsed + written;
+        }
 
         DEBUG1("SSL Handshake finished.\n");
       }
@@ -825,6 +1200,17 @@ namespace Tegenaria
       }
     }
 
+    //
+    // Pass negotiated session to context once handshake finished.
+    //
+
+    if (state_ == SECURE_STATE_ESTABLISHED && handshakeDone_ == 0)
+    {
+      ctx_ -> handshakeFinished(ssl_);
+
+      handshakeDone_ = 1;
+    }
+
     exitCode = 0;
 
     fail:
@@ -887,6 +1273,23 @@ namespace Tegenaria
       FAIL(this -> handshakeStep(outputBuffer, outputSize));
     }
 
+    //
+    // Handshake finished on input data.
+    // Server still needs to send encrypted "OK" message, client has
+    // nothing more to write.
+    //
+
+    else if (this -> intent_ == SECURE_INTENT_SERVER)
+    {
+      *outputSize = this -> encrypt(outputBuffer, *outputSize, "OK", 2);
+
+      FAIL(*outputSize <= 0);
+    }
+    else
+    {
+      *outputSize = 0;
+    }
+
     //
     // Error handler.
     //
@@ -901,32 +1304,162 @@ namespace Tegenaria
   }
 
   //
-  // Create empty secure connection object.
-  // Used internally only.
+  // Non-blocking handshake for custom IO (SECURE_IOMODE_NONE).
+  // Never waits for underlying IO.
   //
-  // TIP#1: Don't create SecureConnection object directly.
-  //        Use one of SecureConnectionCreate() function instead.
+  // Caller algorithm:
   //
+  // while(sc -> handshakeContinue() == 0)
+  // {
+  //   Write data taken by encryptPop() to underlying IO.
+  //   Wait until underlying IO is readable.
+  //   Pass readed data by decryptPush().
+  // }
+  //
+  // Write data taken by encryptPop() to underlying IO.
+  //
+  // TIP#1: Input can be passed in any pieces. There is no limit on flight
+  //        size unlike 5-parameter handshakeStep().
+  //
+  // TIP#2: Function does not touch underlying IO, so it can be called from
+  //        another thread, as long as only one thread uses connection at
+  //        the same time.
+  //
+  // RETURNS: 1 if handshake finished,
+  //          0 if more data from peer needed,
+  //          -1 if error.
+  //
+
+  int SecureConnection::handshakeContinue()
+  {
+    DBG_ENTER3("SecureConnection::handshakeContinue");
+
+    int exitCode = -1;
+
+    int finished = 0;
+
+    int ret = 0;
+
+    char buffer[2];
+
+    FAILEX(stream_, "ERROR: handshakeContinue() is not available in TLS stream mode.\n");
+
+    if (state_ == SECURE_STATE_ESTABLISHED)
+    {
+      finished = 1;
+    }
+
+    //
+    // Move SSL handshake forward as far as data readed from peer allows.
+    //
+
+    else
+    {
+      if (SSL_is_init_finished(ssl_) == 0)
+      {
+        ret = SSL_do_handshake(ssl_);
+
+        if (ret <= 0)
+        {
+          ret = SSL_get_error(ssl_, ret);
+
+          FAIL(ret != SSL_ERROR_WANT_READ && ret != SSL_ERROR_WANT_WRITE);
+        }
+      }
+
+      //
+      // SSL handshake finished.
+      // Server sends encrypted "OK" message, client waits for it.
+      //
+
+      if (SSL_is_init_finished(ssl_))
+      {
+        if (intent_ == SECURE_INTENT_SERVER)
+        {
+          FAIL(SSL_write(ssl_, "OK", 2) != 2);
+
+          finished = 1;
+        }
+        else
+        {
+          ret = SSL_read(ssl_, buffer, 2);
+
+          if (ret == 2)
+          {
+            FAIL(buffer[0] != 'O');
+            FAIL(buffer[1] != 'K');
+
+            finished = 1;
+          }
+          else
+          {
+            FAIL(SSL_get_error(ssl_, ret) != SSL_ERROR_WANT_READ);
 
-  SecureConnection::SecureConnection()
-  {
-    readBio_  = NULL;
-    writeBio_ = NULL;
-    ssl_      = NULL;
-    sslCtx_   = NULL;
-
-    int intent_ = -1;
-    int state_  = -1;
-    int ioMode_ = -1;
+            state_ = SECURE_STATE_HANDSHAKE_READ;
+          }
+        }
+      }
+    }
+
+    //
+    // Pass negotiated session to context once handshake finished.
+    //
+
+    if (finished && handshakeDone_ == 0)
+    {
+      state_ = SECURE_STATE_ESTABLISHED;
+
+      ctx_ -> handshakeFinished(ssl_);
+
+      handshakeDone_ = 1;
+
+      DEBUG1("SSL Handshake finished.\n");
+    }
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("SSL handshake failed.\n");
+    }
+
+    DBG_LEAVE3("SecureConnection::handshakeContinue");
+
+    return exitCode ? -1 : finished;
+  }
+
+  //
+  // Create empty secure connection object.
+  // Used internally only.
+  //
+  // TIP#1: Don't create SecureConnection object directly.
+  //        Use one of SecureConnectionCreate() function instead.
+  //
+
+  SecureConnection::SecureConnection()
+  {
+    readBio_  = NULL;
+    writeBio_ = NULL;
+    ssl_      = NULL;
+    ctx_      = NULL;
+
+    intent_ = -1;
+    state_  = -1;
+    ioMode_ = -1;
+
+    handshakeDone_ = 0;
+    stream_        = 0;
 
     readCallback_  = NULL;
     writeCallback_ = NULL;
 
     ioCtx_ = NULL;
 
-    int fdIn_  = -1;
-    int fdOut_ = -1;
-    int sock_  = -1;
+    fdIn_  = -1;
+    fdOut_ = -1;
+    sock_  = -1;
 
     refCount_ = 1;
 
@@ -934,10 +1467,15 @@ namespace Tegenaria
   }
 
   //
-  // Initialize SSL DTLS connection inside secure connection object.
+  // Initialize SSL DTLS connection inside secure connection object using
+  // private context created for this connection only.
   //
   // Internal use only by SecureConnectionCreate().
   //
+  // TIP#1: Use SecureContextCreate() and share context between connections
+  //        to avoid loading certificate for every connection and to allow
+  //        session resumption.
+  //
   // RETURNS: 0 if OK.
   //
 
@@ -948,72 +1486,60 @@ namespace Tegenaria
 
     int exitCode = -1;
 
-    unsigned char sid[SSL_MAX_SSL_SESSION_ID_LENGTH] ;
-
-    //
-    // Init SSL library.
-    //
-
-    SSL_library_init();
-
-    //
-    // Create SSL context.
-    //
+    SecureContext *ctx = NULL;
 
-    DEBUG3("Creating SSL context...\n");
+    ctx = SecureContextCreate(intent, cert, privKey, privKeyPass,
+                                  SECURE_CONTEXT_NO_CACHE);
 
-    sslCtx_ = SSL_CTX_new(DTLSv1_method());
+    FAIL(ctx == NULL);
 
-    FAILEX(sslCtx_ == NULL, "ERROR: Cannot create SSL context.\n");
+    FAIL(initSSL(ctx));
 
     //
-    // Server.
+    // Error handler.
     //
 
-    if (intent == SECURE_INTENT_SERVER)
-    {
-      //
-      // Assign certificate and private key to context.
-      //
-
-      DEBUG3("Assigning certificate to SSL context...\n");
+    exitCode = 0;
 
-      SSL_CTX_use_certificate_chain_file(sslCtx_, cert);
+    fail:
 
-      //
-      // Set pass to decode private key if needed.
-      //
+    if (ctx)
+    {
+      ctx -> release();
+    }
 
-      if (privKeyPass)
-      {
-        FAILEX(true, "ERROR: 'privKeyPass' param is obsolete.")
-      }
+    DBG_LEAVE("SecureConnection::initSSL");
 
-      //
-      // Set input files with prviate key and server certificate.
-      //
+    return exitCode;
+  }
 
-      SSL_CTX_use_PrivateKey_file(sslCtx_, privKey, SSL_FILETYPE_PEM);
-      SSL_CTX_use_certificate_file(sslCtx_, cert, SSL_FILETYPE_PEM);
+  //
+  // Initialize SSL DTLS connection inside secure connection object.
+  //
+  // Internal use only by SecureConnectionCreate().
+  //
+  // ctx - shared context created by SecureContextCreate() (IN).
+  //
+  // RETURNS: 0 if OK.
+  //
 
-      //
-      // Set SINGLE_DH_USE option.
-      //
+  int SecureConnection::initSSL(SecureContext *ctx)
+  {
+    DBG_ENTER("SecureConnection::initSSL");
 
-      DEBUG3("Setting SINGLE_DH_USE...\n");
+    int exitCode = -1;
 
-      SSL_CTX_set_options(sslCtx_, SSL_OP_SINGLE_DH_USE);
+    FAILEX(ctx == NULL, "ERROR: 'ctx' cannot be NULL in SecureConnection::initSSL().\n");
 
-      //
-      // Assign session ID.
-      //
+    //
+    // Keep refference to shared context.
+    //
 
-      DEBUG3("Setting session id...\n");
+    ctx_ = ctx;
 
-      FAIL(SecureRandom(sid, sizeof(sid)));
+    ctx_ -> addRef();
 
-      SSL_CTX_set_session_id_context(sslCtx_, sid, 4);
-    }
+    intent_ = ctx_ -> getIntent();
 
     //
     // Allocate SSL object.
@@ -1021,32 +1547,97 @@ namespace Tegenaria
 
     DEBUG3("Allocating SSL object...\n");
 
-    ssl_ = SSL_new(sslCtx_);
+    ssl_ = ctx_ -> createSSL();
 
-    //
-    // Server.
-    //
+    FAILEX(ssl_ == NULL, "ERROR: Cannot create SSL object.\n");
 
-    if (intent == SECURE_INTENT_SERVER)
+    if (intent_ == SECURE_INTENT_SERVER)
     {
-      SSL_set_accept_state(ssl_);
-      SSL_set_verify(ssl_, SSL_VERIFY_NONE, NULL);
-      SSL_set_session_id_context(ssl_, sid, 4);
-
       state_ = SECURE_STATE_HANDSHAKE_READ;
     }
+    else
+    {
+      state_ = SECURE_STATE_HANDSHAKE_WRITE;
+    }
 
     //
-    // Client.
+    // TLS stream mode.
+    // Attach SSL object to underlying IO directly and do whole handshake
+    // at once.
+    //
+    // Underlying IO is switched to non-blocking mode, so handshake and
+    // later read/write calls can't block longer than timeout.
+    // FDs on Windows can't be non-blocking and stay in blocking mode.
     //
 
-    else
+    if (ctx_ -> isStream())
     {
-      SSL_set_connect_state(ssl_);
+      int64_t deadline = SecureGetDeadline(SECURE_TLS_HANDSHAKE_TIMEOUT);
 
-      SSL_set_verify(ssl_, SSL_VERIFY_NONE, NULL);
+      int ret = -1;
 
-      state_ = SECURE_STATE_HANDSHAKE_WRITE;
+      stream_ = 1;
+
+      switch(ioMode_)
+      {
+        case SECURE_IOMODE_SOCKET:
+        {
+          #ifdef WIN32
+          u_long nonBlock = 1;
+
+          ioctlsocket(sock_, FIONBIO, &nonBlock);
+          #else
+          fcntl(sock_, F_SETFL, fcntl(sock_, F_GETFL) | O_NONBLOCK);
+          #endif
+
+          FAILEX(SSL_set_fd(ssl_, sock_) != 1,
+                     "ERROR: Cannot attach SSL to socket #%d.\n", sock_);
+
+          break;
+        }
+
+        case SECURE_IOMODE_FDS:
+        {
+          #ifndef WIN32
+          fcntl(fdIn_, F_SETFL, fcntl(fdIn_, F_GETFL) | O_NONBLOCK);
+          fcntl(fdOut_, F_SETFL, fcntl(fdOut_, F_GETFL) | O_NONBLOCK);
+          #endif
+
+          readBio_  = BIO_new_fd(fdIn_, BIO_NOCLOSE);
+          writeBio_ = BIO_new_fd(fdOut_, BIO_NOCLOSE);
+
+          FAILEX(readBio_ == NULL || writeBio_ == NULL,
+                     "ERROR: Cannot attach SSL to FDs #%d/#%d.\n", fdIn_, fdOut_);
+
+          SSL_set_bio(ssl_, readBio_, writeBio_);
+
+          break;
+        }
+
+        default:
+        {
+          FAILEX(1, "ERROR: TLS stream mode needs socket or FD pair as underlying IO.\n");
+        }
+      }
+
+      do
+      {
+        ret = SSL_do_handshake(ssl_);
+      }
+      while(ret != 1 && streamWait(ret, deadline) == 1);
+
+      FAILEX(ret != 1, "ERROR: TLS handshake failed.\n");
+
+      state_ = SECURE_STATE_ESTABLISHED;
+
+      ctx_ -> handshakeFinished(ssl_);
+
+      handshakeDone_ = 1;
+
+      DBG_INFO("TLS Handshake finished, cipher is '%s'.\n",
+                   SSL_get_cipher_name(ssl_));
+
+      goto done;
     }
 
     readBio_ = BIO_new(BIO_s_mem());
@@ -1078,6 +1669,8 @@ namespace Tegenaria
     // Error handler.
     //
 
+    done:
+
     exitCode = 0;
 
     fail:
@@ -1446,4 +2039,237 @@ namespace Tegenaria
 
     return sc;
   }
+
+  //
+  // Wrap abstract read/write callbacks into secure connection using shared
+  // context.
+  //
+  // ctx           - context created by SecureContextCreate() before (IN).
+  // readCallback  - callback used to read from underlying unsecure IO (IN).
+  // writeCallback - callback used to write to underlying unsecure IO (IN).
+  // ioCtx         - caller specified context passed to IO callbacks directly (IN).
+  //
+  // WARNING! Returned pointer MUSTS be released release() method when not
+  //          needed longer.
+  //
+  // TIP#1: Create context once by SecureContextCreate() and share it
+  //        between many connections. Context is refferenced by connection
+  //        and can be released by caller after connection created.
+  //
+  // RETURNS: Pointer to new allocated SecureConnectionCreate object
+  //          or NULL if error.
+  //
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx,
+                                               SecureReadProto readCallback,
+                                                   SecureWriteProto writeCallback,
+                                                       void *ioCtx)
+  {
+    DBG_ENTER("SecureConnectionCreate");
+
+    int exitCode = -1;
+
+    SecureConnection *sc = new SecureConnection;
+
+    sc -> readCallback_  = readCallback;
+    sc -> writeCallback_ = writeCallback;
+    sc -> ioCtx_         = ioCtx;
+    sc -> ioMode_        = SECURE_IOMODE_CALLBACKS;
+
+    //
+    // Init SSL.
+    //
+
+    FAIL(sc -> initSSL(ctx));
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create secure connection.\n");
+
+      sc -> release();
+
+      sc = NULL;
+    }
+
+    DBG_LEAVE("SecureConnectionCreate");
+
+    return sc;
+  }
+
+  //
+  // Wrap FD pair into secure connection using shared context.
+  //
+  // ctx   - context created by SecureContextCreate() before (IN).
+  // fdin  - FD used to read data from underlying unsecure IO (IN).
+  // fdout - FD used to write data into underlying unsecure IO (IN).
+  //
+  // WARNING! Returned pointer MUSTS be released release() method when not
+  //          needed longer.
+  //
+  // TIP#1: Create context once by SecureContextCreate() and share it
+  //        between many connections. Context is refferenced by connection
+  //        and can be released by caller after connection created.
+  //
+  // RETURNS: Pointer to new allocated SecureConnectionCreate object
+  //          or NULL if error.
+  //
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx, int fdin, int fdout)
+  {
+    DBG_ENTER("SecureConnectionCreate");
+
+    int exitCode = -1;
+
+    SecureConnection *sc = new SecureConnection;
+
+    sc -> fdIn_   = fdin;
+    sc -> fdOut_  = fdout;
+    sc -> ioMode_ = SECURE_IOMODE_FDS;
+
+    //
+    // Init SSL.
+    //
+
+    FAIL(sc -> initSSL(ctx));
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create secure connection over FDs #%d/%d.\n", fdin, fdout);
+
+      sc -> release();
+
+      sc = NULL;
+    }
+
+    DBG_LEAVE("SecureConnectionCreate");
+
+    return sc;
+  }
+
+  //
+  // Wrap socket into secure connection using shared context.
+  //
+  // ctx  - context created by SecureContextCreate() before (IN).
+  // sock - socket connected to remote machine (IN).
+  //
+  // WARNING! Returned pointer MUSTS be released release() method when not
+  //          needed longer.
+  //
+  // TIP#1: Create context once by SecureContextCreate() and share it
+  //        between many connections. Context is refferenced by connection
+  //        and can be released by caller after connection created.
+  //
+  // RETURNS: Pointer to new allocated SecureConnectionCreate object
+  //          or NULL if error.
+  //
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx, int sock)
+  {
+    DBG_ENTER("SecureConnectionCreate");
+
+    int exitCode = -1;
+
+    SecureConnection *sc = new SecureConnection;
+
+    sc -> sock_   = sock;
+    sc -> ioMode_ = SECURE_IOMODE_SOCKET;
+
+    //
+    // Init SSL.
+    //
+
+    FAIL(sc -> initSSL(ctx));
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create secure connection over SOCKET #%d.\n", sock);
+
+      sc -> release();
+
+      sc = NULL;
+    }
+
+    DBG_LEAVE("SecureConnectionCreate");
+
+    return sc;
+  }
+
+  //
+  // Custom secure connection using shared context.
+  // Handshake must be performed manually by handshakeStep().
+  //
+  // ctx - context created by SecureContextCreate() before (IN).
+  //
+  // WARNING! Returned pointer MUSTS be released release() method when not
+  //          needed longer.
+  //
+  // TIP#1: Create context once by SecureContextCreate() and share it
+  //        between many connections. Context is refferenced by connection
+  //        and can be released by caller after connection created.
+  //
+  // RETURNS: Pointer to new allocated SecureConnectionCreate object
+  //          or NULL if error.
+  //
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx)
+  {
+    DBG_ENTER("SecureConnectionCreate");
+
+    int exitCode = -1;
+
+    SecureConnection *sc = new SecureConnection;
+
+    sc -> ioMode_ = SECURE_IOMODE_NONE;
+
+    //
+    // Init SSL.
+    //
+
+    FAIL(sc -> initSSL(ctx));
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create custom secure connection.\n");
+
+      sc -> release();
+
+      sc = NULL;
+    }
+
+    DBG_LEAVE("SecureConnectionCreate");
+
+    return sc;
+  }
 } /* namespace Tegenaria */
@@ -0,0 +1,541 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Purpose: Shared SSL context for many secure connections.
+//
+// Usage:
+//
+//   SecureContext *ctx = SecureContextCreate(SECURE_INTENT_SERVER,
+//                                                "cert.pem", "key.pem");
+//
+//   For every incoming connection:
+//     SecureConnection *sc = SecureConnectionCreate(ctx, sock);
+//     ...
+//     sc -> release();
+//
+//   ctx -> release();
+//
+
+#include "Secure.h"
+#include "Internal.h"
+
+namespace Tegenaria
+{
+  //
+  // Guard to init SSL library only once.
+  //
+
+  static Mutex SecureLibraryMutex;
+
+  static int SecureLibraryReady = 0;
+
+  //
+  // Create empty context object.
+  // Used internally only.
+  //
+  // TIP#1: Use SecureContextCreate() instead.
+  //
+
+  SecureContext::SecureContext()
+  {
+    sslCtx_  = NULL;
+    session_ = NULL;
+    intent_  = -1;
+    flags_   = 0;
+
+    handshakes_ = 0;
+    resumed_    = 0;
+
+    refCount_ = 1;
+
+    mutex_.setName("SecureContext::mutex_");
+
+    refCountMutex_.setName("SecureContext::refCountMutex_");
+  }
+
+  //
+  // Destroy context. Called when last refference released.
+  //
+
+  SecureContext::~SecureContext()
+  {
+    DBG_ENTER("SecureContext::~SecureContext");
+
+    if (session_)
+    {
+      SSL_SESSION_free(session_);
+    }
+
+    if (sslCtx_)
+    {
+      SSL_CTX_free(sslCtx_);
+    }
+
+    DBG_LEAVE("SecureContext::~SecureContext");
+  }
+
+  //
+  // Increase refference counter.
+  //
+  // WARNING! Every call to addRef() MUSTS be followed by one release() call.
+  //
+
+  void SecureContext::addRef()
+  {
+    refCountMutex_.lock();
+
+    refCount_ ++;
+
+    DEBUG2("Increased refference counter to %d for SecureContext PTR#%p.\n",
+               refCount_, this);
+
+    refCountMutex_.unlock();
+  }
+
+  //
+  // Decrease refference counter increased by addRef() before and
+  // desroy object when it's refference counter reach 0.
+  //
+
+  void SecureContext::release()
+  {
+    int deleteNeeded = 0;
+
+    refCountMutex_.lock();
+
+    refCount_ --;
+
+    DEBUG2("Decreased refference counter to %d for SecureContext PTR#%p.\n",
+               refCount_, this);
+
+    if (refCount_ == 0)
+    {
+      deleteNeeded = 1;
+    }
+
+    refCountMutex_.unlock();
+
+    if (deleteNeeded)
+    {
+      delete this;
+    }
+  }
+
+  int SecureContext::getIntent()
+  {
+    return intent_;
+  }
+
+  //
+  // RETURNS: 1 if context works in TLS stream mode (SECURE_CONTEXT_TLS),
+  //          0 if DTLS over memory BIOs is used.
+  //
+
+  int SecureContext::isStream()
+  {
+    return (flags_ & SECURE_CONTEXT_TLS) ? 1 : 0;
+  }
+
+  //
+  // Allocate new SSL object basing on shared context.
+  // Client side SSL gets last negotiated session to resume it.
+  //
+  // Used internally by SecureConnection.
+  //
+  // RETURNS: New SSL object or NULL if error.
+  //
+
+  SSL *SecureContext::createSSL()
+  {
+    SSL *ssl = SSL_new(sslCtx_);
+
+    if (ssl == NULL)
+    {
+      return NULL;
+    }
+
+    SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
+
+    //
+    // Server.
+    //
+
+    if (intent_ == SECURE_INTENT_SERVER)
+    {
+      SSL_set_accept_state(ssl);
+    }
+
+    //
+    // Client.
+    //
+
+    else
+    {
+      SSL_set_connect_state(ssl);
+
+      mutex_.lock();
+
+      if (session_)
+      {
+        SSL_set_session(ssl, session_);
+      }
+
+      mutex_.unlock();
+    }
+
+    return ssl;
+  }
+
+  //
+  // Note finished handshake. Update counters and remember session
+  // on client side for next connection.
+  //
+  // Used internally by SecureConnection.
+  //
+  // ssl - SSL object returned by createSSL() with finished handshake (IN).
+  //
+
+  void SecureContext::handshakeFinished(SSL *ssl)
+  {
+    SSL_SESSION *oldSession = NULL;
+
+    int reused = SSL_session_reused(ssl);
+
+    mutex_.lock();
+
+    handshakes_ ++;
+
+    if (reused)
+    {
+      resumed_ ++;
+    }
+
+    //
+    // TLS stream mode gets sessions from newSessionCallback(), because
+    // TLS 1.3 tickets arrive after handshake.
+    //
+
+    if (intent_ == SECURE_INTENT_CLIENT && reused == 0 && isStream() == 0)
+    {
+      oldSession = session_;
+
+      session_ = SSL_get1_session(ssl);
+    }
+
+    mutex_.unlock();
+
+    if (oldSession)
+    {
+      SSL_SESSION_free(oldSession);
+    }
+
+    DEBUG2("SecureContext : Handshake finished, session %s.\n",
+               reused ? "resumed" : "created");
+  }
+
+  //
+  // Called by OpenSSL when client side receives new resumable session.
+  // Used in TLS stream mode only.
+  //
+  // ssl     - SSL object, which negotiated session (IN).
+  // session - new session, refference is passed to us (IN).
+  //
+  // RETURNS: 1 if session refference was taken.
+  //
+
+  int SecureContext::newSessionCallback(SSL *ssl, SSL_SESSION *session)
+  {
+    SecureContext *ctx = (SecureContext *) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+    SSL_SESSION *oldSession = NULL;
+
+    ctx -> mutex_.lock();
+
+    oldSession = ctx -> session_;
+
+    ctx -> session_ = session;
+
+    ctx -> mutex_.unlock();
+
+    if (oldSession)
+    {
+      SSL_SESSION_free(oldSession);
+    }
+
+    return 1;
+  }
+
+  //
+  // Retrieve session resumption counters.
+  //
+  // stats - buffer, where to store counters (OUT).
+  //
+  // RETURNS: 0 if OK.
+  //
+
+  int SecureContext::getStats(SecureContextStats *stats)
+  {
+    int exitCode = -1;
+
+    FAILEX(stats == NULL, "ERROR: 'stats' cannot be NULL in SecureContext::getStats().\n");
+
+    mutex_.lock();
+
+    stats -> handshakes_ = handshakes_;
+    stats -> resumed_    = resumed_;
+
+    mutex_.unlock();
+
+    stats -> resumeRate_ = 0.0;
+
+    if (stats -> handshakes_ > 0)
+    {
+      stats -> resumeRate_ = double(stats -> resumed_) / double(stats -> handshakes_);
+    }
+
+    stats -> cacheHits_     = SSL_CTX_sess_hits(sslCtx_);
+    stats -> cacheMisses_   = SSL_CTX_sess_misses(sslCtx_);
+    stats -> cacheTimeouts_ = SSL_CTX_sess_timeouts(sslCtx_);
+    stats -> cacheSize_     = SSL_CTX_sess_number(sslCtx_);
+
+    exitCode = 0;
+
+    fail:
+
+    return exitCode;
+  }
+
+  //
+  // Create SSL context, which can be shared by many secure connections.
+  // Certificate and private key are loaded once here.
+  //
+  // intent      - set to SECURE_INTENT_CLIENT or SECURE_INTENT_SERVER (IN).
+  // cert        - filename, where server certificate is stored (IN/OPT).
+  //
+  // privKey     - filename, where server private key is stored (server side
+  //               only) (IN/OPT).
+  //
+  // privKeyPass - obsolete, must be NULL (IN/OPT).
+  //
+  // flags       - combination of SECURE_CONTEXT_XXX flags (IN/OPT).
+  //
+  // TIP#3: Use SECURE_CONTEXT_TLS flag to get TLS 1.2/1.3 stream mode with
+  //        AEAD ciphers. SSL object is attached to socket or FDs directly,
+  //        so data goes without extra copies throught memory BIOs.
+  //        Both sides must use the same mode. Stream mode needs socket or
+  //        FD pair as underlying IO, which is switched to non-blocking mode
+  //        to honour read/write timeouts.
+  //
+  // WARNING! Returned pointer MUSTS be released by release() method when
+  //          not needed longer.
+  //
+  // TIP#1: Server side caches up to SECURE_SESSION_CACHE_SIZE sessions
+  //        and issues session tickets. Use SECURE_CONTEXT_NO_CACHE and
+  //        SECURE_CONTEXT_NO_TICKETS flags to disable them.
+  //
+  // TIP#2: Client side context resumes last session negotiated by it.
+  //        Use one client context per server.
+  //
+  // RETURNS: Pointer to new allocated SecureContext object
+  //          or NULL if error.
+  //
+
+  SecureContext *SecureContextCreate(int intent, const char *cert,
+                                         const char *privKey,
+                                             const char *privKeyPass,
+                                                 int flags)
+  {
+    DBG_ENTER("SecureContextCreate");
+
+    int exitCode = -1;
+
+    unsigned char sid[SSL_MAX_SID_CTX_LENGTH];
+
+    SecureContext *ctx = new SecureContext;
+
+    ctx -> intent_ = intent;
+    ctx -> flags_  = flags;
+
+    //
+    // Init SSL library once.
+    //
+
+    SecureLibraryMutex.lock();
+
+    if (SecureLibraryReady == 0)
+    {
+      SSL_library_init();
+
+      SecureLibraryReady = 1;
+    }
+
+    SecureLibraryMutex.unlock();
+
+    //
+    // Create SSL context.
+    //
+
+    DEBUG3("Creating SSL context...\n");
+
+    if (flags & SECURE_CONTEXT_TLS)
+    {
+      ctx -> sslCtx_ = SSL_CTX_new(SSLv23_method());
+    }
+    else
+    {
+      ctx -> sslCtx_ = SSL_CTX_new(DTLSv1_method());
+    }
+
+    FAILEX(ctx -> sslCtx_ == NULL, "ERROR: Cannot create SSL context.\n");
+
+    //
+    // TLS stream mode.
+    // Allow TLS 1.2 or newer with AEAD ciphers only.
+    //
+
+    if (flags & SECURE_CONTEXT_TLS)
+    {
+      SSL_CTX_set_options(ctx -> sslCtx_, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3
+                                              | SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1
+                                                  | SSL_OP_NO_COMPRESSION);
+
+      FAILEX(SSL_CTX_set_cipher_list(ctx -> sslCtx_, SECURE_TLS_CIPHERS) != 1,
+                 "ERROR: Cannot set TLS cipher list.\n");
+
+      SSL_CTX_set_mode(ctx -> sslCtx_, SSL_MODE_AUTO_RETRY);
+
+      SSL_CTX_set_app_data(ctx -> sslCtx_, ctx);
+    }
+
+    //
+    // Server.
+    //
+
+    if (intent == SECURE_INTENT_SERVER)
+    {
+      FAILEX(privKeyPass, "ERROR: 'privKeyPass' param is obsolete.\n");
+
+      //
+      // Assign certificate and private key to context.
+      //
+
+      DEBUG3("Assigning certificate to SSL context...\n");
+
+      FAILEX(SSL_CTX_use_certificate_chain_file(ctx -> sslCtx_, cert) != 1,
+                 "ERROR: Cannot load certificate from '%s'.\n", cert);
+
+      FAILEX(SSL_CTX_use_PrivateKey_file(ctx -> sslCtx_, privKey, SSL_FILETYPE_PEM) != 1,
+                 "ERROR: Cannot load private key from '%s'.\n", privKey);
+
+      FAILEX(SSL_CTX_check_private_key(ctx -> sslCtx_) != 1,
+                 "ERROR: Private key does not match certificate.\n");
+
+      //
+      // Set SINGLE_DH_USE option.
+      //
+
+      DEBUG3("Setting SINGLE_DH_USE...\n");
+
+      SSL_CTX_set_options(ctx -> sslCtx_, SSL_OP_SINGLE_DH_USE);
+
+      //
+      // Assign session ID context. Sessions are resumable only within
+      // the same context.
+      //
+
+      DEBUG3("Setting session id...\n");
+
+      FAIL(SecureRandom(sid, sizeof(sid)));
+
+      SSL_CTX_set_session_id_context(ctx -> sslCtx_, sid, sizeof(sid));
+
+      //
+      // Server side session cache.
+      //
+
+      if (flags & SECURE_CONTEXT_NO_CACHE)
+      {
+        SSL_CTX_set_session_cache_mode(ctx -> sslCtx_, SSL_SESS_CACHE_OFF);
+      }
+      else
+      {
+        SSL_CTX_set_session_cache_mode(ctx -> sslCtx_, SSL_SESS_CACHE_SERVER);
+
+        SSL_CTX_sess_set_cache_size(ctx -> sslCtx_, SECURE_SESSION_CACHE_SIZE);
+      }
+    }
+
+    //
+    // Client. Sessions are stored by context itself, see
+    // handshakeFinished() and newSessionCallback().
+    //
+
+    else if (flags & SECURE_CONTEXT_TLS)
+    {
+      SSL_CTX_set_session_cache_mode(ctx -> sslCtx_, SSL_SESS_CACHE_CLIENT
+                                                         | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+
+      SSL_CTX_sess_set_new_cb(ctx -> sslCtx_, SecureContext::newSessionCallback);
+    }
+    else
+    {
+      SSL_CTX_set_session_cache_mode(ctx -> sslCtx_, SSL_SESS_CACHE_OFF);
+    }
+
+    SSL_CTX_set_timeout(ctx -> sslCtx_, SECURE_SESSION_TIMEOUT);
+
+    //
+    // Session tickets. Keys are generated per context, so all connections
+    // sharing context accept each other tickets.
+    //
+
+    if (flags & SECURE_CONTEXT_NO_TICKETS)
+    {
+      SSL_CTX_set_options(ctx -> sslCtx_, SSL_OP_NO_TICKET);
+    }
+
+    //
+    // Error handler.
+    //
+
+    exitCode = 0;
+
+    fail:
+
+    if (exitCode)
+    {
+      Error("ERROR: Cannot create secure context.\n");
+
+      ctx -> release();
+
+      ctx = NULL;
+    }
+
+    DBG_LEAVE("SecureContextCreate");
+
+    return ctx;
+  }
+
+} /* namespace Tegenaria */
@@ -43,6 +43,8 @@ int main(int argc, char **argv)
 
   int readed = 0;
 
+  int exitCode = 0;
+
   //
   // Initialie Blowfish cipher with given IV vector and key[].
   //
@@ -73,7 +75,7 @@ int main(int argc, char **argv)
 
     if (argc > 1)
     {
-      SecureDecrypt(sc, buf, readed);
+      exitCode = SecureDecrypt(sc, buf, readed);
     }
 
     //
@@ -83,7 +85,14 @@ int main(int argc, char **argv)
 
     else
     {
-      SecureEncrypt(sc, buf, readed);
+      exitCode = SecureEncrypt(sc, buf, readed);
+    }
+
+    if (exitCode)
+    {
+      fprintf(stderr, "ERROR: Cannot process data.\n");
+
+      break;
     }
 
     //
@@ -99,5 +108,5 @@ int main(int argc, char **argv)
 
   SecureCipherDestroy(sc);
 
-  return 0;
+  return exitCode;
 }
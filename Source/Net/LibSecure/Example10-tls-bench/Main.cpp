@@ -0,0 +1,320 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Benchmark: move the same amount of data through secure connection in
+// legacy DTLS mode (records copied throught memory BIOs) and in TLS stream
+// mode (SECURE_CONTEXT_TLS, SSL attached to socket directly).
+// Throughput in MB/s is printed for both.
+//
+// DTLS mode keeps record boundaries only over datagram-like IO, so it runs
+// over SOCK_SEQPACKET socket pair. TLS mode runs over SOCK_STREAM pair.
+//
+// Usage: LibSecure-example10-tls-bench [totalMB] [chunkSize] [cert] [key]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <Tegenaria/Debug.h>
+#include <Tegenaria/Thread.h>
+#include <Tegenaria/Secure.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+# include <sys/socket.h>
+# include <unistd.h>
+#endif
+
+using namespace Tegenaria;
+
+//
+// Max. chunk fitting into one DTLS record written by SecureConnection.
+//
+
+#define BENCH_DTLS_MAX_CHUNK 900
+
+//
+// Benchmark parameters shared by client and server.
+//
+
+struct BenchCtx
+{
+  SecureContext *serverCtx_;
+
+  int sock_;
+
+  uint64_t total_;
+  uint64_t received_;
+};
+
+//
+// Get current time in ms.
+//
+
+static double GetTimeMs()
+{
+  #ifdef WIN32
+  {
+    return double(GetTickCount());
+  }
+  #else
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+  }
+  #endif
+}
+
+//
+// Server side. Accept secure connection and read data until all
+// expected bytes arrived.
+//
+
+static int ServerThread(BenchCtx *ctx)
+{
+  char buf[16384];
+
+  SecureConnection *sc = SecureConnectionCreate(ctx -> serverCtx_, ctx -> sock_);
+
+  if (sc == NULL)
+  {
+    return -1;
+  }
+
+  while (ctx -> received_ < ctx -> total_)
+  {
+    int readed = sc -> read(buf, sizeof(buf), -1);
+
+    if (readed <= 0)
+    {
+      break;
+    }
+
+    ctx -> received_ += readed;
+  }
+
+  sc -> release();
+
+  return 0;
+}
+
+//
+// Run one client and one server over socket pair and print throughput.
+//
+
+static void RunBench(const char *name, int flags, int sockType,
+                         uint64_t total, int chunk,
+                             const char *cert, const char *key)
+{
+  #ifdef WIN32
+  {
+    printf("%-14s not supported on Windows.\n", name);
+  }
+  #else
+  {
+    BenchCtx ctx;
+
+    SecureContext *clientCtx = NULL;
+
+    SecureConnection *sc = NULL;
+
+    ThreadHandle_t *serverThread = NULL;
+
+    char *buf = NULL;
+
+    uint64_t sent = 0;
+
+    double t0      = 0.0;
+    double elapsed = 0.0;
+
+    int fds[2] = {-1, -1};
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    if (socketpair(AF_UNIX, sockType, 0, fds) != 0)
+    {
+      printf("%-14s cannot create socket pair.\n", name);
+
+      return;
+    }
+
+    ctx.serverCtx_ = SecureContextCreate(SECURE_INTENT_SERVER, cert, key, NULL, flags);
+    ctx.sock_      = fds[1];
+    ctx.total_     = total;
+
+    clientCtx = SecureContextCreate(SECURE_INTENT_CLIENT, NULL, NULL, NULL, flags);
+
+    if (ctx.serverCtx_ && clientCtx)
+    {
+      serverThread = ThreadCreate(ServerThread, &ctx);
+
+      sc = SecureConnectionCreate(clientCtx, fds[0]);
+    }
+
+    //
+    // Push data through established connection.
+    //
+
+    if (sc)
+    {
+      buf = (char *) malloc(chunk);
+
+      for (int i = 0; i < chunk; i++)
+      {
+        buf[i] = char(i);
+      }
+
+      t0 = GetTimeMs();
+
+      while (sent < total)
+      {
+        if (sc -> write(buf, chunk, -1) <= 0)
+        {
+          break;
+        }
+
+        sent += chunk;
+      }
+    }
+
+    if (serverThread)
+    {
+      ThreadWait(serverThread);
+
+      ThreadClose(serverThread);
+    }
+
+    elapsed = GetTimeMs() - t0;
+
+    if (elapsed < 1.0)
+    {
+      elapsed = 1.0;
+    }
+
+    if (sc && ctx.received_ == total)
+    {
+      printf("%-14s %6d B chunks %8.1f ms %10.1f MB/s\n",
+                 name, chunk, elapsed, (total / 1048576.0) / (elapsed / 1000.0));
+    }
+    else
+    {
+      printf("%-14s failed after %llu bytes.\n",
+                 name, (unsigned long long) ctx.received_);
+    }
+
+    //
+    // Clean up.
+    //
+
+    if (sc)
+    {
+      sc -> release();
+    }
+
+    if (clientCtx)
+    {
+      clientCtx -> release();
+    }
+
+    if (ctx.serverCtx_)
+    {
+      ctx.serverCtx_ -> release();
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    free(buf);
+  }
+  #endif
+}
+
+//
+// Entry point.
+//
+
+int main(int argc, char **argv)
+{
+  DBG_INIT_EX(NULL, "error", -1);
+
+  int totalMB = 64;
+  int chunk   = BENCH_DTLS_MAX_CHUNK;
+
+  const char *cert = "server.crt";
+  const char *key  = "server.key";
+
+  uint64_t total = 0;
+
+  if (argc > 1)
+  {
+    totalMB = atoi(argv[1]);
+  }
+
+  if (argc > 2)
+  {
+    chunk = atoi(argv[2]);
+  }
+
+  if (argc > 3)
+  {
+    cert = argv[3];
+  }
+
+  if (argc > 4)
+  {
+    key = argv[4];
+  }
+
+  if (totalMB <= 0 || chunk <= 0 || chunk > BENCH_DTLS_MAX_CHUNK)
+  {
+    fprintf(stderr, "Usage: %s [totalMB] [chunkSize <= %d] [cert] [key]\n",
+                argv[0], BENCH_DTLS_MAX_CHUNK);
+
+    return 1;
+  }
+
+  total = uint64_t(totalMB) * 1048576 / chunk * chunk;
+
+  printf("Moving %d MB throught secure connection...\n", totalMB);
+
+  RunBench("DTLS/mem-BIO", 0, SOCK_SEQPACKET, total, chunk, cert, key);
+  RunBench("TLS stream", SECURE_CONTEXT_TLS, SOCK_STREAM, total, chunk, cert, key);
+
+  //
+  // Stream mode is not limited by DTLS record size.
+  // Show it with full TLS record as well.
+  //
+
+  total = uint64_t(totalMB) * 1048576 / 16384 * 16384;
+
+  RunBench("TLS stream", SECURE_CONTEXT_TLS, SOCK_STREAM, total, 16384, cert, key);
+
+  return 0;
+}
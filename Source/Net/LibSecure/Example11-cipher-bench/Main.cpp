@@ -0,0 +1,370 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2010, 2014 Sylwester Wysocki <sw143@wp.pl>                   */
+/*                                                                            */
+/* Permission is hereby granted, free of charge, to any person obtaining a    */
+/* copy of this software and associated documentation files (the "Software"), */
+/* to deal in the Software without restriction, including without limitation  */
+/* the rights to use, copy, modify, merge, publish, distribute, sublicense,   */
+/* and/or sell copies of the Software, and to permit persons to whom the      */
+/* Software is furnished to do so, subject to the following conditions:       */
+/*                                                                            */
+/* The above copyright notice and this permission notice shall be included in */
+/* all copies or substantial portions of the Software.                        */
+/*                                                                            */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    */
+/* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING    */
+/* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER        */
+/* DEALINGS IN THE SOFTWARE.                                                  */
+/*                                                                            */
+/******************************************************************************/
+
+//
+// Benchmark: encrypt and decrypt the same amount of data with legacy
+// Blowfish-CFB cipher and with AES-CTR/AES-GCM ciphers.
+// Throughput in GB/s is printed for:
+//
+// - raw mode       : one SecureEncrypt() call per chunk,
+// - multi-buffer   : SecureEncryptMulti() over all chunks of one batch,
+// - packet mode    : SecureEncryptPacket() per chunk, with tag.
+//
+// Every run decrypts data back and verifies it against original.
+//
+// Usage: LibSecure-example11-cipher-bench [totalMB] [chunkSize]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <Tegenaria/Debug.h>
+#include <Tegenaria/Secure.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+using namespace Tegenaria;
+
+//
+// Size of data processed by one SecureEncryptMulti() call.
+//
+
+#define BENCH_BATCH_SIZE (1024 * 1024)
+
+#define BENCH_MODE_RAW    0
+#define BENCH_MODE_MULTI  1
+#define BENCH_MODE_PACKET 2
+
+//
+// Get current time in ms.
+//
+
+static double GetTimeMs()
+{
+  #ifdef WIN32
+  {
+    return double(GetTickCount());
+  }
+  #else
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+  }
+  #endif
+}
+
+//
+// Encrypt or decrypt whole batch buffer in selected mode.
+//
+
+static int ProcessBatch(SecureCipher *sc, int mode, int decrypt,
+                            char *batch, int chunk, int chunksPerBatch,
+                                char *tags, void **buffers, int *sizes)
+{
+  int exitCode = 0;
+
+  switch(mode)
+  {
+    case BENCH_MODE_RAW:
+    {
+      for (int i = 0; i < chunksPerBatch && exitCode == 0; i++)
+      {
+        if (decrypt)
+        {
+          exitCode = SecureDecrypt(sc, batch + i * chunk, chunk);
+        }
+        else
+        {
+          exitCode = SecureEncrypt(sc, batch + i * chunk, chunk);
+        }
+      }
+
+      break;
+    }
+
+    case BENCH_MODE_MULTI:
+    {
+      if (decrypt)
+      {
+        exitCode = SecureDecryptMulti(sc, buffers, sizes, chunksPerBatch);
+      }
+      else
+      {
+        exitCode = SecureEncryptMulti(sc, buffers, sizes, chunksPerBatch);
+      }
+
+      break;
+    }
+
+    case BENCH_MODE_PACKET:
+    {
+      for (int i = 0; i < chunksPerBatch && exitCode == 0; i++)
+      {
+        char *tag = tags + i * SECURE_PACKET_TAG_SIZE;
+
+        if (decrypt)
+        {
+          exitCode = SecureDecryptPacket(sc, batch + i * chunk, chunk, tag);
+        }
+        else
+        {
+          exitCode = SecureEncryptPacket(sc, batch + i * chunk, chunk, tag);
+        }
+      }
+
+      break;
+    }
+  }
+
+  return exitCode;
+}
+
+//
+// Encrypt and decrypt <total> bytes using given cipher and print
+// throughput of both directions. Every batch is encrypted and then
+// decrypted back by second cipher object, so both sides stay in sync
+// and data can be verified at the end.
+//
+// RETURNS: Encrypt throughput in GB/s or 0 if error.
+//
+
+static double RunBench(const char *name, int cipher, int mode,
+                           const char *key, int keySize, int ivSize,
+                               uint64_t total, int chunk)
+{
+  char iv[SECURE_AES_IV_SIZE] = {0};
+
+  int chunksPerBatch = BENCH_BATCH_SIZE / chunk;
+  int batchSize      = chunksPerBatch * chunk;
+
+  uint64_t batches = total / batchSize;
+
+  char *orig  = (char *) malloc(batchSize);
+  char *batch = (char *) malloc(batchSize);
+  char *tags  = (char *) malloc(chunksPerBatch * SECURE_PACKET_TAG_SIZE);
+
+  void **buffers = (void **) malloc(chunksPerBatch * sizeof(void *));
+
+  int *sizes = (int *) malloc(chunksPerBatch * sizeof(int));
+
+  int failed = 0;
+
+  double t0         = 0.0;
+  double encElapsed = 0.0;
+  double decElapsed = 0.0;
+  double encGBs     = 0.0;
+  double decGBs     = 0.0;
+
+  SecureCipher *enc = NULL;
+  SecureCipher *dec = NULL;
+
+  //
+  // Packet mode has separate keys for each direction, so sender and
+  // receiver play client and server roles.
+  //
+
+  if (mode == BENCH_MODE_PACKET)
+  {
+    enc = SecurePacketCipherCreate(cipher, SECURE_INTENT_CLIENT, key, keySize, iv, ivSize);
+    dec = SecurePacketCipherCreate(cipher, SECURE_INTENT_SERVER, key, keySize, iv, ivSize);
+  }
+  else
+  {
+    enc = SecureCipherCreate(cipher, SECURE_CIPHER_MODE_CTR, key, keySize, iv, ivSize);
+    dec = SecureCipherCreate(cipher, SECURE_CIPHER_MODE_CTR, key, keySize, iv, ivSize);
+  }
+
+  if (enc == NULL || dec == NULL || batches == 0)
+  {
+    failed = 1;
+  }
+
+  for (int i = 0; i < batchSize; i++)
+  {
+    orig[i] = char(i * 7);
+  }
+
+  for (int i = 0; i < chunksPerBatch; i++)
+  {
+    buffers[i] = batch + i * chunk;
+    sizes[i]   = chunk;
+  }
+
+  memcpy(batch, orig, batchSize);
+
+  //
+  // Encrypt and decrypt data batch by batch.
+  //
+
+  for (uint64_t i = 0; i < batches && !failed; i++)
+  {
+    t0 = GetTimeMs();
+
+    failed |= ProcessBatch(enc, mode, 0, batch, chunk, chunksPerBatch,
+                               tags, buffers, sizes);
+
+    encElapsed += GetTimeMs() - t0;
+
+    t0 = GetTimeMs();
+
+    failed |= ProcessBatch(dec, mode, 1, batch, chunk, chunksPerBatch,
+                               tags, buffers, sizes);
+
+    decElapsed += GetTimeMs() - t0;
+  }
+
+  //
+  // Data must be the same after round trip.
+  //
+
+  if (!failed && memcmp(batch, orig, batchSize) != 0)
+  {
+    failed = 1;
+  }
+
+  if (failed)
+  {
+    printf("%-26s failed.\n", name);
+  }
+  else
+  {
+    double gigs = double(batches) * batchSize / (1024.0 * 1024.0 * 1024.0);
+
+    encGBs = gigs / (encElapsed / 1000.0);
+    decGBs = gigs / (decElapsed / 1000.0);
+
+    printf("%-26s %6d B chunks  encrypt %7.3f GB/s  decrypt %7.3f GB/s\n",
+               name, chunk, encGBs, decGBs);
+  }
+
+  //
+  // Clean up.
+  //
+
+  SecureCipherDestroy(enc);
+  SecureCipherDestroy(dec);
+
+  free(orig);
+  free(batch);
+  free(tags);
+  free(buffers);
+  free(sizes);
+
+  return encGBs;
+}
+
+//
+// Entry point.
+//
+
+int main(int argc, char **argv)
+{
+  DBG_INIT_EX(NULL, "error", -1);
+
+  int totalMB = 256;
+  int chunk   = 16384;
+
+  char bfKey[SECURE_BLOWFISH_KEY_SIZE] = "password";
+  char aesKey[32]                      = "password";
+
+  double bf  = 0.0;
+  double aes = 0.0;
+
+  uint64_t total = 0;
+
+  if (argc > 1)
+  {
+    totalMB = atoi(argv[1]);
+  }
+
+  if (argc > 2)
+  {
+    chunk = atoi(argv[2]);
+  }
+
+  if (totalMB <= 0 || chunk <= 0 || chunk > BENCH_BATCH_SIZE)
+  {
+    fprintf(stderr, "Usage: %s [totalMB] [chunkSize <= %d]\n",
+                argv[0], BENCH_BATCH_SIZE);
+
+    return 1;
+  }
+
+  total = uint64_t(totalMB) * 1048576;
+
+  printf("Encrypting %d MB...\n", totalMB);
+
+  //
+  // Raw buffers.
+  //
+
+  bf = RunBench("Blowfish-CFB", SECURE_CIPHER_BLOWFISH, BENCH_MODE_RAW,
+                    bfKey, sizeof(bfKey), SECURE_BLOWFISH_KEY_SIZE, total, chunk);
+
+  RunBench("AES-128-CTR", SECURE_CIPHER_AES_CTR, BENCH_MODE_RAW,
+               aesKey, 16, SECURE_AES_IV_SIZE, total, chunk);
+
+  aes = RunBench("AES-256-CTR", SECURE_CIPHER_AES_CTR, BENCH_MODE_RAW,
+                     aesKey, 32, SECURE_AES_IV_SIZE, total, chunk);
+
+  RunBench("AES-256-GCM", SECURE_CIPHER_AES_GCM, BENCH_MODE_RAW,
+               aesKey, 32, SECURE_AES_IV_SIZE, total, chunk);
+
+  //
+  // Multi-buffer.
+  //
+
+  RunBench("Blowfish-CFB multi", SECURE_CIPHER_BLOWFISH, BENCH_MODE_MULTI,
+               bfKey, sizeof(bfKey), SECURE_BLOWFISH_KEY_SIZE, total, chunk);
+
+  RunBench("AES-256-CTR multi", SECURE_CIPHER_AES_CTR, BENCH_MODE_MULTI,
+               aesKey, 32, SECURE_AES_IV_SIZE, total, chunk);
+
+  //
+  // Authenticated packets.
+  //
+
+  RunBench("Blowfish-CFB+HMAC packet", SECURE_CIPHER_BLOWFISH, BENCH_MODE_PACKET,
+               bfKey, sizeof(bfKey), SECURE_BLOWFISH_KEY_SIZE, total, chunk);
+
+  RunBench("AES-256-CTR+HMAC packet", SECURE_CIPHER_AES_CTR, BENCH_MODE_PACKET,
+               aesKey, 32, SECURE_AES_IV_SIZE, total, chunk);
+
+  RunBench("AES-256-GCM packet", SECURE_CIPHER_AES_GCM, BENCH_MODE_PACKET,
+               aesKey, 32, SECURE_AES_IV_SIZE, total, chunk);
+
+  if (bf > 0.0 && aes > 0.0)
+  {
+    printf("AES-256-CTR is %.1fx faster than Blowfish-CFB.\n", aes / bf);
+  }
+
+  return 0;
+}
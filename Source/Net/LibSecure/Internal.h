@@ -29,17 +29,105 @@
 //
 
 #ifndef Tenegaria_Core_Secure_Internal_H
+#define Tenegaria_Core_Secure_Internal_H
 
 #include <openssl/ssl.h>
 #include <openssl/rand.h>
 #include <openssl/blowfish.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#ifdef WIN64
+  static int Win64NotImportedError()
+  {
+    fprintf(stderr, "OpenSSL is not imported on Win64");
+    exit(-1);
+  }
+
+  #define SSL_write(x, y, z)                           Win64NotImportedError()
+  #define SSL_read(x, y, z)                            Win64NotImportedError()
+  #define SSL_free(x)                                  Win64NotImportedError()
+  #define SSL_CTX_free(x)                              Win64NotImportedError()
+  #define SSL_is_init_finished(x)                      Win64NotImportedError()
+  #define SSL_do_handshake(x)                          Win64NotImportedError()
+  #define BIO_read(x, y, z)                            Win64NotImportedError()
+  #define BIO_write(x, y, z)                           Win64NotImportedError()
+  #define SSL_library_init()                           Win64NotImportedError()
+  #define SSL_CTX_new(x)                               (SSL_CTX *) Win64NotImportedError()
+  #define SSL_CTX_use_certificate_chain_file(x, y)     Win64NotImportedError()
+  #define SSL_CTX_set_default_passwd_cb(x, y)          Win64NotImportedError()
+  #define SSL_CTX_set_default_passwd_cb_userdata(x, y) Win64NotImportedError()
+  #define SSL_CTX_use_PrivateKey_file(x, y, z)         Win64NotImportedError()
+  #define SSL_CTX_use_certificate_file(x, y, z)        Win64NotImportedError()
+  #define SSL_CTX_set_options(x, y)                    Win64NotImportedError()
+  #define SSL_CTX_set_session_id_context(x, y, z)      Win64NotImportedError()
+  #define SSL_new(x)                                   (SSL *) Win64NotImportedError()
+  #define SSL_set_accept_state(x)                      Win64NotImportedError()
+  #define SSL_set_verify(x, y, z)                      Win64NotImportedError()
+  #define SSL_set_session_id_context(x, y, z)          Win64NotImportedError()
+  #define BIO_s_mem()                                  Win64NotImportedError()
+  #define SSL_set_connect_state(x)                     Win64NotImportedError()
+  #define BIO_new(x)                                   (BIO *) Win64NotImportedError()
+  #define BIO_set_nbio(x, y)                           Win64NotImportedError()
+  #define SSL_set_bio(x, y, z)                         Win64NotImportedError()
+  #define SSL_CTX_ctrl(x, y, z, w)                     Win64NotImportedError()
+  #define SSL_CTX_check_private_key(x)                 Win64NotImportedError()
+  #define SSL_get1_session(x)                          (SSL_SESSION *) Win64NotImportedError()
+  #define SSL_set_session(x, y)                        Win64NotImportedError()
+  #define SSL_SESSION_free(x)                          Win64NotImportedError()
+  #define SSL_session_reused(x)                        Win64NotImportedError()
+  #define SSL_CTX_set_timeout(x, y)                    Win64NotImportedError()
+  #define SSL_set_shutdown(x, y)                       Win64NotImportedError()
+  #define SSL_get_error(x, y)                          Win64NotImportedError()
+  #define BIO_ctrl(x, y, z, w)                         Win64NotImportedError()
+  #define SSLv23_method()                              Win64NotImportedError()
+  #define SSL_CTX_set_cipher_list(x, y)                Win64NotImportedError()
+  #define SSL_CTX_sess_set_new_cb(x, y)                Win64NotImportedError()
+  #define SSL_CTX_set_ex_data(x, y, z)                 Win64NotImportedError()
+  #define SSL_CTX_get_ex_data(x, y)                    (void *) Win64NotImportedError()
+  #define SSL_get_SSL_CTX(x)                           (SSL_CTX *) Win64NotImportedError()
+  #define SSL_set_fd(x, y)                             Win64NotImportedError()
+  #define BIO_new_fd(x, y)                             (BIO *) Win64NotImportedError()
+  #define SSL_get_cipher_name(x)                       (const char *) Win64NotImportedError()
+#endif
 
 namespace Tegenaria
 {
+  //
+  // Keys and state of one packet direction. See SecureEncryptPacket().
+  // Every direction has own keys derived from shared secret, so the
+  // same sequence number never reuses keystream or MAC key between
+  // directions.
+  //
+  // seq_      - sequence number of next packet.
+  // iv_       - direction iv base.
+  // bfKey_    - direction key for SECURE_CIPHER_BLOWFISH.
+  // evp_      - AES context keyed with direction key.
+  // macInner_ - SHA256 state after absorbing HMAC (key ^ ipad).
+  // macOuter_ - SHA256 state after absorbing HMAC (key ^ opad).
+  // macWork_  - scratch state to compute MAC of one packet.
+  //
+
+  struct SecurePacketKeys
+  {
+    uint64_t seq_;
+
+    unsigned char iv_[16];
+
+    BF_KEY bfKey_;
+
+    EVP_CIPHER_CTX *evp_;
+
+    EVP_MD_CTX *macInner_;
+    EVP_MD_CTX *macOuter_;
+    EVP_MD_CTX *macWork_;
+  };
+
   struct SecureCipher
   {
-    int counterEncrypt_;
-    int counterDecrypt_;
+    uint64_t counterEncrypt_;
+    uint64_t counterDecrypt_;
 
     int cipher_;
     int cipherMode_;
@@ -47,6 +135,29 @@ namespace Tegenaria
     BF_KEY key_;
 
     unsigned char iv_[16];
+
+    //
+    // AES ciphers only. Key schedule is expanded once in
+    // SecureCipherCreate(), every call resets iv only.
+    // Directions have own contexts, so encrypt and decrypt can run
+    // from different threads.
+    //
+
+    EVP_CIPHER_CTX *evpEncrypt_;
+    EVP_CIPHER_CTX *evpDecrypt_;
+
+    //
+    // Packet mode. Set up by SecurePacketCipherCreate() only.
+    //
+    // packetReady_ - 1 if packet keys below are set.
+    // packetSend_  - keys used by SecureEncryptPacket().
+    // packetRecv_  - keys used by SecureDecryptPacket().
+    //
+
+    int packetReady_;
+
+    SecurePacketKeys packetSend_;
+    SecurePacketKeys packetRecv_;
   };
 } /* namespace Tegenaria */
 
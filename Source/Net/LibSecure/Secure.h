@@ -78,13 +78,43 @@ namespace Tegenaria
 
   #define SECURE_TLS_HANDSHAKE_TIMEOUT 30000 // Timeout while performing SSL handshake
 
+  #define SECURE_SESSION_CACHE_SIZE 20480 // Max. number of sessions cached by server
+  #define SECURE_SESSION_TIMEOUT    300   // Session lifetime in seconds
+
+  //
+  // Flags for SecureContextCreate().
+  //
+
+  #define SECURE_CONTEXT_NO_CACHE   (1 << 0)
+  #define SECURE_CONTEXT_NO_TICKETS (1 << 1)
+  #define SECURE_CONTEXT_TLS        (1 << 2)
+
+  //
+  // Ciphers allowed in TLS stream mode (SECURE_CONTEXT_TLS).
+  // TLS 1.2 is limited to AEAD suites, TLS 1.3 suites are AEAD only.
+  //
+
+  #define SECURE_TLS_CIPHERS "ECDHE+AESGCM:ECDHE+CHACHA20:DHE+AESGCM:!aNULL:!eNULL"
+
   #define SECURE_BLOWFISH_KEY_SIZE 16
 
   #define SECURE_CIPHER_BLOWFISH 0
+  #define SECURE_CIPHER_AES_CTR  1
+  #define SECURE_CIPHER_AES_GCM  2
+
+  //
+  // AES ciphers accept 16, 24 or 32 bytes key (AES-128/192/256)
+  // and 16 bytes iv. GCM uses first 12 bytes of iv as nonce base.
+  // AES works in SECURE_CIPHER_MODE_CTR only.
+  //
+
+  #define SECURE_AES_IV_SIZE 16
 
   #define SECURE_CIPHER_MODE_ECB 0
   #define SECURE_CIPHER_MODE_CTR 1
 
+  #define SECURE_PACKET_TAG_SIZE 16
+
   #define SECURE_MAX_KEYPASS_LEN 64
 
   //
@@ -110,6 +140,106 @@ namespace Tegenaria
   typedef int (*SecureReadProto)(void *buf, int count, int timeout, void *ctx);
   typedef int (*SecureWriteProto)(const void *buf, int count, int timeout, void *ctx);
 
+  //
+  // Session resumption counters returned by SecureContext::getStats().
+  //
+  // handshakes_    - number of finished handshakes.
+  // resumed_       - number of handshakes finished with resumed session.
+  // resumeRate_    - resumed_ / handshakes_ in <0;1> range.
+  // cacheHits_     - server side cache hits (including tickets).
+  // cacheMisses_   - server side cache misses.
+  // cacheTimeouts_ - sessions found in cache, but expired.
+  // cacheSize_     - number of sessions currently stored in cache.
+  //
+
+  struct SecureContextStats
+  {
+    int64_t handshakes_;
+    int64_t resumed_;
+
+    double resumeRate_;
+
+    int64_t cacheHits_;
+    int64_t cacheMisses_;
+    int64_t cacheTimeouts_;
+    int64_t cacheSize_;
+  };
+
+  //
+  // Shared SSL context. Certificate and private key are loaded once and
+  // reused by every connection created from context. Sessions are cached
+  // server side and resumed by client side, so next connections can skip
+  // full handshake.
+  //
+
+  class SecureContext
+  {
+    friend SecureContext *SecureContextCreate(int, const char *, const char *,
+                                                  const char *, int);
+
+    private:
+
+    SSL_CTX *sslCtx_;
+
+    //
+    // SECURE_INTENT_CLIENT or SECURE_INTENT_SERVER.
+    //
+
+    int intent_;
+
+    //
+    // Combination of SECURE_CONTEXT_XXX flags.
+    //
+
+    int flags_;
+
+    //
+    // Client side only. Last negotiated session to resume by next
+    // connection.
+    //
+
+    SSL_SESSION *session_;
+
+    //
+    // Handshake counters.
+    //
+
+    int64_t handshakes_;
+    int64_t resumed_;
+
+    Mutex mutex_;
+
+    //
+    // Refference counter. Every connection created from context keeps
+    // one refference.
+    //
+
+    int refCount_;
+
+    Mutex refCountMutex_;
+
+    SecureContext();
+
+    ~SecureContext();
+
+    static int newSessionCallback(SSL *ssl, SSL_SESSION *session);
+
+    public:
+
+    void addRef();
+    void release();
+
+    int getIntent();
+
+    int isStream();
+
+    SSL *createSSL();
+
+    void handshakeFinished(SSL *ssl);
+
+    int getStats(SecureContextStats *stats);
+  };
+
   //
   // Class to wrap FD/SOCKET/Callbacks into secure one.
   //
@@ -135,6 +265,19 @@ namespace Tegenaria
                *SecureConnectionCreate(int, const char *,
                                            const char *, const char *);
 
+    friend SecureConnection
+               *SecureConnectionCreate(SecureContext *, SecureReadProto,
+                                           SecureWriteProto, void *);
+
+    friend SecureConnection
+               *SecureConnectionCreate(SecureContext *, int, int);
+
+    friend SecureConnection
+               *SecureConnectionCreate(SecureContext *, int);
+
+    friend SecureConnection
+               *SecureConnectionCreate(SecureContext *);
+
     //
     // Private fields.
     //
@@ -150,7 +293,11 @@ namespace Tegenaria
 
     SSL *ssl_;
 
-    SSL_CTX *sslCtx_;
+    //
+    // Context shared with other connections.
+    //
+
+    SecureContext *ctx_;
 
     //
     // SECURE_INTENT_CLIENT or SECURE_INTENT_SERVER.
@@ -165,6 +312,21 @@ namespace Tegenaria
 
     int state_;
 
+    //
+    // Set to 1 when finished handshake was reported to context.
+    //
+
+    int handshakeDone_;
+
+    //
+    // Set to 1 in TLS stream mode (SECURE_CONTEXT_TLS). SSL object works
+    // on underlying socket or FDs directly without memory BIOs.
+    // Underlying IO is switched to non-blocking mode, so every SSL call
+    // can be bounded by caller's timeout. See streamWait().
+    //
+
+    int stream_;
+
     //
     // Specify type of underlying unecrypted IO.
     // See SECURE_IOMODE_XXX defines.
@@ -214,6 +376,14 @@ namespace Tegenaria
     int initSSL(int intent, const char *cert,
                     const char *privKey, const char *privKeyPass);
 
+    int initSSL(SecureContext *ctx);
+
+    //
+    // TLS stream mode helpers.
+    //
+
+    int streamWait(int ret, int64_t deadline);
+
     //
     // Callbacks called by OpenSSL.
     //
@@ -255,6 +425,21 @@ namespace Tegenaria
     int decrypt(void *decrypted,int decryptedSize,
                     const void *buffer, int bufferSize);
 
+    //
+    // Split encrypt/decrypt. Data can be passed and taken back in many
+    // pieces without joining them into one buffer first.
+    //
+
+    int encryptPush(const void *buffer, int bufferSize);
+
+    int encryptPop(void *encrypted, int encryptedSize);
+
+    int encryptPending();
+
+    int decryptPush(const void *encrypted, int encryptedSize);
+
+    int decryptPop(void *decrypted, int decryptedSize);
+
     //
     // Functions for read/write bypassing encryption system.
     // These function passes data to underlying IO directly.
@@ -273,6 +458,8 @@ namespace Tegenaria
     int handshakeStep(void *outputBuffer, int *outputSize,
                           void *inputBuffer, int inputSize);
 
+    int handshakeContinue();
+
     //
     // Getters.
     //
@@ -287,6 +474,13 @@ namespace Tegenaria
 
   struct SecureCipher;
 
+  //
+  // Authenticated cipher interface used by IOMixer.
+  // See IOCodec.h in LibIO.
+  //
+
+  class IOCipher;
+
   //
   // Class to implement generic access list.
   //
@@ -363,10 +557,15 @@ namespace Tegenaria
 
   //
   // Generic encrypt/decrypt for raw buffers.
+  // All return 0 if OK, -1 if underlying OpenSSL cipher call failed.
+  // Buffer content is undefined on error.
   //
 
-  void SecureEncrypt(SecureCipher *sc, void *buffer, int size);
-  void SecureDecrypt(SecureCipher *sc, void *buffer, int size);
+  int SecureEncrypt(SecureCipher *sc, void *buffer, int size);
+  int SecureDecrypt(SecureCipher *sc, void *buffer, int size);
+
+  int SecureEncryptMulti(SecureCipher *sc, void **buffers, int *sizes, int count);
+  int SecureDecryptMulti(SecureCipher *sc, void **buffers, int *sizes, int count);
 
   SecureCipher *SecureCipherCreate(int cipher, int cipherMode,
                                          const char *key, int keySize,
@@ -374,6 +573,21 @@ namespace Tegenaria
 
   void SecureCipherDestroy(SecureCipher *ctx);
 
+  //
+  // Authenticated encrypt/decrypt for ordered packets.
+  //
+
+  SecureCipher *SecurePacketCipherCreate(int cipher, int intent,
+                                             const char *key, int keySize,
+                                                 const char *iv, int ivSize);
+
+  int SecureEncryptPacket(SecureCipher *sc, void *buffer, int size, void *tag);
+  int SecureDecryptPacket(SecureCipher *sc, void *buffer, int size, const void *tag);
+
+  IOCipher *SecureMixerCipherCreate(int cipher, int intent,
+                                        const char *key, int keySize,
+                                            const char *iv, int ivSize);
+
   //
   // Wrap {read, write} callback into secure connection.
   //
@@ -413,6 +627,30 @@ namespace Tegenaria
                                                    const char *privKey,
                                                        const char *privKeyPass);
 
+  //
+  // Shared SSL context.
+  //
+
+  SecureContext *SecureContextCreate(int intent, const char *cert,
+                                         const char *privKey,
+                                             const char *privKeyPass = NULL,
+                                                 int flags = 0);
+
+  //
+  // Create secure connection using shared context.
+  //
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx,
+                                               SecureReadProto readCallback,
+                                                   SecureWriteProto writeCallback,
+                                                       void *ioCtx);
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx, int fdin, int fdout);
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx, int sock);
+
+  SecureConnection *SecureConnectionCreate(SecureContext *ctx);
+
   //
   // One-direction hash functions.
   //